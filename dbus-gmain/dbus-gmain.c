@@ -34,193 +34,578 @@
 
 #include <dbus-gmain/dbus-gmain.h>
 
+typedef struct _ConnectionSetup ConnectionSetup;
+
 /*
- * DBusGMessageQueue:
+ * DBusGConnectionSource:
+ *
+ * A GSource subclass that polls all the file descriptors of a
+ * DBusConnection or DBusServer, and for a connection, also dispatches
+ * messages. Messages can be queued up with no I/O pending, so it is
+ * ready whenever there is something to dispatch, even if none of the
+ * file descriptors are.
  *
- * A GSource subclass for dispatching DBusConnection messages.
- * We need this on top of the IO handlers, because sometimes
- * there are messages to dispatch queued up but no IO pending.
+ * There is one per ConnectionSetup, for its whole lifetime: DBusWatches
+ * being added, removed, enabled or disabled just change the set of file
+ * descriptors it polls, rather than creating and destroying sources.
+ * DBusTimeouts are kept in a TimerWheel, and its ready time is set to
+ * the next time the wheel needs attention.
  */
 typedef struct
 {
   GSource source; /**< the parent GSource */
-  DBusConnection *connection; /**< the connection to dispatch */
-} DBusGMessageQueue;
-
-static gboolean message_queue_prepare  (GSource     *source,
-                                        gint        *timeout);
-static gboolean message_queue_check    (GSource     *source);
-static gboolean message_queue_dispatch (GSource     *source,
-                                        GSourceFunc  callback,
-                                        gpointer     user_data);
-
-static const GSourceFuncs message_queue_funcs = {
-  message_queue_prepare,
-  message_queue_check,
-  message_queue_dispatch,
+  ConnectionSetup *cs; /**< the connection setup that owns this */
+} DBusGConnectionSource;
+
+static gboolean connection_source_prepare  (GSource     *source,
+                                            gint        *timeout);
+static gboolean connection_source_check    (GSource     *source);
+static gboolean connection_source_dispatch (GSource     *source,
+                                            GSourceFunc  callback,
+                                            gpointer     user_data);
+
+static const GSourceFuncs connection_source_funcs = {
+  connection_source_prepare,
+  connection_source_check,
+  connection_source_dispatch,
   NULL
 };
 
-static gboolean
-message_queue_prepare (GSource *source,
-                       gint    *timeout)
-{
-  DBusConnection *connection = ((DBusGMessageQueue *)source)->connection;
-
-  *timeout = -1;
+/*
+ * TimerWheel:
+ *
+ * A hierarchical timing wheel holding all the enabled DBusTimeouts of
+ * a ConnectionSetup, so that adding, removing and expiring one takes
+ * constant time however many there are (typically one per pending call).
+ *
+ * Level 0 has one slot per millisecond, and each slot in a higher level
+ * spans a whole revolution of the level below it. A timeout is filed in
+ * the lowest level whose range covers it, and moved down ("cascaded")
+ * when the wheel reaches the start of its slot. Timeouts further ahead
+ * than the whole wheel (about 4.6 hours) are parked in the top level and
+ * filed again when it reaches them.
+ *
+ * libdbus adds and removes timeouts from whichever thread is using the
+ * connection, while the wheel is moved on in the thread running the
+ * main context, so the ConnectionSetup's wheel_lock is held whenever
+ * the wheel is looked at. It is never held while calling back into
+ * libdbus, because that can add or remove timeouts.
+ */
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SPAN(level) ((gint64) 1 << ((level) * TIMER_WHEEL_BITS))
 
-  return (dbus_connection_get_dispatch_status (connection) == DBUS_DISPATCH_DATA_REMAINS);
-}
+typedef struct _TimeoutHandler TimeoutHandler;
 
-static gboolean
-message_queue_check (GSource *source)
+typedef struct
 {
-  return FALSE;
-}
+  gint64 now;                 /**< the last tick processed, in ms */
+  guint n_timeouts;           /**< number of TimeoutHandler in the wheel */
+  TimeoutHandler *expired;    /**< timeouts waiting to be dispatched */
+  TimeoutHandler *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
 
-static gboolean
-message_queue_dispatch (GSource     *source,
-                        GSourceFunc  callback,
-                        gpointer     user_data)
-{
-  DBusConnection *connection = ((DBusGMessageQueue *)source)->connection;
-
-  dbus_connection_ref (connection);
-
-  /* Only dispatch once - we don't want to starve other GSource */
-  dbus_connection_dispatch (connection);
-
-  dbus_connection_unref (connection);
-
-  return TRUE;
-}
-
-typedef struct
+struct _ConnectionSetup
 {
   GMainContext *context;      /**< the main context */
+  GMutex ios_lock;            /**< protects ios and each IOHandler's tag and condition */
   GSList *ios;                /**< all IOHandler */
-  GSList *timeouts;           /**< all TimeoutHandler */
+  GMutex wheel_lock;          /**< protects wheel */
+  TimerWheel wheel;           /**< all TimeoutHandler */
   DBusConnection *connection; /**< NULL if this is really for a server not a connection */
-  GSource *message_queue_source; /**< DBusGMessageQueue */
-} ConnectionSetup;
+  GSource *source;            /**< DBusGConnectionSource */
+
+  gint64 busy_poll_usec;      /**< how long to spin for another message, or 0 */
+  guint64 busy_poll_spins;    /**< number of times we started spinning */
+  guint64 busy_poll_hits;     /**< messages picked up by spinning */
+  guint64 busy_poll_total_usec; /**< time spent spinning */
+  guint64 busy_poll_useful_usec; /**< time spent spinning that found a message */
+};
+
+/* Spinning stops after this many messages even if more keep arriving,
+ * so that other sources get a chance to run */
+#define BUSY_POLL_MAX_MESSAGES 64
 
 
 typedef struct
 {
   ConnectionSetup *cs;
-  GSource *source;
   DBusWatch *watch;
+  gpointer tag;               /**< from g_source_add_unix_fd() */
+  GIOCondition condition;     /**< what to poll for, or 0 if disabled */
 } IOHandler;
 
-typedef struct
+struct _TimeoutHandler
 {
   ConnectionSetup *cs;
-  GSource *source;
   DBusTimeout *timeout;
-} TimeoutHandler;
+  gint64 expires;             /**< monotonic time in ms */
+  TimeoutHandler **list;      /**< the slot or expired list it is in */
+  TimeoutHandler *prev;
+  TimeoutHandler *next;
+};
 
 dbus_int32_t _dbus_gmain_connection_slot = -1;
 static dbus_int32_t server_slot = -1;
 
-static ConnectionSetup*
-connection_setup_new (GMainContext   *context,
-                      DBusConnection *connection)
+/* Held while a connection's ConnectionSetup is being replaced, so that
+ * dbus_gmain_get_connection_context() in another thread never looks at
+ * one that is being freed */
+G_LOCK_DEFINE_STATIC (connection_setup);
+
+/* Called with the ConnectionSetup's ios_lock held.
+ *
+ * poll() reports G_IO_ERR and G_IO_HUP whether or not they were asked
+ * for, so they are passed on even if the watch is disabled: libdbus
+ * closes the connection when it sees them, which stops the source from
+ * waking up for a hung-up socket forever. */
+static GIOCondition
+io_handler_get_ready (IOHandler *handler)
 {
-  ConnectionSetup *cs;
+  return g_source_query_unix_fd (handler->cs->source, handler->tag) &
+      (handler->condition | G_IO_ERR | G_IO_HUP);
+}
 
-  cs = g_new0 (ConnectionSetup, 1);
+static gint64
+timer_wheel_get_time (void)
+{
+  return g_get_monotonic_time () / 1000;
+}
 
-  g_assert (context != NULL);
+static void
+timer_wheel_link (TimeoutHandler **list,
+                  TimeoutHandler  *handler)
+{
+  handler->list = list;
+  handler->prev = NULL;
+  handler->next = *list;
 
-  cs->context = context;
-  g_main_context_ref (cs->context);
+  if (*list != NULL)
+    (*list)->prev = handler;
 
-  if (connection)
+  *list = handler;
+}
+
+static void
+timer_wheel_unlink (TimeoutHandler *handler)
+{
+  if (handler->prev != NULL)
+    handler->prev->next = handler->next;
+  else
+    *handler->list = handler->next;
+
+  if (handler->next != NULL)
+    handler->next->prev = handler->prev;
+
+  handler->list = NULL;
+  handler->prev = NULL;
+  handler->next = NULL;
+}
+
+/* Put @handler in the slot covering its expiry time, relative to the
+ * wheel's current time, or in the expired list if it is already due */
+static void
+timer_wheel_file (TimerWheel     *wheel,
+                  TimeoutHandler *handler)
+{
+  gint64 expires = handler->expires;
+  gint64 delta = expires - wheel->now;
+  guint level;
+
+  if (delta <= 0)
     {
-      cs->connection = connection;
+      timer_wheel_link (&wheel->expired, handler);
+      return;
+    }
 
-      cs->message_queue_source = g_source_new ((GSourceFuncs *) &message_queue_funcs,
-                                               sizeof (DBusGMessageQueue));
-      ((DBusGMessageQueue*)cs->message_queue_source)->connection = connection;
-      g_source_attach (cs->message_queue_source, cs->context);
+  for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    {
+      if (delta < TIMER_WHEEL_SPAN (level + 1))
+        break;
     }
 
-  return cs;
+  if (delta >= TIMER_WHEEL_SPAN (TIMER_WHEEL_LEVELS))
+    expires = wheel->now + TIMER_WHEEL_SPAN (TIMER_WHEEL_LEVELS) - 1;
+
+  timer_wheel_link (&wheel->slots[level][(expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK],
+                    handler);
 }
 
 static void
-io_handler_source_finalized (gpointer data)
+timer_wheel_insert (TimerWheel     *wheel,
+                    TimeoutHandler *handler)
 {
-  IOHandler *handler;
+  wheel->n_timeouts++;
+  timer_wheel_file (wheel, handler);
+}
 
-  handler = data;
+static void
+timer_wheel_remove (TimerWheel     *wheel,
+                    TimeoutHandler *handler)
+{
+  g_assert (wheel->n_timeouts > 0);
 
-  if (handler->watch)
-    dbus_watch_set_data (handler->watch, NULL, NULL);
+  timer_wheel_unlink (handler);
+  wheel->n_timeouts--;
+}
 
-  g_free (handler);
+/* Return any timeout in the wheel, or NULL if it is empty */
+static TimeoutHandler *
+timer_wheel_peek (TimerWheel *wheel)
+{
+  guint level, i;
+
+  if (wheel->n_timeouts == 0)
+    return NULL;
+
+  if (wheel->expired != NULL)
+    return wheel->expired;
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+      for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+        {
+          if (wheel->slots[level][i] != NULL)
+            return wheel->slots[level][i];
+        }
+    }
+
+  g_assert_not_reached ();
+  return NULL;
+}
+
+/* Return the next tick after the current one at which there is anything
+ * to do: a level 0 slot to expire, or a higher level slot to cascade.
+ * This is bounded by the size of the wheel, not the number of timeouts.
+ * Returns G_MAXINT64 if there are no timeouts in the slots. */
+static gint64
+timer_wheel_next_tick (TimerWheel *wheel)
+{
+  gint64 next = G_MAXINT64;
+  guint level;
+
+  if (wheel->n_timeouts == 0)
+    return next;
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+      guint shift = level * TIMER_WHEEL_BITS;
+      gint64 base = wheel->now >> shift;
+      guint k;
+
+      for (k = 1; k <= TIMER_WHEEL_SLOTS; k++)
+        {
+          if (wheel->slots[level][(base + k) & TIMER_WHEEL_MASK] != NULL)
+            {
+              next = MIN (next, (base + k) << shift);
+              break;
+            }
+        }
+    }
+
+  return next;
 }
 
 static void
-io_handler_destroy_source (void *data)
+timer_wheel_refile_slot (TimerWheel      *wheel,
+                         TimeoutHandler **slot)
 {
-  IOHandler *handler;
+  TimeoutHandler *handler;
 
-  handler = data;
+  while ((handler = *slot) != NULL)
+    {
+      timer_wheel_unlink (handler);
+      timer_wheel_file (wheel, handler);
+    }
+}
 
-  if (handler->source)
+/* Move the wheel on to @now, moving all the timeouts that are due by
+ * then into the expired list. Ticks with nothing to do are skipped. */
+static void
+timer_wheel_advance (TimerWheel *wheel,
+                     gint64      now)
+{
+  while (wheel->now < now)
     {
-      GSource *source = handler->source;
-      handler->source = NULL;
-      handler->cs->ios = g_slist_remove (handler->cs->ios, handler);
-      g_source_destroy (source);
-      g_source_unref (source);
+      gint64 tick = timer_wheel_next_tick (wheel);
+      guint level;
+
+      if (tick > now)
+        {
+          wheel->now = now;
+          break;
+        }
+
+      wheel->now = tick;
+
+      for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+          if ((tick & (TIMER_WHEEL_SPAN (level) - 1)) != 0)
+            break;
+
+          timer_wheel_refile_slot (wheel,
+              &wheel->slots[level][(tick >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK]);
+        }
+
+      timer_wheel_refile_slot (wheel, &wheel->slots[0][tick & TIMER_WHEEL_MASK]);
     }
 }
 
+/* File an expired timeout again, @interval ms after the current tick */
 static void
-io_handler_watch_freed (void *data)
+timer_wheel_rearm (TimerWheel     *wheel,
+                   TimeoutHandler *handler,
+                   gint64          interval)
 {
-  IOHandler *handler;
+  timer_wheel_unlink (handler);
+  handler->expires = wheel->now + MAX (interval, 1);
+  timer_wheel_file (wheel, handler);
+}
 
-  handler = data;
+/* Ask the main context to dispatch cs->source when the wheel next has
+ * something to do */
+static void
+connection_setup_update_ready_time (ConnectionSetup *cs)
+{
+  gint64 tick;
 
-  handler->watch = NULL;
+  g_mutex_lock (&cs->wheel_lock);
 
-  io_handler_destroy_source (handler);
+  if (cs->wheel.expired != NULL)
+    tick = 0;
+  else
+    tick = timer_wheel_next_tick (&cs->wheel);
+
+  g_mutex_unlock (&cs->wheel_lock);
+
+  if (tick == G_MAXINT64)
+    g_source_set_ready_time (cs->source, -1);
+  else
+    g_source_set_ready_time (cs->source, tick * 1000);
 }
 
+/* If busy-polling is enabled, wait for the next message by repeatedly
+ * reading without blocking, rather than going back to the main loop and
+ * poll(). Each message found restarts the time limit. Returns FALSE if
+ * the source was destroyed while dispatching, in which case @cs might
+ * have been freed. */
 static gboolean
-io_handler_dispatch (GIOChannel   *source,
-                     GIOCondition  condition,
-                     gpointer      data)
+connection_setup_busy_poll (ConnectionSetup *cs,
+                            GSource         *source)
 {
-  IOHandler *handler;
-  guint dbus_condition = 0;
-  DBusConnection *connection;
+  DBusConnection *connection = cs->connection;
+  gint64 start, now;
+  guint n_messages = 0;
 
-  handler = data;
+  if (connection == NULL || cs->busy_poll_usec <= 0)
+    return TRUE;
+
+  cs->busy_poll_spins++;
+  start = now = g_get_monotonic_time ();
+
+  while (now - start < cs->busy_poll_usec &&
+         n_messages < BUSY_POLL_MAX_MESSAGES)
+    {
+      /* FALSE means we are disconnected: let the main loop deal with it */
+      if (!dbus_connection_read_write (connection, 0))
+        break;
+
+      now = g_get_monotonic_time ();
+
+      if (dbus_connection_get_dispatch_status (connection) != DBUS_DISPATCH_DATA_REMAINS)
+        continue;
 
-  connection = handler->cs->connection;
+      cs->busy_poll_hits++;
+      cs->busy_poll_total_usec += now - start;
+      cs->busy_poll_useful_usec += now - start;
+      n_messages++;
+
+      dbus_connection_dispatch (connection);
+
+      if (g_source_is_destroyed (source))
+        return FALSE;
+
+      start = now = g_get_monotonic_time ();
+    }
+
+  cs->busy_poll_total_usec += now - start;
+  return TRUE;
+}
+
+static gboolean
+connection_source_prepare (GSource *source,
+                           gint    *timeout)
+{
+  ConnectionSetup *cs = ((DBusGConnectionSource *) source)->cs;
+
+  *timeout = -1;
+
+  if (cs->connection == NULL)
+    return FALSE;
+
+  return (dbus_connection_get_dispatch_status (cs->connection) == DBUS_DISPATCH_DATA_REMAINS);
+}
+
+static gboolean
+connection_source_check (GSource *source)
+{
+  ConnectionSetup *cs = ((DBusGConnectionSource *) source)->cs;
+  gboolean ready = FALSE;
+  GSList *iter;
+
+  g_mutex_lock (&cs->ios_lock);
+
+  for (iter = cs->ios; iter != NULL; iter = iter->next)
+    {
+      if (io_handler_get_ready (iter->data) != 0)
+        {
+          ready = TRUE;
+          break;
+        }
+    }
+
+  g_mutex_unlock (&cs->ios_lock);
+
+  return ready;
+}
+
+/* Called with ios_lock held. The IOHandler for a watch can be freed by
+ * another thread whenever the lock is dropped, so the dispatcher keeps
+ * hold of the DBusWatch, which lives as long as the connection or
+ * server, and looks its handler up again. */
+static IOHandler *
+connection_setup_find_io (ConnectionSetup *cs,
+                          DBusWatch       *watch)
+{
+  GSList *iter;
+
+  for (iter = cs->ios; iter != NULL; iter = iter->next)
+    {
+      IOHandler *handler = iter->data;
+
+      if (handler->watch == watch)
+        return handler;
+    }
+
+  return NULL;
+}
+
+static gboolean
+connection_source_dispatch (GSource     *source,
+                            GSourceFunc  callback,
+                            gpointer     user_data)
+{
+  ConnectionSetup *cs = ((DBusGConnectionSource *) source)->cs;
+  DBusConnection *connection = cs->connection;
+  DBusWatch *ready[8];
+  GPtrArray *more_ready = NULL;
+  guint n_ready = 0;
+  guint i;
+  GSList *iter;
 
   if (connection)
     dbus_connection_ref (connection);
 
-  if (condition & G_IO_IN)
-    dbus_condition |= DBUS_WATCH_READABLE;
-  if (condition & G_IO_OUT)
-    dbus_condition |= DBUS_WATCH_WRITABLE;
-  if (condition & G_IO_ERR)
-    dbus_condition |= DBUS_WATCH_ERROR;
-  if (condition & G_IO_HUP)
-    dbus_condition |= DBUS_WATCH_HANGUP;
-
-  /* Note that we don't touch the handler after this, because
-   * dbus may have disabled the watch and thus killed the
-   * handler.
-   */
-  dbus_watch_handle (handler->watch, dbus_condition);
-  handler = NULL;
+  g_mutex_lock (&cs->wheel_lock);
+  timer_wheel_advance (&cs->wheel, g_source_get_time (source) / 1000);
+
+  while (cs->wheel.expired != NULL)
+    {
+      TimeoutHandler *handler = cs->wheel.expired;
+      DBusTimeout *timeout = handler->timeout;
+
+      /* Like a GLib timeout source, a DBusTimeout repeats until it is
+       * removed. Re-arm it first, because handling it might remove it. */
+      timer_wheel_rearm (&cs->wheel, handler,
+                         dbus_timeout_get_interval (timeout));
+
+      g_mutex_unlock (&cs->wheel_lock);
+      dbus_timeout_handle (timeout);
+      g_mutex_lock (&cs->wheel_lock);
+    }
+
+  g_mutex_unlock (&cs->wheel_lock);
+
+  connection_setup_update_ready_time (cs);
+
+  /* Handling one watch can cause others to be removed, so find out which
+   * ones are ready before handling any of them. Like the wheel_lock, the
+   * ios_lock is not held while calling back into libdbus. */
+  g_mutex_lock (&cs->ios_lock);
+
+  for (iter = cs->ios; iter != NULL; iter = iter->next)
+    {
+      IOHandler *handler = iter->data;
+
+      if (io_handler_get_ready (handler) == 0)
+        continue;
+
+      if (n_ready < G_N_ELEMENTS (ready))
+        {
+          ready[n_ready++] = handler->watch;
+        }
+      else
+        {
+          if (more_ready == NULL)
+            more_ready = g_ptr_array_new ();
+
+          g_ptr_array_add (more_ready, handler->watch);
+        }
+    }
+
+  g_mutex_unlock (&cs->ios_lock);
+
+  for (i = 0; i < n_ready + (more_ready ? more_ready->len : 0); i++)
+    {
+      DBusWatch *watch;
+      IOHandler *handler;
+      GIOCondition condition = 0;
+      guint dbus_condition = 0;
+
+      if (i < n_ready)
+        watch = ready[i];
+      else
+        watch = g_ptr_array_index (more_ready, i - n_ready);
+
+      /* Check that an earlier watch, or another thread, didn't remove or
+       * disable it */
+      g_mutex_lock (&cs->ios_lock);
+      handler = connection_setup_find_io (cs, watch);
+
+      if (handler != NULL)
+        condition = io_handler_get_ready (handler);
+
+      g_mutex_unlock (&cs->ios_lock);
+
+      if (condition & G_IO_IN)
+        dbus_condition |= DBUS_WATCH_READABLE;
+      if (condition & G_IO_OUT)
+        dbus_condition |= DBUS_WATCH_WRITABLE;
+      if (condition & G_IO_ERR)
+        dbus_condition |= DBUS_WATCH_ERROR;
+      if (condition & G_IO_HUP)
+        dbus_condition |= DBUS_WATCH_HANGUP;
+
+      if (dbus_condition != 0)
+        dbus_watch_handle (watch, dbus_condition);
+    }
+
+  if (more_ready != NULL)
+    g_ptr_array_unref (more_ready);
+
+  /* Only dispatch once - we don't want to starve other GSource */
+  if (connection &&
+      dbus_connection_get_dispatch_status (connection) == DBUS_DISPATCH_DATA_REMAINS)
+    {
+      dbus_connection_dispatch (connection);
+
+      /* The reply to whatever we just dispatched is likely to be on its
+       * way, so that's the time to spin */
+      if (!g_source_is_destroyed (source))
+        connection_setup_busy_poll (cs, source);
+    }
 
   if (connection)
     dbus_connection_unref (connection);
@@ -228,20 +613,43 @@ io_handler_dispatch (GIOChannel   *source,
   return TRUE;
 }
 
-/* Attach the connection setup to the given watch, removing any
- * previously-attached connection setup.
- */
-static void
-connection_setup_add_watch (ConnectionSetup *cs,
-                            DBusWatch       *watch)
+static ConnectionSetup*
+connection_setup_new (GMainContext   *context,
+                      DBusConnection *connection)
+{
+  ConnectionSetup *cs;
+
+  cs = g_new0 (ConnectionSetup, 1);
+
+  g_assert (context != NULL);
+
+  cs->context = context;
+  g_main_context_ref (cs->context);
+
+  cs->connection = connection;
+  g_mutex_init (&cs->ios_lock);
+  g_mutex_init (&cs->wheel_lock);
+  cs->wheel.now = timer_wheel_get_time ();
+
+  cs->source = g_source_new ((GSourceFuncs *) &connection_source_funcs,
+                             sizeof (DBusGConnectionSource));
+  ((DBusGConnectionSource *) cs->source)->cs = cs;
+
+  /* The caller attaches the source once it has all the watches and
+   * timeouts, so that a main loop running in another thread never sees
+   * a half-populated connection setup */
+
+  return cs;
+}
+
+static GIOCondition
+watch_get_condition (DBusWatch *watch)
 {
   guint flags;
   GIOCondition condition;
-  GIOChannel *channel;
-  IOHandler *handler;
 
   if (!dbus_watch_get_enabled (watch))
-    return;
+    return 0;
 
   flags = dbus_watch_get_flags (watch);
 
@@ -251,89 +659,118 @@ connection_setup_add_watch (ConnectionSetup *cs,
   if (flags & DBUS_WATCH_WRITABLE)
     condition |= G_IO_OUT;
 
-  handler = g_new0 (IOHandler, 1);
-  handler->cs = cs;
-  handler->watch = watch;
-
-  channel = g_io_channel_unix_new (dbus_watch_get_unix_fd (watch));
-
-  handler->source = g_io_create_watch (channel, condition);
-  g_source_set_callback (handler->source, (GSourceFunc) io_handler_dispatch, handler,
-                         io_handler_source_finalized);
-  g_source_attach (handler->source, cs->context);
-
-  cs->ios = g_slist_prepend (cs->ios, handler);
-
-  dbus_watch_set_data (watch, handler, io_handler_watch_freed);
-  g_io_channel_unref (channel);
+  return condition;
 }
 
+/* Called with ios_lock held. The fd stays in the source for as long as
+ * the watch exists, and enabling or disabling it only changes what is
+ * polled for; see io_handler_get_ready() for what happens to a disabled
+ * watch on a hung-up socket. */
 static void
-connection_setup_remove_watch (ConnectionSetup *cs,
-                               DBusWatch       *watch)
+io_handler_set_condition (IOHandler    *handler,
+                          GIOCondition  condition)
 {
-  IOHandler *handler;
+  ConnectionSetup *cs = handler->cs;
 
-  handler = dbus_watch_get_data (watch);
+  handler->condition = condition;
 
-  if (handler == NULL || handler->cs != cs)
-    return;
+  if (handler->tag == NULL)
+    {
+      int fd = dbus_watch_get_unix_fd (handler->watch);
 
-  io_handler_destroy_source (handler);
+      handler->tag = g_source_add_unix_fd (cs->source, fd, condition);
+    }
+  else
+    {
+      g_source_modify_unix_fd (cs->source, handler->tag, condition);
+    }
 }
 
+/* Called when the watch is freed, or attached to a different
+ * connection setup */
 static void
-timeout_handler_source_finalized (gpointer data)
+io_handler_watch_freed (void *data)
 {
-  TimeoutHandler *handler;
+  IOHandler *handler;
+  ConnectionSetup *cs;
 
   handler = data;
+  cs = handler->cs;
 
-  if (handler->timeout)
-    dbus_timeout_set_data (handler->timeout, NULL, NULL);
+  g_mutex_lock (&cs->ios_lock);
+  cs->ios = g_slist_remove (cs->ios, handler);
+  g_source_remove_unix_fd (cs->source, handler->tag);
+  g_mutex_unlock (&cs->ios_lock);
 
   g_free (handler);
 }
 
+/* Attach the connection setup to the given watch, removing any
+ * previously-attached connection setup.
+ */
 static void
-timeout_handler_destroy_source (void *data)
+connection_setup_add_watch (ConnectionSetup *cs,
+                            DBusWatch       *watch)
 {
-  TimeoutHandler *handler;
+  IOHandler *handler;
 
-  handler = data;
+  handler = dbus_watch_get_data (watch);
 
-  if (handler->source)
+  if (handler != NULL && handler->cs == cs)
     {
-      GSource *source = handler->source;
-      handler->source = NULL;
-      handler->cs->timeouts = g_slist_remove (handler->cs->timeouts, handler);
-      g_source_destroy (source);
-      g_source_unref (source);
+      /* Already watching it: just change what we're polling for */
+      g_mutex_lock (&cs->ios_lock);
+      io_handler_set_condition (handler, watch_get_condition (watch));
+      g_mutex_unlock (&cs->ios_lock);
+      return;
     }
+
+  handler = g_new0 (IOHandler, 1);
+  handler->cs = cs;
+  handler->watch = watch;
+
+  g_mutex_lock (&cs->ios_lock);
+  io_handler_set_condition (handler, watch_get_condition (watch));
+  cs->ios = g_slist_prepend (cs->ios, handler);
+  g_mutex_unlock (&cs->ios_lock);
+
+  /* this calls io_handler_watch_freed() on any previous handler, which
+   * takes the other connection setup's ios_lock, so ours is not held */
+  dbus_watch_set_data (watch, handler, io_handler_watch_freed);
 }
 
 static void
-timeout_handler_timeout_freed (void *data)
+connection_setup_remove_watch (ConnectionSetup *cs,
+                               DBusWatch       *watch)
 {
-  TimeoutHandler *handler;
+  IOHandler *handler;
 
-  handler = data;
+  handler = dbus_watch_get_data (watch);
 
-  handler->timeout = NULL;
+  if (handler == NULL || handler->cs != cs)
+    return;
 
-  timeout_handler_destroy_source (handler);
+  /* this calls io_handler_watch_freed() */
+  dbus_watch_set_data (watch, NULL, NULL);
 }
 
-static gboolean
-timeout_handler_dispatch (gpointer      data)
+/* Called when the timeout is freed, or attached to a different
+ * connection setup */
+static void
+timeout_handler_timeout_freed (void *data)
 {
   TimeoutHandler *handler;
 
+  ConnectionSetup *cs;
+
   handler = data;
+  cs = handler->cs;
 
-  dbus_timeout_handle (handler->timeout);
+  g_mutex_lock (&cs->wheel_lock);
+  timer_wheel_remove (&cs->wheel, handler);
+  g_mutex_unlock (&cs->wheel_lock);
 
-  return TRUE;
+  g_free (handler);
 }
 
 static void
@@ -341,22 +778,44 @@ connection_setup_add_timeout (ConnectionSetup *cs,
                               DBusTimeout     *timeout)
 {
   TimeoutHandler *handler;
+  gint64 now;
+  gint64 expires;
+  gint64 ready_time;
+  gboolean expired;
 
   if (!dbus_timeout_get_enabled (timeout))
     return;
 
+  now = timer_wheel_get_time ();
+
   handler = g_new0 (TimeoutHandler, 1);
   handler->cs = cs;
   handler->timeout = timeout;
+  handler->expires = now + dbus_timeout_get_interval (timeout);
+
+  g_mutex_lock (&cs->wheel_lock);
 
-  handler->source = g_timeout_source_new (dbus_timeout_get_interval (timeout));
-  g_source_set_callback (handler->source, timeout_handler_dispatch, handler,
-                         timeout_handler_source_finalized);
-  g_source_attach (handler->source, handler->cs->context);
+  /* Nothing to catch up on, so skip straight to the present */
+  if (cs->wheel.n_timeouts == 0)
+    cs->wheel.now = MAX (cs->wheel.now, now);
 
-  cs->timeouts = g_slist_prepend (cs->timeouts, handler);
+  timer_wheel_insert (&cs->wheel, handler);
+  expires = handler->expires;
+  expired = (handler->list == &cs->wheel.expired);
 
+  g_mutex_unlock (&cs->wheel_lock);
+
+  /* this calls timeout_handler_timeout_freed() on any previous handler */
   dbus_timeout_set_data (timeout, handler, timeout_handler_timeout_freed);
+
+  /* Only wake up the main context if this is due sooner than anything
+   * else; anything later will be found when the wheel is next moved on */
+  ready_time = g_source_get_ready_time (cs->source);
+
+  if (expired)
+    g_source_set_ready_time (cs->source, 0);
+  else if (ready_time == -1 || ready_time > expires * 1000)
+    g_source_set_ready_time (cs->source, expires * 1000);
 }
 
 static void
@@ -367,32 +826,62 @@ connection_setup_remove_timeout (ConnectionSetup *cs,
 
   handler = dbus_timeout_get_data (timeout);
 
-  if (handler == NULL)
+  if (handler == NULL || handler->cs != cs)
     return;
 
-  timeout_handler_destroy_source (handler);
+  /* this calls timeout_handler_timeout_freed() */
+  dbus_timeout_set_data (timeout, NULL, NULL);
 }
 
 static void
 connection_setup_free (ConnectionSetup *cs)
 {
-  while (cs->ios)
-    io_handler_destroy_source (cs->ios->data);
+  while (TRUE)
+    {
+      DBusWatch *watch = NULL;
+
+      g_mutex_lock (&cs->ios_lock);
+
+      if (cs->ios != NULL)
+        watch = ((IOHandler *) cs->ios->data)->watch;
+
+      g_mutex_unlock (&cs->ios_lock);
 
-  while (cs->timeouts)
-    timeout_handler_destroy_source (cs->timeouts->data);
+      if (watch == NULL)
+        break;
 
-  if (cs->message_queue_source)
+      /* this calls io_handler_watch_freed(), which removes it */
+      dbus_watch_set_data (watch, NULL, NULL);
+    }
+
+  while (TRUE)
+    {
+      TimeoutHandler *handler;
+
+      g_mutex_lock (&cs->wheel_lock);
+      handler = timer_wheel_peek (&cs->wheel);
+      g_mutex_unlock (&cs->wheel_lock);
+
+      if (handler == NULL)
+        break;
+
+      /* this calls timeout_handler_timeout_freed(), which removes it */
+      dbus_timeout_set_data (handler->timeout, NULL, NULL);
+    }
+
+  if (cs->source)
     {
       GSource *source;
 
-      source = cs->message_queue_source;
-      cs->message_queue_source = NULL;
+      source = cs->source;
+      cs->source = NULL;
 
       g_source_destroy (source);
       g_source_unref (source);
     }
 
+  g_mutex_clear (&cs->wheel_lock);
+  g_mutex_clear (&cs->ios_lock);
   g_main_context_unref (cs->context);
   g_free (cs);
 }
@@ -425,13 +914,13 @@ static void
 watch_toggled (DBusWatch *watch,
                void      *data)
 {
-  /* Because we just exit on OOM, enable/disable is
-   * no different from add/remove
-   */
-  if (dbus_watch_get_enabled (watch))
-    add_watch (watch, data);
-  else
-    remove_watch (watch, data);
+  ConnectionSetup *cs;
+
+  cs = data;
+
+  /* Enabling or disabling changes what the existing source polls the
+   * fd for */
+  connection_setup_add_watch (cs, watch);
 }
 
 static dbus_bool_t
@@ -493,20 +982,43 @@ connection_setup_new_from_old (GMainContext    *context,
   g_assert (old->context != context);
 
   cs = connection_setup_new (context, old->connection);
+  cs->busy_poll_usec = old->busy_poll_usec;
+  cs->busy_poll_spins = old->busy_poll_spins;
+  cs->busy_poll_hits = old->busy_poll_hits;
+  cs->busy_poll_total_usec = old->busy_poll_total_usec;
+  cs->busy_poll_useful_usec = old->busy_poll_useful_usec;
 
-  while (old->ios != NULL)
+  while (TRUE)
     {
-      IOHandler *handler = old->ios->data;
+      DBusWatch *watch = NULL;
+
+      g_mutex_lock (&old->ios_lock);
+
+      if (old->ios != NULL)
+        watch = ((IOHandler *) old->ios->data)->watch;
+
+      g_mutex_unlock (&old->ios_lock);
+
+      if (watch == NULL)
+        break;
 
-      connection_setup_add_watch (cs, handler->watch);
+      connection_setup_add_watch (cs, watch);
       /* The old handler will be removed from old->ios as a side-effect */
     }
 
-  while (old->timeouts != NULL)
+  while (TRUE)
     {
-      TimeoutHandler *handler = old->timeouts->data;
+      TimeoutHandler *handler;
+
+      g_mutex_lock (&old->wheel_lock);
+      handler = timer_wheel_peek (&old->wheel);
+      g_mutex_unlock (&old->wheel_lock);
+
+      if (handler == NULL)
+        break;
 
       connection_setup_add_timeout (cs, handler->timeout);
+      /* The old handler will be removed from old->wheel as a side-effect */
     }
 
   return cs;
@@ -546,11 +1058,16 @@ set_up_connection, DBusConnection *connection,
 
   cs = NULL;
 
+  G_LOCK (connection_setup);
+
   old_setup = dbus_connection_get_data (connection, _dbus_gmain_connection_slot);
   if (old_setup != NULL)
     {
       if (old_setup->context == context)
-        return; /* nothing to do */
+        {
+          G_UNLOCK (connection_setup);
+          return; /* nothing to do */
+        }
 
       cs = connection_setup_new_from_old (context, old_setup);
 
@@ -584,12 +1101,51 @@ set_up_connection, DBusConnection *connection,
 					    wakeup_main,
 					    cs, NULL);
 
+  g_source_attach (cs->source, cs->context);
+  G_UNLOCK (connection_setup);
   return;
 
  nomem:
   g_error ("Not enough memory to set up DBusConnection for use with GLib");
 }
 
+/**
+ * dbus_gmain_get_connection_context:
+ * @connection: the connection
+ *
+ * Returns the #GMainContext whose main loop is monitoring @connection,
+ * for instance so that work done in another thread can be handed back
+ * to it.
+ *
+ * This may be called from any thread. If another thread moves
+ * @connection to a different context at the same time, either context
+ * may be returned.
+ *
+ * Returns: (transfer none): the context passed to
+ *  dbus_gmain_set_up_connection(), or %NULL if @connection has not been
+ *  set up with a GLib main loop
+ */
+DBUS_GMAIN_FUNCTION (GMainContext *,
+get_connection_context, DBusConnection *connection)
+{
+  ConnectionSetup *cs;
+  GMainContext *context = NULL;
+
+  if (_dbus_gmain_connection_slot < 0)
+    return NULL;
+
+  G_LOCK (connection_setup);
+
+  cs = dbus_connection_get_data (connection, _dbus_gmain_connection_slot);
+
+  if (cs != NULL)
+    context = cs->context;
+
+  G_UNLOCK (connection_setup);
+
+  return context;
+}
+
 /**
  * dbus_gmain_set_up_server:
  * @server: the server
@@ -658,8 +1214,80 @@ set_up_server, DBusServer   *server,
                                           cs, NULL))
     goto nomem;
 
+  g_source_attach (cs->source, cs->context);
   return;
 
  nomem:
   g_error ("Not enough memory to set up DBusServer for use with GLib");
 }
+
+/**
+ * dbus_gmain_set_busy_poll:
+ * @connection: a connection set up with dbus_gmain_set_up_connection()
+ * @usec: the maximum time to spin, in microseconds, or 0 to disable
+ *
+ * Makes the connection's main loop source keep reading from the
+ * connection without blocking, for up to @usec microseconds, after
+ * dispatching a message, instead of returning to the main loop and
+ * waiting in poll(). Each message that arrives in that time is
+ * dispatched immediately and restarts the time limit.
+ *
+ * This trades CPU time for latency, and is only worthwhile for
+ * request/response traffic where the next message is expected very
+ * soon. Other sources attached to the same main context are not
+ * dispatched while spinning.
+ */
+DBUS_GMAIN_FUNCTION (void,
+set_busy_poll, DBusConnection *connection,
+               guint           usec)
+{
+  ConnectionSetup *cs;
+
+  /* no connection has been set up yet, so this one cannot have been */
+  g_return_if_fail (_dbus_gmain_connection_slot >= 0);
+
+  cs = dbus_connection_get_data (connection, _dbus_gmain_connection_slot);
+  g_return_if_fail (cs != NULL);
+
+  cs->busy_poll_usec = usec;
+}
+
+/**
+ * dbus_gmain_get_busy_poll_stats:
+ * @connection: a connection set up with dbus_gmain_set_up_connection()
+ * @n_spins: (out) (allow-none): number of times the source spun
+ * @n_hits: (out) (allow-none): number of messages found while spinning
+ * @total_usec: (out) (allow-none): total time spent spinning
+ * @useful_usec: (out) (allow-none): time spent spinning before finding a
+ *  message; the rest of @total_usec was spent waiting for nothing
+ *
+ * Reports how effective dbus_gmain_set_busy_poll() has been for
+ * @connection.
+ */
+DBUS_GMAIN_FUNCTION (void,
+get_busy_poll_stats, DBusConnection *connection,
+                     guint64        *n_spins,
+                     guint64        *n_hits,
+                     guint64        *total_usec,
+                     guint64        *useful_usec)
+{
+  ConnectionSetup *cs;
+
+  /* no connection has been set up yet, so this one cannot have been */
+  g_return_if_fail (_dbus_gmain_connection_slot >= 0);
+
+  cs = dbus_connection_get_data (connection, _dbus_gmain_connection_slot);
+  g_return_if_fail (cs != NULL);
+
+  if (n_spins != NULL)
+    *n_spins = cs->busy_poll_spins;
+
+  if (n_hits != NULL)
+    *n_hits = cs->busy_poll_hits;
+
+  if (total_usec != NULL)
+    *total_usec = cs->busy_poll_total_usec;
+
+  if (useful_usec != NULL)
+    *useful_usec = cs->busy_poll_useful_usec;
+}
@@ -50,6 +50,17 @@ DBUS_GMAIN_FUNCTION (void, set_up_connection,
 DBUS_GMAIN_FUNCTION (void, set_up_server,
                      DBusServer *server,
                      GMainContext *context);
+DBUS_GMAIN_FUNCTION (GMainContext *, get_connection_context,
+                     DBusConnection *connection);
+DBUS_GMAIN_FUNCTION (void, set_busy_poll,
+                     DBusConnection *connection,
+                     guint usec);
+DBUS_GMAIN_FUNCTION (void, get_busy_poll_stats,
+                     DBusConnection *connection,
+                     guint64 *n_spins,
+                     guint64 *n_hits,
+                     guint64 *total_usec,
+                     guint64 *useful_usec);
 
 G_END_DECLS
 
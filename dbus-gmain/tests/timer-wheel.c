@@ -0,0 +1,209 @@
+/* Unit tests for the timer wheel that holds a connection's timeouts
+ *
+ * Copyright © 2006-2018 Collabora Ltd.
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* The wheel is private to dbus-gmain.c, so test it from the inside */
+#include "dbus-gmain/dbus-gmain.c"
+
+#include <string.h>
+
+typedef struct
+{
+  TimerWheel wheel;
+} Fixture;
+
+static void
+setup (Fixture       *f,
+       gconstpointer  data)
+{
+  memset (&f->wheel, 0, sizeof (f->wheel));
+}
+
+static TimeoutHandler *
+add (Fixture *f,
+     gint64   expires)
+{
+  TimeoutHandler *handler = g_new0 (TimeoutHandler, 1);
+
+  handler->expires = expires;
+  timer_wheel_insert (&f->wheel, handler);
+  return handler;
+}
+
+static gboolean
+is_expired (Fixture        *f,
+            TimeoutHandler *handler)
+{
+  return handler->list == &f->wheel.expired;
+}
+
+static void
+assert_filed (Fixture        *f,
+              TimeoutHandler *handler,
+              guint           level)
+{
+  guint shift = level * TIMER_WHEEL_BITS;
+  guint slot = (handler->expires >> shift) & TIMER_WHEEL_MASK;
+
+  g_assert (handler->list == &f->wheel.slots[level][slot]);
+}
+
+static void
+remove_and_free (Fixture        *f,
+                 TimeoutHandler *handler)
+{
+  timer_wheel_remove (&f->wheel, handler);
+  g_free (handler);
+}
+
+static void
+test_cascade (Fixture       *f,
+              gconstpointer  data)
+{
+  TimeoutHandler *soon = add (f, 10);
+  TimeoutHandler *later = add (f, 100);
+  TimeoutHandler *latest = add (f, 5000);
+
+  assert_filed (f, soon, 0);
+  assert_filed (f, later, 1);
+  assert_filed (f, latest, 2);
+  g_assert_cmpint (timer_wheel_next_tick (&f->wheel), ==, 10);
+
+  timer_wheel_advance (&f->wheel, 9);
+  g_assert (f->wheel.expired == NULL);
+
+  timer_wheel_advance (&f->wheel, 10);
+  g_assert (is_expired (f, soon));
+  remove_and_free (f, soon);
+
+  /* level 1 moves down to level 0 at the start of its slot */
+  g_assert_cmpint (timer_wheel_next_tick (&f->wheel), ==, 64);
+  timer_wheel_advance (&f->wheel, 63);
+  assert_filed (f, later, 1);
+  timer_wheel_advance (&f->wheel, 64);
+  assert_filed (f, later, 0);
+
+  timer_wheel_advance (&f->wheel, 99);
+  g_assert (f->wheel.expired == NULL);
+  timer_wheel_advance (&f->wheel, 100);
+  g_assert (is_expired (f, later));
+  remove_and_free (f, later);
+
+  /* level 2 moves down through level 1 and level 0 */
+  timer_wheel_advance (&f->wheel, 4096);
+  assert_filed (f, latest, 1);
+  timer_wheel_advance (&f->wheel, 4992);
+  assert_filed (f, latest, 0);
+  timer_wheel_advance (&f->wheel, 4999);
+  g_assert (f->wheel.expired == NULL);
+  timer_wheel_advance (&f->wheel, 5000);
+  g_assert (is_expired (f, latest));
+  remove_and_free (f, latest);
+
+  g_assert_cmpuint (f->wheel.n_timeouts, ==, 0);
+  g_assert (timer_wheel_peek (&f->wheel) == NULL);
+}
+
+static void
+test_overflow (Fixture       *f,
+               gconstpointer  data)
+{
+  guint top_level = TIMER_WHEEL_LEVELS - 1;
+  gint64 top = TIMER_WHEEL_SPAN (top_level);
+  gint64 whole = TIMER_WHEEL_SPAN (TIMER_WHEEL_LEVELS);
+  guint last_slot = ((whole - 1) / top) & TIMER_WHEEL_MASK;
+  TimeoutHandler *beyond_64_cubed = add (f, top + 1);
+  TimeoutHandler *beyond_wheel = add (f, 2 * whole + 7);
+
+  assert_filed (f, beyond_64_cubed, top_level);
+  /* parked in the top level, in the last slot the wheel can reach */
+  g_assert (beyond_wheel->list == &f->wheel.slots[top_level][last_slot]);
+
+  timer_wheel_advance (&f->wheel, top);
+  g_assert (f->wheel.expired == NULL);
+  timer_wheel_advance (&f->wheel, top + 1);
+  g_assert (is_expired (f, beyond_64_cubed));
+  remove_and_free (f, beyond_64_cubed);
+
+  /* reaching the parked slot files it again rather than expiring it */
+  timer_wheel_advance (&f->wheel, whole);
+  g_assert (!is_expired (f, beyond_wheel));
+  g_assert (beyond_wheel->list != NULL);
+
+  timer_wheel_advance (&f->wheel, 2 * whole + 6);
+  g_assert (f->wheel.expired == NULL);
+  timer_wheel_advance (&f->wheel, 2 * whole + 7);
+  g_assert (is_expired (f, beyond_wheel));
+  remove_and_free (f, beyond_wheel);
+
+  g_assert_cmpuint (f->wheel.n_timeouts, ==, 0);
+}
+
+static void
+test_rearm (Fixture       *f,
+            gconstpointer  data)
+{
+  TimeoutHandler *repeating = add (f, 25);
+  guint i;
+
+  for (i = 1; i <= 5; i++)
+    {
+      timer_wheel_advance (&f->wheel, 25 * i - 1);
+      g_assert (f->wheel.expired == NULL);
+      timer_wheel_advance (&f->wheel, 25 * i);
+      g_assert (is_expired (f, repeating));
+
+      /* as connection_source_dispatch() does before handling it */
+      timer_wheel_rearm (&f->wheel, repeating, 25);
+      g_assert (!is_expired (f, repeating));
+      g_assert_cmpint (repeating->expires, ==, 25 * (i + 1));
+      g_assert_cmpuint (f->wheel.n_timeouts, ==, 1);
+    }
+
+  /* a zero interval is still pushed into the future, so dispatching
+   * cannot loop forever */
+  timer_wheel_advance (&f->wheel, 150);
+  g_assert (is_expired (f, repeating));
+  timer_wheel_rearm (&f->wheel, repeating, 0);
+  g_assert (!is_expired (f, repeating));
+  g_assert_cmpint (timer_wheel_next_tick (&f->wheel), ==, 151);
+
+  remove_and_free (f, repeating);
+  g_assert (timer_wheel_peek (&f->wheel) == NULL);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/timer-wheel/cascade", Fixture, NULL, setup, test_cascade,
+              NULL);
+  g_test_add ("/timer-wheel/overflow", Fixture, NULL, setup, test_overflow,
+              NULL);
+  g_test_add ("/timer-wheel/rearm", Fixture, NULL, setup, test_rearm,
+              NULL);
+
+  return g_test_run ();
+}
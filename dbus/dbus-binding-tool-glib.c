@@ -41,7 +41,7 @@
 
 /* Remember to grep for ->format_version in the code if you change this,
  * most changes should be in dbus-gobject.c. */
-#define FORMAT_VERSION 1
+#define FORMAT_VERSION 5
 
 #define MARSHAL_PREFIX "dbus_glib_marshal_"
 
@@ -54,15 +54,18 @@ typedef struct
   GError **error;
   
   GHashTable *generated;
+  gboolean direct;
   GString *blob;
   GString *signal_blob;
   GString *property_blob;
+  GArray *method_hashes;
   guint count;
 } DBusBindingToolCData;
 
 static gboolean gather_marshallers (BaseInfo *base, DBusBindingToolCData *data, GError **error);
 static gboolean generate_glue_toplevel (BaseInfo *base, DBusBindingToolCData *data, GError **error);
 static gboolean generate_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error);
+static gboolean generate_direct_stubs (BaseInfo *base, DBusBindingToolCData *data, GError **error);
 static gboolean generate_client_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error);
 
 static const char *
@@ -138,6 +141,116 @@ dbus_g_type_get_c_name (GType gtype)
   return g_type_name (gtype);
 }
 
+/* Threaded methods are invoked with a DBusGMethodInvocation, like
+ * asynchronous ones, and reply with dbus_g_method_return() */
+static gboolean
+method_info_is_async (MethodInfo *method)
+{
+  return method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_ASYNC) != NULL
+    || method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_THREADED) != NULL;
+}
+
+/* How --mode=glib-server-direct handles each basic type: the C type
+ * libdbus reads and writes, and the C type the implementation is called
+ * with, which is the same as with the GClosure marshallers */
+typedef struct
+{
+  char typecode;
+  const char *dbus_type;
+  const char *wire_c_type;
+  const char *call_c_type;
+  gboolean allowed_out;
+} DirectArgType;
+
+static const DirectArgType direct_arg_types[] = {
+  { 'y', "DBUS_TYPE_BYTE", "guchar", "guchar", TRUE },
+  { 'b', "DBUS_TYPE_BOOLEAN", "dbus_bool_t", "gboolean", TRUE },
+  /* the GValue path sends gint and guint as INT32 and UINT32 whatever
+   * the signature says, so stubs would reply differently: leave those
+   * outputs to it */
+  { 'n', "DBUS_TYPE_INT16", "dbus_int16_t", "gint", FALSE },
+  { 'q', "DBUS_TYPE_UINT16", "dbus_uint16_t", "guint", FALSE },
+  { 'i', "DBUS_TYPE_INT32", "dbus_int32_t", "gint", TRUE },
+  { 'u', "DBUS_TYPE_UINT32", "dbus_uint32_t", "guint", TRUE },
+  { 'x', "DBUS_TYPE_INT64", "dbus_int64_t", "gint64", TRUE },
+  { 't', "DBUS_TYPE_UINT64", "dbus_uint64_t", "guint64", TRUE },
+  { 'd', "DBUS_TYPE_DOUBLE", "double", "gdouble", TRUE },
+  { 's', "DBUS_TYPE_STRING", "const char *", "char *", TRUE },
+  /* the GValue path rejects NULL object paths and signatures, which a
+   * stub cannot do as cheaply, so these are only supported as inputs
+   * too */
+  { 'o', "DBUS_TYPE_OBJECT_PATH", "const char *", "char *", FALSE },
+  { 'g', "DBUS_TYPE_SIGNATURE", "const char *", "char *", FALSE },
+};
+
+static const DirectArgType *
+direct_arg_type_lookup (ArgInfo *arg)
+{
+  const char *sig;
+  guint i;
+
+  sig = arg_info_get_type (arg);
+
+  if (sig[0] == '\0' || sig[1] != '\0')
+    return NULL;
+
+  for (i = 0; i < G_N_ELEMENTS (direct_arg_types); i++)
+    {
+      const DirectArgType *type = &direct_arg_types[i];
+
+      if (type->typecode != sig[0])
+        continue;
+
+      if (arg_info_get_direction (arg) == ARG_OUT && !type->allowed_out)
+        return NULL;
+
+      return type;
+    }
+
+  return NULL;
+}
+
+/* Whether --mode=glib-server-direct can generate a stub for @method,
+ * rather than falling back to a GClosure marshaller */
+static gboolean
+method_info_can_be_direct (MethodInfo *method)
+{
+  GSList *elt;
+
+  if (method_info_is_async (method))
+    return FALSE;
+
+  for (elt = method_info_get_args (method); elt; elt = elt->next)
+    {
+      ArgInfo *arg = elt->data;
+
+      if (arg_info_get_annotation (arg, DBUS_GLIB_ANNOTATION_RETURNVAL) != NULL)
+        return FALSE;
+
+      if (direct_arg_type_lookup (arg) == NULL)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static char *
+compute_method_c_name (MethodInfo *method, const char *interface_c_name)
+{
+  const char *c_symbol;
+  char *method_name_uscored;
+  char *ret;
+
+  c_symbol = method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_C_SYMBOL);
+  if (c_symbol != NULL)
+    return g_strdup (c_symbol);
+
+  method_name_uscored = _dbus_gutils_wincaps_to_uscore (method_info_get_name (method));
+  ret = g_strdup_printf ("%s_%s", interface_c_name, method_name_uscored);
+  g_free (method_name_uscored);
+  return ret;
+}
+
 static gboolean
 compute_gsignature (MethodInfo *method, GType *rettype, GArray **params, GError **error)
 {
@@ -148,7 +261,7 @@ compute_gsignature (MethodInfo *method, GType *rettype, GArray **params, GError
   const char *arg_type;
   gboolean retval_signals_error;
   
-  is_async = method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_ASYNC) != NULL;
+  is_async = method_info_is_async (method);
   retval_signals_error = FALSE;
 
   ret = g_array_new (TRUE, TRUE, sizeof (GType));
@@ -383,6 +496,9 @@ gather_marshallers (BaseInfo *base, DBusBindingToolCData *data, GError **error)
 
           method = (MethodInfo *) tmp->data;
 
+          if (data->direct && method_info_can_be_direct (method))
+            continue;
+
           marshaller_name = compute_marshaller (method, error);
 	  if (!marshaller_name)
 	    return FALSE;
@@ -466,11 +582,291 @@ write_quoted_string (GIOChannel *channel, GString *string, GError **error)
   return FALSE;
 }
 
+/* So that pointer declarations come out as "char *x" rather than
+ * "char * x" */
+static const char *
+c_type_separator (const char *c_type)
+{
+  return g_str_has_suffix (c_type, "*") ? "" : " ";
+}
+
+static gboolean
+write_direct_stub (MethodInfo *method, const char *interface_c_name,
+                   GIOChannel *channel, GError **error)
+{
+  GString *stub;
+  GString *proto;
+  GString *args;
+  GString *appends;
+  GString *frees;
+  GString *error_frees;
+  GSList *elt;
+  char *method_c_name;
+  guint n_in = 0;
+  guint n_out = 0;
+  gboolean ret;
+
+  method_c_name = compute_method_c_name (method, interface_c_name);
+  stub = g_string_new ("");
+  proto = g_string_new ("gboolean (*) (gpointer");
+  args = g_string_new ("object");
+  appends = g_string_new ("");
+  frees = g_string_new ("");
+  error_frees = g_string_new ("");
+
+  g_string_append_printf (stub,
+                          "static gboolean\n"
+                          "dbus_glib_direct_%s (GObject *object, DBusMessage *message, DBusMessage **reply, GError **error)\n"
+                          "{\n",
+                          method_c_name);
+
+  if (method_info_get_args (method) != NULL)
+    g_string_append (stub, "  DBusMessageIter iter;\n");
+
+  /* Declarations, and the prototype of the implementation */
+  for (elt = method_info_get_args (method); elt; elt = elt->next)
+    {
+      ArgInfo *arg = elt->data;
+      const DirectArgType *type = direct_arg_type_lookup (arg);
+      gboolean is_string = (strchr ("sog", type->typecode) != NULL);
+
+      if (arg_info_get_direction (arg) == ARG_IN)
+        {
+          g_string_append_printf (stub, "  %s%sin%u;\n", type->wire_c_type,
+                                  c_type_separator (type->wire_c_type), n_in);
+          g_string_append_printf (proto, ", %s", is_string ? "const char *" : type->call_c_type);
+          g_string_append_printf (args, ", in%u", n_in);
+          n_in++;
+        }
+      else
+        {
+          g_string_append_printf (stub, "  %s%sout%u = %s;\n", type->call_c_type,
+                                  c_type_separator (type->call_c_type), n_out,
+                                  is_string ? "NULL" : "0");
+          g_string_append_printf (proto, ", %s%s*", type->call_c_type,
+                                  c_type_separator (type->call_c_type));
+          g_string_append_printf (args, ", &out%u", n_out);
+
+          if (appends->len == 0)
+            g_string_append (appends, "      if (");
+          else
+            g_string_append (appends, "\n          || ");
+
+          g_string_append_printf (appends, "!dbus_message_iter_append_basic (&iter, %s, &wire%u)",
+                                  type->dbus_type, n_out);
+
+          if (is_string && arg_info_get_annotation (arg, DBUS_GLIB_ANNOTATION_CONST) == NULL)
+            {
+              g_string_append_printf (frees, "  g_free (out%u);\n", n_out);
+              g_string_append_printf (error_frees, "      g_free (out%u);\n", n_out);
+            }
+
+          n_out++;
+        }
+    }
+
+  g_string_append (proto, ", GError **)");
+  g_string_append (args, ", error");
+  g_string_append_c (stub, '\n');
+
+  /* The signature was checked before the stub was called */
+  if (n_in > 0)
+    g_string_append (stub, "  dbus_message_iter_init (message, &iter);\n");
+
+  for (elt = method_info_get_args (method), n_in = 0; elt; elt = elt->next)
+    {
+      ArgInfo *arg = elt->data;
+
+      if (arg_info_get_direction (arg) != ARG_IN)
+        continue;
+
+      g_string_append_printf (stub,
+                              "  dbus_message_iter_get_basic (&iter, &in%u);\n"
+                              "  dbus_message_iter_next (&iter);\n",
+                              n_in);
+      n_in++;
+    }
+
+  if (frees->len == 0)
+    {
+      g_string_append_printf (stub,
+                              "\n"
+                              "  if (!((%s) %s) (%s))\n"
+                              "    return FALSE;\n",
+                              proto->str, method_c_name, args->str);
+    }
+  else
+    {
+      /* The implementation might have set some of them before failing */
+      g_string_append_printf (stub,
+                              "\n"
+                              "  if (!((%s) %s) (%s))\n"
+                              "    {\n",
+                              proto->str, method_c_name, args->str);
+
+      g_string_append (stub, error_frees->str);
+      g_string_append (stub,
+                       "      return FALSE;\n"
+                       "    }\n");
+    }
+
+  g_string_append (stub,
+                   "\n"
+                   "  if (reply != NULL)\n"
+                   "    {\n");
+
+  for (elt = method_info_get_args (method), n_out = 0; elt; elt = elt->next)
+    {
+      ArgInfo *arg = elt->data;
+      const DirectArgType *type = direct_arg_type_lookup (arg);
+
+      if (arg_info_get_direction (arg) != ARG_OUT)
+        continue;
+
+      /* Like the GValue path, send NULL strings as "" */
+      if (type->typecode == 's')
+        g_string_append_printf (stub, "      %s%swire%u = out%u != NULL ? out%u : \"\";\n",
+                                type->wire_c_type, c_type_separator (type->wire_c_type),
+                                n_out, n_out, n_out);
+      else
+        g_string_append_printf (stub, "      %s%swire%u = out%u;\n",
+                                type->wire_c_type, c_type_separator (type->wire_c_type),
+                                n_out, n_out);
+      n_out++;
+    }
+
+  if (n_out > 0)
+    g_string_append_c (stub, '\n');
+
+  g_string_append (stub,
+                   "      *reply = dbus_message_new_method_return (message);\n"
+                   "      if (*reply == NULL)\n"
+                   "        g_error (\"out of memory\");\n");
+
+  if (n_out > 0)
+    g_string_append_printf (stub,
+                            "      dbus_message_iter_init_append (*reply, &iter);\n"
+                            "%s)\n"
+                            "        {\n"
+                            "          g_critical (\"unable to append OUT args for %s\");\n"
+                            "          dbus_message_unref (*reply);\n"
+                            "          *reply = NULL;\n"
+                            "        }\n",
+                            appends->str, method_info_get_name (method));
+
+  g_string_append (stub, "    }\n\n");
+  g_string_append (stub, frees->str);
+  g_string_append (stub, "  return TRUE;\n}\n\n");
+
+  ret = (g_io_channel_write_chars (channel, stub->str, stub->len, NULL, error)
+         == G_IO_STATUS_NORMAL);
+
+  g_string_free (stub, TRUE);
+  g_string_free (proto, TRUE);
+  g_string_free (args, TRUE);
+  g_string_free (appends, TRUE);
+  g_string_free (frees, TRUE);
+  g_string_free (error_frees, TRUE);
+  g_free (method_c_name);
+  return ret;
+}
+
+static gboolean
+generate_direct_stubs_list (GSList *list, DBusBindingToolCData *data, GError **error)
+{
+  GSList *tmp;
+
+  for (tmp = list; tmp != NULL; tmp = tmp->next)
+    {
+      if (!generate_direct_stubs (tmp->data, data, error))
+	return FALSE;
+    }
+  return TRUE;
+}
+
+/* For --mode=glib-server-direct: the stubs have to be written before the
+ * method table that points to them */
+static gboolean
+generate_direct_stubs (BaseInfo *base, DBusBindingToolCData *data, GError **error)
+{
+  if (base_info_get_type (base) == INFO_TYPE_NODE)
+    {
+      if (!generate_direct_stubs_list (node_info_get_nodes ((NodeInfo *) base),
+                                       data, error))
+        return FALSE;
+      if (!generate_direct_stubs_list (node_info_get_interfaces ((NodeInfo *) base),
+                                       data, error))
+        return FALSE;
+    }
+  else
+    {
+      InterfaceInfo *interface;
+      GSList *tmp;
+      const char *interface_c_name;
+
+      interface = (InterfaceInfo *) base;
+      interface_c_name = interface_info_get_annotation (interface, DBUS_GLIB_ANNOTATION_C_SYMBOL);
+      if (interface_c_name == NULL)
+        {
+	  if (data->prefix == NULL)
+	    return TRUE;
+	  interface_c_name = data->prefix;
+        }
+
+      for (tmp = interface_info_get_methods (interface); tmp != NULL; tmp = g_slist_next (tmp))
+        {
+          MethodInfo *method = tmp->data;
+
+          if (!method_info_can_be_direct (method))
+            continue;
+
+          if (!write_direct_stub (method, interface_c_name, data->channel, error))
+            return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+static gboolean
+write_method_lookup (DBusBindingToolCData *data, gboolean *written, GError **error)
+{
+  GIOChannel *channel = data->channel;
+  guint *table;
+  guint n_entries = 0;
+  guint i;
+
+  *written = FALSE;
+
+  table = _dbus_gutils_build_method_lookup (data->method_hashes, &n_entries);
+  if (table == NULL)
+    return TRUE;
+
+  if (!write_printf_to_iochannel ("static const guint dbus_glib_%s_method_lookup[] = {", channel, error, data->prefix))
+    goto io_lose;
+
+  for (i = 0; i < n_entries; i++)
+    {
+      if (!write_printf_to_iochannel ("%s%u,", channel, error,
+                                      i % 12 == 0 ? "\n  " : " ", table[i]))
+        goto io_lose;
+    }
+
+  WRITE_OR_LOSE ("\n};\n\n");
+
+  g_free (table);
+  *written = TRUE;
+  return TRUE;
+ io_lose:
+  g_free (table);
+  return FALSE;
+}
+
 static gboolean
 generate_glue_toplevel (BaseInfo *base, DBusBindingToolCData *data, GError **error)
 {
   GString *object_introspection_data_blob;
   GIOChannel *channel;
+  gboolean have_method_lookup = FALSE;
 
   channel = data->channel;
 
@@ -480,6 +876,10 @@ generate_glue_toplevel (BaseInfo *base, DBusBindingToolCData *data, GError **err
 
   data->signal_blob = g_string_new_len ("", 0);
   data->property_blob = g_string_new_len ("", 0);
+  data->method_hashes = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  if (data->direct && !generate_direct_stubs (base, data, error))
+    return FALSE;
 
   if (!write_printf_to_iochannel ("static const DBusGMethodInfo dbus_glib_%s_methods[] = {\n", channel, error, data->prefix))
     goto io_lose;
@@ -492,6 +892,10 @@ generate_glue_toplevel (BaseInfo *base, DBusBindingToolCData *data, GError **err
     return FALSE;
 
   WRITE_OR_LOSE ("};\n\n");
+
+  if (!write_method_lookup (data, &have_method_lookup, error))
+    goto io_lose;
+
   /* Information about the object. */
 
   if (!write_printf_to_iochannel ("const DBusGObjectInfo dbus_glib_%s_object_info = {  %d,\n",
@@ -509,12 +913,22 @@ generate_glue_toplevel (BaseInfo *base, DBusBindingToolCData *data, GError **err
   WRITE_OR_LOSE (",\n");
   if (!write_quoted_string (channel, data->property_blob, error))
     goto io_lose;
+  WRITE_OR_LOSE (",\n");
+  if (have_method_lookup)
+    {
+      if (!write_printf_to_iochannel ("  dbus_glib_%s_method_lookup", channel, error, data->prefix))
+        goto io_lose;
+    }
+  else
+    WRITE_OR_LOSE ("  NULL");
   WRITE_OR_LOSE ("\n};\n\n");
   g_string_free (object_introspection_data_blob, TRUE);
   g_string_free (data->signal_blob, TRUE);
   g_string_free (data->property_blob, TRUE);
+  g_array_free (data->method_hashes, TRUE);
   data->signal_blob = NULL;
   data->property_blob = NULL;
+  data->method_hashes = NULL;
   return TRUE;
 io_lose:
  return FALSE;  
@@ -564,48 +978,66 @@ generate_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error)
           MethodInfo *method;
           char *marshaller_name;
 	  char *method_c_name;
-          gboolean async = FALSE;
+          char invocation_type;
+	  gboolean is_direct;
+	  const char *priority;
 	  GSList *args;
 	  gboolean found_retval = FALSE;
           guint found_out_args = 0;
 
           method = (MethodInfo *) tmp->data;
-	  method_c_name = g_strdup (method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_C_SYMBOL));
-          if (method_c_name == NULL)
-	    {
-	      char *method_name_uscored;
-	      method_name_uscored = _dbus_gutils_wincaps_to_uscore (method_info_get_name (method));
-              method_c_name = g_strdup_printf ("%s_%s",
-					       interface_c_name,
-					       method_name_uscored);
-	      g_free (method_name_uscored);
-            }
+	  method_c_name = compute_method_c_name (method, interface_c_name);
 
-          if (!write_printf_to_iochannel ("  { (GCallback) %s, ", channel, error,
-					  method_c_name))
+          is_direct = data->direct && method_info_can_be_direct (method);
+
+          if (is_direct)
             {
-	      g_free (method_c_name);
-              goto io_lose;
+              if (!write_printf_to_iochannel ("  { (GCallback) dbus_glib_direct_%s, NULL, %d },\n",
+                                              channel, error, method_c_name,
+                                              object_introspection_data_blob->len))
+                {
+                  g_free (method_c_name);
+                  goto io_lose;
+                }
+              g_free (method_c_name);
             }
-          g_free (method_c_name);
-
-          marshaller_name = compute_marshaller_name (method, data->prefix, error);
-	  if (!marshaller_name)
-	    goto io_lose;
+          else
+            {
+              if (!write_printf_to_iochannel ("  { (GCallback) %s, ", channel, error,
+                                              method_c_name))
+                {
+                  g_free (method_c_name);
+                  goto io_lose;
+                }
+              g_free (method_c_name);
 
-          if (!write_printf_to_iochannel ("%s, %d },\n", channel, error,
-					  marshaller_name,
-					  object_introspection_data_blob->len))
-	    {
-	      g_free (marshaller_name);
-	      goto io_lose;
-	    }
+              marshaller_name = compute_marshaller_name (method, data->prefix, error);
+              if (!marshaller_name)
+                goto io_lose;
+
+              if (!write_printf_to_iochannel ("%s, %d },\n", channel, error,
+                                              marshaller_name,
+                                              object_introspection_data_blob->len))
+                {
+                  g_free (marshaller_name);
+                  goto io_lose;
+                }
+              g_free (marshaller_name);
+            }
 
-          if (method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_ASYNC) != NULL)
-            async = TRUE;
+          if (is_direct)
+            invocation_type = 'D';
+          else if (method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_THREADED) != NULL)
+            invocation_type = 'T';
+          else if (method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_ASYNC) != NULL)
+            invocation_type = 'A';
+          else
+            invocation_type = 'S';
 
 	  /* Object method data blob format:
-	   * <iface>\0<name>\0(<argname>\0<argdirection>\0<argtype>\0)*\0
+	   * <iface>\0<name>\0<invocation type>[H]\0(<argname>\0<argdirection>\0<argtype>\0)*\0
+	   * where H, since format version 3, marks a high-priority method,
+	   * and invocation type D, since format version 4, a direct stub
 	   */
 
 	  g_string_append (object_introspection_data_blob, interface_info_get_name (interface));
@@ -614,7 +1046,21 @@ generate_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error)
 	  g_string_append (object_introspection_data_blob, method_info_get_name (method));
 	  g_string_append_c (object_introspection_data_blob, '\0');
 
-	  g_string_append_c (object_introspection_data_blob, async ? 'A' : 'S');
+	  g_string_append_c (object_introspection_data_blob, invocation_type);
+	  priority = method_info_get_annotation (method, DBUS_GLIB_ANNOTATION_PRIORITY);
+	  if (priority != NULL && strcmp (priority, "high") == 0)
+	    g_string_append_c (object_introspection_data_blob, 'H');
+	  else if (priority != NULL && strcmp (priority, "normal") != 0)
+	    {
+	      g_set_error (error,
+			   DBUS_BINDING_TOOL_ERROR,
+			   DBUS_BINDING_TOOL_ERROR_INVALID_ANNOTATION,
+			   "Invalid priority \"%s\" in method \"%s\" of interface \"%s\": must be \"high\" or \"normal\"\n",
+			   priority,
+			   method_info_get_name (method),
+			   interface_info_get_name (interface));
+	      return FALSE;
+	    }
 	  g_string_append_c (object_introspection_data_blob, '\0');
 
 	  for (args = method_info_get_args (method); args; args = args->next)
@@ -753,6 +1199,24 @@ generate_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error)
 
 	  g_string_append_c (object_introspection_data_blob, '\0');
 
+          {
+            GString *in_signature;
+            guint32 hash;
+
+            in_signature = g_string_new (NULL);
+            for (args = method_info_get_args (method); args; args = args->next)
+              {
+                if (arg_info_get_direction (args->data) == ARG_IN)
+                  g_string_append (in_signature, arg_info_get_type (args->data));
+              }
+
+            hash = _dbus_gutils_method_hash (interface_info_get_name (interface),
+                                             method_info_get_name (method),
+                                             in_signature->str);
+            g_array_append_val (data->method_hashes, hash);
+            g_string_free (in_signature, TRUE);
+          }
+
           data->count++;
         }
 
@@ -768,6 +1232,10 @@ generate_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error)
 	  g_string_append_c (data->signal_blob, '\0');
 	  g_string_append (data->signal_blob, signal_info_get_name (sig));
 	  g_string_append_c (data->signal_blob, '\0');
+	  /* Flags, since format version 2 */
+	  if (signal_info_get_annotation (sig, DBUS_GLIB_ANNOTATION_LOSSY) != NULL)
+	    g_string_append_c (data->signal_blob, 'L');
+	  g_string_append_c (data->signal_blob, '\0');
 	}
 
       properties = interface_info_get_properties (interface);
@@ -830,7 +1298,7 @@ write_marshaller (gpointer key, gpointer value, gpointer user_data)
 }
 
 gboolean
-dbus_binding_tool_output_glib_server (BaseInfo *info, GIOChannel *channel, const char *prefix, GError **error)
+dbus_binding_tool_output_glib_server (BaseInfo *info, GIOChannel *channel, const char *prefix, gboolean direct, GError **error)
 {
   gboolean ret;
   GPtrArray *argv;
@@ -850,6 +1318,7 @@ dbus_binding_tool_output_glib_server (BaseInfo *info, GIOChannel *channel, const
   _dbus_g_type_specialized_builtins_init ();
 
   data.prefix = prefix;
+  data.direct = direct;
   data.generated = g_hash_table_new_full (g_str_hash, g_str_equal, (GDestroyNotify) g_free, NULL);
   data.error = error;
   genmarshal_stdout = NULL;
@@ -917,6 +1386,8 @@ dbus_binding_tool_output_glib_server (BaseInfo *info, GIOChannel *channel, const
   g_io_channel_shutdown (genmarshal_stdout, TRUE, error);
 
   WRITE_OR_LOSE ("#include <dbus/dbus-glib.h>\n");
+  if (direct)
+    WRITE_OR_LOSE ("#include <dbus/dbus-glib-lowlevel.h>\n");
 
   data.channel = channel;
   g_io_channel_ref (data.channel);
@@ -1153,10 +1624,9 @@ dbus_g_type_get_lookup_function (GType gtype)
 #undef MAP_KNOWN
 
 static gboolean
-write_args_for_direction (InterfaceInfo *iface, MethodInfo *method, GIOChannel *channel, int direction, GError **error)
+check_supported_parameters (MethodInfo *method)
 {
   GSList *args;
-  char *type_lookup = NULL;
 
   for (args = method_info_get_args (method); args; args = args->next)
     {
@@ -1164,34 +1634,73 @@ write_args_for_direction (InterfaceInfo *iface, MethodInfo *method, GIOChannel *
       GType gtype;
 
       arg = args->data;
+      gtype = _dbus_gtype_from_signature (arg_info_get_type (arg), TRUE);
+      if (gtype == G_TYPE_INVALID)
+	return FALSE;
+    }
+  return TRUE;
+}
 
-      if (direction != arg_info_get_direction (arg))
-	continue;
+static guint
+count_args_for_direction (MethodInfo *method, int direction)
+{
+  GSList *args;
+  guint n = 0;
 
-      gtype = _dbus_gtype_from_signature (arg_info_get_type (arg), TRUE);
-      g_assert (gtype != G_TYPE_INVALID);
-      type_lookup = dbus_g_type_get_lookup_function (gtype);
-      g_assert (type_lookup != NULL);
+  for (args = method_info_get_args (method); args; args = args->next)
+    {
+      if (arg_info_get_direction (args->data) == direction)
+        n++;
+    }
 
-      switch (direction)
-	{
+  return n;
+}
 
-	case ARG_IN:
-	  if (!write_printf_to_iochannel ("%s, IN_%s, ", channel, error,
-					  type_lookup,
-					  arg_info_get_name (arg)))
-	    goto io_lose;
-	  break;
-	case ARG_OUT:
-	  if (!write_printf_to_iochannel ("%s, OUT_%s, ", channel, error,
-					  type_lookup,
-					  arg_info_get_name (arg)))
-	    goto io_lose;
-	  break;
-	case ARG_INVALID:
-	  break;
-	}
-      g_free (type_lookup);
+static char *
+compute_client_types_name (const char *iface_prefix)
+{
+  return g_strdup_printf ("_dbus_glib_client_types_%s", iface_prefix);
+}
+
+/* The client glue for each interface looks up the GTypes of all its
+ * methods' arguments once, into a single static table.  Each method
+ * owns two G_TYPE_INVALID-terminated runs in it: its "in" types starting
+ * at *offset, immediately followed by its "out" types. */
+static gboolean
+write_client_types_for_method (MethodInfo *method, GIOChannel *channel, guint *offset, GError **error)
+{
+  char *type_lookup = NULL;
+  int direction;
+
+  for (direction = ARG_IN; direction <= ARG_OUT; direction++)
+    {
+      GSList *args;
+
+      for (args = method_info_get_args (method); args; args = args->next)
+        {
+          ArgInfo *arg;
+          GType gtype;
+
+          arg = args->data;
+
+          if (direction != arg_info_get_direction (arg))
+            continue;
+
+          gtype = _dbus_gtype_from_signature (arg_info_get_type (arg), TRUE);
+          g_assert (gtype != G_TYPE_INVALID);
+          type_lookup = dbus_g_type_get_lookup_function (gtype);
+          g_assert (type_lookup != NULL);
+
+          if (!write_printf_to_iochannel ("      types[%u] = %s;\n", channel, error,
+                                          *offset, type_lookup))
+            goto io_lose;
+          g_free (type_lookup);
+          type_lookup = NULL;
+          (*offset)++;
+        }
+
+      /* Leave the terminating G_TYPE_INVALID (0) in place */
+      (*offset)++;
     }
 
   return TRUE;
@@ -1201,23 +1710,114 @@ write_args_for_direction (InterfaceInfo *iface, MethodInfo *method, GIOChannel *
 }
 
 static gboolean
-check_supported_parameters (MethodInfo *method)
+write_client_types (InterfaceInfo *interface, const char *types_name, GIOChannel *channel, GError **error)
+{
+  GSList *methods;
+  guint n_types;
+
+  n_types = 0;
+  for (methods = interface_info_get_methods (interface); methods; methods = methods->next)
+    {
+      MethodInfo *method = methods->data;
+
+      if (!check_supported_parameters (method))
+        continue;
+
+      n_types += count_args_for_direction (method, ARG_IN) + 1;
+      n_types += count_args_for_direction (method, ARG_OUT) + 1;
+    }
+
+  if (n_types == 0)
+    return TRUE;
+
+  WRITE_OR_LOSE ("static inline const GType *\n");
+  if (!write_printf_to_iochannel ("%s (void)\n"
+                                  "{\n"
+                                  "  static GType types[%u];\n"
+                                  "  static gsize types_initialized = 0;\n\n"
+                                  "  if (g_once_init_enter (&types_initialized))\n"
+                                  "    {\n",
+                                  channel, error, types_name, n_types))
+    goto io_lose;
+
+  n_types = 0;
+  for (methods = interface_info_get_methods (interface); methods; methods = methods->next)
+    {
+      MethodInfo *method = methods->data;
+
+      if (!check_supported_parameters (method))
+        continue;
+
+      if (!write_client_types_for_method (method, channel, &n_types, error))
+        goto io_lose;
+    }
+
+  WRITE_OR_LOSE ("      g_once_init_leave (&types_initialized, 1);\n"
+                 "    }\n\n"
+                 "  return types;\n"
+                 "}\n\n");
+
+  return TRUE;
+ io_lose:
+  return FALSE;
+}
+
+/* Declares in_args or out_args, with one pointer per argument in
+ * @direction, or does nothing if there are none */
+static gboolean
+write_arg_vector_declaration (MethodInfo *method, GIOChannel *channel, int direction, GError **error)
+{
+  guint n;
+
+  n = count_args_for_direction (method, direction);
+  if (n == 0)
+    return TRUE;
+
+  if (direction == ARG_IN)
+    return write_printf_to_iochannel ("  gconstpointer in_args[%u];\n", channel, error, n);
+  else
+    return write_printf_to_iochannel ("  gpointer out_args[%u];\n", channel, error, n);
+}
+
+/* Fills in the vector declared by write_arg_vector_declaration(); if
+ * @take_address is TRUE, it points to the arguments themselves rather than
+ * holding their values */
+static gboolean
+write_arg_vector_for_direction (MethodInfo *method, GIOChannel *channel, int direction, gboolean take_address, GError **error)
 {
   GSList *args;
+  guint i = 0;
 
   for (args = method_info_get_args (method); args; args = args->next)
     {
       ArgInfo *arg;
-      GType gtype;
 
       arg = args->data;
-      gtype = _dbus_gtype_from_signature (arg_info_get_type (arg), TRUE);
-      if (gtype == G_TYPE_INVALID)
-	return FALSE;
+
+      if (direction != arg_info_get_direction (arg))
+        continue;
+
+      if (!write_printf_to_iochannel ("  %s_args[%u] = %s%s_%s;\n", channel, error,
+                                      direction == ARG_IN ? "in" : "out", i,
+                                      take_address ? "&" : "",
+                                      direction == ARG_IN ? "IN" : "OUT",
+                                      arg_info_get_name (arg)))
+        return FALSE;
+      i++;
     }
+
   return TRUE;
 }
 
+static const char *
+arg_vector_name (MethodInfo *method, int direction)
+{
+  if (count_args_for_direction (method, direction) == 0)
+    return "NULL";
+
+  return direction == ARG_IN ? "in_args" : "out_args";
+}
+
 static gboolean
 write_untyped_out_args (InterfaceInfo *iface, MethodInfo *method, GIOChannel *channel, GError **error)
 {
@@ -1392,42 +1992,11 @@ write_formal_parameters_for_direction (InterfaceInfo *iface, MethodInfo *method,
 }
 
 static gboolean
-write_typed_args_for_direction (InterfaceInfo *iface, MethodInfo *method, GIOChannel *channel, const int direction, GError **error)
-{
-  GSList *args;
-  char *type_lookup = NULL;
-  
-  for (args = method_info_get_args (method); args; args = args->next)
-    {
-      ArgInfo *arg;
-      int dir;
-      GType gtype;
-      
-      arg = args->data;
-
-      dir = arg_info_get_direction (arg);
-
-      if (dir != direction)
-        continue;
-
-      gtype = _dbus_gtype_from_signature (arg_info_get_type (arg), TRUE);
-      type_lookup = dbus_g_type_get_lookup_function (gtype);
-
-      if (!write_printf_to_iochannel ("%s, &%s_%s, ", channel, error, type_lookup, direction == ARG_IN ? "IN" : "OUT", arg_info_get_name (arg)))
-        goto io_lose;
-      g_free (type_lookup);
-    }
-  return TRUE;
- io_lose:
-  g_free (type_lookup);
-  return FALSE;
-}
-
-static gboolean
-write_async_method_client (GIOChannel *channel, InterfaceInfo *interface, MethodInfo *method, GError **error)
+write_async_method_client (GIOChannel *channel, InterfaceInfo *interface, MethodInfo *method, const char *types_name, guint types_offset, GError **error)
 {
   char *method_name, *iface_prefix;
   const char *interface_c_name;
+  guint out_offset;
 
   iface_prefix = iface_to_c_prefix (interface_info_get_name (interface));
   interface_c_name = interface_info_get_annotation (interface, DBUS_GLIB_ANNOTATION_CLIENT_C_SYMBOL);
@@ -1443,6 +2012,8 @@ write_async_method_client (GIOChannel *channel, InterfaceInfo *interface, Method
     }
   g_free(iface_prefix);
 
+  out_offset = types_offset + count_args_for_direction (method, ARG_IN) + 1;
+
   /* Write the typedef for the client callback */
   if (!write_printf_to_iochannel ("typedef void (*%s_reply) (DBusGProxy *proxy, ", channel, error, method_name))
     goto io_lose;
@@ -1481,11 +2052,16 @@ write_async_method_client (GIOChannel *channel, InterfaceInfo *interface, Method
   WRITE_OR_LOSE ("  DBusGAsyncData *data = (DBusGAsyncData*) user_data;\n  GError *error = NULL;\n");
   if (!write_formal_declarations_for_direction (interface, method, channel, ARG_OUT, error))
     goto io_lose;
+  if (!write_arg_vector_declaration (method, channel, ARG_OUT, error))
+    goto io_lose;
+  WRITE_OR_LOSE ("\n");
+  if (!write_arg_vector_for_direction (method, channel, ARG_OUT, TRUE, error))
+    goto io_lose;
   /* TODO: handle return boolean of end_call */
-  WRITE_OR_LOSE ("  dbus_g_proxy_end_call (proxy, call, &error, ");
-  if (!write_typed_args_for_direction (interface, method, channel, ARG_OUT, error))
+  if (!write_printf_to_iochannel ("  dbus_g_proxy_end_call_typed (proxy, call, &error, %s () + %u, %s);\n", channel, error,
+                                  types_name, out_offset,
+                                  arg_vector_name (method, ARG_OUT)))
     goto io_lose;
-  WRITE_OR_LOSE("G_TYPE_INVALID);\n");
   if (!write_printf_to_iochannel ("  (*(%s_reply)data->cb) (proxy, ", channel, error, method_name))
     goto io_lose;
   if (!write_untyped_out_args (interface, method, channel, error))
@@ -1506,12 +2082,17 @@ write_async_method_client (GIOChannel *channel, InterfaceInfo *interface, Method
     goto io_lose;
   
   WRITE_OR_LOSE ("{\n");
-  WRITE_OR_LOSE ("  DBusGAsyncData *stuff;\n  stuff = g_slice_new (DBusGAsyncData);\n  stuff->cb = G_CALLBACK (callback);\n  stuff->userdata = userdata;\n");
-  if (!write_printf_to_iochannel ("  return dbus_g_proxy_begin_call (proxy, \"%s\", %s_async_callback, stuff, _dbus_glib_async_data_free, ", channel, error, method_info_get_name (method), method_name))
+  WRITE_OR_LOSE ("  DBusGAsyncData *stuff;\n");
+  if (!write_arg_vector_declaration (method, channel, ARG_IN, error))
+    goto io_lose;
+  WRITE_OR_LOSE ("  stuff = g_slice_new (DBusGAsyncData);\n  stuff->cb = G_CALLBACK (callback);\n  stuff->userdata = userdata;\n");
+  if (!write_arg_vector_for_direction (method, channel, ARG_IN, TRUE, error))
     goto io_lose;
-  if (!write_args_for_direction (interface, method, channel, ARG_IN, error))
+  if (!write_printf_to_iochannel ("  return dbus_g_proxy_begin_call_typed (proxy, \"%s\", %s_async_callback, stuff, _dbus_glib_async_data_free, %s () + %u, %s);\n}\n", channel, error,
+                                  method_info_get_name (method), method_name,
+                                  types_name, types_offset,
+                                  arg_vector_name (method, ARG_IN)))
     goto io_lose;
-  WRITE_OR_LOSE ("G_TYPE_INVALID);\n}\n");
 
   g_free (method_name);
   return TRUE;
@@ -1540,8 +2121,11 @@ generate_client_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error
 {
   char *iface_prefix;
   char *method_c_name;
+  char *types_name;
+  guint types_offset;
   iface_prefix = NULL;
   method_c_name = NULL;
+  types_name = NULL;
 
   if (base_info_get_type (base) == INFO_TYPE_NODE)
     {
@@ -1579,6 +2163,12 @@ generate_client_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error
               iface_prefix, iface_prefix))
         goto io_lose;
 
+      types_name = compute_client_types_name (iface_prefix);
+      types_offset = 0;
+
+      if (!write_client_types (interface, types_name, channel, error))
+        goto io_lose;
+
       for (tmp = methods; tmp != NULL; tmp = g_slist_next (tmp))
         {
           MethodInfo *method;
@@ -1618,51 +2208,54 @@ generate_client_glue (BaseInfo *base, DBusBindingToolCData *data, GError **error
 
           WRITE_OR_LOSE ("{\n");
 
-          if (is_noreply) {
-            if (!write_printf_to_iochannel ("  dbus_g_proxy_call_no_reply (proxy, \"%s\", ", channel, error,
-                    method_info_get_name (method)))
-              goto io_lose;
+          if (!write_arg_vector_declaration (method, channel, ARG_IN, error))
+            goto io_lose;
 
-            if (!write_args_for_direction (interface, method, channel, ARG_IN, error))
-              goto io_lose;
+          if (!is_noreply &&
+              !write_arg_vector_declaration (method, channel, ARG_OUT, error))
+            goto io_lose;
 
-            WRITE_OR_LOSE ("G_TYPE_INVALID, ");
+          WRITE_OR_LOSE ("\n");
 
-            if (!write_args_for_direction (interface, method, channel, ARG_OUT, error))
-              goto io_lose;
+          if (!write_arg_vector_for_direction (method, channel, ARG_IN, TRUE, error))
+            goto io_lose;
 
-            WRITE_OR_LOSE ("G_TYPE_INVALID);\n");
+          if (is_noreply) {
+            if (!write_printf_to_iochannel ("  dbus_g_proxy_call_no_reply_typed (proxy, \"%s\", %s () + %u, %s);\n", channel, error,
+                    method_info_get_name (method), types_name, types_offset,
+                    arg_vector_name (method, ARG_IN)))
+              goto io_lose;
 
             WRITE_OR_LOSE ("  return TRUE;\n}\n\n");
           } else {
-            if (!write_printf_to_iochannel ("  return dbus_g_proxy_call (proxy, \"%s\", ", channel, error,
-                    method_info_get_name (method)))
-              goto io_lose;
-
-            WRITE_OR_LOSE ("error, ");
-
-            if (!write_args_for_direction (interface, method, channel, ARG_IN, error))
+            if (!write_arg_vector_for_direction (method, channel, ARG_OUT, FALSE, error))
               goto io_lose;
 
-            WRITE_OR_LOSE ("G_TYPE_INVALID, ");
-
-            if (!write_args_for_direction (interface, method, channel, ARG_OUT, error))
+            if (!write_printf_to_iochannel ("  return dbus_g_proxy_call_typed (proxy, \"%s\", error, %s () + %u, %s, %s () + %u, %s);\n}\n\n", channel, error,
+                    method_info_get_name (method),
+                    types_name, types_offset, arg_vector_name (method, ARG_IN),
+                    types_name, types_offset + count_args_for_direction (method, ARG_IN) + 1,
+                    arg_vector_name (method, ARG_OUT)))
               goto io_lose;
-
-            WRITE_OR_LOSE ("G_TYPE_INVALID);\n}\n\n");
           }
 
-          write_async_method_client (channel, interface, method, error);
+          if (!write_async_method_client (channel, interface, method, types_name, types_offset, error))
+            goto io_lose;
+
+          types_offset += count_args_for_direction (method, ARG_IN) + 1;
+          types_offset += count_args_for_direction (method, ARG_OUT) + 1;
         }
 
       if (!write_printf_to_iochannel ("#endif /* defined DBUS_GLIB_CLIENT_WRAPPERS_%s */\n\n", channel, error, iface_prefix))
         goto io_lose;
 
+      g_free (types_name);
       g_free (iface_prefix);
     }
   return TRUE;
  io_lose:
   g_free (method_c_name);
+  g_free (types_name);
   g_free (iface_prefix);
   return FALSE;
 }
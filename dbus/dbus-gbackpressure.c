@@ -0,0 +1,434 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gbackpressure.c: limiting how much is queued for a slow peer
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+#include "dbus-gbackpressure.h"
+#include "dbus-gcork.h"
+#include "dbus-gutils.h"
+#include "dbus-gmain/dbus-gmain.h"
+
+/* libdbus does not tell us when its outgoing queue shrinks, so while a
+ * connection is congested we look at it this often */
+#define CONGESTION_POLL_INTERVAL_MS 10
+
+/* Per-connection state, only touched with the backpressure lock held */
+typedef struct
+{
+  gsize low_watermark;
+  gsize high_watermark;         /**< 0 if watermarks are not in use */
+  DBusGConnectionWatermarkFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+  gboolean congested;           /**< crossed high, not yet back to low */
+  DBusGLossySignalPolicy policy;
+  GQueue coalesced;             /**< owned DBusMessage, oldest first */
+  GHashTable *coalesced_index;  /**< owned key => GList link in coalesced */
+  GSource *poll_source;         /**< polls the queue while congested */
+} OutgoingState;
+
+G_LOCK_DEFINE_STATIC (backpressure);
+static dbus_int32_t backpressure_slot = -1;
+
+static void
+outgoing_state_free (gpointer data)
+{
+  OutgoingState *state = data;
+
+  g_queue_foreach (&state->coalesced, (GFunc) dbus_message_unref, NULL);
+  g_queue_clear (&state->coalesced);
+  g_hash_table_destroy (state->coalesced_index);
+
+  if (state->poll_source != NULL)
+    {
+      g_source_destroy (state->poll_source);
+      g_source_unref (state->poll_source);
+    }
+
+  if (state->notify != NULL)
+    state->notify (state->user_data);
+
+  g_slice_free (OutgoingState, state);
+}
+
+static gpointer
+outgoing_state_new (void)
+{
+  OutgoingState *state;
+
+  state = g_slice_new0 (OutgoingState);
+  state->policy = DBUS_G_LOSSY_SIGNAL_SEND;
+  g_queue_init (&state->coalesced);
+  state->coalesced_index = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+  return state;
+}
+
+/* Must be called with the backpressure lock held */
+static OutgoingState *
+outgoing_state_get (DBusConnection *connection,
+                    gboolean        create)
+{
+  return _dbus_gutils_connection_get_data (connection, &backpressure_slot,
+                                           create ? outgoing_state_new : NULL,
+                                           outgoing_state_free);
+}
+
+/* Must be called with the backpressure lock held, which is kept while
+ * sending so that these cannot overtake newer copies sent by another
+ * thread */
+static void
+outgoing_state_release_coalesced (DBusConnection *connection,
+                                  OutgoingState  *state)
+{
+  DBusMessage *message;
+
+  g_hash_table_remove_all (state->coalesced_index);
+
+  while ((message = g_queue_pop_head (&state->coalesced)) != NULL)
+    {
+      if (!_dbus_g_connection_send (connection, message))
+        g_error ("dbus_connection_send failed: out of memory?");
+
+      dbus_message_unref (message);
+    }
+}
+
+static gboolean
+outgoing_poll_cb (gpointer data)
+{
+  DBusConnection *connection = data;
+
+  /* This destroys the source once the queue is short enough */
+  _dbus_g_connection_check_outgoing (connection);
+
+  return TRUE;
+}
+
+/* Must be called with the backpressure lock held. Returns TRUE if
+ * @state->congested changed. Signals coalesced while congested are
+ * sent when it clears. */
+static gboolean
+outgoing_state_update (DBusConnection *connection,
+                       OutgoingState  *state)
+{
+  gsize size = 0;
+
+  /* Messages held back by corking are on their way to the same queue */
+  if (state->high_watermark > 0)
+    size = (gsize) dbus_connection_get_outgoing_size (connection) +
+        _dbus_g_connection_get_corked_size (connection);
+  else if (!state->congested)
+    return FALSE;
+
+  if (!state->congested)
+    {
+      if (size < state->high_watermark)
+        return FALSE;
+
+      state->congested = TRUE;
+
+      g_assert (state->poll_source == NULL);
+      state->poll_source = g_timeout_source_new (CONGESTION_POLL_INTERVAL_MS);
+      g_source_set_callback (state->poll_source, outgoing_poll_cb,
+                             dbus_connection_ref (connection),
+                             (GDestroyNotify) dbus_connection_unref);
+      g_source_attach (state->poll_source,
+                       _dbus_g_get_connection_context (connection));
+      return TRUE;
+    }
+
+  if (state->high_watermark > 0 && size > state->low_watermark)
+    return FALSE;
+
+  state->congested = FALSE;
+
+  if (state->poll_source != NULL)
+    {
+      g_source_destroy (state->poll_source);
+      g_source_unref (state->poll_source);
+      state->poll_source = NULL;
+    }
+
+  outgoing_state_release_coalesced (connection, state);
+  return TRUE;
+}
+
+/*
+ * _dbus_g_connection_check_outgoing:
+ * @connection: a connection
+ *
+ * Compares the size of @connection's outgoing queue with the watermarks
+ * set by dbus_g_connection_set_outgoing_watermarks(), if any, and calls
+ * the callback if it has crossed one of them. Call this after queueing
+ * a message.
+ */
+void
+_dbus_g_connection_check_outgoing (DBusConnection *connection)
+{
+  OutgoingState *state;
+  DBusGConnectionWatermarkFunc func = NULL;
+  gpointer user_data = NULL;
+  gboolean congested = FALSE;
+
+  /* Nobody has ever set watermarks: don't bother with the lock */
+  if (backpressure_slot < 0)
+    return;
+
+  G_LOCK (backpressure);
+  state = outgoing_state_get (connection, FALSE);
+
+  if (state != NULL && outgoing_state_update (connection, state))
+    {
+      func = state->func;
+      user_data = state->user_data;
+      congested = state->congested;
+    }
+
+  G_UNLOCK (backpressure);
+
+  if (func != NULL)
+    func (DBUS_G_CONNECTION_FROM_CONNECTION (connection), congested,
+          user_data);
+}
+
+static char *
+coalesce_key (DBusMessage *message)
+{
+  /* None of these can contain a newline */
+  return g_strdup_printf ("%s\n%s\n%s", dbus_message_get_path (message),
+                          dbus_message_get_interface (message),
+                          dbus_message_get_member (message));
+}
+
+/*
+ * _dbus_g_connection_send_signal:
+ * @connection: a connection
+ * @message: a signal
+ * @lossy: %TRUE if the signal was annotated as lossy
+ *
+ * Sends @message like _dbus_g_connection_send(), unless @lossy is set,
+ * @connection is congested and its policy says to drop or coalesce
+ * such signals.
+ *
+ * Returns: %FALSE if out of memory
+ */
+gboolean
+_dbus_g_connection_send_signal (DBusConnection *connection,
+                                DBusMessage    *message,
+                                gboolean        lossy)
+{
+  OutgoingState *state;
+
+  if (lossy && backpressure_slot >= 0)
+    {
+      G_LOCK (backpressure);
+      state = outgoing_state_get (connection, FALSE);
+
+      if (state != NULL && state->congested &&
+          state->policy == DBUS_G_LOSSY_SIGNAL_DROP)
+        {
+          G_UNLOCK (backpressure);
+          return TRUE;
+        }
+
+      if (state != NULL && state->congested &&
+          state->policy == DBUS_G_LOSSY_SIGNAL_COALESCE)
+        {
+          char *key = coalesce_key (message);
+          GList *link = g_hash_table_lookup (state->coalesced_index, key);
+
+          if (link != NULL)
+            {
+              /* Only the newest value is interesting */
+              dbus_message_unref (link->data);
+              link->data = dbus_message_ref (message);
+              g_free (key);
+            }
+          else
+            {
+              g_queue_push_tail (&state->coalesced,
+                                 dbus_message_ref (message));
+              g_hash_table_insert (state->coalesced_index, key,
+                                   g_queue_peek_tail_link (&state->coalesced));
+            }
+
+          G_UNLOCK (backpressure);
+          return TRUE;
+        }
+
+      G_UNLOCK (backpressure);
+    }
+
+  if (!_dbus_g_connection_send (connection, message))
+    return FALSE;
+
+  _dbus_g_connection_check_outgoing (connection);
+  return TRUE;
+}
+
+/**
+ * DBusGConnectionWatermarkFunc:
+ * @connection: the connection
+ * @congested: %TRUE if the outgoing queue has reached the high
+ *  watermark, %FALSE if it has gone back down to the low watermark
+ * @user_data: the data passed to dbus_g_connection_set_outgoing_watermarks()
+ *
+ * Called when the amount of data waiting to be written to @connection
+ * crosses one of its watermarks.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * DBusGLossySignalPolicy:
+ * @DBUS_G_LOSSY_SIGNAL_SEND: send lossy signals like any other
+ * @DBUS_G_LOSSY_SIGNAL_DROP: while congested, discard lossy signals
+ * @DBUS_G_LOSSY_SIGNAL_COALESCE: while congested, keep only the most
+ *  recent emission of each lossy signal from each object, and send
+ *  those when the congestion clears
+ *
+ * What to do with exported signals annotated with
+ * <literal>org.freedesktop.DBus.GLib.Lossy</literal> in the
+ * introspection XML given to dbus-binding-tool, while the connection is
+ * congested in the sense of dbus_g_connection_set_outgoing_watermarks().
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * dbus_g_connection_set_outgoing_watermarks:
+ * @connection: a #DBusGConnection
+ * @low_watermark: number of bytes at or below which @connection stops
+ *  being congested
+ * @high_watermark: number of bytes at or above which @connection becomes
+ *  congested, or 0 to stop watching the outgoing queue
+ * @func: (allow-none): called when @connection becomes congested or
+ *  stops being congested
+ * @user_data: data for @func
+ * @notify: (allow-none): called on @user_data when it is no longer
+ *  needed
+ *
+ * Watches the amount of data queued to be written to @connection. A peer
+ * that does not read its messages fast enough makes this grow without
+ * limit; with watermarks, the application can find out and slow down,
+ * and signals annotated as lossy can be discarded as described for
+ * dbus_g_connection_set_lossy_signal_policy().
+ *
+ * The queue is measured whenever a signal or method reply is sent, and
+ * includes messages held back by dbus_g_connection_cork() or automatic
+ * corking.
+ * Once congested, it is checked every few milliseconds from the main
+ * context that @connection is attached to, until it has drained to
+ * @low_watermark.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_connection_set_outgoing_watermarks (DBusGConnection              *connection,
+                                           gsize                         low_watermark,
+                                           gsize                         high_watermark,
+                                           DBusGConnectionWatermarkFunc  func,
+                                           gpointer                      user_data,
+                                           GDestroyNotify                notify)
+{
+  DBusConnection *dconnection;
+  OutgoingState *state;
+  gpointer old_user_data;
+  GDestroyNotify old_notify;
+  gboolean changed;
+  gboolean congested;
+
+  g_return_if_fail (connection != NULL);
+  g_return_if_fail (high_watermark == 0 || low_watermark < high_watermark);
+
+  dconnection = DBUS_CONNECTION_FROM_G_CONNECTION (connection);
+
+  _dbus_g_connection_set_measure_corked (dconnection, high_watermark > 0);
+
+  G_LOCK (backpressure);
+  state = outgoing_state_get (dconnection, TRUE);
+
+  old_user_data = state->user_data;
+  old_notify = state->notify;
+
+  state->low_watermark = low_watermark;
+  state->high_watermark = high_watermark;
+  state->func = func;
+  state->user_data = user_data;
+  state->notify = notify;
+
+  changed = outgoing_state_update (dconnection, state);
+  congested = state->congested;
+
+  G_UNLOCK (backpressure);
+
+  if (old_notify != NULL)
+    old_notify (old_user_data);
+
+  if (changed && func != NULL)
+    func (connection, congested, user_data);
+}
+
+/**
+ * dbus_g_connection_set_lossy_signal_policy:
+ * @connection: a #DBusGConnection
+ * @policy: what to do with lossy signals while @connection is congested
+ *
+ * Sets how signals annotated as lossy are treated while @connection's
+ * outgoing queue is above its high watermark, so that a high rate of
+ * such signals cannot exhaust memory while a peer is stalled. This has
+ * no effect unless dbus_g_connection_set_outgoing_watermarks() has been
+ * called.
+ *
+ * Coalesced signals are sent after any that were sent normally while
+ * @connection was congested, so only use %DBUS_G_LOSSY_SIGNAL_COALESCE
+ * for signals whose order relative to others does not matter.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_connection_set_lossy_signal_policy (DBusGConnection        *connection,
+                                           DBusGLossySignalPolicy  policy)
+{
+  DBusConnection *dconnection;
+  OutgoingState *state;
+
+  g_return_if_fail (connection != NULL);
+  g_return_if_fail (policy <= DBUS_G_LOSSY_SIGNAL_COALESCE);
+
+  dconnection = DBUS_CONNECTION_FROM_G_CONNECTION (connection);
+
+  G_LOCK (backpressure);
+  state = outgoing_state_get (dconnection, TRUE);
+  state->policy = policy;
+
+  if (policy != DBUS_G_LOSSY_SIGNAL_COALESCE)
+    {
+      /* Don't strand what was coalesced until the congestion clears */
+      outgoing_state_release_coalesced (dconnection, state);
+    }
+
+  G_UNLOCK (backpressure);
+}
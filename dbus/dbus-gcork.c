@@ -0,0 +1,576 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gcork.c: holding back outgoing messages to be sent later, in order
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+#include <string.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+#include "dbus-gcork.h"
+#include "dbus-gutils.h"
+#include "dbus-gmain/dbus-gmain.h"
+
+/* Per-connection state, only touched with the cork lock held */
+typedef struct
+{
+  guint depth;                  /**< nesting of dbus_g_connection_cork() */
+  gboolean auto_cork;           /**< hold messages until the main loop iterates */
+  guint max_messages;           /**< flush when this many are held, or 0 */
+  guint max_latency_ms;         /**< flush when one has been held this long, or 0 */
+  GQueue held;                  /**< owned DBusMessage, oldest first */
+  GSource *flush_source;        /**< pending flush, or NULL */
+  gboolean measure;             /**< keep track of held_bytes */
+  gsize held_bytes;             /**< size of held, if measure is set */
+} CorkState;
+
+G_LOCK_DEFINE_STATIC (cork);
+static dbus_int32_t cork_slot = -1;
+
+static void
+cork_state_free (gpointer data)
+{
+  CorkState *state = data;
+
+  g_queue_foreach (&state->held, (GFunc) dbus_message_unref, NULL);
+  g_queue_clear (&state->held);
+
+  if (state->flush_source != NULL)
+    {
+      g_source_destroy (state->flush_source);
+      g_source_unref (state->flush_source);
+    }
+
+  g_slice_free (CorkState, state);
+}
+
+static gpointer
+cork_state_new (void)
+{
+  CorkState *state;
+
+  state = g_slice_new0 (CorkState);
+  g_queue_init (&state->held);
+  return state;
+}
+
+/* Must be called with the cork lock held */
+static CorkState *
+cork_state_get (DBusConnection *connection,
+                gboolean        create)
+{
+  return _dbus_gutils_connection_get_data (connection, &cork_slot,
+                                           create ? cork_state_new : NULL,
+                                           cork_state_free);
+}
+
+/* Size of a string header field: code, signature "s" and length, then
+ * the string and its nul, padded to the next field */
+static gsize
+header_field_get_size (const char *value)
+{
+  if (value == NULL)
+    return 0;
+
+  return (8 + strlen (value) + 1 + 7) & ~(gsize) 7;
+}
+
+static gsize
+fixed_type_get_size (int type)
+{
+  switch (type)
+    {
+    case DBUS_TYPE_BYTE:
+      return 1;
+    case DBUS_TYPE_INT16:
+    case DBUS_TYPE_UINT16:
+      return 2;
+    case DBUS_TYPE_INT64:
+    case DBUS_TYPE_UINT64:
+    case DBUS_TYPE_DOUBLE:
+      return 8;
+    default:
+      return 4;
+    }
+}
+
+/* Size of the values from @iter to the end of its container, not
+ * counting alignment padding */
+static gsize
+iter_get_size (DBusMessageIter *iter)
+{
+  gsize size = 0;
+  int type;
+
+  while ((type = dbus_message_iter_get_arg_type (iter)) != DBUS_TYPE_INVALID)
+    {
+      DBusMessageIter subiter;
+      const char *str;
+
+      switch (type)
+        {
+        case DBUS_TYPE_STRING:
+        case DBUS_TYPE_OBJECT_PATH:
+          dbus_message_iter_get_basic (iter, &str);
+          size += 4 + strlen (str) + 1;
+          break;
+
+        case DBUS_TYPE_SIGNATURE:
+          dbus_message_iter_get_basic (iter, &str);
+          size += 1 + strlen (str) + 1;
+          break;
+
+        case DBUS_TYPE_ARRAY:
+          size += 4;
+          dbus_message_iter_recurse (iter, &subiter);
+
+          if (dbus_type_is_fixed (dbus_message_iter_get_element_type (iter)))
+            {
+              /* no need to look at each element */
+              if (dbus_message_iter_get_arg_type (&subiter) != DBUS_TYPE_INVALID)
+                {
+                  gconstpointer elements;
+                  int n_elements;
+
+                  dbus_message_iter_get_fixed_array (&subiter, &elements,
+                                                     &n_elements);
+                  size += n_elements *
+                      fixed_type_get_size (dbus_message_iter_get_element_type (iter));
+                }
+            }
+          else
+            {
+              size += iter_get_size (&subiter);
+            }
+          break;
+
+        case DBUS_TYPE_VARIANT:
+          /* the signature of a single complete type is usually one
+           * character, so this is an underestimate for containers */
+          dbus_message_iter_recurse (iter, &subiter);
+          size += 3 + iter_get_size (&subiter);
+          break;
+
+        case DBUS_TYPE_STRUCT:
+        case DBUS_TYPE_DICT_ENTRY:
+          dbus_message_iter_recurse (iter, &subiter);
+          size += iter_get_size (&subiter);
+          break;
+
+        default:
+          size += fixed_type_get_size (type);
+          break;
+        }
+
+      dbus_message_iter_next (iter);
+    }
+
+  return size;
+}
+
+/* libdbus can only tell us exactly how big a message is by marshalling
+ * a copy of it, so this estimates it from the header fields that are set
+ * and the values in the body, without copying anything. Alignment
+ * padding, the serial numbers and unix fds are not counted, so this is
+ * a slight underestimate, which is close enough for watermarks. */
+static gsize
+message_get_size (DBusMessage *message)
+{
+  DBusMessageIter iter;
+  const char *signature;
+  gsize size;
+
+  /* fixed part of the header */
+  size = 16;
+
+  size += header_field_get_size (dbus_message_get_path (message));
+  size += header_field_get_size (dbus_message_get_interface (message));
+  size += header_field_get_size (dbus_message_get_member (message));
+  size += header_field_get_size (dbus_message_get_error_name (message));
+  size += header_field_get_size (dbus_message_get_destination (message));
+  size += header_field_get_size (dbus_message_get_sender (message));
+
+  signature = dbus_message_get_signature (message);
+
+  if (signature != NULL && *signature != '\0')
+    size += header_field_get_size (signature);
+
+  if (dbus_message_iter_init (message, &iter))
+    size += iter_get_size (&iter);
+
+  return size;
+}
+
+/* Must be called with the cork lock held. The lock is kept while
+ * sending, so that messages held by different threads cannot overtake
+ * each other. libdbus writes each message as it is sent, so this saves
+ * no writes; it only decides when they happen. */
+static void
+cork_state_flush (DBusConnection *connection,
+                  CorkState      *state)
+{
+  DBusMessage *message;
+
+  if (state->flush_source != NULL)
+    {
+      g_source_destroy (state->flush_source);
+      g_source_unref (state->flush_source);
+      state->flush_source = NULL;
+    }
+
+  while ((message = g_queue_pop_head (&state->held)) != NULL)
+    {
+      if (!dbus_connection_send (connection, message, NULL))
+        g_error ("dbus_connection_send failed: out of memory?");
+
+      dbus_message_unref (message);
+    }
+
+  state->held_bytes = 0;
+}
+
+static gboolean
+cork_flush_cb (gpointer data)
+{
+  DBusConnection *connection = data;
+  CorkState *state;
+
+  G_LOCK (cork);
+  state = cork_state_get (connection, FALSE);
+
+  if (state != NULL)
+    {
+      /* Unless another thread flushed while this was being dispatched,
+       * the source is this one, and it is finishing anyway */
+      if (state->flush_source == g_main_current_source ())
+        {
+          g_source_unref (state->flush_source);
+          state->flush_source = NULL;
+        }
+
+      cork_state_flush (connection, state);
+    }
+
+  G_UNLOCK (cork);
+
+  return FALSE;
+}
+
+/* Must be called with the cork lock held */
+static void
+cork_state_schedule_flush (DBusConnection *connection,
+                           CorkState      *state)
+{
+  if (state->flush_source != NULL)
+    return;
+
+  if (state->depth == 0)
+    {
+      /* Automatic: send them all at the start of the next main loop
+       * iteration, once everything dispatched in this one has run */
+      state->flush_source = g_idle_source_new ();
+      g_source_set_priority (state->flush_source, G_PRIORITY_DEFAULT);
+    }
+  else if (state->max_latency_ms > 0)
+    {
+      state->flush_source = g_timeout_source_new (state->max_latency_ms);
+    }
+  else
+    {
+      return;
+    }
+
+  g_source_set_callback (state->flush_source, cork_flush_cb,
+                         dbus_connection_ref (connection),
+                         (GDestroyNotify) dbus_connection_unref);
+  g_source_attach (state->flush_source,
+                   _dbus_g_get_connection_context (connection));
+}
+
+/*
+ * _dbus_g_connection_send:
+ * @connection: a connection
+ * @message: a message that does not need its serial number reported
+ *
+ * Sends @message, or holds it back to be sent later if the connection
+ * is corked. Messages are always sent in order.
+ *
+ * Returns: %FALSE if out of memory
+ */
+gboolean
+_dbus_g_connection_send (DBusConnection *connection,
+                         DBusMessage    *message)
+{
+  CorkState *state;
+
+  /* Nothing has ever been corked: don't bother with the lock */
+  if (cork_slot < 0)
+    return dbus_connection_send (connection, message, NULL);
+
+  G_LOCK (cork);
+  state = cork_state_get (connection, FALSE);
+
+  if (state == NULL || (state->depth == 0 && !state->auto_cork))
+    {
+      G_UNLOCK (cork);
+      return dbus_connection_send (connection, message, NULL);
+    }
+
+  g_queue_push_tail (&state->held, dbus_message_ref (message));
+
+  if (state->measure)
+    state->held_bytes += message_get_size (message);
+
+  if (state->max_messages > 0 && state->held.length >= state->max_messages)
+    cork_state_flush (connection, state);
+  else
+    cork_state_schedule_flush (connection, state);
+
+  G_UNLOCK (cork);
+  return TRUE;
+}
+
+/*
+ * _dbus_g_connection_flush_corked:
+ * @connection: a connection
+ *
+ * Sends any messages held back by corking. This must be called before
+ * sending a message by any other route, so that it does not overtake
+ * them.
+ */
+void
+_dbus_g_connection_flush_corked (DBusConnection *connection)
+{
+  CorkState *state;
+
+  if (cork_slot < 0)
+    return;
+
+  G_LOCK (cork);
+  state = cork_state_get (connection, FALSE);
+
+  if (state != NULL)
+    cork_state_flush (connection, state);
+
+  G_UNLOCK (cork);
+}
+
+/*
+ * _dbus_g_connection_set_measure_corked:
+ * @connection: a connection
+ * @measure: %TRUE if _dbus_g_connection_get_corked_size() will be used
+ *
+ * Held messages are only measured for connections that need it, such as
+ * those with outgoing watermarks. Each is measured once, when it is
+ * held back.
+ */
+void
+_dbus_g_connection_set_measure_corked (DBusConnection *connection,
+                                       gboolean        measure)
+{
+  CorkState *state;
+
+  G_LOCK (cork);
+  state = cork_state_get (connection, measure);
+
+  if (state != NULL && state->measure != measure)
+    {
+      GList *link;
+
+      state->measure = measure;
+      state->held_bytes = 0;
+
+      for (link = state->held.head;
+           measure && link != NULL;
+           link = link->next)
+        state->held_bytes += message_get_size (link->data);
+    }
+
+  G_UNLOCK (cork);
+}
+
+/*
+ * _dbus_g_connection_get_corked_size:
+ * @connection: a connection
+ *
+ * Returns: roughly the number of bytes held back, or 0 if
+ *  _dbus_g_connection_set_measure_corked() has not been enabled
+ */
+gsize
+_dbus_g_connection_get_corked_size (DBusConnection *connection)
+{
+  CorkState *state;
+  gsize ret = 0;
+
+  if (cork_slot < 0)
+    return 0;
+
+  G_LOCK (cork);
+  state = cork_state_get (connection, FALSE);
+
+  if (state != NULL)
+    ret = state->held_bytes;
+
+  G_UNLOCK (cork);
+  return ret;
+}
+
+/**
+ * dbus_g_connection_cork:
+ * @connection: a #DBusGConnection
+ *
+ * Holds back signals, method replies and calls made with
+ * dbus_g_proxy_call_no_reply() on @connection, instead of sending each
+ * as soon as it is emitted, until the matching
+ * dbus_g_connection_uncork(), which sends them in the order they were
+ * emitted.
+ *
+ * This only controls when messages are sent. libdbus still writes each
+ * message to the socket separately, so holding them back does not
+ * reduce the number of writes.
+ *
+ * Calls that expect a reply, and anything else that needs a serial
+ * number, are never held back: they send whatever is held first, so
+ * that messages are never reordered.
+ *
+ * Calls nest. The limits set with dbus_g_connection_set_auto_cork()
+ * also apply here.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_connection_cork (DBusGConnection *connection)
+{
+  CorkState *state;
+
+  g_return_if_fail (connection != NULL);
+
+  G_LOCK (cork);
+  state = cork_state_get (DBUS_CONNECTION_FROM_G_CONNECTION (connection), TRUE);
+  state->depth++;
+  G_UNLOCK (cork);
+}
+
+/**
+ * dbus_g_connection_uncork:
+ * @connection: a #DBusGConnection
+ *
+ * Undoes one dbus_g_connection_cork(). When the last one is undone,
+ * sends all the messages that were held back, unless automatic corking
+ * is enabled, in which case they are sent when the main loop next
+ * iterates.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_connection_uncork (DBusGConnection *connection)
+{
+  DBusConnection *dconnection;
+  CorkState *state;
+
+  g_return_if_fail (connection != NULL);
+
+  dconnection = DBUS_CONNECTION_FROM_G_CONNECTION (connection);
+
+  G_LOCK (cork);
+  state = cork_state_get (dconnection, FALSE);
+
+  if (state == NULL || state->depth == 0)
+    {
+      G_UNLOCK (cork);
+      g_critical ("dbus_g_connection_uncork() called without "
+                  "dbus_g_connection_cork()");
+      return;
+    }
+
+  state->depth--;
+
+  if (state->depth == 0)
+    {
+      if (state->auto_cork)
+        {
+          /* A latency timer for the explicit cork is no longer wanted */
+          if (state->flush_source != NULL)
+            {
+              g_source_destroy (state->flush_source);
+              g_source_unref (state->flush_source);
+              state->flush_source = NULL;
+            }
+
+          if (state->held.length > 0)
+            cork_state_schedule_flush (dconnection, state);
+        }
+      else
+        {
+          cork_state_flush (dconnection, state);
+        }
+    }
+
+  G_UNLOCK (cork);
+}
+
+/**
+ * dbus_g_connection_set_auto_cork:
+ * @connection: a #DBusGConnection
+ * @auto_cork: %TRUE to hold back messages until the main loop iterates
+ * @max_messages: send held messages as soon as this many are held, or 0
+ *  for no limit
+ * @max_latency_ms: while explicitly corked, send held messages when the
+ *  oldest has been held for this many milliseconds, or 0 for no limit
+ *
+ * With @auto_cork, @connection behaves as if it was corked at the start
+ * of each main loop iteration and uncorked at the end: signals and
+ * replies produced while dispatching are held back, as described for
+ * dbus_g_connection_cork(), and sent in order from an idle callback at
+ * %G_PRIORITY_DEFAULT in the main context that @connection is attached
+ * to, after everything else dispatched in that iteration has run.
+ *
+ * @max_messages and @max_latency_ms bound how much is held back, both in
+ * this mode and for explicit dbus_g_connection_cork(). libdbus offers
+ * no cheap way to know a message's size in bytes, so the first limit is
+ * a number of messages.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_connection_set_auto_cork (DBusGConnection *connection,
+                                 gboolean         auto_cork,
+                                 guint            max_messages,
+                                 guint            max_latency_ms)
+{
+  DBusConnection *dconnection;
+  CorkState *state;
+
+  g_return_if_fail (connection != NULL);
+
+  dconnection = DBUS_CONNECTION_FROM_G_CONNECTION (connection);
+
+  G_LOCK (cork);
+  state = cork_state_get (dconnection, TRUE);
+  state->auto_cork = (auto_cork != FALSE);
+  state->max_messages = max_messages;
+  state->max_latency_ms = max_latency_ms;
+
+  if (state->depth == 0 && !state->auto_cork)
+    cork_state_flush (dconnection, state);
+
+  G_UNLOCK (cork);
+}
@@ -0,0 +1,42 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gcork.h: holding back outgoing messages to be sent later, in order
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef DBUS_GLIB_CORK_H
+#define DBUS_GLIB_CORK_H
+
+#include <dbus/dbus.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gboolean _dbus_g_connection_send         (DBusConnection *connection,
+                                          DBusMessage    *message);
+
+void     _dbus_g_connection_flush_corked (DBusConnection *connection);
+
+void     _dbus_g_connection_set_measure_corked (DBusConnection *connection,
+                                                gboolean        measure);
+gsize    _dbus_g_connection_get_corked_size    (DBusConnection *connection);
+
+G_END_DECLS
+
+#endif /* DBUS_GLIB_CORK_H */
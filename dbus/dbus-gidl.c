@@ -64,6 +64,7 @@ struct MethodInfo
 struct SignalInfo
 {
   BaseInfo base;
+  GHashTable *annotations;
   GSList *args;
 };
 
@@ -587,6 +588,9 @@ signal_info_new (const char *name)
   info->base.refcount = 1;
   info->base.name = g_strdup (name);
   info->base.type = INFO_TYPE_SIGNAL;
+  info->annotations = g_hash_table_new_full (g_str_hash, g_str_equal,
+					  (GDestroyNotify) g_free,
+					  (GDestroyNotify) g_free);
   
   return info;
 }
@@ -605,6 +609,7 @@ signal_info_unref (SignalInfo *info)
   info->base.refcount -= 1;
   if (info->base.refcount == 0)
     {
+      g_hash_table_destroy (info->annotations);
       free_arg_list (&info->args);
       base_info_free (info);
     }
@@ -616,6 +621,29 @@ signal_info_get_name (SignalInfo *info)
   return info->base.name;
 }
 
+GSList *
+signal_info_get_annotations (SignalInfo *info)
+{
+  return get_hash_keys (info->annotations);
+}
+
+const char*
+signal_info_get_annotation (SignalInfo *info,
+			    const char *name)
+{
+  return g_hash_table_lookup (info->annotations, name);
+}
+
+void
+signal_info_add_annotation (SignalInfo  *info,
+			    const char  *name,
+			    const char  *value)
+{
+  g_hash_table_insert (info->annotations,
+		       g_strdup (name),
+		       g_strdup (value));
+}
+
 GSList*
 signal_info_get_args (SignalInfo *info)
 {
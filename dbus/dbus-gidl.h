@@ -123,6 +123,12 @@ SignalInfo*         signal_info_new               (const char          *name);
 SignalInfo*         signal_info_ref               (SignalInfo          *info);
 void                signal_info_unref             (SignalInfo          *info);
 const char*         signal_info_get_name          (SignalInfo          *info);
+GSList*             signal_info_get_annotations   (SignalInfo          *info);
+const char*         signal_info_get_annotation    (SignalInfo          *info,
+						   const char          *annotation);
+void                signal_info_add_annotation    (SignalInfo          *info,
+                                                   const char          *name,
+                                                   const char          *value);
 GSList*             signal_info_get_args          (SignalInfo          *info);
 void                signal_info_add_arg           (SignalInfo          *info,
                                                    ArgInfo             *arg);
@@ -44,6 +44,48 @@ void            dbus_connection_setup_with_g_main (DBusConnection  *connection,
 void            dbus_server_setup_with_g_main     (DBusServer      *server,
                                                    GMainContext    *context);
 
+typedef struct {
+  guint64 n_spins;
+  guint64 n_hits;
+  guint64 total_usec;
+  guint64 useful_usec;
+} DBusGBusyPollStats;
+
+void            dbus_connection_set_g_main_busy_poll       (DBusConnection     *connection,
+                                                            guint               usec);
+void            dbus_connection_get_g_main_busy_poll_stats (DBusConnection     *connection,
+                                                            DBusGBusyPollStats *stats);
+
+typedef struct _DBusGServerWorkers DBusGServerWorkers;
+
+typedef enum
+{
+  DBUS_G_SERVER_WORKERS_ROUND_ROBIN,
+  DBUS_G_SERVER_WORKERS_LEAST_LOADED
+} DBusGServerWorkersPolicy;
+
+typedef void (* DBusGServerWorkersNewConnectionFunc) (DBusConnection *connection,
+                                                      GMainContext   *context,
+                                                      gpointer        user_data);
+
+DBusGServerWorkers *dbus_g_server_workers_new (DBusServer                          *server,
+                                               guint                                n_workers,
+                                               DBusGServerWorkersPolicy             policy,
+                                               DBusGServerWorkersNewConnectionFunc  func,
+                                               gpointer                             user_data,
+                                               GDestroyNotify                       notify);
+void          dbus_g_server_workers_free             (DBusGServerWorkers *workers);
+guint         dbus_g_server_workers_get_n_workers    (DBusGServerWorkers *workers);
+GMainContext *dbus_g_server_workers_get_context      (DBusGServerWorkers *workers,
+                                                      guint               index);
+guint         dbus_g_server_workers_get_n_connections (DBusGServerWorkers *workers,
+                                                       guint               index);
+gint          dbus_g_server_workers_get_connection_worker (DBusGServerWorkers *workers,
+                                                           DBusConnection     *connection);
+gboolean      dbus_g_server_workers_move_connection  (DBusGServerWorkers *workers,
+                                                      DBusConnection     *connection,
+                                                      guint               index);
+
 void dbus_g_proxy_send (DBusGProxy    *proxy,
                         DBusMessage   *message,
                         dbus_uint32_t *client_serial);
@@ -59,6 +101,30 @@ DBusMessage*      dbus_g_method_get_reply     (DBusGMethodInvocation *context);
 void              dbus_g_method_send_reply    (DBusGMethodInvocation *context, 
                                                DBusMessage *reply);
 
+typedef gboolean (* DBusGMethodDirectFunc) (GObject      *object,
+                                            DBusMessage  *message,
+                                            DBusMessage **reply,
+                                            GError      **error);
+
+typedef struct _DBusGMethodReply DBusGMethodReply;
+
+DBusGMethodReply *dbus_g_method_reply_new     (DBusGMethodInvocation *context);
+gboolean          dbus_g_method_reply_append_basic (DBusGMethodReply *reply,
+                                                    int               type,
+                                                    const void       *value);
+gboolean          dbus_g_method_reply_append_fixed_array (DBusGMethodReply *reply,
+                                                          int               element_type,
+                                                          gconstpointer     elements,
+                                                          int               n_elements);
+gboolean          dbus_g_method_reply_append_value (DBusGMethodReply *reply,
+                                                    const GValue     *value);
+gboolean          dbus_g_method_reply_open_container (DBusGMethodReply *reply,
+                                                      int               type,
+                                                      const char       *contained_signature);
+gboolean          dbus_g_method_reply_close_container (DBusGMethodReply *reply);
+void              dbus_g_method_reply_send    (DBusGMethodReply *reply);
+void              dbus_g_method_reply_free    (DBusGMethodReply *reply);
+
 G_END_DECLS
 
 #endif /* DBUS_GLIB_LOWLEVEL_H */
@@ -41,6 +41,7 @@ typedef enum {
   DBUS_BINDING_OUTPUT_NONE,
   DBUS_BINDING_OUTPUT_PRETTY,
   DBUS_BINDING_OUTPUT_GLIB_SERVER,
+  DBUS_BINDING_OUTPUT_GLIB_SERVER_DIRECT,
   DBUS_BINDING_OUTPUT_GLIB_CLIENT
 } DBusBindingOutputMode;
 
@@ -159,10 +160,21 @@ pretty_print (BaseInfo *base,
     case INFO_TYPE_SIGNAL:
       {
         SignalInfo *s = (SignalInfo*) base;
+	GSList *annotations, *elt;
 
         g_assert (name != NULL);
 
+	annotations = signal_info_get_annotations (s);
         printf ("signal \"%s\" (\n", name);
+	for (elt = annotations; elt; elt = elt->next)
+	  {
+	    const char *name = elt->data;
+	    const char *value = signal_info_get_annotation (s, name);
+
+	    printf (" (annotation \"%s\": \"%s\") ",
+		    name, value);
+	  }
+	g_slist_free (annotations);
 
         pretty_print_list (signal_info_get_args (s), depth + 1);
 
@@ -240,8 +252,8 @@ static void
 usage (int ecode)
 {
   fprintf (stderr, "dbus-binding-tool [--version] [--help]\n");
-  fprintf (stderr, "dbus-binding-tool --mode=[pretty|glib-server|glib-client] [--prefix=SYMBOL_PREFIX] [--ignore-unsupported] [--force] [--output=FILE]\n");
-  fprintf (stderr, "dbus-binding-tool --mode=glib-server --prefix=SYMBOL_PREFIX [--ignore-unsupported] [--force] [--output=FILE]\n");
+  fprintf (stderr, "dbus-binding-tool --mode=[pretty|glib-server|glib-server-direct|glib-client] [--prefix=SYMBOL_PREFIX] [--ignore-unsupported] [--force] [--output=FILE]\n");
+  fprintf (stderr, "dbus-binding-tool --mode=[glib-server|glib-server-direct] --prefix=SYMBOL_PREFIX [--ignore-unsupported] [--force] [--output=FILE]\n");
   exit (ecode);
 }
 
@@ -307,6 +319,8 @@ main (int argc, char **argv)
 		outputmode = DBUS_BINDING_OUTPUT_PRETTY;
 	      else if (!strcmp (mode, "glib-server"))
 		outputmode = DBUS_BINDING_OUTPUT_GLIB_SERVER;
+	      else if (!strcmp (mode, "glib-server-direct"))
+		outputmode = DBUS_BINDING_OUTPUT_GLIB_SERVER_DIRECT;
 	      else if (!strcmp (mode, "glib-client"))
 		outputmode = DBUS_BINDING_OUTPUT_GLIB_CLIENT;
 	      else
@@ -342,7 +356,8 @@ main (int argc, char **argv)
       ++i;
     }
 
-  if (outputmode == DBUS_BINDING_OUTPUT_GLIB_SERVER && !has_prefix)
+  if ((outputmode == DBUS_BINDING_OUTPUT_GLIB_SERVER ||
+       outputmode == DBUS_BINDING_OUTPUT_GLIB_SERVER_DIRECT) && !has_prefix)
     usage (1);
 
   error = NULL;
@@ -418,7 +433,10 @@ main (int argc, char **argv)
 	      pretty_print ((BaseInfo*) node, 0);
 	      break;
 	    case DBUS_BINDING_OUTPUT_GLIB_SERVER:
-	      if (!dbus_binding_tool_output_glib_server ((BaseInfo *) node, channel, prefix, &error))
+	    case DBUS_BINDING_OUTPUT_GLIB_SERVER_DIRECT:
+	      if (!dbus_binding_tool_output_glib_server ((BaseInfo *) node, channel, prefix,
+                                                         outputmode == DBUS_BINDING_OUTPUT_GLIB_SERVER_DIRECT,
+                                                         &error))
                 {
                   warn_gerror ("Compilation failed", error);
                   node_info_unref (node);
@@ -27,6 +27,7 @@
 #include "dbus/dbus-glib.h"
 #include "dbus/dbus-glib-lowlevel.h"
 #include "dbus-gmain/dbus-gmain.h"
+#include "dbus-gcork.h"
 #include "dbus-gtest.h"
 #include "dbus-gutils.h"
 #include "dbus-gvalue.h"
@@ -68,6 +69,7 @@
 void
 dbus_g_connection_flush (DBusGConnection *connection)
 {
+  _dbus_g_connection_flush_corked (DBUS_CONNECTION_FROM_G_CONNECTION (connection));
   dbus_connection_flush (DBUS_CONNECTION_FROM_G_CONNECTION (connection));
 }
 
@@ -652,3 +654,67 @@ dbus_server_setup_with_g_main     (DBusServer      *server,
 {
   _dbus_g_set_up_server (server, context);
 }
+
+/**
+ * DBusGBusyPollStats:
+ * @n_spins: number of times the connection's source spun waiting for
+ *  another message
+ * @n_hits: number of messages that arrived while spinning
+ * @total_usec: total time spent spinning, in microseconds
+ * @useful_usec: the part of @total_usec that ended with a message
+ *  arriving; the rest was spent waiting for nothing
+ *
+ * Statistics about busy-polling on a connection, as returned by
+ * dbus_connection_get_g_main_busy_poll_stats().
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * dbus_connection_set_g_main_busy_poll:
+ * @connection: a connection set up with dbus_connection_setup_with_g_main()
+ * @usec: the maximum time to spin, in microseconds, or 0 to disable
+ *
+ * Opts in to busy-polling for a connection with very latency-sensitive
+ * request/response traffic. After dispatching a message, the
+ * connection's main loop source keeps reading from the connection
+ * without blocking for up to @usec microseconds, instead of going back
+ * to the main loop and poll(). Each message that arrives in that time
+ * is dispatched immediately and restarts the time limit.
+ *
+ * This burns CPU time while there is nothing to read, and other sources
+ * attached to the same #GMainContext do not run while it spins, so
+ * @usec should be of the order of the expected round-trip time. Use
+ * dbus_connection_get_g_main_busy_poll_stats() to see how much of the
+ * spinning was useful.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_connection_set_g_main_busy_poll (DBusConnection *connection,
+                                      guint           usec)
+{
+  _dbus_g_set_busy_poll (connection, usec);
+}
+
+/**
+ * dbus_connection_get_g_main_busy_poll_stats:
+ * @connection: a connection set up with dbus_connection_setup_with_g_main()
+ * @stats: (out caller-allocates): filled in with the statistics
+ *
+ * Reports how often busy-polling, as enabled by
+ * dbus_connection_set_g_main_busy_poll(), has picked up a message and
+ * how much time it has spent. The statistics are kept if the
+ * connection is moved to a different #GMainContext.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_connection_get_g_main_busy_poll_stats (DBusConnection     *connection,
+                                            DBusGBusyPollStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  _dbus_g_get_busy_poll_stats (connection, &stats->n_spins, &stats->n_hits,
+                               &stats->total_usec, &stats->useful_usec);
+}
@@ -56,6 +56,32 @@ DBusGMessage*     dbus_g_message_ref             (DBusGMessage           *messag
 void              dbus_g_message_unref           (DBusGMessage           *message);
 
 void              dbus_g_connection_flush        (DBusGConnection        *connection);
+void              dbus_g_connection_cork         (DBusGConnection        *connection);
+void              dbus_g_connection_uncork       (DBusGConnection        *connection);
+void              dbus_g_connection_set_auto_cork (DBusGConnection       *connection,
+                                                   gboolean               auto_cork,
+                                                   guint                  max_messages,
+                                                   guint                  max_latency_ms);
+
+typedef void (* DBusGConnectionWatermarkFunc) (DBusGConnection *connection,
+                                               gboolean         congested,
+                                               gpointer         user_data);
+
+typedef enum
+{
+  DBUS_G_LOSSY_SIGNAL_SEND,
+  DBUS_G_LOSSY_SIGNAL_DROP,
+  DBUS_G_LOSSY_SIGNAL_COALESCE
+} DBusGLossySignalPolicy;
+
+void              dbus_g_connection_set_outgoing_watermarks (DBusGConnection              *connection,
+                                                             gsize                         low_watermark,
+                                                             gsize                         high_watermark,
+                                                             DBusGConnectionWatermarkFunc  func,
+                                                             gpointer                      user_data,
+                                                             GDestroyNotify                notify);
+void              dbus_g_connection_set_lossy_signal_policy (DBusGConnection              *connection,
+                                                             DBusGLossySignalPolicy        policy);
 
 GQuark dbus_g_error_quark (void);
 #define DBUS_GERROR dbus_g_error_quark ()
@@ -120,13 +146,20 @@ typedef struct _DBusGMethodInfo DBusGMethodInfo;
 
 /**
  * DBusGMethodInfo:
- * @function: C method to invoke
- * @marshaller: Marshaller to invoke method 
+ * @function: C method to invoke, or a #DBusGMethodDirectFunc
+ * @marshaller: Marshaller to invoke method, or %NULL for a
+ *   #DBusGMethodDirectFunc
  * @data_offset: Offset into the introspection data
  *
  * Object typically generated by #dbus-binding-tool that
  * stores a mapping from introspection data to a
  * function pointer for a C method to be invoked.
+ *
+ * Since format version 4 of #DBusGObjectInfo, a method whose invocation
+ * type in the introspection data is 'D' was generated by
+ * <literal>dbus-binding-tool --mode=glib-server-direct</literal>: its
+ * @function is a #DBusGMethodDirectFunc cast to #GCallback, and it has no
+ * @marshaller.
  */
 struct _DBusGMethodInfo
 {
@@ -144,6 +177,8 @@ struct _DBusGMethodInfo
  * @data: Introspection data 
  * @exported_signals: Exported signals
  * @exported_properties: Exported properties 
+ * @method_lookup: Perfect hash table over the methods' interfaces, names
+ *   and input signatures, or %NULL; only read since format version 5
  *
  * Introspection data for a #GObject, normally autogenerated by
  * a tool such as #dbus-binding-tool.
@@ -157,13 +192,52 @@ struct _DBusGObjectInfo
   const char *data; 
   const char *exported_signals;  
   const char *exported_properties; 
+  const guint *method_lookup;
 };
 
 void       dbus_glib_global_set_disable_legacy_property_access (void);
+void       dbus_glib_global_set_max_method_threads (gint max_threads);
+void       dbus_glib_global_set_max_value_nesting (guint max_depth);
+
+typedef struct {
+  GType        type;
+  const char  *interface;
+  const char  *method;
+  guint64      calls;
+  guint64      errors;
+  guint64      total_usec;
+  guint64      demarshal_usec;
+  guint64      marshal_usec;
+  guint        n_buckets;
+  const guint64 *buckets;
+} DBusGMethodStats;
+
+typedef void (*DBusGMethodStatsFunc) (const DBusGMethodStats *stats,
+                                      gpointer                user_data);
+
+void       dbus_glib_global_set_method_stats_enabled (gboolean enabled);
+void       dbus_g_method_stats_foreach         (DBusGMethodStatsFunc  func,
+                                                gpointer              user_data);
+void       dbus_g_method_stats_reset           (void);
+guint64    dbus_g_method_stats_get_bucket_start (guint                bucket);
+void       dbus_g_connection_export_method_stats (DBusGConnection    *connection);
 
 void       dbus_g_object_type_install_info     (GType                 object_type,
                                                 const DBusGObjectInfo *info);
 
+void       dbus_g_object_type_use_emission_hooks (GType                object_type);
+
+typedef enum
+{
+  DBUS_G_METHOD_PRIORITY_NORMAL,
+  DBUS_G_METHOD_PRIORITY_HIGH
+} DBusGMethodPriority;
+
+void       dbus_g_object_type_set_method_priority (GType                object_type,
+                                                   const char          *interface,
+                                                   const char          *method,
+                                                   DBusGMethodPriority  priority);
+
 void       dbus_g_object_type_register_shadow_property (GType         iface_type,
                                                         const char    *dbus_prop_name,
                                                         const char    *shadow_prop_name);
@@ -205,6 +279,9 @@ typedef gchar DBusGSignature;
 GType        dbus_g_signature_get_g_type           (void) G_GNUC_CONST;
 #define DBUS_TYPE_G_SIGNATURE (dbus_g_signature_get_g_type ())
 
+GType        dbus_g_packed_strv_get_g_type         (void) G_GNUC_CONST;
+#define DBUS_TYPE_G_PACKED_STRV (dbus_g_packed_strv_get_g_type ())
+
 void         dbus_g_object_register_marshaller      (GClosureMarshal  marshaller,
 						     GType            rettype,
 						     ...);
@@ -239,6 +316,10 @@ typedef struct _DBusGProxyCall DBusGProxyCall;
 typedef void (* DBusGProxyCallNotify) (DBusGProxy       *proxy,
 				       DBusGProxyCall   *call_id,
 				       void             *user_data);
+typedef gboolean (* DBusGProxyElementFunc) (DBusGProxy   *proxy,
+					    guint         index_,
+					    const GValue *element,
+					    gpointer      user_data);
 
 GType             dbus_g_proxy_get_type              (void) G_GNUC_CONST;
 DBusGProxy*       dbus_g_proxy_new_for_name          (DBusGConnection   *connection,
@@ -292,6 +373,18 @@ void              dbus_g_proxy_call_no_reply         (DBusGProxy        *proxy,
                                                       GType              first_arg_type,
                                                       ...);
 
+gboolean          dbus_g_proxy_call_typed            (DBusGProxy        *proxy,
+                                                      const char        *method,
+                                                      GError           **error,
+                                                      const GType       *in_types,
+                                                      const gconstpointer *in_args,
+                                                      const GType       *out_types,
+                                                      gpointer const    *out_args);
+void              dbus_g_proxy_call_no_reply_typed   (DBusGProxy        *proxy,
+                                                      const char        *method,
+                                                      const GType       *in_types,
+                                                      const gconstpointer *in_args);
+
 DBusGProxyCall *  dbus_g_proxy_begin_call            (DBusGProxy        *proxy,
                                                       const char        *method,
 						      DBusGProxyCallNotify notify,
@@ -308,6 +401,14 @@ DBusGProxyCall * dbus_g_proxy_begin_call_with_timeout (DBusGProxy        *proxy,
                                                        GType             first_arg_type,
 				                       ...);
 
+DBusGProxyCall *  dbus_g_proxy_begin_call_typed      (DBusGProxy        *proxy,
+                                                      const char        *method,
+                                                      DBusGProxyCallNotify notify,
+                                                      gpointer           user_data,
+                                                      GDestroyNotify     destroy,
+                                                      const GType       *in_types,
+                                                      const gconstpointer *in_args);
+
 void              dbus_g_proxy_set_default_timeout   (DBusGProxy        *proxy,
                                                       int                timeout);
 
@@ -316,6 +417,17 @@ gboolean          dbus_g_proxy_end_call              (DBusGProxy        *proxy,
                                                       GError           **error,
                                                       GType              first_arg_type,
                                                       ...);
+gboolean          dbus_g_proxy_end_call_foreach      (DBusGProxy        *proxy,
+                                                      DBusGProxyCall    *call,
+                                                      GError           **error,
+                                                      GType              element_type,
+                                                      DBusGProxyElementFunc func,
+                                                      gpointer           user_data);
+gboolean          dbus_g_proxy_end_call_typed        (DBusGProxy        *proxy,
+                                                      DBusGProxyCall    *call,
+                                                      GError           **error,
+                                                      const GType       *out_types,
+                                                      gpointer const    *out_args);
 void              dbus_g_proxy_cancel_call           (DBusGProxy        *proxy,
                                                       DBusGProxyCall    *call);
 
@@ -28,6 +28,8 @@
 #include <gobject/gvaluecollector.h>
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
+#include "dbus-gbackpressure.h"
+#include "dbus-gcork.h"
 #include "dbus-gtest.h"
 #include "dbus-gutils.h"
 #include "dbus-gobject.h"
@@ -35,6 +37,8 @@
 #include "dbus-gvalue.h"
 #include "dbus-gmarshal.h"
 #include "dbus-gvalue-utils.h"
+#include "dbus-gstats.h"
+#include "dbus-gmain/dbus-gmain.h"
 #include <string.h>
 
 #include <gio/gio.h>
@@ -88,8 +92,10 @@ connection_send_or_die (DBusConnection *connection,
   g_return_if_fail (connection != NULL);
   g_return_if_fail (message != NULL);
 
-  if (!dbus_connection_send (connection, message, NULL))
+  if (!_dbus_g_connection_send (connection, message))
     oom ("dbus_connection_send failed: out of memory?");
+
+  _dbus_g_connection_check_outgoing (connection);
 }
 
 static char *lookup_property_name (GObject    *object,
@@ -100,12 +106,19 @@ typedef struct
 {
   char *default_iface;
   GType code_enum;
+  /* code => interned D-Bus error name if default_iface is set, or the
+   * interned last component of the name if not; never modified after
+   * the DBusGErrorInfo has been published in error_metadata */
+  GHashTable *names;
 } DBusGErrorInfo;
 
 static GStaticRWLock globals_lock = G_STATIC_RW_LOCK_INIT;
 /* See comments in check_property_access */
 static gboolean disable_legacy_property_access = FALSE;
-static GData *error_metadata = NULL;
+/* GQuark => DBusGErrorInfo. This is copied, not modified, when a domain is
+ * registered (with globals_lock held for writing), so that it can be read
+ * without taking any lock. */
+static GHashTable *error_metadata = NULL;
 
 static char*
 uscore_to_wincaps_full (const char *uscore,
@@ -219,6 +232,13 @@ method_name_from_object_info (const DBusGObjectInfo *object,
   return string_table_lookup (get_method_data (object, method), 1);
 }
 
+static const char *
+method_invocation_type_from_object_info (const DBusGObjectInfo *object,
+                                         const DBusGMethodInfo *method)
+{
+  return string_table_lookup (get_method_data (object, method), 2);
+}
+
 static const char *
 method_arg_info_from_object_info (const DBusGObjectInfo *object,
 				  const DBusGMethodInfo *method)
@@ -397,14 +417,31 @@ method_output_signature_from_object_info (const DBusGObjectInfo *object,
 }
 
 static const char *
-signal_iterate (const char *data, const char **iface, const char **name)
+signal_iterate (const char  *data,
+                int          format_version,
+                const char **iface,
+                const char **name,
+                gboolean    *lossy)
 {
   *iface = data;
 
   data = string_table_next (data);
   *name = data;
 
-  return string_table_next (data);
+  data = string_table_next (data);
+  if (format_version >= 2)
+    {
+      /* Flags: 'L' means the signal was annotated as lossy */
+      if (lossy != NULL)
+        *lossy = (strchr (data, 'L') != NULL);
+      return string_table_next (data);
+    }
+  else
+    {
+      if (lossy != NULL)
+        *lossy = FALSE;
+      return data;
+    }
 }
 
 static const char *
@@ -421,7 +458,7 @@ property_iterate (const char  *data,
   *exported_name = data;
 
   data = string_table_next (data);
-  if (format_version == 1)
+  if (format_version >= 1)
     {
       *name_uscored = data;
       data = string_table_next (data);
@@ -644,10 +681,28 @@ typedef struct {
     gchar *object_path;
     /* borrowed pointer to parent, never NULL */
     ObjectExport *export;
+    /* owned set of borrowed DBusGMethodInfo, resolved when registered,
+     * or NULL if there are no high-priority methods */
+    GHashTable *high_priority_methods;
 } ObjectRegistration;
 
 static void object_export_object_died (gpointer user_data, GObject *dead);
 
+#define OBJECT_EXPORT_QUARK (dbus_g_object_export_quark ())
+
+/* The ObjectExport is looked up on every signal emission, so use a quark
+ * rather than making GObject intern the string each time. The string is
+ * unchanged, so g_object_get_data() callers keep working. */
+static GQuark
+dbus_g_object_export_quark (void)
+{
+  static GQuark quark;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("dbus_glib_object_registrations");
+  return quark;
+}
+
 static void
 object_export_unregister_all (ObjectExport *oe)
 {
@@ -690,14 +745,20 @@ object_registration_new (DBusGConnection *connection,
   return o;
 }
 
+static void method_lanes_forget_registration (ObjectRegistration *registration);
+
 static void
 object_registration_free (ObjectRegistration *o)
 {
   g_assert (o->export != NULL);
+  method_lanes_forget_registration (o);
   o->export->registrations = g_slist_remove (o->export->registrations, o);
 
   g_free (o->object_path);
 
+  if (o->high_priority_methods != NULL)
+    g_hash_table_unref (o->high_priority_methods);
+
   g_slice_free (ObjectRegistration, o);
 }
 
@@ -931,7 +992,7 @@ introspect_interfaces (GObject *object, GString *xml)
           const char *iface;
           const char *signame;
 
-          propsig = signal_iterate (propsig, &iface, &signame);
+          propsig = signal_iterate (propsig, info->format_version, &iface, &signame, NULL);
 
           values = lookup_values (interfaces, iface);
           values->signals = g_slist_prepend (values->signals, (gpointer) signame);
@@ -1060,6 +1121,7 @@ set_object_property (DBusConnection  *connection,
   context.recursion_depth = 0;
   context.gconnection = DBUS_G_CONNECTION_FROM_CONNECTION (connection);
   context.proxy = NULL;
+  context.message = message;
 
   g_value_init (&value, pspec->value_type);
   if (_dbus_gvalue_demarshal (&context, &sub, &value, NULL))
@@ -1402,6 +1464,96 @@ get_all_object_properties (DBusConnection        *connection,
   return ret;
 }
 
+/* Like comparing method_input_signature_from_object_info() with
+ * @signature, but without building the expected signature */
+static gboolean
+method_input_signature_matches (const DBusGObjectInfo *object,
+                                const DBusGMethodInfo *method,
+                                const char            *signature)
+{
+  const char *arg;
+
+  arg = method_arg_info_from_object_info (object, method);
+
+  while (*arg)
+    {
+      gboolean arg_in;
+      const char *type;
+      gsize len;
+
+      arg = arg_iterate (arg, NULL, &arg_in, NULL, NULL, &type);
+
+      if (!arg_in)
+        continue;
+
+      len = strlen (type);
+      if (strncmp (signature, type, len) != 0)
+        return FALSE;
+      signature += len;
+    }
+
+  return *signature == '\0';
+}
+
+static gboolean
+method_matches (const DBusGObjectInfo *object,
+                const DBusGMethodInfo *method,
+                const char            *interface,
+                const char            *member,
+                const char            *signature)
+{
+  return (interface == NULL
+          || strcmp (method_interface_from_object_info (object, method), interface) == 0)
+      && strcmp (method_name_from_object_info (object, method), member) == 0
+      && method_input_signature_matches (object, method, signature);
+}
+
+/* Since format version 5, dbus-binding-tool writes a perfect hash table
+ * over each object info's methods: two counts, then a displacement per
+ * bucket, then for each slot the index of its method plus one, or 0. */
+static const DBusGMethodInfo *
+object_info_lookup_method (const DBusGObjectInfo *info,
+                           const char            *interface,
+                           const char            *member,
+                           const char            *signature)
+{
+  int i;
+
+  if (interface != NULL && info->format_version >= 5 &&
+      info->method_lookup != NULL)
+    {
+      const guint *table = info->method_lookup;
+      guint n_buckets = table[0];
+      guint n_slots = table[1];
+      guint32 hash;
+      guint slot;
+      guint index;
+
+      hash = _dbus_gutils_method_hash (interface, member, signature);
+      slot = _dbus_gutils_method_hash_slot (hash, table[2 + hash % n_buckets],
+                                            n_slots);
+      index = table[2 + n_buckets + slot];
+
+      if (index == 0 || index > (guint) info->n_method_infos)
+        return NULL;
+
+      if (method_matches (info, &info->method_infos[index - 1], interface,
+                          member, signature))
+        return &info->method_infos[index - 1];
+
+      return NULL;
+    }
+
+  for (i = 0; i < info->n_method_infos; i++)
+    {
+      if (method_matches (info, &info->method_infos[i], interface, member,
+                          signature))
+        return &info->method_infos[i];
+    }
+
+  return NULL;
+}
+
 static gboolean
 lookup_object_and_method (GObject      *object,
 			  DBusMessage  *message,
@@ -1413,8 +1565,6 @@ lookup_object_and_method (GObject      *object,
   const char *signature;
   GList *info_list;
   const GList *info_list_walk;
-  const DBusGObjectInfo *info;
-  int i;
 
   interface = dbus_message_get_interface (message);
   member = dbus_message_get_member (message);
@@ -1424,34 +1574,18 @@ lookup_object_and_method (GObject      *object,
   
   for (info_list_walk = info_list; info_list_walk != NULL; info_list_walk = g_list_next (info_list_walk))
     {
-      info = (DBusGObjectInfo *) info_list_walk->data;
-      *object_ret = info;
+      const DBusGObjectInfo *info = info_list_walk->data;
+      const DBusGMethodInfo *method;
 
-      for (i = 0; i < info->n_method_infos; i++)
-        {
-          const char *expected_member;
-          const char *expected_interface;
-          char *expected_signature;
-          const DBusGMethodInfo *method;
-
-          method = &(info->method_infos[i]);
+      *object_ret = info;
 
-          /* Check method interface/name and input signature */ 
-          expected_interface = method_interface_from_object_info (*object_ret, method);
-          expected_member = method_name_from_object_info (*object_ret, method);
-          expected_signature = method_input_signature_from_object_info (*object_ret, method);
+      method = object_info_lookup_method (info, interface, member, signature);
 
-          if ((interface == NULL
-              || strcmp (expected_interface, interface) == 0)
-              && strcmp (expected_member, member) == 0
-              && strcmp (expected_signature, signature) == 0)
-            {
-              g_free (expected_signature);
-              *method_ret = method;
-              g_list_free (info_list);
-              return TRUE;
-            }
-            g_free (expected_signature);
+      if (method != NULL)
+        {
+          *method_ret = method;
+          g_list_free (info_list);
+          return TRUE;
         }
     }
 
@@ -1461,51 +1595,59 @@ lookup_object_and_method (GObject      *object,
   return FALSE;
 }
 
-static char *
+/* Returns the error name, which must be freed with g_free() if it is
+ * also returned in @to_free */
+static const char *
 gerror_domaincode_to_dbus_error_name (const DBusGObjectInfo *object_info,
 				      const char *msg_interface,
-				      GQuark domain, gint code)
+				      GQuark domain, gint code,
+				      char **to_free)
 {
   const char *domain_str;
   const char *code_str;
+  gboolean code_is_wincaps = FALSE;
   GString *dbus_error_name;
 
+  *to_free = NULL;
+
   domain_str = object_error_domain_prefix_from_object_info (object_info);
   code_str = object_error_code_from_object_info (object_info, domain, code);
 
   if (!domain_str || !code_str)
     {
+      GHashTable *metadata;
       DBusGErrorInfo *info;
 
-      g_static_rw_lock_reader_lock (&globals_lock);
+      metadata = g_atomic_pointer_get (&error_metadata);
 
-      if (error_metadata != NULL)
-	info = g_datalist_id_get_data (&error_metadata, domain);
+      if (metadata != NULL)
+	info = g_hash_table_lookup (metadata, GUINT_TO_POINTER (domain));
       else
 	info = NULL;
 
-      g_static_rw_lock_reader_unlock (&globals_lock);
-
       if (info)
 	{
-	  GEnumValue *value;
-	  GEnumClass *klass;
+	  const char *name;
 
-	  klass = g_type_class_ref (info->code_enum);
-	  value = g_enum_get_value (klass, code);
-	  g_type_class_unref (klass);
+	  name = g_hash_table_lookup (info->names, GINT_TO_POINTER (code));
 
 	  domain_str = info->default_iface;
-	  if (value)
-            {
-              code_str = value->value_nick;
-            }
-          else
+	  if (name == NULL)
             {
               g_warning ("Error code %d out of range for GError domain %s",
                          code, g_quark_to_string (domain));
               code_str = NULL;
             }
+          else if (domain_str != NULL)
+            {
+              /* the whole name was worked out at registration time */
+              return name;
+            }
+          else
+            {
+              code_str = name;
+              code_is_wincaps = TRUE;
+            }
 	}
     }
 
@@ -1531,6 +1673,12 @@ gerror_domaincode_to_dbus_error_name (const DBusGObjectInfo *object_info,
       /* Map -1 to (unsigned) -1 to avoid "-", which is not valid */
       g_string_append_printf (dbus_error_name, "Code%u", (unsigned) code);
     }
+  else if (code_is_wincaps)
+    {
+      dbus_error_name = g_string_new (domain_str);
+      g_string_append_c (dbus_error_name, '.');
+      g_string_append (dbus_error_name, code_str);
+    }
   else
     {
       gchar *code_str_wincaps;
@@ -1545,7 +1693,8 @@ gerror_domaincode_to_dbus_error_name (const DBusGObjectInfo *object_info,
       g_free (code_str_wincaps);
     }
 
-  return g_string_free (dbus_error_name, FALSE);
+  *to_free = g_string_free (dbus_error_name, FALSE);
+  return *to_free;
 }
 
 static DBusMessage *
@@ -1676,12 +1825,15 @@ gerror_to_dbus_error_message (const DBusGObjectInfo *object_info,
         }
       else
 	{
-	  char *error_name;
+	  const char *error_name;
+	  char *to_free;
+
 	  error_name = gerror_domaincode_to_dbus_error_name (object_info,
 							     dbus_message_get_interface (message),
-							     error->domain, error->code);
+							     error->domain, error->code,
+							     &to_free);
           reply = error_or_die (message, error_name, error->message);
-          g_free (error_name);
+          g_free (to_free);
         }
     }
 
@@ -1713,8 +1865,393 @@ struct _DBusGMethodInvocation {
   const DBusGObjectInfo *object; /**< The object the method was called on */
   const DBusGMethodInfo *method; /**< The method called */
   gboolean send_reply;
+  gboolean threaded; /**< The method was called on a worker thread */
+  GType stats_type; /**< Type of the object, if collecting statistics */
+  gint64 stats_start_time; /**< When the call arrived, or 0 */
+  gint64 stats_demarshal_usec; /**< Time taken to demarshal arguments */
 };
 
+static void
+method_invocation_record_stats (DBusGMethodInvocation *context,
+                                gboolean               is_error,
+                                gint64                 marshal_usec)
+{
+  if (context->stats_start_time == 0)
+    return;
+
+  _dbus_g_method_stats_record (context->stats_type, context->method,
+      method_interface_from_object_info (context->object, context->method),
+      method_name_from_object_info (context->object, context->method),
+      is_error, g_get_monotonic_time () - context->stats_start_time,
+      context->stats_demarshal_usec, marshal_usec);
+}
+
+/* Methods with the org.freedesktop.DBus.GLib.Threaded annotation are
+ * handed off to this pool, rather than called from the main loop; the
+ * default is one thread per processor. */
+G_LOCK_DEFINE_STATIC (method_thread_pool);
+static GThreadPool *method_thread_pool = NULL;
+static gint max_method_threads = 0;
+static gboolean max_method_threads_set = FALSE;
+
+typedef struct {
+  const DBusGMethodInfo *method;
+  GValueArray *value_array;
+} ThreadedMethodCall;
+
+static void
+threaded_method_call_run (gpointer data,
+                          gpointer user_data)
+{
+  ThreadedMethodCall *call = data;
+  GClosure closure;
+
+  /* See invoke_object_method */
+  memset (&closure, 0, sizeof (closure));
+
+  call->method->marshaller (&closure, NULL,
+                            call->value_array->n_values,
+                            call->value_array->values,
+                            NULL, call->method->function);
+
+  g_value_array_free (call->value_array);
+  g_slice_free (ThreadedMethodCall, call);
+}
+
+/* Returns FALSE if threaded methods should be called in the main loop
+ * after all, in which case @value_array still belongs to the caller */
+static gboolean
+method_thread_pool_push (const DBusGMethodInfo *method,
+                         GValueArray           *value_array)
+{
+  ThreadedMethodCall *call;
+  GError *error = NULL;
+
+  G_LOCK (method_thread_pool);
+
+  if (!max_method_threads_set)
+    {
+      max_method_threads = g_get_num_processors ();
+      max_method_threads_set = TRUE;
+    }
+
+  if (max_method_threads == 0)
+    {
+      G_UNLOCK (method_thread_pool);
+      return FALSE;
+    }
+
+  if (method_thread_pool == NULL)
+    {
+      method_thread_pool = g_thread_pool_new (threaded_method_call_run, NULL,
+                                              max_method_threads, FALSE,
+                                              &error);
+
+      if (method_thread_pool == NULL)
+        {
+          g_warning ("Unable to create thread pool for D-Bus methods: %s",
+                     error->message);
+          g_error_free (error);
+          /* don't try again */
+          max_method_threads = 0;
+          G_UNLOCK (method_thread_pool);
+          return FALSE;
+        }
+    }
+
+  call = g_slice_new (ThreadedMethodCall);
+  call->method = method;
+  call->value_array = value_array;
+
+  /* this can only fail for exclusive pools */
+  g_thread_pool_push (method_thread_pool, call, NULL);
+
+  G_UNLOCK (method_thread_pool);
+  return TRUE;
+}
+
+/**
+ * dbus_glib_global_set_max_method_threads:
+ * @max_threads: the maximum number of threads, 0 to call threaded methods
+ *  from the main loop, or -1 for no limit
+ *
+ * Set the maximum number of threads used to call methods that have the
+ * <literal>org.freedesktop.DBus.GLib.Threaded</literal> annotation. Such
+ * methods are called with a #DBusGMethodInvocation, like methods with the
+ * <literal>org.freedesktop.DBus.GLib.Async</literal> annotation, but from
+ * a worker thread; they may call dbus_g_method_return() or
+ * dbus_g_method_return_error() from that thread, and the reply will be
+ * sent from the main context of the connection.
+ *
+ * By default, one thread per processor is used.
+ *
+ * Deprecated: New code should use GDBus instead. There is no direct
+ *  equivalent for this function.
+ */
+void
+dbus_glib_global_set_max_method_threads (gint max_threads)
+{
+  g_return_if_fail (max_threads >= -1);
+
+  G_LOCK (method_thread_pool);
+
+  max_method_threads = max_threads;
+  max_method_threads_set = TRUE;
+
+  if (method_thread_pool != NULL && max_threads != 0)
+    g_thread_pool_set_max_threads (method_thread_pool, max_threads, NULL);
+
+  G_UNLOCK (method_thread_pool);
+}
+
+/* Method priorities: once an object with a high-priority method has been
+ * registered on a connection, calls to other methods on that connection
+ * are not run as soon as libdbus dispatches them, but queued on the
+ * connection's lane, which runs them at a lower priority than the
+ * connection itself. High-priority calls that arrive behind them are then
+ * run as soon as they are read, instead of waiting for the queued calls. */
+#define METHOD_LANE_PRIORITY (G_PRIORITY_DEFAULT + 1)
+
+/* The lane goes back to the main loop after this many calls, even if
+ * nothing more urgent has been read, so other sources are not starved */
+#define METHOD_LANE_MAX_CALLS 16
+
+G_LOCK_DEFINE_STATIC (method_priorities);
+
+#define METHOD_PRIORITIES_QUARK (dbus_g_object_type_dbus_method_priorities_quark ())
+
+static GQuark
+dbus_g_object_type_dbus_method_priorities_quark (void)
+{
+  static GQuark quark;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("DBusGObjectTypeDBusMethodPrioritiesQuark");
+  return quark;
+}
+
+/* Takes a lock and builds a string, so this is only used when an object
+ * is registered, not for each call */
+static DBusGMethodPriority
+method_get_priority (GObject               *object,
+                     const DBusGObjectInfo *object_info,
+                     const DBusGMethodInfo *method)
+{
+  GType gtype;
+  gpointer found = NULL;
+  char *key = NULL;
+
+  /* Priorities set at runtime take precedence, and are inherited */
+  G_LOCK (method_priorities);
+
+  for (gtype = G_TYPE_FROM_INSTANCE (object);
+       gtype != 0 && found == NULL;
+       gtype = g_type_parent (gtype))
+    {
+      GHashTable *priorities = g_type_get_qdata (gtype, METHOD_PRIORITIES_QUARK);
+
+      if (priorities == NULL)
+        continue;
+
+      if (key == NULL)
+        key = g_strdup_printf ("%s.%s",
+            method_interface_from_object_info (object_info, method),
+            method_name_from_object_info (object_info, method));
+
+      found = g_hash_table_lookup (priorities, key);
+    }
+
+  G_UNLOCK (method_priorities);
+  g_free (key);
+
+  /* stored off by one, so that NULL means "not set" */
+  if (found != NULL)
+    return GPOINTER_TO_INT (found) - 1;
+
+  if (object_info->format_version >= 3 &&
+      strchr (method_invocation_type_from_object_info (object_info, method), 'H') != NULL)
+    return DBUS_G_METHOD_PRIORITY_HIGH;
+
+  return DBUS_G_METHOD_PRIORITY_NORMAL;
+}
+
+/* Priorities are looked up once, when the object is registered, so that
+ * routing a call only needs a lookup in the result. Returns NULL if
+ * there are no high-priority methods. */
+static GHashTable *
+object_get_high_priority_methods (GObject *object)
+{
+  GList *info_list, *info_list_walk;
+  GHashTable *ret = NULL;
+
+  info_list = lookup_object_info (object);
+
+  for (info_list_walk = info_list;
+       info_list_walk != NULL;
+       info_list_walk = g_list_next (info_list_walk))
+    {
+      const DBusGObjectInfo *info = info_list_walk->data;
+      int i;
+
+      for (i = 0; i < info->n_method_infos; i++)
+        {
+          const DBusGMethodInfo *method = &(info->method_infos[i]);
+
+          if (method_get_priority (object, info, method) !=
+              DBUS_G_METHOD_PRIORITY_HIGH)
+            continue;
+
+          if (ret == NULL)
+            ret = g_hash_table_new (NULL, NULL);
+
+          g_hash_table_add (ret, (gpointer) method);
+        }
+    }
+
+  g_list_free (info_list);
+  return ret;
+}
+
+/**
+ * DBusGMethodPriority:
+ * @DBUS_G_METHOD_PRIORITY_NORMAL: calls are run in the order they arrive
+ * @DBUS_G_METHOD_PRIORITY_HIGH: calls are run as soon as they are read,
+ *  ahead of any normal-priority calls still waiting
+ *
+ * The priority of an exported method, as set with
+ * dbus_g_object_type_set_method_priority() or with the
+ * <literal>org.freedesktop.DBus.GLib.Priority</literal> annotation
+ * (value <literal>high</literal> or <literal>normal</literal>) in the
+ * introspection XML given to dbus-binding-tool.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * dbus_g_object_type_set_method_priority:
+ * @object_type: #GType for the object
+ * @interface: the D-Bus interface of the method
+ * @method: the D-Bus name of the method
+ * @priority: the new priority
+ *
+ * Sets the priority of a method exported by @object_type and its
+ * subclasses, overriding any priority in its #DBusGObjectInfo. This
+ * must be called before objects of @object_type are registered with
+ * dbus_g_connection_register_g_object().
+ *
+ * Normally, method calls are run one at a time in the order they arrive,
+ * so a cheap call, such as a watchdog's ping, has to wait for any slow
+ * calls that arrived before it. Once an object with a
+ * %DBUS_G_METHOD_PRIORITY_HIGH method has been registered on a
+ * connection, calls on that connection to normal-priority methods,
+ * property accesses and introspection are queued, and run from an idle
+ * source at a lower #GSource priority than the connection itself;
+ * calls to high-priority methods are run as soon as they are
+ * dispatched. A high-priority call still waits for a normal-priority
+ * call that is already running, unless the latter uses the
+ * <literal>org.freedesktop.DBus.GLib.Threaded</literal> annotation.
+ * Connections without such objects are not affected.
+ *
+ * Deprecated: New code should use GDBus instead. There is no direct
+ *  equivalent for this function.
+ */
+void
+dbus_g_object_type_set_method_priority (GType                object_type,
+                                        const char          *interface,
+                                        const char          *method,
+                                        DBusGMethodPriority  priority)
+{
+  GHashTable *priorities;
+
+  g_return_if_fail (G_TYPE_IS_CLASSED (object_type));
+  g_return_if_fail (g_dbus_is_interface_name (interface));
+  g_return_if_fail (g_dbus_is_member_name (method));
+  g_return_if_fail (priority <= DBUS_G_METHOD_PRIORITY_HIGH);
+
+  G_LOCK (method_priorities);
+
+  priorities = g_type_get_qdata (object_type, METHOD_PRIORITIES_QUARK);
+
+  if (priorities == NULL)
+    {
+      /* never freed, like the type itself */
+      priorities = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, NULL);
+      g_type_set_qdata (object_type, METHOD_PRIORITIES_QUARK, priorities);
+    }
+
+  g_hash_table_insert (priorities,
+                       g_strdup_printf ("%s.%s", interface, method),
+                       GINT_TO_POINTER (priority + 1));
+
+  G_UNLOCK (method_priorities);
+}
+
+/**
+ * DBusGMethodDirectFunc:
+ * @object: the object the method was called on
+ * @message: the method call, whose signature has already been checked
+ * @reply: (out) (allow-none): used to return the reply, or %NULL if the
+ *  caller did not ask for one
+ * @error: used to return an error
+ *
+ * A method stub generated by
+ * <literal>dbus-binding-tool --mode=glib-server-direct</literal>. It
+ * reads the arguments from @message straight into C variables, calls the
+ * implementation, and appends its results to a new method return in
+ * @reply, without going through #GValue or a #GClosure marshaller.
+ * Only methods that are neither asynchronous nor threaded, have no
+ * <literal>org.freedesktop.DBus.GLib.ReturnVal</literal> annotation, and
+ * have only basic-typed arguments get such a stub.
+ *
+ * Returns: %FALSE if the implementation failed, in which case @error is
+ *  normally set
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+static DBusHandlerResult
+invoke_object_method_direct (GObject               *object,
+                             const DBusGObjectInfo *object_info,
+                             const DBusGMethodInfo *method,
+                             DBusConnection        *connection,
+                             DBusMessage           *message,
+                             gint64                 start_time)
+{
+  DBusGMethodDirectFunc func;
+  DBusMessage *reply = NULL;
+  GError *gerror = NULL;
+  gboolean send_reply;
+  gboolean had_error;
+
+  /* See invoke_object_method */
+  send_reply = !dbus_message_get_no_reply (message);
+
+  func = (DBusGMethodDirectFunc) method->function;
+  had_error = !func (object, message, send_reply ? &reply : NULL, &gerror);
+
+  if (had_error && send_reply)
+    reply = gerror_to_dbus_error_message (object_info, message, gerror);
+
+  /* Demarshalling and marshalling are part of the stub, so they are
+   * only counted in the total */
+  if (start_time != 0)
+    _dbus_g_method_stats_record (G_TYPE_FROM_INSTANCE (object), method,
+        method_interface_from_object_info (object_info, method),
+        method_name_from_object_info (object_info, method),
+        had_error, g_get_monotonic_time () - start_time, 0, 0);
+
+  if (reply != NULL)
+    {
+      connection_send_or_die (connection, reply);
+      dbus_message_unref (reply);
+    }
+
+  g_clear_error (&gerror);
+
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 static DBusHandlerResult
 invoke_object_method (GObject         *object,
 		      const DBusGObjectInfo *object_info,
@@ -1722,7 +2259,8 @@ invoke_object_method (GObject         *object,
 		      DBusConnection  *connection,
 		      DBusMessage     *message)
 {
-  gboolean had_error, is_async, send_reply;
+  gboolean had_error, is_async, is_threaded, send_reply;
+  const char *invocation_type;
   GError *gerror;
   GValueArray *value_array;
   GValue return_value = {0,};
@@ -1738,6 +2276,14 @@ invoke_object_method (GObject         *object,
   gboolean retval_is_synthetic;
   gboolean retval_is_constant;
   const char *arg_metadata;
+  gint64 start_time = 0;
+  gint64 demarshal_usec = 0;
+  gint64 marshal_start_time = 0;
+  DBusGArena arena;
+  gpointer arena_buffer[32];
+
+  if (_dbus_g_method_stats_enabled ())
+    start_time = g_get_monotonic_time ();
 
   gerror = NULL;
 
@@ -1745,7 +2291,13 @@ invoke_object_method (GObject         *object,
    * instead of being required to fill out all return values in the context of the function.
    * Some additional data is also exposed, such as the message sender.
    */
-  is_async = strcmp (string_table_lookup (get_method_data (object_info, method), 2), "A") == 0;
+  invocation_type = method_invocation_type_from_object_info (object_info, method);
+  is_threaded = invocation_type[0] == 'T';
+  is_async = is_threaded || invocation_type[0] == 'A';
+
+  if (invocation_type[0] == 'D' && object_info->format_version >= 4)
+    return invoke_object_method_direct (object, object_info, method,
+                                        connection, message, start_time);
   
   /* Messages can be sent with a flag that says "I don't need a reply".  This is an optimization
    * normally, but in the context of the system bus it's important to not send a reply
@@ -1780,25 +2332,45 @@ invoke_object_method (GObject         *object,
     context.recursion_depth = 0;
     context.gconnection = DBUS_G_CONNECTION_FROM_CONNECTION (connection);
     context.proxy = NULL;
+    context.message = message;
 
-    types_array = _dbus_gtypes_from_arg_signature (in_signature, FALSE);
+    types_array = _dbus_gtypes_from_arg_signature_cached (in_signature, FALSE);
     n_params = types_array->len;
     types = (const GType*) types_array->data;
 
-    value_array = _dbus_gvalue_demarshal_message (&context, message, n_params, types, &error);
+    /* The method doesn't own its arguments and they're freed as soon as
+     * it returns, so strings can be borrowed from the message rather than
+     * copied. Threaded methods outlive this function, so they get copies. */
+    _dbus_g_arena_init (&arena, arena_buffer, sizeof (arena_buffer));
+
+    value_array = _dbus_gvalue_demarshal_message (&context, message, n_params, types,
+                                                  is_threaded ? NULL : &arena,
+                                                  &error);
     if (value_array == NULL)
       {
 	g_free (in_signature); 
-	g_array_free (types_array, TRUE);
+	g_array_unref (types_array);
+	_dbus_g_arena_clear (&arena);
         reply = gerror_to_dbus_error_message (object_info, message, error);
         connection_send_or_die (connection, reply);
 	dbus_message_unref (reply);
 	g_error_free (error);
+
+        if (start_time != 0)
+          _dbus_g_method_stats_record (G_TYPE_FROM_INSTANCE (object), method,
+              method_interface_from_object_info (object_info, method),
+              method_name_from_object_info (object_info, method),
+              TRUE, g_get_monotonic_time () - start_time,
+              g_get_monotonic_time () - start_time, 0);
+
 	return DBUS_HANDLER_RESULT_HANDLED;
       }
-    g_array_free (types_array, TRUE);
+    g_array_unref (types_array);
   }
 
+  if (start_time != 0)
+    demarshal_usec = g_get_monotonic_time () - start_time;
+
   /* Prepend object as first argument */ 
   g_value_array_prepend (value_array, NULL);
   g_value_init (g_value_array_get_nth (value_array, 0), G_TYPE_OBJECT);
@@ -1814,6 +2386,10 @@ invoke_object_method (GObject         *object,
       context->object = object_info;
       context->method = method;
       context->send_reply = send_reply;
+      context->threaded = FALSE;
+      context->stats_type = G_TYPE_FROM_INSTANCE (object);
+      context->stats_start_time = start_time;
+      context->stats_demarshal_usec = demarshal_usec;
       g_value_init (&context_value, G_TYPE_POINTER);
       g_value_set_pointer (&context_value, context);
       g_value_array_append (value_array, &context_value);
@@ -1946,16 +2522,37 @@ invoke_object_method (GObject         *object,
       g_value_set_pointer (g_value_array_get_nth (value_array, value_array->n_values - 1), &gerror);
     }
   
-  /* Actually invoke method */
-  method->marshaller (&closure, have_retval ? &return_value : NULL,
-		      value_array->n_values,
-		      value_array->values,
-		      NULL, method->function);
+  if (is_threaded)
+    {
+      DBusGMethodInvocation *context;
+
+      context = g_value_get_pointer (g_value_array_get_nth (value_array,
+            value_array->n_values - 1));
+      context->threaded = TRUE;
+
+      if (method_thread_pool_push (method, value_array))
+        {
+          /* the worker thread frees it */
+          value_array = NULL;
+          goto done;
+        }
+
+      context->threaded = FALSE;
+    }
+
+  /* Actually invoke method */
+  method->marshaller (&closure, have_retval ? &return_value : NULL,
+		      value_array->n_values,
+		      value_array->values,
+		      NULL, method->function);
   if (is_async)
     {
       goto done;
     }
 
+  if (start_time != 0)
+    marshal_start_time = g_get_monotonic_time ();
+
   if (retval_signals_error)
     had_error = _dbus_gvalue_signals_error (&return_value);
   else
@@ -2072,6 +2669,13 @@ invoke_object_method (GObject         *object,
   else if (send_reply)
     reply = gerror_to_dbus_error_message (object_info, message, gerror);
 
+  if (start_time != 0)
+    _dbus_g_method_stats_record (G_TYPE_FROM_INSTANCE (object), method,
+        method_interface_from_object_info (object_info, method),
+        method_name_from_object_info (object_info, method),
+        had_error, g_get_monotonic_time () - start_time, demarshal_usec,
+        g_get_monotonic_time () - marshal_start_time);
+
   if (reply)
     {
       connection_send_or_die (connection, reply);
@@ -2090,7 +2694,10 @@ done:
   if (gerror != NULL)
     g_clear_error (&gerror);
 
-  g_value_array_free (value_array);
+  if (value_array != NULL)
+    g_value_array_free (value_array);
+  _dbus_g_arena_clear (&arena);
+
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
@@ -2176,9 +2783,9 @@ error:
 }
 
 static DBusHandlerResult
-object_registration_message (DBusConnection  *connection,
-                             DBusMessage     *message,
-                             void            *user_data)
+object_registration_handle_message (DBusConnection  *connection,
+                                    DBusMessage     *message,
+                                    void            *user_data)
 {
   GParamSpec *pspec;
   GObject *object;
@@ -2330,6 +2937,269 @@ out:
   return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+typedef struct {
+  /* borrowed, or NULL if it has been unregistered since */
+  ObjectRegistration *registration;
+  /* owned */
+  DBusMessage *message;
+} MethodLaneCall;
+
+/* Per-connection queue of normal-priority calls, only touched with the
+ * method_lanes lock held. It exists from when the first object with a
+ * high-priority method is registered on the connection until the
+ * connection is freed. */
+typedef struct {
+  /* owned MethodLaneCall, oldest first */
+  GQueue calls;
+  /* runs them, or NULL if none are queued */
+  GSource *source;
+} MethodLane;
+
+G_LOCK_DEFINE_STATIC (method_lanes);
+static dbus_int32_t method_lane_slot = -1;
+
+static void
+method_lane_call_free (MethodLaneCall *call)
+{
+  dbus_message_unref (call->message);
+  g_slice_free (MethodLaneCall, call);
+}
+
+static void
+method_lane_free (gpointer data)
+{
+  MethodLane *lane = data;
+
+  /* Normally the source holds a reference to the connection, but it
+   * might have been destroyed along with its main context */
+  if (lane->source != NULL)
+    {
+      g_source_destroy (lane->source);
+      g_source_unref (lane->source);
+    }
+
+  g_queue_foreach (&lane->calls, (GFunc) method_lane_call_free, NULL);
+  g_queue_clear (&lane->calls);
+  g_slice_free (MethodLane, lane);
+}
+
+static gpointer
+method_lane_new (void)
+{
+  MethodLane *lane;
+
+  lane = g_slice_new0 (MethodLane);
+  g_queue_init (&lane->calls);
+  return lane;
+}
+
+/* Must be called with the method_lanes lock held */
+static MethodLane *
+method_lane_get (DBusConnection *connection,
+                 gboolean        create)
+{
+  return _dbus_gutils_connection_get_data (connection, &method_lane_slot,
+                                           create ? method_lane_new : NULL,
+                                           method_lane_free);
+}
+
+static void
+method_lane_run_call (DBusConnection *connection,
+                      MethodLaneCall *call)
+{
+  DBusHandlerResult result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  DBusMessage *reply;
+
+  if (call->registration != NULL)
+    result = object_registration_handle_message (connection, call->message,
+                                                 call->registration);
+
+  if (result != DBUS_HANDLER_RESULT_NOT_YET_HANDLED ||
+      dbus_message_get_no_reply (call->message))
+    return;
+
+  /* libdbus would have replied to this if we had not taken it */
+  if (call->registration == NULL)
+    {
+      reply = error_or_die (call->message, DBUS_ERROR_UNKNOWN_OBJECT,
+                            "No such object path");
+    }
+  else
+    {
+      char *error_message;
+
+      error_message = g_strdup_printf (
+          "Method \"%s\" with signature \"%s\" on interface \"%s\" doesn't exist\n",
+          dbus_message_get_member (call->message),
+          dbus_message_get_signature (call->message),
+          dbus_message_get_interface (call->message) ?
+            dbus_message_get_interface (call->message) : "(null)");
+      reply = error_or_die (call->message, DBUS_ERROR_UNKNOWN_METHOD,
+                            error_message);
+      g_free (error_message);
+    }
+
+  connection_send_or_die (connection, reply);
+  dbus_message_unref (reply);
+}
+
+static gboolean
+method_lane_dispatch (gpointer data)
+{
+  DBusConnection *connection = data;
+  guint n;
+
+  for (n = 0; n < METHOD_LANE_MAX_CALLS; n++)
+    {
+      MethodLane *lane;
+      MethodLaneCall *call = NULL;
+
+      G_LOCK (method_lanes);
+      lane = method_lane_get (connection, FALSE);
+
+      if (lane != NULL)
+        {
+          call = g_queue_pop_head (&lane->calls);
+
+          if (call == NULL && lane->source == g_main_current_source ())
+            {
+              g_source_unref (lane->source);
+              lane->source = NULL;
+            }
+        }
+
+      G_UNLOCK (method_lanes);
+
+      if (call == NULL)
+        return FALSE;
+
+      method_lane_run_call (connection, call);
+      method_lane_call_free (call);
+
+      /* If the main loop's watch has read something in the meantime, go
+       * back to it so that the connection can dispatch it: it might be
+       * a high-priority call */
+      if (dbus_connection_get_dispatch_status (connection) ==
+          DBUS_DISPATCH_DATA_REMAINS)
+        break;
+    }
+
+  return TRUE;
+}
+
+/* Start queueing normal-priority calls on @connection */
+static void
+method_lanes_enable (DBusConnection *connection)
+{
+  G_LOCK (method_lanes);
+  method_lane_get (connection, TRUE);
+  G_UNLOCK (method_lanes);
+}
+
+static gboolean
+method_lanes_enabled (DBusConnection *connection)
+{
+  /* The lane is only freed with the connection, so no lock is needed to
+   * find out whether it exists */
+  return (method_lane_slot >= 0 &&
+          dbus_connection_get_data (connection, method_lane_slot) != NULL);
+}
+
+static void
+method_lane_push (DBusConnection     *connection,
+                  ObjectRegistration *registration,
+                  DBusMessage        *message)
+{
+  MethodLane *lane;
+  MethodLaneCall *call;
+
+  call = g_slice_new (MethodLaneCall);
+  call->registration = registration;
+  call->message = dbus_message_ref (message);
+
+  G_LOCK (method_lanes);
+  lane = method_lane_get (connection, TRUE);
+  g_queue_push_tail (&lane->calls, call);
+
+  if (lane->source == NULL)
+    {
+      lane->source = g_idle_source_new ();
+      g_source_set_priority (lane->source, METHOD_LANE_PRIORITY);
+      g_source_set_callback (lane->source, method_lane_dispatch,
+                             dbus_connection_ref (connection),
+                             (GDestroyNotify) dbus_connection_unref);
+      g_source_attach (lane->source,
+                       _dbus_g_get_connection_context (connection));
+    }
+
+  G_UNLOCK (method_lanes);
+}
+
+/* Called when @registration is about to be freed */
+static void
+method_lanes_forget_registration (ObjectRegistration *registration)
+{
+  MethodLane *lane;
+  GList *iter;
+
+  if (method_lane_slot < 0)
+    return;
+
+  G_LOCK (method_lanes);
+  lane = method_lane_get (
+      DBUS_CONNECTION_FROM_G_CONNECTION (registration->connection), FALSE);
+
+  if (lane != NULL)
+    {
+      for (iter = lane->calls.head; iter != NULL; iter = iter->next)
+        {
+          MethodLaneCall *call = iter->data;
+
+          if (call->registration == registration)
+            call->registration = NULL;
+        }
+    }
+
+  G_UNLOCK (method_lanes);
+}
+
+static DBusHandlerResult
+object_registration_message (DBusConnection  *connection,
+                             DBusMessage     *message,
+                             void            *user_data)
+{
+  ObjectRegistration *o = user_data;
+  const DBusGMethodInfo *method;
+  const DBusGObjectInfo *object_info;
+  GObject *object;
+
+  if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL ||
+      !method_lanes_enabled (connection))
+    return object_registration_handle_message (connection, message, o);
+
+  object = G_OBJECT (o->export->object);
+  g_assert (object != NULL);
+
+  if (lookup_object_and_method (object, message, &object_info, &method))
+    {
+      if (o->high_priority_methods != NULL &&
+          g_hash_table_contains (o->high_priority_methods, method))
+        return invoke_object_method (object, object_info, method, connection, message);
+    }
+  else if (!dbus_message_is_method_call (message, DBUS_INTERFACE_INTROSPECTABLE, "Introspect") &&
+           !dbus_message_is_method_call (message, DBUS_INTERFACE_PROPERTIES, "Get") &&
+           !dbus_message_is_method_call (message, DBUS_INTERFACE_PROPERTIES, "Set") &&
+           !dbus_message_is_method_call (message, DBUS_INTERFACE_PROPERTIES, "GetAll"))
+    {
+      /* Not one of ours: leave it to libdbus or a fallback handler,
+       * straight away */
+      return object_registration_handle_message (connection, message, o);
+    }
+
+  method_lane_push (connection, o, message);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 static const DBusObjectPathVTable gobject_dbus_vtable = {
   object_registration_unregistered,
   object_registration_message,
@@ -2342,12 +3212,14 @@ typedef struct {
   GObject         *object;
   const char      *signame;
   const char      *sigiface;
+  gboolean         lossy;
 } DBusGSignalClosure;
 
 static GClosure *
 dbus_g_signal_closure_new (GObject         *object,
 			   const char      *signame,
-			   const char      *sigiface)
+			   const char      *sigiface,
+			   gboolean         lossy)
 {
   DBusGSignalClosure *closure;
   
@@ -2356,13 +3228,15 @@ dbus_g_signal_closure_new (GObject         *object,
   closure->object = object;
   closure->signame = signame;
   closure->sigiface = sigiface;
+  closure->lossy = lossy;
   return (GClosure*) closure;
 }
 
 static void
 emit_signal_for_registration (ObjectRegistration *o,
-                              DBusGSignalClosure *sigclosure,
-                              GValue             *retval,
+                              const char         *sigiface,
+                              const char         *signame,
+                              gboolean            lossy,
                               guint               n_param_values,
                               const GValue       *param_values)
 {
@@ -2371,12 +3245,12 @@ emit_signal_for_registration (ObjectRegistration *o,
   guint i;
 
   g_assert (g_variant_is_object_path (o->object_path));
-  g_assert (g_dbus_is_interface_name (sigclosure->sigiface));
-  g_assert (g_dbus_is_member_name (sigclosure->signame));
+  g_assert (g_dbus_is_interface_name (sigiface));
+  g_assert (g_dbus_is_member_name (signame));
 
   signal = dbus_message_new_signal (o->object_path,
-                                    sigclosure->sigiface,
-                                    sigclosure->signame);
+                                    sigiface,
+                                    signame);
   if (!signal)
     oom (NULL);
 
@@ -2389,17 +3263,37 @@ emit_signal_for_registration (ObjectRegistration *o,
                                 (GValue *) (&(param_values[i]))))
         {
           g_warning ("failed to marshal parameter %d for signal %s",
-                     i, sigclosure->signame);
+                     i, signame);
           goto out;
         }
     }
 
-  connection_send_or_die (DBUS_CONNECTION_FROM_G_CONNECTION (o->connection),
-      signal);
+  if (!_dbus_g_connection_send_signal (
+          DBUS_CONNECTION_FROM_G_CONNECTION (o->connection), signal, lossy))
+    oom ("dbus_connection_send failed: out of memory?");
 out:
   dbus_message_unref (signal);
 }
 
+static void
+emit_signal_for_export (const ObjectExport *oe,
+                        const char         *sigiface,
+                        const char         *signame,
+                        gboolean            lossy,
+                        guint               n_param_values,
+                        const GValue       *param_values)
+{
+  const GSList *iter;
+
+  for (iter = oe->registrations; iter; iter = iter->next)
+    {
+      ObjectRegistration *o = iter->data;
+
+      emit_signal_for_registration (o, sigiface, signame, lossy,
+                                    n_param_values, param_values);
+    }
+}
+
 static void
 signal_emitter_marshaller (GClosure        *closure,
 			   GValue          *retval,
@@ -2410,23 +3304,97 @@ signal_emitter_marshaller (GClosure        *closure,
 {
   DBusGSignalClosure *sigclosure;
   const ObjectExport *oe;
-  const GSList *iter;
 
   sigclosure = (DBusGSignalClosure *) closure;
 
   g_assert (retval == NULL);
 
-  oe = g_object_get_data (sigclosure->object, "dbus_glib_object_registrations");
+  oe = g_object_get_qdata (sigclosure->object, OBJECT_EXPORT_QUARK);
   /* If the object has ever been exported, this should exist; it persists until
    * the object is actually freed. */
   g_assert (oe != NULL);
 
-  for (iter = oe->registrations; iter; iter = iter->next)
-    {
-      ObjectRegistration *o = iter->data;
+  emit_signal_for_export (oe, sigclosure->sigiface, sigclosure->signame,
+                          sigclosure->lossy, n_param_values, param_values);
+}
+
+/* Per-class signal export: instead of connecting one closure per signal
+ * per instance, one emission hook per signal is added the first time an
+ * instance of a given concrete type is exported. The hook sees every
+ * emission of that signal, so it has to filter out instances of other
+ * types, and instances that have never been exported. */
+typedef struct {
+  GType       gtype;
+  const char *signame;
+  const char *sigiface;
+  gboolean    lossy;
+} DBusGSignalHook;
+
+G_LOCK_DEFINE_STATIC (signal_hooks);
+
+#define EMISSION_HOOKS_QUARK (dbus_g_object_type_dbus_emission_hooks_quark ())
+
+static GQuark
+dbus_g_object_type_dbus_emission_hooks_quark (void)
+{
+  static GQuark quark;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("DBusGObjectTypeDBusEmissionHooksQuark");
+  return quark;
+}
+
+#define SIGNAL_HOOKS_INSTALLED_QUARK (dbus_g_object_type_dbus_signal_hooks_installed_quark ())
+
+static GQuark
+dbus_g_object_type_dbus_signal_hooks_installed_quark (void)
+{
+  static GQuark quark;
+
+  if (!quark)
+    quark = g_quark_from_static_string ("DBusGObjectTypeDBusSignalHooksInstalledQuark");
+  return quark;
+}
 
-      emit_signal_for_registration (o, sigclosure, retval, n_param_values, param_values);
+static gboolean
+type_uses_emission_hooks (GType gtype)
+{
+  for (; gtype != 0; gtype = g_type_parent (gtype))
+    {
+      if (g_type_get_qdata (gtype, EMISSION_HOOKS_QUARK) != NULL)
+        return TRUE;
     }
+
+  return FALSE;
+}
+
+static gboolean
+signal_emission_hook (GSignalInvocationHint *ihint,
+                      guint                  n_param_values,
+                      const GValue          *param_values,
+                      gpointer               user_data)
+{
+  const DBusGSignalHook *hook = user_data;
+  const ObjectExport *oe;
+  GObject *object;
+
+  g_assert (n_param_values > 0);
+
+  object = g_value_get_object (&param_values[0]);
+
+  /* Subclasses get hooks of their own, because they might export more
+   * signals than we know about */
+  if (object == NULL || G_TYPE_FROM_INSTANCE (object) != hook->gtype)
+    return TRUE;
+
+  oe = g_object_get_qdata (object, OBJECT_EXPORT_QUARK);
+
+  if (oe != NULL)
+    emit_signal_for_export (oe, hook->sigiface, hook->signame,
+                            hook->lossy, n_param_values, param_values);
+
+  /* keep the hook */
+  return TRUE;
 }
 
 static void
@@ -2437,8 +3405,26 @@ export_signals (const GList *info_list, GObject *object)
   const char *iface;
   const char *signame;
   const DBusGObjectInfo *info;
+  gboolean use_hooks;
+  gboolean lossy;
 
   gtype = G_TYPE_FROM_INSTANCE (object);
+  use_hooks = type_uses_emission_hooks (gtype);
+
+  if (use_hooks)
+    {
+      G_LOCK (signal_hooks);
+
+      if (g_type_get_qdata (gtype, SIGNAL_HOOKS_INSTALLED_QUARK) != NULL)
+        {
+          /* Another instance of this class already did all the work */
+          G_UNLOCK (signal_hooks);
+          return;
+        }
+
+      g_type_set_qdata (gtype, SIGNAL_HOOKS_INSTALLED_QUARK,
+                        GINT_TO_POINTER (TRUE));
+    }
 
   for (; info_list != NULL; info_list = g_list_next (info_list))
     {
@@ -2453,7 +3439,8 @@ export_signals (const GList *info_list, GObject *object)
           GClosure *closure;
           char *s;
 
-          sigdata = signal_iterate (sigdata, &iface, &signame);
+          sigdata = signal_iterate (sigdata, info->format_version,
+                                    &iface, &signame, &lossy);
 
           if (!g_dbus_is_interface_name (iface))
             {
@@ -2489,8 +3476,33 @@ export_signals (const GList *info_list, GObject *object)
               g_free (s);
               continue; /* FIXME: these could be listed as methods ? */
             }
-          
-          closure = dbus_g_signal_closure_new (object, signame, (char*) iface);
+
+          if (use_hooks)
+            {
+              DBusGSignalHook *hook;
+
+              if (query.signal_flags & G_SIGNAL_NO_HOOKS)
+                {
+                  g_warning ("Not exporting signal \"%s\" for object class \"%s\" as it does not allow emission hooks",
+                         s, g_type_name (gtype));
+                  g_free (s);
+                  continue;
+                }
+
+              /* never freed, like the type itself */
+              hook = g_new0 (DBusGSignalHook, 1);
+              hook->gtype = gtype;
+              hook->signame = signame;
+              hook->sigiface = iface;
+              hook->lossy = lossy;
+
+              g_signal_add_emission_hook (id, 0, signal_emission_hook,
+                                          hook, NULL);
+              g_free (s);
+              continue;
+            }
+
+          closure = dbus_g_signal_closure_new (object, signame, (char*) iface, lossy);
           g_closure_set_marshal (closure, signal_emitter_marshaller);
 
           g_signal_connect_closure_by_id (object,
@@ -2502,6 +3514,9 @@ export_signals (const GList *info_list, GObject *object)
           g_free (s);
         }
     }
+
+  if (use_hooks)
+    G_UNLOCK (signal_hooks);
 }
 
 static gint
@@ -2627,15 +3642,55 @@ dbus_set_g_error (GError    **gerror,
 		 derror->name);
 }
 
-static void
-dbus_g_error_info_free (gpointer p)
+static DBusGErrorInfo *
+dbus_g_error_info_new (const char *default_iface,
+                       GType       code_enum)
 {
   DBusGErrorInfo *info;
+  GEnumClass *klass;
+  guint i;
+
+  info = g_new0 (DBusGErrorInfo, 1);
+  info->default_iface = g_strdup (default_iface);
+  info->code_enum = code_enum;
+  info->names = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  klass = g_type_class_ref (code_enum);
+
+  for (i = 0; i < klass->n_values; i++)
+    {
+      const GEnumValue *value = &klass->values[i];
+      char *wincaps;
+
+      /* the first nick wins if values are aliased, as with
+       * g_enum_get_value() */
+      if (g_hash_table_lookup (info->names, GINT_TO_POINTER (value->value)))
+        continue;
+
+      /* We can't uppercase here for backwards compatibility reasons:
+       * see gerror_domaincode_to_dbus_error_name() */
+      wincaps = uscore_to_wincaps_full (value->value_nick, FALSE, FALSE);
 
-  info = p;
+      if (default_iface != NULL)
+        {
+          char *name = g_strconcat (default_iface, ".", wincaps, NULL);
+
+          g_hash_table_insert (info->names, GINT_TO_POINTER (value->value),
+                               (gpointer) g_intern_string (name));
+          g_free (name);
+        }
+      else
+        {
+          g_hash_table_insert (info->names, GINT_TO_POINTER (value->value),
+                               (gpointer) g_intern_string (wincaps));
+        }
+
+      g_free (wincaps);
+    }
+
+  g_type_class_unref (klass);
 
-  g_free (info->default_iface);
-  g_free (info);
+  return info;
 }
 
 /**
@@ -2706,6 +3761,34 @@ dbus_g_object_type_install_info (GType                  object_type,
 		    (gpointer) info);
 }
 
+/**
+ * dbus_g_object_type_use_emission_hooks:
+ * @object_type: #GType for the object
+ *
+ * Export the D-Bus signals of instances of @object_type, and of its
+ * subclasses, using one signal emission hook per signal per class, rather
+ * than connecting a closure to each signal of each instance when it is
+ * first registered with dbus_g_connection_register_g_object(). This makes
+ * exporting an object cost a constant amount of memory, however many
+ * signals it has, which is worthwhile for classes with a large number of
+ * exported instances.
+ *
+ * Like dbus_g_object_type_install_info(), this should be called in the
+ * class_init() for the object class, before any instance is registered.
+ * Signals flagged with %G_SIGNAL_NO_HOOKS cannot be exported in this mode.
+ *
+ * Deprecated: New code should use GDBus instead. There is no direct
+ *  equivalent for this function.
+ */
+void
+dbus_g_object_type_use_emission_hooks (GType object_type)
+{
+  g_return_if_fail (G_TYPE_IS_CLASSED (object_type));
+
+  g_type_set_qdata (object_type, EMISSION_HOOKS_QUARK,
+                    GINT_TO_POINTER (TRUE));
+}
+
 /**
  * dbus_g_error_domain_register:
  * @domain: the #GError domain
@@ -2752,10 +3835,10 @@ dbus_g_error_domain_register (GQuark                domain,
 
   g_static_rw_lock_writer_lock (&globals_lock);
 
-  if (error_metadata == NULL)
-    g_datalist_init (&error_metadata);
-
-  info = g_datalist_id_get_data (&error_metadata, domain);
+  if (error_metadata != NULL)
+    info = g_hash_table_lookup (error_metadata, GUINT_TO_POINTER (domain));
+  else
+    info = NULL;
 
   if (info != NULL)
     {
@@ -2764,23 +3847,38 @@ dbus_g_error_domain_register (GQuark                domain,
     }
   else
     {
-      info = g_new0 (DBusGErrorInfo, 1);
-      info->default_iface = g_strdup (default_iface);
-      info->code_enum = code_enum;
+      GHashTable *metadata;
 
-      g_datalist_id_set_data_full (&error_metadata,
-				   domain,
-				   info,
-				   dbus_g_error_info_free);
-    }
+      info = dbus_g_error_info_new (default_iface, code_enum);
 
-  g_static_rw_lock_writer_unlock (&globals_lock);
-}
+      metadata = g_hash_table_new (g_direct_hash, g_direct_equal);
 
-/* Called when the object is destroyed */
-static void
-object_export_object_died (gpointer user_data, GObject *dead)
-{
+      if (error_metadata != NULL)
+        {
+          GHashTableIter iter;
+          gpointer k, v;
+
+          g_hash_table_iter_init (&iter, error_metadata);
+
+          while (g_hash_table_iter_next (&iter, &k, &v))
+            g_hash_table_insert (metadata, k, v);
+        }
+
+      g_hash_table_insert (metadata, GUINT_TO_POINTER (domain), info);
+
+      /* Other threads might still be reading the old table, so it is
+       * never freed; there is one per registered error domain, and the
+       * DBusGErrorInfo structs are shared between them. */
+      g_atomic_pointer_set (&error_metadata, metadata);
+    }
+
+  g_static_rw_lock_writer_unlock (&globals_lock);
+}
+
+/* Called when the object is destroyed */
+static void
+object_export_object_died (gpointer user_data, GObject *dead)
+{
   ObjectExport *oe = user_data;
 
   g_assert (dead == oe->object);
@@ -2820,7 +3918,7 @@ dbus_g_connection_unregister_g_object (DBusGConnection *connection,
   g_return_if_fail (connection != NULL);
   g_return_if_fail (G_IS_OBJECT (object));
 
-  oe = g_object_get_data (object, "dbus_glib_object_registrations");
+  oe = g_object_get_qdata (object, OBJECT_EXPORT_QUARK);
 
   g_return_if_fail (oe != NULL);
   g_return_if_fail (oe->registrations != NULL);
@@ -2879,7 +3977,7 @@ dbus_g_connection_register_g_object (DBusGConnection       *connection,
   g_return_if_fail (g_variant_is_object_path (at_path));
   g_return_if_fail (G_IS_OBJECT (object));
 
-  oe = g_object_get_data (object, "dbus_glib_object_registrations");
+  oe = g_object_get_qdata (object, OBJECT_EXPORT_QUARK);
 
   if (oe == NULL)
     {
@@ -2892,15 +3990,16 @@ dbus_g_connection_register_g_object (DBusGConnection       *connection,
           return;
         }
 
-      /* This adds a hook into every signal for the object.  Only do this
-       * on the first registration, because inside the signal marshaller
-       * we emit a signal for each registration.
+      /* This adds a hook into every signal for the object (or, for
+       * classes using emission hooks, for the first object of its class).
+       * Only do this on the first registration, because inside the signal
+       * marshaller we emit a signal for each registration.
        */
       export_signals (info_list, object);
       g_list_free (info_list);
 
       oe = object_export_new ();
-      g_object_set_data_full (object, "dbus_glib_object_registrations", oe,
+      g_object_set_qdata_full (object, OBJECT_EXPORT_QUARK, oe,
           (GDestroyNotify) object_export_free);
     }
 
@@ -2923,6 +4022,7 @@ dbus_g_connection_register_g_object (DBusGConnection       *connection,
     }
 
   o = object_registration_new (connection, at_path, oe);
+  o->high_priority_methods = object_get_high_priority_methods (object);
 
   dbus_error_init (&error);
   if (!dbus_connection_try_register_object_path (DBUS_CONNECTION_FROM_G_CONNECTION (connection),
@@ -2939,6 +4039,9 @@ dbus_g_connection_register_g_object (DBusGConnection       *connection,
     }
 
   oe->registrations = g_slist_append (oe->registrations, o);
+
+  if (o->high_priority_methods != NULL)
+    method_lanes_enable (DBUS_CONNECTION_FROM_G_CONNECTION (connection));
 }
 
 /**
@@ -3073,6 +4176,75 @@ dbus_g_method_get_reply (DBusGMethodInvocation *context)
   return reply_or_die (dbus_g_message_get_message (context->message));
 }
 
+typedef struct {
+  DBusConnection *connection;
+  DBusMessage *reply;
+} PendingReply;
+
+static gboolean
+pending_reply_send (gpointer data)
+{
+  PendingReply *pending = data;
+
+  connection_send_or_die (pending->connection, pending->reply);
+  return FALSE;
+}
+
+static void
+pending_reply_free (gpointer data)
+{
+  PendingReply *pending = data;
+
+  dbus_message_unref (pending->reply);
+  dbus_connection_unref (pending->connection);
+  g_slice_free (PendingReply, pending);
+}
+
+/* Send @reply (without stealing the reference), bouncing it back to
+ * the connection's main context if the method is running in a worker
+ * thread */
+static void
+method_invocation_send (DBusGMethodInvocation *context,
+                        DBusMessage           *reply)
+{
+  DBusConnection *connection;
+  GMainContext *main_context;
+  PendingReply *pending;
+  GSource *source;
+
+  connection = dbus_g_connection_get_connection (context->connection);
+
+  if (context->threaded)
+    main_context = _dbus_g_get_connection_context (connection);
+  else
+    main_context = NULL;
+
+  if (main_context == NULL || g_main_context_is_owner (main_context))
+    {
+      connection_send_or_die (connection, reply);
+      return;
+    }
+
+  pending = g_slice_new (PendingReply);
+  pending->connection = dbus_connection_ref (connection);
+  pending->reply = dbus_message_ref (reply);
+
+  source = g_idle_source_new ();
+  g_source_set_priority (source, G_PRIORITY_DEFAULT);
+  g_source_set_callback (source, pending_reply_send, pending,
+                         pending_reply_free);
+  g_source_attach (source, main_context);
+  g_source_unref (source);
+}
+
+static void
+method_invocation_free (DBusGMethodInvocation *context)
+{
+  dbus_g_connection_unref (context->connection);
+  dbus_g_message_unref (context->message);
+  g_free (context);
+}
+
 /**
  * dbus_g_method_send_reply:
  * @context: the method context
@@ -3092,13 +4264,13 @@ dbus_g_method_send_reply (DBusGMethodInvocation *context, DBusMessage *reply)
   g_return_if_fail (context != NULL);
   g_return_if_fail (reply != NULL);
 
-  connection_send_or_die (dbus_g_connection_get_connection (context->connection),
-      reply);
+  method_invocation_record_stats (context,
+      dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR, 0);
+
+  method_invocation_send (context, reply);
   dbus_message_unref (reply);
 
-  dbus_g_connection_unref (context->connection);
-  dbus_g_message_unref (context->message);
-  g_free (context);
+  method_invocation_free (context);
 }
 
 
@@ -3123,9 +4295,13 @@ dbus_g_method_return (DBusGMethodInvocation *context, ...)
   char *out_sig;
   GArray *argsig;
   guint i;
+  gint64 marshal_start_time = 0;
 
   g_return_if_fail (context != NULL);
 
+  if (context->stats_start_time != 0)
+    marshal_start_time = g_get_monotonic_time ();
+
   /* This field was initialized inside invoke_object_method; we
    * carry it over through the async invocation to here.
    */
@@ -3134,7 +4310,7 @@ dbus_g_method_return (DBusGMethodInvocation *context, ...)
 
   reply = dbus_g_method_get_reply (context);
   out_sig = method_output_signature_from_object_info (context->object, context->method);
-  argsig = _dbus_gtypes_from_arg_signature (out_sig, FALSE);
+  argsig = _dbus_gtypes_from_arg_signature_cached (out_sig, FALSE);
 
   dbus_message_iter_init_append (reply, &iter);
 
@@ -3161,17 +4337,18 @@ dbus_g_method_return (DBusGMethodInvocation *context, ...)
     }
   va_end (args);
 
-  connection_send_or_die (dbus_g_connection_get_connection (context->connection),
-      reply);
+  method_invocation_send (context, reply);
   dbus_message_unref (reply);
 
   g_free (out_sig);
-  g_array_free (argsig, TRUE);
+  g_array_unref (argsig);
 
 out:
-  dbus_g_connection_unref (context->connection);
-  dbus_g_message_unref (context->message);
-  g_free (context);
+  if (marshal_start_time != 0)
+    method_invocation_record_stats (context, FALSE,
+        g_get_monotonic_time () - marshal_start_time);
+
+  method_invocation_free (context);
 }
 
 /**
@@ -3198,14 +4375,569 @@ dbus_g_method_return_error (DBusGMethodInvocation *context, const GError *error)
     goto out;
 
   reply = gerror_to_dbus_error_message (context->object, dbus_g_message_get_message (context->message), error);
-  connection_send_or_die (
-      dbus_g_connection_get_connection (context->connection), reply);
+  method_invocation_send (context, reply);
   dbus_message_unref (reply);
 
 out:
-  dbus_g_connection_unref (context->connection);
-  dbus_g_message_unref (context->message);
-  g_free (context);
+  method_invocation_record_stats (context, TRUE, 0);
+  method_invocation_free (context);
+}
+
+/**
+ * DBusGMethodReply:
+ *
+ * A #DBusGMethodReply appends the return values of an asynchronous method
+ * directly to the reply message, checking each one against the method's
+ * out signature as it goes, without going via #GValue.
+ *
+ * Once a type error has been detected, every further call on the builder
+ * returns %FALSE without doing anything, and dbus_g_method_reply_send()
+ * sends an error reply instead.
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is #GVariantBuilder.
+ */
+struct _DBusGMethodReply {
+  DBusGMethodInvocation *context;
+  /* NULL if the caller did not want a reply */
+  DBusMessage *message;
+  /* ReplyLevel, innermost first; the last one is the message itself */
+  GSList *levels;
+  char *out_signature;
+  gboolean failed;
+};
+
+typedef struct {
+  DBusMessageIter iter;
+  /* the type expected next, or the element type inside an array */
+  DBusSignatureIter sig;
+  /* DBUS_TYPE_INVALID for the message itself */
+  int container_type;
+  /* FALSE inside variants, whose contents are not described by the
+   * out signature */
+  gboolean checked;
+  /* TRUE when every expected value has been appended */
+  gboolean finished;
+} ReplyLevel;
+
+static const char *
+method_reply_get_member (DBusGMethodReply *reply)
+{
+  return dbus_message_get_member (
+      dbus_g_message_get_message (reply->context->message));
+}
+
+static gboolean
+method_reply_expect (DBusGMethodReply *reply,
+                     int               type)
+{
+  ReplyLevel *level = reply->levels->data;
+  int expected;
+
+  if (!level->checked)
+    return TRUE;
+
+  if (level->finished)
+    expected = DBUS_TYPE_INVALID;
+  else
+    expected = dbus_signature_iter_get_current_type (&level->sig);
+
+  if (expected != type)
+    {
+      g_critical ("Cannot append '%c' to reply to %s: expected '%c'",
+                  type, method_reply_get_member (reply),
+                  expected == DBUS_TYPE_INVALID ? '-' : expected);
+      reply->failed = TRUE;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+method_reply_advance (DBusGMethodReply *reply)
+{
+  ReplyLevel *level = reply->levels->data;
+
+  /* arrays repeat the same element type any number of times */
+  if (!level->checked || level->container_type == DBUS_TYPE_ARRAY)
+    return;
+
+  if (!dbus_signature_iter_next (&level->sig))
+    level->finished = TRUE;
+}
+
+/* Returns a newly allocated element signature, to be freed with
+ * dbus_free(), if the next expected type is an array */
+static char *
+method_reply_get_element_signature (DBusGMethodReply *reply)
+{
+  ReplyLevel *level = reply->levels->data;
+  DBusSignatureIter element;
+
+  dbus_signature_iter_recurse (&level->sig, &element);
+  return dbus_signature_iter_get_signature (&element);
+}
+
+/**
+ * dbus_g_method_reply_new:
+ * @context: the method context
+ *
+ * Start building the reply to an asynchronous method call. Use the
+ * dbus_g_method_reply_append_*() functions to append each of the method's
+ * out arguments in turn, then dbus_g_method_reply_send() to send it.
+ *
+ * Returns: (transfer full): a new reply builder
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is #GVariantBuilder.
+ */
+DBusGMethodReply *
+dbus_g_method_reply_new (DBusGMethodInvocation *context)
+{
+  DBusGMethodReply *reply;
+  ReplyLevel *level;
+
+  g_return_val_if_fail (context != NULL, NULL);
+
+  reply = g_slice_new0 (DBusGMethodReply);
+  reply->context = context;
+
+  /* See comment in dbus_g_method_return */
+  if (!context->send_reply)
+    return reply;
+
+  reply->message = dbus_g_method_get_reply (context);
+  reply->out_signature = method_output_signature_from_object_info (
+      context->object, context->method);
+
+  level = g_slice_new0 (ReplyLevel);
+  level->container_type = DBUS_TYPE_INVALID;
+  level->checked = TRUE;
+  level->finished = (reply->out_signature[0] == '\0');
+  dbus_signature_iter_init (&level->sig, reply->out_signature);
+  dbus_message_iter_init_append (reply->message, &level->iter);
+  reply->levels = g_slist_prepend (NULL, level);
+
+  return reply;
+}
+
+/**
+ * dbus_g_method_reply_append_basic:
+ * @reply: the reply builder
+ * @type: a basic D-Bus type code, such as %DBUS_TYPE_UINT32
+ * @value: the address of the value, as for dbus_message_iter_append_basic()
+ *
+ * Append a basic value to the reply.
+ *
+ * Returns: %TRUE on success, or %FALSE if @type is not the type expected
+ *  next according to the method's out signature
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is g_variant_builder_add().
+ */
+gboolean
+dbus_g_method_reply_append_basic (DBusGMethodReply *reply,
+                                  int               type,
+                                  const void       *value)
+{
+  ReplyLevel *level;
+
+  g_return_val_if_fail (reply != NULL, FALSE);
+  g_return_val_if_fail (dbus_type_is_basic (type), FALSE);
+  g_return_val_if_fail (value != NULL, FALSE);
+
+  if (reply->message == NULL)
+    return TRUE;
+
+  if (reply->failed)
+    return FALSE;
+
+  if (!method_reply_expect (reply, type))
+    return FALSE;
+
+  level = reply->levels->data;
+
+  if (!dbus_message_iter_append_basic (&level->iter, type, value))
+    oom (NULL);
+
+  method_reply_advance (reply);
+  return TRUE;
+}
+
+/**
+ * dbus_g_method_reply_append_fixed_array:
+ * @reply: the reply builder
+ * @element_type: a fixed-length D-Bus type code, such as %DBUS_TYPE_INT32
+ * @elements: (array length=n_elements): the elements
+ * @n_elements: the number of elements
+ *
+ * Append an array of fixed-length values to the reply in one go, without
+ * converting each element.
+ *
+ * Returns: %TRUE on success, or %FALSE if an array of @element_type is not
+ *  the type expected next according to the method's out signature
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is g_variant_new_fixed_array().
+ */
+gboolean
+dbus_g_method_reply_append_fixed_array (DBusGMethodReply *reply,
+                                        int               element_type,
+                                        gconstpointer     elements,
+                                        int               n_elements)
+{
+  ReplyLevel *level;
+  DBusMessageIter sub;
+  char element_signature[2] = { '\0', '\0' };
+
+  g_return_val_if_fail (reply != NULL, FALSE);
+  g_return_val_if_fail (dbus_type_is_fixed (element_type), FALSE);
+  g_return_val_if_fail (elements != NULL || n_elements == 0, FALSE);
+  g_return_val_if_fail (n_elements >= 0, FALSE);
+
+  if (reply->message == NULL)
+    return TRUE;
+
+  if (reply->failed)
+    return FALSE;
+
+  if (!method_reply_expect (reply, DBUS_TYPE_ARRAY))
+    return FALSE;
+
+  level = reply->levels->data;
+  element_signature[0] = (char) element_type;
+
+  if (level->checked)
+    {
+      char *expected = method_reply_get_element_signature (reply);
+      gboolean ok = (strcmp (expected, element_signature) == 0);
+
+      if (!ok)
+        {
+          g_critical ("Cannot append array of '%s' to reply to %s: "
+                      "expected array of '%s'", element_signature,
+                      method_reply_get_member (reply), expected);
+          reply->failed = TRUE;
+        }
+
+      dbus_free (expected);
+
+      if (!ok)
+        return FALSE;
+    }
+
+  if (!dbus_message_iter_open_container (&level->iter, DBUS_TYPE_ARRAY,
+                                         element_signature, &sub))
+    oom (NULL);
+
+  if (!dbus_message_iter_append_fixed_array (&sub, element_type, &elements,
+                                             n_elements))
+    oom (NULL);
+
+  if (!dbus_message_iter_close_container (&level->iter, &sub))
+    oom (NULL);
+
+  method_reply_advance (reply);
+  return TRUE;
+}
+
+/**
+ * dbus_g_method_reply_append_value:
+ * @reply: the reply builder
+ * @value: a #GValue of a type that can be marshalled to D-Bus
+ *
+ * Append a value to the reply, in the same way as dbus_g_method_return()
+ * would. This is mainly useful for parts of a reply that already exist
+ * as #GValue.
+ *
+ * Returns: %TRUE on success, or %FALSE if the value's type does not match
+ *  the type expected next according to the method's out signature
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is g_variant_builder_add_value().
+ */
+gboolean
+dbus_g_method_reply_append_value (DBusGMethodReply *reply,
+                                  const GValue     *value)
+{
+  ReplyLevel *level;
+
+  g_return_val_if_fail (reply != NULL, FALSE);
+  g_return_val_if_fail (G_IS_VALUE (value), FALSE);
+
+  if (reply->message == NULL)
+    return TRUE;
+
+  if (reply->failed)
+    return FALSE;
+
+  level = reply->levels->data;
+
+  if (level->checked)
+    {
+      char *value_signature;
+      char *expected = NULL;
+      gboolean ok;
+
+      value_signature = _dbus_gtype_to_signature (G_VALUE_TYPE (value));
+
+      if (level->finished)
+        ok = FALSE;
+      else
+        {
+          /* inside an array, this is the element type */
+          expected = dbus_signature_iter_get_signature (&level->sig);
+          ok = (value_signature != NULL
+                && strcmp (value_signature, expected) == 0);
+        }
+
+      if (!ok)
+        {
+          g_critical ("Cannot append %s to reply to %s: expected '%s'",
+                      G_VALUE_TYPE_NAME (value),
+                      method_reply_get_member (reply),
+                      expected != NULL ? expected : "");
+          reply->failed = TRUE;
+        }
+
+      g_free (value_signature);
+      dbus_free (expected);
+
+      if (!ok)
+        return FALSE;
+    }
+
+  if (!_dbus_gvalue_marshal (&level->iter, value))
+    {
+      g_critical ("Failed to marshal %s for reply to %s",
+                  G_VALUE_TYPE_NAME (value), method_reply_get_member (reply));
+      reply->failed = TRUE;
+      return FALSE;
+    }
+
+  method_reply_advance (reply);
+  return TRUE;
+}
+
+/**
+ * dbus_g_method_reply_open_container:
+ * @reply: the reply builder
+ * @type: %DBUS_TYPE_ARRAY, %DBUS_TYPE_STRUCT, %DBUS_TYPE_DICT_ENTRY or
+ *  %DBUS_TYPE_VARIANT
+ * @contained_signature: for a variant, the signature of its contents;
+ *  for an array, the signature of its elements, or %NULL to use the
+ *  method's out signature; for a struct or dict entry, %NULL
+ *
+ * Start appending a container to the reply. Its contents are appended
+ * with the other dbus_g_method_reply_append_*() functions, followed by
+ * dbus_g_method_reply_close_container().
+ *
+ * Returns: %TRUE on success, or %FALSE if the container is not the type
+ *  expected next according to the method's out signature
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is g_variant_builder_open().
+ */
+gboolean
+dbus_g_method_reply_open_container (DBusGMethodReply *reply,
+                                    int               type,
+                                    const char       *contained_signature)
+{
+  ReplyLevel *parent;
+  ReplyLevel *level;
+  char *element_signature = NULL;
+
+  g_return_val_if_fail (reply != NULL, FALSE);
+  g_return_val_if_fail (dbus_type_is_container (type), FALSE);
+  g_return_val_if_fail (type != DBUS_TYPE_VARIANT
+                        || contained_signature != NULL, FALSE);
+  g_return_val_if_fail ((type != DBUS_TYPE_STRUCT
+                         && type != DBUS_TYPE_DICT_ENTRY)
+                        || contained_signature == NULL, FALSE);
+
+  if (reply->message == NULL)
+    return TRUE;
+
+  if (reply->failed)
+    return FALSE;
+
+  if (!method_reply_expect (reply, type))
+    return FALSE;
+
+  parent = reply->levels->data;
+
+  if (type == DBUS_TYPE_ARRAY)
+    {
+      if (parent->checked)
+        {
+          element_signature = method_reply_get_element_signature (reply);
+
+          if (contained_signature != NULL
+              && strcmp (contained_signature, element_signature) != 0)
+            {
+              g_critical ("Cannot append array of '%s' to reply to %s: "
+                          "expected array of '%s'", contained_signature,
+                          method_reply_get_member (reply),
+                          element_signature);
+              reply->failed = TRUE;
+              dbus_free (element_signature);
+              return FALSE;
+            }
+
+          contained_signature = element_signature;
+        }
+
+      g_return_val_if_fail (contained_signature != NULL, FALSE);
+    }
+
+  level = g_slice_new0 (ReplyLevel);
+  level->container_type = type;
+  level->checked = parent->checked && type != DBUS_TYPE_VARIANT;
+
+  if (level->checked)
+    dbus_signature_iter_recurse (&parent->sig, &level->sig);
+
+  if (!dbus_message_iter_open_container (&parent->iter, type,
+                                         contained_signature, &level->iter))
+    oom (NULL);
+
+  dbus_free (element_signature);
+  reply->levels = g_slist_prepend (reply->levels, level);
+  return TRUE;
+}
+
+/**
+ * dbus_g_method_reply_close_container:
+ * @reply: the reply builder
+ *
+ * Finish the container most recently opened with
+ * dbus_g_method_reply_open_container().
+ *
+ * Returns: %TRUE on success, or %FALSE if not all the members of a struct
+ *  or dict entry have been appended
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is g_variant_builder_close().
+ */
+gboolean
+dbus_g_method_reply_close_container (DBusGMethodReply *reply)
+{
+  ReplyLevel *level;
+  ReplyLevel *parent;
+
+  g_return_val_if_fail (reply != NULL, FALSE);
+
+  if (reply->message == NULL)
+    return TRUE;
+
+  if (reply->failed)
+    return FALSE;
+
+  level = reply->levels->data;
+  g_return_val_if_fail (level->container_type != DBUS_TYPE_INVALID, FALSE);
+
+  if (level->checked && level->container_type != DBUS_TYPE_ARRAY
+      && !level->finished)
+    {
+      g_critical ("Cannot close container in reply to %s: expected '%c'",
+                  method_reply_get_member (reply),
+                  dbus_signature_iter_get_current_type (&level->sig));
+      reply->failed = TRUE;
+      return FALSE;
+    }
+
+  parent = reply->levels->next->data;
+
+  if (!dbus_message_iter_close_container (&parent->iter, &level->iter))
+    oom (NULL);
+
+  reply->levels = g_slist_delete_link (reply->levels, reply->levels);
+  g_slice_free (ReplyLevel, level);
+
+  method_reply_advance (reply);
+  return TRUE;
+}
+
+/**
+ * dbus_g_method_reply_free:
+ * @reply: (transfer full): the reply builder
+ *
+ * Discard the reply without sending it. The method context remains valid,
+ * so dbus_g_method_return_error() can still be used to send an error.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_method_reply_free (DBusGMethodReply *reply)
+{
+  g_return_if_fail (reply != NULL);
+
+  while (reply->levels != NULL)
+    {
+      g_slice_free (ReplyLevel, reply->levels->data);
+      reply->levels = g_slist_delete_link (reply->levels, reply->levels);
+    }
+
+  if (reply->message != NULL)
+    dbus_message_unref (reply->message);
+
+  g_free (reply->out_signature);
+  g_slice_free (DBusGMethodReply, reply);
+}
+
+/**
+ * dbus_g_method_reply_send:
+ * @reply: (transfer full): the reply builder
+ *
+ * Send the reply built with @reply. This function also frees the reply
+ * builder and the sending context, like dbus_g_method_return().
+ *
+ * If a type error was detected while building the reply, or not all of the
+ * method's out arguments were appended, an error reply is sent instead.
+ *
+ * Deprecated: New code should use GDBus instead. The closest
+ *  equivalent is g_dbus_method_invocation_return_value().
+ */
+void
+dbus_g_method_reply_send (DBusGMethodReply *reply)
+{
+  DBusGMethodInvocation *context;
+
+  g_return_if_fail (reply != NULL);
+
+  context = reply->context;
+
+  if (reply->message != NULL)
+    {
+      ReplyLevel *level = reply->levels->data;
+
+      if (!reply->failed
+          && (level->container_type != DBUS_TYPE_INVALID || !level->finished))
+        {
+          g_critical ("Reply to %s is incomplete", method_reply_get_member (reply));
+          reply->failed = TRUE;
+        }
+
+      if (reply->failed)
+        {
+          DBusMessage *error;
+
+          error = error_or_die (dbus_g_message_get_message (context->message),
+                                DBUS_ERROR_FAILED,
+                                "The service failed to build a valid reply");
+          method_invocation_send (context, error);
+          dbus_message_unref (error);
+        }
+      else
+        {
+          method_invocation_send (context, reply->message);
+        }
+    }
+
+  method_invocation_record_stats (context, reply->failed, 0);
+  dbus_g_method_reply_free (reply);
+  method_invocation_free (context);
 }
 
 /**
@@ -3233,7 +4965,7 @@ _dbus_gobject_get_path (GObject *obj)
   ObjectExport *oe;
   ObjectRegistration *o;
 
-  oe = g_object_get_data (obj, "dbus_glib_object_registrations");
+  oe = g_object_get_qdata (obj, OBJECT_EXPORT_QUARK);
 
   if (oe == NULL || oe->registrations == NULL)
     return NULL;
@@ -3297,6 +5029,69 @@ const DBusGObjectInfo dbus_glib_internal_test_object_info = {
 "\0"
 };
 
+static char *
+method_input_signature (const DBusGObjectInfo *info,
+                        const DBusGMethodInfo *method)
+{
+  GString *signature = g_string_new (NULL);
+  const char *arg;
+
+  arg = method_arg_info_from_object_info (info, method);
+
+  while (*arg != '\0')
+    {
+      const char *name;
+      const char *type;
+      gboolean arg_in;
+      gboolean constval;
+      RetvalType retval;
+
+      arg = arg_iterate (arg, &name, &arg_in, &constval, &retval, &type);
+
+      if (arg_in)
+        g_string_append (signature, type);
+    }
+
+  return g_string_free (signature, FALSE);
+}
+
+/* Returns a copy of the test object info in format version 5, with the
+ * method lookup table that dbus-binding-tool would have written for it */
+static guint *
+build_test_method_lookup (DBusGObjectInfo *info_ret)
+{
+  const DBusGObjectInfo *info = &dbus_glib_internal_test_object_info;
+  GArray *hashes;
+  guint *table;
+  guint n_entries = 0;
+  int i;
+
+  hashes = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  for (i = 0; i < info->n_method_infos; i++)
+    {
+      const DBusGMethodInfo *method = &(info->method_infos[i]);
+      char *signature = method_input_signature (info, method);
+      guint32 hash;
+
+      hash = _dbus_gutils_method_hash (method_interface_from_object_info (info, method),
+                                       method_name_from_object_info (info, method),
+                                       signature);
+      g_array_append_val (hashes, hash);
+      g_free (signature);
+    }
+
+  table = _dbus_gutils_build_method_lookup (hashes, &n_entries);
+  g_assert (table != NULL);
+  g_assert_cmpuint (n_entries, ==, 2 + table[0] + table[1]);
+  g_array_free (hashes, TRUE);
+
+  *info_ret = *info;
+  info_ret->format_version = 5;
+  info_ret->method_lookup = table;
+  return table;
+}
+
 
 /*
  * Unit test for GLib GObject integration ("skeletons")
@@ -3395,21 +5190,126 @@ _dbus_gobject_test (const char *test_data_dir)
   g_assert (!strcmp (arg_signature, "s"));
   g_assert (*arg == '\0');
 
+  /* Method lookup by interface, name and input signature */
+  g_assert (object_info_lookup_method (&dbus_glib_internal_test_object_info,
+                                       "org.freedesktop.DBus.Tests.MyObject",
+                                       "ManyArgs", "usd") ==
+            &(dbus_glib_internal_test_methods[6]));
+  g_assert (object_info_lookup_method (&dbus_glib_internal_test_object_info,
+                                       "org.freedesktop.DBus.Tests.MyObject",
+                                       "ManyArgs", "us") == NULL);
+  g_assert (object_info_lookup_method (&dbus_glib_internal_test_object_info,
+                                       "org.freedesktop.DBus.Tests.MyObject",
+                                       "ManyArgs", "usdd") == NULL);
+  g_assert (object_info_lookup_method (&dbus_glib_internal_test_object_info,
+                                       "org.freedesktop.DBus.Tests.FooObject",
+                                       "Terminate", "") ==
+            &(dbus_glib_internal_test_methods[29]));
+  g_assert (object_info_lookup_method (&dbus_glib_internal_test_object_info,
+                                       NULL, "Terminate", "") ==
+            &(dbus_glib_internal_test_methods[25]));
+
+  /* The same, through a format 5 lookup table */
+  {
+    DBusGObjectInfo info5;
+    guint *table;
+    guint n_used = 0;
+    guint slot;
+
+    table = build_test_method_lookup (&info5);
+
+    /* every method is in exactly one slot */
+    for (slot = 0; slot < table[1]; slot++)
+      {
+        if (table[2 + table[0] + slot] != 0)
+          n_used++;
+      }
+    g_assert_cmpuint (n_used, ==, (guint) info5.n_method_infos);
+
+    for (i = 0; i < info5.n_method_infos; i++)
+      {
+        const DBusGMethodInfo *method = &(info5.method_infos[i]);
+        char *signature = method_input_signature (&info5, method);
+
+        g_assert (object_info_lookup_method (&info5,
+                                             method_interface_from_object_info (&info5, method),
+                                             method_name_from_object_info (&info5, method),
+                                             signature) == method);
+        g_free (signature);
+      }
+
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.MyObject",
+                                         "ManyArgs", "usd") ==
+              &(dbus_glib_internal_test_methods[6]));
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.FooObject",
+                                         "Terminate", "") ==
+              &(dbus_glib_internal_test_methods[29]));
+
+    /* misses */
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.MyObject",
+                                         "NoSuchMethod", "") == NULL);
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.NoSuchObject",
+                                         "Terminate", "") == NULL);
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.FooObject",
+                                         "DoNothing", "") == NULL);
+
+    /* the right name, with the wrong signature */
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.MyObject",
+                                         "ManyArgs", "us") == NULL);
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.MyObject",
+                                         "ManyArgs", "usdd") == NULL);
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.MyObject",
+                                         "Increment", "") == NULL);
+
+    /* without an interface, the table can't be used, so the first
+     * method with that name wins, as before */
+    g_assert (object_info_lookup_method (&info5, NULL, "Terminate", "") ==
+              &(dbus_glib_internal_test_methods[25]));
+
+    /* a format 5 info without a table is searched linearly */
+    info5.method_lookup = NULL;
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.MyObject",
+                                         "ManyArgs", "usd") ==
+              &(dbus_glib_internal_test_methods[6]));
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.FooObject",
+                                         "Terminate", "") ==
+              &(dbus_glib_internal_test_methods[29]));
+    g_assert (object_info_lookup_method (&info5,
+                                         "org.freedesktop.DBus.Tests.MyObject",
+                                         "ManyArgs", "us") == NULL);
+
+    g_free (table);
+  }
+
   sigdata = dbus_glib_internal_test_object_info.exported_signals;
   g_assert (*sigdata != '\0');
-  sigdata = signal_iterate (sigdata, &iface, &signame);
+  sigdata = signal_iterate (sigdata, dbus_glib_internal_test_object_info.format_version,
+                            &iface, &signame, NULL);
   g_assert (!strcmp (iface, "org.freedesktop.DBus.Tests.MyObject"));
   g_assert (!strcmp (signame, "Frobnicate"));
   g_assert (*sigdata != '\0');
-  sigdata = signal_iterate (sigdata, &iface, &signame);
+  sigdata = signal_iterate (sigdata, dbus_glib_internal_test_object_info.format_version,
+                            &iface, &signame, NULL);
   g_assert (!strcmp (iface, "org.freedesktop.DBus.Tests.FooObject"));
   g_assert (!strcmp (signame, "Sig0"));
   g_assert (*sigdata != '\0');
-  sigdata = signal_iterate (sigdata, &iface, &signame);
+  sigdata = signal_iterate (sigdata, dbus_glib_internal_test_object_info.format_version,
+                            &iface, &signame, NULL);
   g_assert (!strcmp (iface, "org.freedesktop.DBus.Tests.FooObject"));
   g_assert (!strcmp (signame, "Sig1"));
   g_assert (*sigdata != '\0');
-  sigdata = signal_iterate (sigdata, &iface, &signame);
+  sigdata = signal_iterate (sigdata, dbus_glib_internal_test_object_info.format_version,
+                            &iface, &signame, NULL);
   g_assert (!strcmp (iface, "org.freedesktop.DBus.Tests.FooObject"));
   g_assert (!strcmp (signame, "Sig2"));
   g_assert (*sigdata == '\0');
@@ -0,0 +1,394 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gpacked-structs.c: arrays of fixed-size structs stored as C structs
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+#include <string.h>
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include "dbus-gpacked-structs.h"
+#include "dbus-gvalue-utils.h"
+
+#define PACKED_STRUCTS_CONTAINER "DBusGPackedStructArray"
+
+/* Used to find out how the compiler aligns each member type inside a
+ * struct, which isn't necessarily its size (gint64 on i386, for
+ * instance) */
+struct align_guchar { char c; guchar x; };
+struct align_gint { char c; gint x; };
+struct align_gint64 { char c; gint64 x; };
+struct align_gdouble { char c; gdouble x; };
+
+static char
+member_typecode (GType type)
+{
+  switch (type)
+    {
+    case G_TYPE_CHAR:
+    case G_TYPE_UCHAR:
+      return DBUS_TYPE_BYTE;
+    case G_TYPE_BOOLEAN:
+      return DBUS_TYPE_BOOLEAN;
+    case G_TYPE_INT:
+      return DBUS_TYPE_INT32;
+    case G_TYPE_UINT:
+      return DBUS_TYPE_UINT32;
+    case G_TYPE_INT64:
+      return DBUS_TYPE_INT64;
+    case G_TYPE_UINT64:
+      return DBUS_TYPE_UINT64;
+    case G_TYPE_DOUBLE:
+      return DBUS_TYPE_DOUBLE;
+    default:
+      /* Other fixed-size types, like glong, don't have the same size on
+       * the wire and in memory, so they can't be copied directly */
+      return DBUS_TYPE_INVALID;
+    }
+}
+
+static void
+typecode_get_size_and_alignment (char   typecode,
+                                 gsize *size,
+                                 gsize *alignment)
+{
+  switch (typecode)
+    {
+    case DBUS_TYPE_BYTE:
+      *size = sizeof (guchar);
+      *alignment = G_STRUCT_OFFSET (struct align_guchar, x);
+      break;
+    case DBUS_TYPE_BOOLEAN:
+    case DBUS_TYPE_INT32:
+    case DBUS_TYPE_UINT32:
+      *size = sizeof (gint);
+      *alignment = G_STRUCT_OFFSET (struct align_gint, x);
+      break;
+    case DBUS_TYPE_INT64:
+    case DBUS_TYPE_UINT64:
+      *size = sizeof (gint64);
+      *alignment = G_STRUCT_OFFSET (struct align_gint64, x);
+      break;
+    case DBUS_TYPE_DOUBLE:
+      *size = sizeof (gdouble);
+      *alignment = G_STRUCT_OFFSET (struct align_gdouble, x);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+G_STATIC_ASSERT (sizeof (dbus_bool_t) == sizeof (gboolean));
+G_STATIC_ASSERT (sizeof (dbus_int32_t) == sizeof (gint));
+G_STATIC_ASSERT (sizeof (dbus_int64_t) == sizeof (gint64));
+
+static gboolean
+struct_type_is_packable (GType struct_type)
+{
+  guint i, n;
+
+  if (!dbus_g_type_is_struct (struct_type))
+    return FALSE;
+
+  n = dbus_g_type_get_struct_size (struct_type);
+
+  if (n == 0)
+    return FALSE;
+
+  for (i = 0; i < n; i++)
+    {
+      if (member_typecode (dbus_g_type_get_struct_member_type (struct_type, i))
+          == DBUS_TYPE_INVALID)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static GQuark
+packed_struct_layout_quark (void)
+{
+  static GQuark quark;
+  if (!quark)
+    quark = g_quark_from_static_string ("DBusGPackedStructLayout");
+  return quark;
+}
+
+G_LOCK_DEFINE_STATIC (layouts);
+
+const DBusGPackedStructLayout *
+_dbus_g_packed_struct_layout_get (GType type)
+{
+  DBusGPackedStructLayout *layout;
+  gsize max_alignment = 1;
+  gsize offset = 0;
+  guint i;
+
+  layout = g_type_get_qdata (type, packed_struct_layout_quark ());
+
+  if (layout != NULL)
+    return layout;
+
+  G_LOCK (layouts);
+
+  /* someone else might have got there first */
+  layout = g_type_get_qdata (type, packed_struct_layout_quark ());
+
+  if (layout != NULL)
+    goto out;
+
+  /* Layouts are never freed, just like the types they describe */
+  layout = g_new0 (DBusGPackedStructLayout, 1);
+  layout->struct_type = dbus_g_type_get_collection_specialization (type);
+  layout->n_members = dbus_g_type_get_struct_size (layout->struct_type);
+  layout->offsets = g_new0 (gsize, layout->n_members);
+  layout->typecodes = g_new0 (char, layout->n_members);
+
+  for (i = 0; i < layout->n_members; i++)
+    {
+      gsize size, alignment;
+
+      layout->typecodes[i] = member_typecode (
+          dbus_g_type_get_struct_member_type (layout->struct_type, i));
+      typecode_get_size_and_alignment (layout->typecodes[i], &size,
+                                       &alignment);
+
+      offset = (offset + alignment - 1) / alignment * alignment;
+      layout->offsets[i] = offset;
+      offset += size;
+      max_alignment = MAX (max_alignment, alignment);
+    }
+
+  layout->row_size = (offset + max_alignment - 1) / max_alignment * max_alignment;
+
+  g_type_set_qdata (type, packed_struct_layout_quark (), layout);
+
+out:
+  G_UNLOCK (layouts);
+  return layout;
+}
+
+static gpointer
+packed_structs_constructor (GType type)
+{
+  const DBusGPackedStructLayout *layout = _dbus_g_packed_struct_layout_get (type);
+
+  return g_array_new (FALSE, TRUE, layout->row_size);
+}
+
+static void
+packed_structs_free (GType    type,
+                     gpointer instance)
+{
+  g_array_unref (instance);
+}
+
+static gpointer
+packed_structs_copy (GType    type,
+                     gpointer src)
+{
+  GArray *array = src;
+  GArray *ret;
+
+  ret = packed_structs_constructor (type);
+  g_array_append_vals (ret, array->data, array->len);
+  return ret;
+}
+
+static gboolean
+packed_structs_fixed_accessor (GType     type,
+                               gpointer  instance,
+                               gpointer *values,
+                               guint    *len)
+{
+  GArray *array = instance;
+
+  *values = array->data;
+  *len = array->len;
+  return TRUE;
+}
+
+static void
+packed_structs_iterator (GType                                  type,
+                         gpointer                               instance,
+                         DBusGTypeSpecializedCollectionIterator iterator,
+                         gpointer                               user_data)
+{
+  const DBusGPackedStructLayout *layout = _dbus_g_packed_struct_layout_get (type);
+  GArray *array = instance;
+  guint row, i;
+
+  for (row = 0; row < array->len; row++)
+    {
+      const char *data = array->data + row * layout->row_size;
+      GValue val = { 0, };
+
+      g_value_init (&val, layout->struct_type);
+      g_value_take_boxed (&val,
+          dbus_g_type_specialized_construct (layout->struct_type));
+
+      for (i = 0; i < layout->n_members; i++)
+        {
+          GValue member = { 0, };
+
+          g_value_init (&member,
+              dbus_g_type_get_struct_member_type (layout->struct_type, i));
+          _dbus_gvalue_set_from_pointer (&member, data + layout->offsets[i]);
+          dbus_g_type_struct_set_member (&val, i, &member);
+          g_value_unset (&member);
+        }
+
+      iterator (&val, user_data);
+      g_value_unset (&val);
+    }
+}
+
+static void
+packed_structs_append (DBusGTypeSpecializedAppendContext *ctx,
+                       GValue                            *value)
+{
+  const DBusGPackedStructLayout *layout =
+      _dbus_g_packed_struct_layout_get (G_VALUE_TYPE (ctx->val));
+  GArray *array = g_value_get_boxed (ctx->val);
+  char *data;
+  guint i;
+
+  g_array_set_size (array, array->len + 1);
+  data = array->data + (array->len - 1) * layout->row_size;
+
+  for (i = 0; i < layout->n_members; i++)
+    {
+      GValue member = { 0, };
+
+      g_value_init (&member,
+          dbus_g_type_get_struct_member_type (layout->struct_type, i));
+
+      if (dbus_g_type_struct_get_member (value, i, &member))
+        _dbus_gvalue_store (&member, data + layout->offsets[i]);
+
+      g_value_unset (&member);
+    }
+
+  /* we've taken ownership of the struct, but only needed its contents */
+  g_value_unset (value);
+}
+
+static const DBusGTypeSpecializedCollectionVtable packed_structs_vtable = {
+  {
+    packed_structs_constructor,
+    packed_structs_free,
+    packed_structs_copy,
+    NULL,
+    NULL,
+    NULL,
+  },
+  packed_structs_fixed_accessor,
+  packed_structs_iterator,
+  packed_structs_append,
+  NULL
+};
+
+static gpointer
+packed_structs_register (gpointer data G_GNUC_UNUSED)
+{
+  dbus_g_type_register_collection (PACKED_STRUCTS_CONTAINER,
+                                   &packed_structs_vtable, 0);
+  return NULL;
+}
+
+gboolean
+_dbus_g_type_is_packed_struct_collection (GType type)
+{
+  return dbus_g_type_is_collection (type) &&
+      dbus_g_type_collection_peek_vtable (type) == &packed_structs_vtable;
+}
+
+/**
+ * dbus_g_type_get_packed_struct_collection:
+ * @struct_type: a specialized struct type, such as one returned by
+ *  dbus_g_type_get_struct(), whose members are all #G_TYPE_CHAR,
+ *  #G_TYPE_UCHAR, #G_TYPE_BOOLEAN, #G_TYPE_INT, #G_TYPE_UINT,
+ *  #G_TYPE_INT64, #G_TYPE_UINT64 or #G_TYPE_DOUBLE
+ *
+ * Gets a specialized collection type that is sent and received like
+ * <literal>dbus_g_type_get_collection ("GPtrArray", struct_type)</literal>,
+ * for instance as <literal>a(td)</literal>, but whose instances store
+ * each struct as a row of a #GArray, laid out like the equivalent C
+ * struct would be on this platform. For instance, the rows of a
+ * collection of structs of #G_TYPE_UINT64 and #G_TYPE_DOUBLE can be
+ * accessed as an array of
+ * <literal>struct { guint64 t; gdouble d; }</literal>.
+ *
+ * This uses a small fraction of the memory of a #GPtrArray of
+ * #GValueArray<!-- -->s, and can be sent and received without
+ * creating a #GValue for each member. Use
+ * dbus_g_type_collection_get_fixed() to get the rows, and
+ * dbus_g_type_get_packed_struct_offsets() if the layout isn't
+ * known at compile time.
+ *
+ * Returns: the #GType of such collections, or #G_TYPE_INVALID if
+ *  @struct_type is not suitable
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is g_variant_get_data() on a #GVariant whose type is an array of
+ *  fixed-size structs.
+ */
+GType
+dbus_g_type_get_packed_struct_collection (GType struct_type)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_return_val_if_fail (struct_type_is_packable (struct_type), G_TYPE_INVALID);
+
+  g_once (&once, packed_structs_register, NULL);
+
+  return dbus_g_type_get_collection (PACKED_STRUCTS_CONTAINER, struct_type);
+}
+
+/**
+ * dbus_g_type_get_packed_struct_offsets:
+ * @type: a type returned by dbus_g_type_get_packed_struct_collection()
+ * @row_size: (out) (allow-none): used to return the size of each row, in
+ *  bytes, which is also the #GArray's element size
+ *
+ * Gets the offset of each struct member within a row of a packed struct
+ * collection.
+ *
+ * Returns: (array): an array of offsets in bytes, one per struct member,
+ *  owned by dbus-glib
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+const gsize *
+dbus_g_type_get_packed_struct_offsets (GType  type,
+                                       gsize *row_size)
+{
+  const DBusGPackedStructLayout *layout;
+
+  g_return_val_if_fail (_dbus_g_type_is_packed_struct_collection (type), NULL);
+
+  layout = _dbus_g_packed_struct_layout_get (type);
+
+  if (row_size != NULL)
+    *row_size = layout->row_size;
+
+  return layout->offsets;
+}
@@ -0,0 +1,48 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gpacked-structs.h: arrays of fixed-size structs stored as C structs
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef DBUS_GLIB_PACKED_STRUCTS_H
+#define DBUS_GLIB_PACKED_STRUCTS_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* How each row of a packed struct collection is laid out: like the
+ * equivalent C struct on this platform */
+typedef struct {
+  GType struct_type;
+  guint n_members;
+  gsize row_size;
+  gsize *offsets;
+  /* D-Bus type code of each member, which is also what determines
+   * its size in memory */
+  char *typecodes;
+} DBusGPackedStructLayout;
+
+gboolean                       _dbus_g_type_is_packed_struct_collection (GType type);
+
+const DBusGPackedStructLayout *_dbus_g_packed_struct_layout_get         (GType type);
+
+G_END_DECLS
+
+#endif /* DBUS_GLIB_PACKED_STRUCTS_H */
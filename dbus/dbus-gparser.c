@@ -766,6 +766,8 @@ parse_annotation (Parser      *parser,
     arg_info_add_annotation (parser->arg, name, value);
   else if (parser->method)
     method_info_add_annotation (parser->method, name, value);
+  else if (parser->signal)
+    signal_info_add_annotation (parser->signal, name, value);
   else if (parser->interface)
     interface_info_add_annotation (parser->interface, name, value);
   else
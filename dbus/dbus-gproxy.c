@@ -29,6 +29,7 @@
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
 #include <dbus/dbus-signature.h>
+#include "dbus-gcork.h"
 #include "dbus-gutils.h"
 #include "dbus-gsignature.h"
 #include "dbus-gvalue.h"
@@ -886,6 +887,9 @@ get_name_owner (DBusConnection     *connection,
 				 DBUS_TYPE_INVALID))
     g_error ("Out of memory");
 
+  /* Don't let the call overtake anything held back by corking */
+  _dbus_g_connection_flush_corked (connection);
+
   reply =
     dbus_connection_send_with_reply_and_block (connection,
                                                request,
@@ -1710,6 +1714,8 @@ marshal_dbus_message_to_g_marshaller (GClosure     *closure,
   GArray *gsignature;
   const GType *types;
   DBusGProxyPrivate *priv;
+  DBusGArena arena;
+  gpointer arena_buffer[32];
 
   g_assert (n_param_values == 3);
 
@@ -1728,14 +1734,23 @@ marshal_dbus_message_to_g_marshaller (GClosure     *closure,
     context.recursion_depth = 0;
     context.gconnection = DBUS_G_CONNECTION_FROM_CONNECTION (priv->manager->connection);
     context.proxy = proxy;
+    context.message = message;
+
+    /* Handlers don't own the signal's arguments, so string arguments
+     * can be borrowed from the message for the duration of the emission */
+    _dbus_g_arena_init (&arena, arena_buffer, sizeof (arena_buffer));
 
     types = (const GType*) gsignature->data;
     value_array = _dbus_gvalue_demarshal_message (&context, message,
-						 gsignature->len, types, NULL);
+						 gsignature->len, types,
+						 &arena, NULL);
   }
 
   if (value_array == NULL)
-    return;
+    {
+      _dbus_g_arena_clear (&arena);
+      return;
+    }
   
   g_value_array_prepend (value_array, NULL);
   g_value_init (g_value_array_get_nth (value_array, 0), G_TYPE_FROM_INSTANCE (proxy));
@@ -1745,6 +1760,7 @@ marshal_dbus_message_to_g_marshaller (GClosure     *closure,
       value_array->values, invocation_hint, marshal_data);
 
   g_value_array_free (value_array);
+  _dbus_g_arena_clear (&arena);
 }
 
 static void
@@ -1783,8 +1799,8 @@ dbus_g_proxy_emit_remote_signal (DBusGProxy  *proxy,
       if (gsignature == NULL)
 	goto out;
       
-      msg_gsignature = _dbus_gtypes_from_arg_signature (dbus_message_get_signature (message),
-						       TRUE);
+      msg_gsignature = _dbus_gtypes_from_arg_signature_cached (dbus_message_get_signature (message),
+							      TRUE);
       for (i = 0; i < gsignature->len; i++)
 	{
 	  if (msg_gsignature->len == i
@@ -1804,7 +1820,7 @@ dbus_g_proxy_emit_remote_signal (DBusGProxy  *proxy,
  out:
   g_free (name);
   if (msg_gsignature)
-    g_array_free (msg_gsignature, TRUE);
+    g_array_unref (msg_gsignature);
   return;
  mismatch:
 #if 0
@@ -2349,16 +2365,147 @@ dbus_g_proxy_marshal_args_to_message (DBusGProxy  *proxy,
   return message;
 }
 
-static guint
-dbus_g_proxy_begin_call_internal (DBusGProxy          *proxy,
-				  const char          *method,
-				  DBusGProxyCallNotify notify,
-				  gpointer             user_data,
-				  GDestroyNotify       destroy,
-				  GValueArray         *args,
-				  int timeout)
+/* Returns the D-Bus type code that the typed-call fast paths read and
+ * write directly for @gtype, or DBUS_TYPE_INVALID if values of @gtype
+ * have to go through the GValue marshallers. */
+static int
+typed_arg_get_basic_typecode (GType gtype)
+{
+  switch (gtype)
+    {
+    case G_TYPE_UCHAR:
+      return DBUS_TYPE_BYTE;
+    case G_TYPE_BOOLEAN:
+      return DBUS_TYPE_BOOLEAN;
+    case G_TYPE_INT:
+      return DBUS_TYPE_INT32;
+    case G_TYPE_UINT:
+      return DBUS_TYPE_UINT32;
+    case G_TYPE_INT64:
+      return DBUS_TYPE_INT64;
+    case G_TYPE_UINT64:
+      return DBUS_TYPE_UINT64;
+    case G_TYPE_DOUBLE:
+      return DBUS_TYPE_DOUBLE;
+    case G_TYPE_STRING:
+      return DBUS_TYPE_STRING;
+    default:
+      if (gtype == DBUS_TYPE_G_OBJECT_PATH)
+        return DBUS_TYPE_OBJECT_PATH;
+      if (gtype == DBUS_TYPE_G_SIGNATURE)
+        return DBUS_TYPE_SIGNATURE;
+      return DBUS_TYPE_INVALID;
+    }
+}
+
+/* Like _dbus_gvalue_set_from_pointer(), but borrows strings and boxed
+ * values rather than copying them, as G_VALUE_COLLECT() does for the
+ * varargs API. */
+static void
+typed_arg_borrow (GValue        *value,
+                  gconstpointer  storage)
+{
+  switch (g_type_fundamental (G_VALUE_TYPE (value)))
+    {
+    case G_TYPE_STRING:
+      g_value_set_static_string (value, *((const gchar * const *) storage));
+      break;
+    case G_TYPE_BOXED:
+      g_value_set_static_boxed (value, *((const gconstpointer *) storage));
+      break;
+    default:
+      if (!_dbus_gvalue_set_from_pointer (value, storage))
+        g_assert_not_reached ();
+      break;
+    }
+}
+
+static gboolean
+typed_arg_marshal (DBusMessageIter *iter,
+                   GType            gtype,
+                   gconstpointer    storage)
+{
+  int typecode;
+  GValue gvalue = { 0, };
+  gboolean ret;
+
+  typecode = typed_arg_get_basic_typecode (gtype);
+
+  switch (typecode)
+    {
+    case DBUS_TYPE_BOOLEAN:
+      {
+        dbus_bool_t b = (*((const gboolean *) storage) != FALSE);
+
+        return dbus_message_iter_append_basic (iter, typecode, &b);
+      }
+    case DBUS_TYPE_STRING:
+    case DBUS_TYPE_OBJECT_PATH:
+    case DBUS_TYPE_SIGNATURE:
+      if (*((const gchar * const *) storage) == NULL)
+        return FALSE;
+      /* fall through */
+    case DBUS_TYPE_BYTE:
+    case DBUS_TYPE_INT32:
+    case DBUS_TYPE_UINT32:
+    case DBUS_TYPE_INT64:
+    case DBUS_TYPE_UINT64:
+    case DBUS_TYPE_DOUBLE:
+      return dbus_message_iter_append_basic (iter, typecode, storage);
+    default:
+      break;
+    }
+
+  g_value_init (&gvalue, gtype);
+  typed_arg_borrow (&gvalue, storage);
+  ret = _dbus_gvalue_marshal (iter, &gvalue);
+  g_value_unset (&gvalue);
+  return ret;
+}
+
+static DBusMessage *
+dbus_g_proxy_marshal_typed_args_to_message (DBusGProxy          *proxy,
+                                            const char          *method,
+                                            const GType         *in_types,
+                                            const gconstpointer *in_args)
 {
   DBusMessage *message;
+  DBusMessageIter msgiter;
+  guint i;
+  DBusGProxyPrivate *priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
+
+  message = dbus_message_new_method_call (priv->name,
+                                          priv->path,
+                                          priv->interface,
+                                          method);
+  if (message == NULL)
+    return NULL;
+
+  dbus_message_iter_init_append (message, &msgiter);
+  for (i = 0; in_types[i] != G_TYPE_INVALID; i++)
+    {
+      if (!typed_arg_marshal (&msgiter, in_types[i], in_args[i]))
+        {
+          /* This is a programming error by the caller, most likely */
+          g_critical ("Could not marshal argument %u for %s: type %s",
+              i, method, g_type_name (in_types[i]));
+          dbus_message_unref (message);
+          return NULL;
+        }
+    }
+
+  return message;
+}
+
+/* Sends @message, which is consumed, and starts tracking its reply */
+static guint
+dbus_g_proxy_send_call (DBusGProxy          *proxy,
+                        DBusMessage         *message,
+                        DBusGProxyCallNotify notify,
+                        gpointer             user_data,
+                        GDestroyNotify       destroy,
+                        int                  timeout)
+{
   DBusPendingCall *pending;
   GPendingNotifyClosure *closure;
   guint call_id;
@@ -2366,11 +2513,7 @@ dbus_g_proxy_begin_call_internal (DBusGProxy          *proxy,
 
   pending = NULL;
 
-  message = dbus_g_proxy_marshal_args_to_message (proxy, method, args);
-
-  /* can only happen on a programming error or OOM; we already critical'd */
-  if (!message)
-    return 0;
+  _dbus_g_connection_flush_corked (priv->manager->connection);
 
   if (!dbus_connection_send_with_reply (priv->manager->connection,
                                         message,
@@ -2407,6 +2550,48 @@ dbus_g_proxy_begin_call_internal (DBusGProxy          *proxy,
   return call_id;
 }
 
+static guint
+dbus_g_proxy_begin_call_internal (DBusGProxy          *proxy,
+				  const char          *method,
+				  DBusGProxyCallNotify notify,
+				  gpointer             user_data,
+				  GDestroyNotify       destroy,
+				  GValueArray         *args,
+				  int timeout)
+{
+  DBusMessage *message;
+
+  message = dbus_g_proxy_marshal_args_to_message (proxy, method, args);
+
+  /* can only happen on a programming error or OOM; we already critical'd */
+  if (!message)
+    return 0;
+
+  return dbus_g_proxy_send_call (proxy, message, notify, user_data, destroy,
+      timeout);
+}
+
+/* Blocks until @call_id has completed, then forgets about it and returns
+ * its reply */
+static DBusMessage *
+dbus_g_proxy_steal_call_reply (DBusGProxy *proxy,
+                               guint       call_id)
+{
+  DBusGProxyPrivate *priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
+  DBusPendingCall *pending;
+  DBusMessage *reply;
+
+  pending = g_hash_table_lookup (priv->pending_calls, GUINT_TO_POINTER (call_id));
+  
+  dbus_pending_call_block (pending);
+  reply = dbus_pending_call_steal_reply (pending);
+
+  g_assert (reply != NULL);
+
+  g_hash_table_remove (priv->pending_calls, GUINT_TO_POINTER (call_id));
+  return reply;
+}
+
 static gboolean
 dbus_g_proxy_end_call_internal (DBusGProxy        *proxy,
 				guint              call_id,
@@ -2422,7 +2607,6 @@ dbus_g_proxy_end_call_internal (DBusGProxy        *proxy,
   int n_retvals_processed;
   gboolean ret;
   GType valtype;
-  DBusPendingCall *pending;
   DBusGProxyPrivate *priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
 
   if (call_id == 0)
@@ -2443,12 +2627,7 @@ dbus_g_proxy_end_call_internal (DBusGProxy        *proxy,
   /* Keep around a copy of output arguments so we can free on error. */
   G_VA_COPY(args_unwind, args);
 
-  pending = g_hash_table_lookup (priv->pending_calls, GUINT_TO_POINTER (call_id));
-  
-  dbus_pending_call_block (pending);
-  reply = dbus_pending_call_steal_reply (pending);
-
-  g_assert (reply != NULL);
+  reply = dbus_g_proxy_steal_call_reply (proxy, call_id);
 
   dbus_error_init (&derror);
 
@@ -2467,6 +2646,7 @@ dbus_g_proxy_end_call_internal (DBusGProxy        *proxy,
           context.recursion_depth = 0;
 	  context.gconnection = DBUS_G_CONNECTION_FROM_CONNECTION (priv->manager->connection);
 	  context.proxy = proxy;
+	  context.message = reply;
 
 	  arg_type = dbus_message_iter_get_arg_type (&msgiter);
 	  if (arg_type == DBUS_TYPE_INVALID)
@@ -2576,13 +2756,206 @@ dbus_g_proxy_end_call_internal (DBusGProxy        *proxy,
   va_end (args_unwind);
   va_end (args);
 
-  g_hash_table_remove (priv->pending_calls, GUINT_TO_POINTER (call_id));
-
   if (reply)
     dbus_message_unref (reply);
   return ret;
 }
 
+static gboolean
+typed_arg_demarshal (DBusGValueMarshalCtx  *context,
+                     DBusMessageIter       *iter,
+                     GType                  gtype,
+                     gpointer               storage,
+                     GError               **error)
+{
+  GValue gvalue = { 0, };
+  int arg_type;
+
+  arg_type = dbus_message_iter_get_arg_type (iter);
+
+  if (arg_type == typed_arg_get_basic_typecode (gtype))
+    {
+      switch (arg_type)
+        {
+        case DBUS_TYPE_BOOLEAN:
+          {
+            dbus_bool_t b;
+
+            dbus_message_iter_get_basic (iter, &b);
+            *((gboolean *) storage) = (b != FALSE);
+          }
+          break;
+        case DBUS_TYPE_STRING:
+        case DBUS_TYPE_OBJECT_PATH:
+        case DBUS_TYPE_SIGNATURE:
+          {
+            const char *str;
+
+            dbus_message_iter_get_basic (iter, &str);
+            *((gchar **) storage) = g_strdup (str);
+          }
+          break;
+        default:
+          dbus_message_iter_get_basic (iter, storage);
+          break;
+        }
+
+      return TRUE;
+    }
+
+  /* We handle variants specially; the caller is expected
+   * to have already allocated storage for them.
+   */
+  if (arg_type == DBUS_TYPE_VARIANT && g_type_is_a (gtype, G_TYPE_VALUE))
+    {
+      if (!_dbus_gvalue_demarshal_variant (context, iter, (GValue *) storage, NULL))
+        {
+          g_set_error (error,
+                       DBUS_GERROR,
+                       DBUS_GERROR_INVALID_ARGS,
+                       "Couldn't convert argument, expected \"%s\"",
+                       g_type_name (gtype));
+          return FALSE;
+        }
+
+      return TRUE;
+    }
+
+  g_value_init (&gvalue, gtype);
+
+  if (!_dbus_gvalue_demarshal (context, iter, &gvalue, error))
+    return FALSE;
+
+  /* Anything that can be demarshaled must be storable */
+  if (!_dbus_gvalue_store (&gvalue, storage))
+    g_assert_not_reached ();
+  /* Ownership of the value passes to the client, don't unset */
+  return TRUE;
+}
+
+/* Frees what typed_arg_demarshal() stored in @storage */
+static void
+typed_arg_free (GType    gtype,
+                gpointer storage)
+{
+  GValue value = { 0, };
+
+  if (g_type_is_a (gtype, G_TYPE_VALUE))
+    {
+      g_value_unset ((GValue *) storage);
+      return;
+    }
+
+  g_value_init (&value, gtype);
+  _dbus_gvalue_take (&value, storage);
+  g_value_unset (&value);
+}
+
+static gboolean
+dbus_g_proxy_end_call_typed_internal (DBusGProxy        *proxy,
+                                      guint              call_id,
+                                      GError           **error,
+                                      const GType       *out_types,
+                                      gpointer const    *out_args)
+{
+  DBusMessage *reply;
+  DBusMessageIter msgiter;
+  DBusError derror;
+  DBusGValueMarshalCtx context;
+  guint n_processed;
+  guint i;
+  gboolean ret;
+  DBusGProxyPrivate *priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
+
+  if (call_id == 0)
+    {
+      /* See dbus_g_proxy_end_call_internal() */
+      g_set_error (error, DBUS_GERROR, DBUS_GERROR_DISCONNECTED,
+          "Disconnected from D-Bus (or argument error during call)");
+      return FALSE;
+    }
+
+  ret = FALSE;
+  n_processed = 0;
+
+  reply = dbus_g_proxy_steal_call_reply (proxy, call_id);
+
+  dbus_error_init (&derror);
+
+  switch (dbus_message_get_type (reply))
+    {
+    case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+      break;
+    case DBUS_MESSAGE_TYPE_ERROR:
+      dbus_set_error_from_message (&derror, reply);
+      dbus_set_g_error (error, &derror);
+      dbus_error_free (&derror);
+      goto out;
+    default:
+      dbus_set_error (&derror, DBUS_ERROR_FAILED,
+                      "Reply was neither a method return nor an exception");
+      dbus_set_g_error (error, &derror);
+      dbus_error_free (&derror);
+      goto out;
+    }
+
+  context.recursion_depth = 0;
+  context.gconnection = DBUS_G_CONNECTION_FROM_CONNECTION (priv->manager->connection);
+  context.proxy = proxy;
+  context.message = reply;
+
+  dbus_message_iter_init (reply, &msgiter);
+
+  for (; out_types[n_processed] != G_TYPE_INVALID; n_processed++)
+    {
+      if (dbus_message_iter_get_arg_type (&msgiter) == DBUS_TYPE_INVALID)
+        {
+          g_set_error (error, DBUS_GERROR,
+                       DBUS_GERROR_INVALID_ARGS,
+                       "Too few arguments in reply");
+          goto out;
+        }
+
+      if (out_args[n_processed] != NULL &&
+          !typed_arg_demarshal (&context, &msgiter, out_types[n_processed],
+                                out_args[n_processed], error))
+        goto out;
+
+      dbus_message_iter_next (&msgiter);
+    }
+
+  if (dbus_message_iter_get_arg_type (&msgiter) != DBUS_TYPE_INVALID)
+    {
+      guint over = 0;
+
+      while (dbus_message_iter_get_arg_type (&msgiter) != DBUS_TYPE_INVALID)
+        {
+          over++;
+          dbus_message_iter_next (&msgiter);
+        }
+
+      g_set_error (error, DBUS_GERROR,
+                   DBUS_GERROR_INVALID_ARGS,
+                   "Too many arguments in reply; expected %u, got %u",
+                   n_processed, over);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (!ret)
+    {
+      for (i = 0; i < n_processed; i++)
+        {
+          if (out_args[i] != NULL)
+            typed_arg_free (out_types[i], out_args[i]);
+        }
+    }
+
+  dbus_message_unref (reply);
+  return ret;
+}
+
 /**
  * dbus_g_proxy_begin_call:
  * @proxy: a proxy for a remote interface
@@ -2717,6 +3090,57 @@ dbus_g_proxy_begin_call_with_timeout (DBusGProxy          *proxy,
   return DBUS_G_PROXY_ID_TO_CALL (call_id);
 }
 
+/**
+ * dbus_g_proxy_begin_call_typed:
+ * @proxy: a proxy for a remote interface
+ * @method: the name of the method to invoke
+ * @notify: callback to be invoked when method returns
+ * @user_data: user data passed to callback
+ * @destroy: function called to destroy user_data
+ * @in_types: the types of the arguments, terminated by %G_TYPE_INVALID
+ * @in_args: pointers to the argument values, as for
+ *    dbus_g_proxy_call_typed()
+ *
+ * Equivalent to dbus_g_proxy_begin_call(), but takes the argument types
+ * and values as arrays, like dbus_g_proxy_call_typed(). The results can
+ * be collected with dbus_g_proxy_end_call_typed() or
+ * dbus_g_proxy_end_call().
+ *
+ * Returns: call identifier.
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is g_dbus_proxy_call().
+ */
+DBusGProxyCall *
+dbus_g_proxy_begin_call_typed (DBusGProxy          *proxy,
+                               const char          *method,
+                               DBusGProxyCallNotify notify,
+                               gpointer             user_data,
+                               GDestroyNotify       destroy,
+                               const GType         *in_types,
+                               const gconstpointer *in_args)
+{
+  DBusMessage *message;
+  guint call_id = 0;
+  DBusGProxyPrivate *priv;
+
+  g_return_val_if_fail (DBUS_IS_G_PROXY (proxy), NULL);
+  g_return_val_if_fail (!DBUS_G_PROXY_DESTROYED (proxy), NULL);
+  g_return_val_if_fail (g_dbus_is_member_name (method), NULL);
+  g_return_val_if_fail (in_types != NULL, NULL);
+
+  priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
+
+  message = dbus_g_proxy_marshal_typed_args_to_message (proxy, method,
+      in_types, in_args);
+
+  if (message != NULL)
+    call_id = dbus_g_proxy_send_call (proxy, message, notify, user_data,
+        destroy, priv->default_timeout);
+
+  return DBUS_G_PROXY_ID_TO_CALL (call_id);
+}
+
 /**
  * dbus_g_proxy_end_call:
  * @proxy: a proxy for a remote interface
@@ -2766,6 +3190,190 @@ dbus_g_proxy_end_call (DBusGProxy          *proxy,
   return ret;
 }
 
+/**
+ * DBusGProxyElementFunc:
+ * @proxy: the proxy on which the method was called
+ * @index_: the position of @element in the array, starting from 0
+ * @element: the element, which is only valid until this function returns;
+ *  use g_value_copy() or similar to keep it
+ * @user_data: data passed to dbus_g_proxy_end_call_foreach()
+ *
+ * Called by dbus_g_proxy_end_call_foreach() for each element of the
+ * array returned by a method call.
+ *
+ * Returns: %TRUE to carry on with the next element, %FALSE to ignore
+ *  the rest of the array
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is iterating over the #GVariant result of g_dbus_proxy_call_finish().
+ */
+
+/**
+ * dbus_g_proxy_end_call_foreach:
+ * @proxy: a proxy for a remote interface
+ * @call: the pending call ID from dbus_g_proxy_begin_call()
+ * @error: return location for an error
+ * @element_type: the #GType of each element of the returned array
+ * @func: called for each element
+ * @user_data: data to pass to @func
+ *
+ * Collects the results of a method call whose only "out" argument is an
+ * array, like dbus_g_proxy_end_call(), but instead of building the whole
+ * array in memory, decodes one element at a time and passes it to @func.
+ * Each element is freed as soon as @func returns, so the memory needed is
+ * roughly that of the reply message plus one element, however long the
+ * array is.
+ *
+ * For instance, the elements of a method returning
+ * <literal>a(ssx)</literal> could be received with an @element_type of
+ * <literal>dbus_g_type_get_struct ("GValueArray", G_TYPE_STRING,
+ * G_TYPE_STRING, G_TYPE_INT64, G_TYPE_INVALID)</literal>. Arrays of dict
+ * entries (that is, maps) can't be received this way.
+ *
+ * If an element can't be converted to @element_type, @error is set and
+ * %FALSE is returned, although @func might already have been called for
+ * earlier elements.
+ *
+ * Returns: %TRUE on success, including if @func stopped the iteration
+ *  early
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is g_dbus_proxy_call_finish().
+ */
+gboolean
+dbus_g_proxy_end_call_foreach (DBusGProxy            *proxy,
+                               DBusGProxyCall        *call,
+                               GError               **error,
+                               GType                  element_type,
+                               DBusGProxyElementFunc  func,
+                               gpointer               user_data)
+{
+  DBusGProxyPrivate *priv;
+  DBusMessage *reply;
+  DBusMessageIter msgiter;
+  DBusMessageIter subiter;
+  DBusError derror;
+  DBusGValueMarshalCtx context;
+  gboolean ret = FALSE;
+  guint call_id;
+  guint i;
+
+  g_return_val_if_fail (DBUS_IS_G_PROXY (proxy), FALSE);
+  g_return_val_if_fail (element_type != G_TYPE_INVALID, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
+  call_id = GPOINTER_TO_UINT (call);
+
+  if (call_id == 0)
+    {
+      /* See dbus_g_proxy_end_call_internal() */
+      g_set_error (error, DBUS_GERROR, DBUS_GERROR_DISCONNECTED,
+          "Disconnected from D-Bus (or argument error during call)");
+      return FALSE;
+    }
+
+  reply = dbus_g_proxy_steal_call_reply (proxy, call_id);
+
+  dbus_error_init (&derror);
+
+  switch (dbus_message_get_type (reply))
+    {
+    case DBUS_MESSAGE_TYPE_METHOD_RETURN:
+      break;
+    case DBUS_MESSAGE_TYPE_ERROR:
+      dbus_set_error_from_message (&derror, reply);
+      dbus_set_g_error (error, &derror);
+      dbus_error_free (&derror);
+      goto out;
+    default:
+      dbus_set_error (&derror, DBUS_ERROR_FAILED,
+                      "Reply was neither a method return nor an exception");
+      dbus_set_g_error (error, &derror);
+      dbus_error_free (&derror);
+      goto out;
+    }
+
+  if (!dbus_message_iter_init (reply, &msgiter) ||
+      dbus_message_iter_get_arg_type (&msgiter) != DBUS_TYPE_ARRAY ||
+      dbus_message_iter_get_element_type (&msgiter) == DBUS_TYPE_DICT_ENTRY ||
+      dbus_message_iter_has_next (&msgiter))
+    {
+      g_set_error (error, DBUS_GERROR,
+                   DBUS_GERROR_INVALID_ARGS,
+                   "Expected a single array (not a map) in reply, got \"%s\"",
+                   dbus_message_get_signature (reply));
+      goto out;
+    }
+
+  context.recursion_depth = 0;
+  context.gconnection = DBUS_G_CONNECTION_FROM_CONNECTION (priv->manager->connection);
+  context.proxy = proxy;
+  context.message = reply;
+
+  dbus_message_iter_recurse (&msgiter, &subiter);
+
+  for (i = 0;
+       dbus_message_iter_get_arg_type (&subiter) != DBUS_TYPE_INVALID;
+       i++, dbus_message_iter_next (&subiter))
+    {
+      GValue element = { 0, };
+      gboolean carry_on;
+
+      g_value_init (&element, element_type);
+
+      if (!_dbus_gvalue_demarshal (&context, &subiter, &element, error))
+        {
+          g_value_unset (&element);
+          goto out;
+        }
+
+      carry_on = func (proxy, i, &element, user_data);
+      g_value_unset (&element);
+
+      if (!carry_on)
+        break;
+    }
+
+  ret = TRUE;
+ out:
+  dbus_message_unref (reply);
+  return ret;
+}
+
+/**
+ * dbus_g_proxy_end_call_typed:
+ * @proxy: a proxy for a remote interface
+ * @call: the pending call ID from dbus_g_proxy_begin_call() or
+ *    dbus_g_proxy_begin_call_typed()
+ * @error: return location for an error
+ * @out_types: the types of the "out" arguments, terminated by
+ *    %G_TYPE_INVALID
+ * @out_args: locations for the "out" arguments, as for
+ *    dbus_g_proxy_call_typed()
+ *
+ * Equivalent to dbus_g_proxy_end_call(), but takes the argument types
+ * and return locations as arrays, like dbus_g_proxy_call_typed().
+ *
+ * Returns: %TRUE on success
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is g_dbus_proxy_call_finish().
+ */
+gboolean
+dbus_g_proxy_end_call_typed (DBusGProxy        *proxy,
+                             DBusGProxyCall    *call,
+                             GError           **error,
+                             const GType       *out_types,
+                             gpointer const    *out_args)
+{
+  g_return_val_if_fail (DBUS_IS_G_PROXY (proxy), FALSE);
+  g_return_val_if_fail (out_types != NULL, FALSE);
+
+  return dbus_g_proxy_end_call_typed_internal (proxy, GPOINTER_TO_UINT (call),
+      error, out_types, out_args);
+}
+
 /**
  * dbus_g_proxy_call:
  * @proxy: a proxy for a remote interface
@@ -2949,9 +3557,115 @@ dbus_g_proxy_call_no_reply (DBusGProxy               *proxy,
 
   dbus_message_set_no_reply (message, TRUE);
 
-  if (!dbus_connection_send (priv->manager->connection,
-                             message,
-                             NULL))
+  if (!_dbus_g_connection_send (priv->manager->connection, message))
+    oom ();
+
+  dbus_message_unref (message);
+}
+
+/**
+ * dbus_g_proxy_call_typed:
+ * @proxy: a proxy for a remote interface
+ * @method: method to invoke
+ * @error: return location for an error
+ * @in_types: the types of the "in" arguments, terminated by
+ *    %G_TYPE_INVALID
+ * @in_args: for each type in @in_types, a pointer to the variable holding
+ *    the value that would be passed to dbus_g_proxy_call() for it; may be
+ *    %NULL if there are no "in" arguments
+ * @out_types: the types of the "out" arguments, terminated by
+ *    %G_TYPE_INVALID
+ * @out_args: for each type in @out_types, the location that would be
+ *    passed to dbus_g_proxy_call() for it, or %NULL to ignore that
+ *    argument; may be %NULL if there are no "out" arguments
+ *
+ * Equivalent to dbus_g_proxy_call(), but takes the argument types and
+ * values as arrays instead of a variable argument list. The type arrays
+ * can be built once and reused for every call, and arguments of basic
+ * types are copied straight between the message and the variables,
+ * without going through a #GValue.
+ *
+ * This is mainly intended for the client glue generated by
+ * dbus-binding-tool.
+ *
+ * Returns: %TRUE if the method succeeds, %FALSE if it fails
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is g_dbus_proxy_call_sync().
+ */
+gboolean
+dbus_g_proxy_call_typed (DBusGProxy          *proxy,
+                         const char          *method,
+                         GError             **error,
+                         const GType         *in_types,
+                         const gconstpointer *in_args,
+                         const GType         *out_types,
+                         gpointer const      *out_args)
+{
+  DBusMessage *message;
+  guint call_id = 0;
+  DBusGProxyPrivate *priv;
+
+  g_return_val_if_fail (DBUS_IS_G_PROXY (proxy), FALSE);
+  g_return_val_if_fail (!DBUS_G_PROXY_DESTROYED (proxy), FALSE);
+  g_return_val_if_fail (g_dbus_is_member_name (method), FALSE);
+  g_return_val_if_fail (in_types != NULL, FALSE);
+  g_return_val_if_fail (out_types != NULL, FALSE);
+
+  priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
+
+  message = dbus_g_proxy_marshal_typed_args_to_message (proxy, method,
+      in_types, in_args);
+
+  /* can only happen on a programming error or OOM; we already critical'd */
+  if (message != NULL)
+    call_id = dbus_g_proxy_send_call (proxy, message, NULL, NULL, NULL,
+        priv->default_timeout);
+
+  return dbus_g_proxy_end_call_typed_internal (proxy, call_id, error,
+      out_types, out_args);
+}
+
+/**
+ * dbus_g_proxy_call_no_reply_typed:
+ * @proxy: a proxy for a remote interface
+ * @method: the name of the method to invoke
+ * @in_types: the types of the arguments, terminated by %G_TYPE_INVALID
+ * @in_args: pointers to the argument values, as for
+ *    dbus_g_proxy_call_typed()
+ *
+ * Equivalent to dbus_g_proxy_call_no_reply(), but takes the argument
+ * types and values as arrays, like dbus_g_proxy_call_typed().
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is g_dbus_proxy_call() with @callback = %NULL.
+ */
+void
+dbus_g_proxy_call_no_reply_typed (DBusGProxy          *proxy,
+                                  const char          *method,
+                                  const GType         *in_types,
+                                  const gconstpointer *in_args)
+{
+  DBusMessage *message;
+  DBusGProxyPrivate *priv;
+
+  g_return_if_fail (DBUS_IS_G_PROXY (proxy));
+  g_return_if_fail (g_dbus_is_member_name (method));
+  g_return_if_fail (!DBUS_G_PROXY_DESTROYED (proxy));
+  g_return_if_fail (in_types != NULL);
+
+  priv = DBUS_G_PROXY_GET_PRIVATE(proxy);
+
+  message = dbus_g_proxy_marshal_typed_args_to_message (proxy, method,
+      in_types, in_args);
+
+  /* can only happen on a programming error or OOM; we already critical'd */
+  if (!message)
+    return;
+
+  dbus_message_set_no_reply (message, TRUE);
+
+  if (!_dbus_g_connection_send (priv->manager->connection, message))
     oom ();
 
   dbus_message_unref (message);
@@ -3055,6 +3769,19 @@ dbus_g_proxy_send (DBusGProxy          *proxy,
         g_error ("Out of memory");
     }
   
+  if (client_serial == NULL)
+    {
+      if (!_dbus_g_connection_send (priv->manager->connection, message))
+        g_error ("Out of memory\n");
+
+      return;
+    }
+
+  /* The serial is only assigned when it is really sent, so this one
+   * can't be held back, and nothing that was can be allowed to be
+   * overtaken by it */
+  _dbus_g_connection_flush_corked (priv->manager->connection);
+
   if (!dbus_connection_send (priv->manager->connection, message, client_serial))
     g_error ("Out of memory\n");
 }
@@ -0,0 +1,510 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gserver-workers.c: spreading a DBusServer's connections over threads
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+#include "dbus-gmain/dbus-gmain.h"
+
+typedef struct
+{
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+  guint n_connections;          /**< protected by DBusGServerWorkers.lock */
+} DBusGServerWorker;
+
+struct _DBusGServerWorkers
+{
+  DBusServer *server;
+  DBusGServerWorkersPolicy policy;
+  DBusGServerWorkersNewConnectionFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+
+  guint n_workers;
+  DBusGServerWorker *workers;
+
+  GMutex lock;
+  /* DBusConnection * (owned) => DBusGServerWorker *, protected by lock */
+  GHashTable *connections;
+  guint next_worker;            /**< for round-robin, protected by lock */
+};
+
+typedef struct
+{
+  DBusConnection *connection;
+  GMainContext *context;
+} MoveConnection;
+
+static gpointer
+worker_thread (gpointer data)
+{
+  DBusGServerWorker *worker = data;
+
+  g_main_context_push_thread_default (worker->context);
+  g_main_loop_run (worker->loop);
+  g_main_context_pop_thread_default (worker->context);
+
+  return NULL;
+}
+
+/* Must be called with workers->lock held */
+static DBusGServerWorker *
+choose_worker (DBusGServerWorkers *workers)
+{
+  DBusGServerWorker *best;
+  guint i;
+
+  if (workers->policy == DBUS_G_SERVER_WORKERS_ROUND_ROBIN)
+    {
+      best = &workers->workers[workers->next_worker];
+      workers->next_worker = (workers->next_worker + 1) % workers->n_workers;
+      return best;
+    }
+
+  best = &workers->workers[0];
+
+  for (i = 1; i < workers->n_workers; i++)
+    {
+      if (workers->workers[i].n_connections < best->n_connections)
+        best = &workers->workers[i];
+    }
+
+  return best;
+}
+
+/* Forget about connections when they disconnect, so that they stop
+ * counting towards their worker's load */
+static DBusHandlerResult
+connection_filter (DBusConnection *connection,
+                   DBusMessage    *message,
+                   void           *user_data)
+{
+  DBusGServerWorkers *workers = user_data;
+  DBusGServerWorker *worker;
+  gboolean found;
+
+  if (!dbus_message_is_signal (message, DBUS_INTERFACE_LOCAL, "Disconnected"))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  g_mutex_lock (&workers->lock);
+
+  worker = g_hash_table_lookup (workers->connections, connection);
+  found = (worker != NULL);
+
+  if (found)
+    {
+      worker->n_connections--;
+      g_hash_table_steal (workers->connections, connection);
+    }
+
+  g_mutex_unlock (&workers->lock);
+
+  dbus_connection_remove_filter (connection, connection_filter, workers);
+
+  if (found)
+    dbus_connection_unref (connection);
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+new_connection (DBusServer     *server,
+                DBusConnection *connection,
+                void           *data)
+{
+  DBusGServerWorkers *workers = data;
+  DBusGServerWorker *worker;
+
+  g_mutex_lock (&workers->lock);
+  worker = choose_worker (workers);
+  worker->n_connections++;
+  g_hash_table_insert (workers->connections,
+                       dbus_connection_ref (connection), worker);
+  g_mutex_unlock (&workers->lock);
+
+  dbus_connection_set_exit_on_disconnect (connection, FALSE);
+
+  if (!dbus_connection_add_filter (connection, connection_filter, workers,
+                                   NULL))
+    g_error ("no memory setting up connection filter");
+
+  /* Nothing is dispatched until the connection is attached to the
+   * worker's context, so objects registered here will see every
+   * message */
+  if (workers->func != NULL)
+    workers->func (connection, worker->context, workers->user_data);
+
+  dbus_connection_setup_with_g_main (connection, worker->context);
+}
+
+/**
+ * DBusGServerWorkers:
+ *
+ * A set of threads, each running its own #GMainContext, among which
+ * the connections accepted by a #DBusServer are shared out.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * DBusGServerWorkersPolicy:
+ * @DBUS_G_SERVER_WORKERS_ROUND_ROBIN: give each new connection to the
+ *  next worker in turn
+ * @DBUS_G_SERVER_WORKERS_LEAST_LOADED: give each new connection to the
+ *  worker with the fewest connections
+ *
+ * How a #DBusGServerWorkers chooses a worker for a new connection.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * DBusGServerWorkersNewConnectionFunc:
+ * @connection: the new connection
+ * @context: the worker's main context
+ * @user_data: the data passed to dbus_g_server_workers_new()
+ *
+ * Called for each new connection, in the thread that dispatches the
+ * server, after the connection has been given to a worker but before
+ * anything is dispatched on it. This is the place to register objects
+ * on the connection.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * dbus_g_server_workers_new:
+ * @server: a server
+ * @n_workers: the number of worker threads, or 0 for one per processor
+ * @policy: how to choose a worker for each new connection
+ * @func: (allow-none): called for each new connection
+ * @user_data: data for @func
+ * @notify: (allow-none): frees @user_data
+ *
+ * Starts @n_workers threads, each running a main loop in its own
+ * #GMainContext, and sets @server's new connection function so that
+ * each connection it accepts is set up with the main context of one of
+ * them, as if by dbus_connection_setup_with_g_main(). The server itself
+ * still has to be set up with dbus_server_setup_with_g_main() as usual.
+ *
+ * This lets a peer-to-peer server with many clients use more than one
+ * processor. Method calls on objects registered on a connection are
+ * dispatched in that connection's worker thread, so those objects must
+ * be safe to use from it; dbus_g_thread_init() must have been called.
+ *
+ * Returns: the new workers, to be freed with dbus_g_server_workers_free()
+ * Deprecated: New code should use GDBus instead.
+ */
+DBusGServerWorkers *
+dbus_g_server_workers_new (DBusServer                          *server,
+                           guint                                n_workers,
+                           DBusGServerWorkersPolicy             policy,
+                           DBusGServerWorkersNewConnectionFunc  func,
+                           gpointer                             user_data,
+                           GDestroyNotify                       notify)
+{
+  DBusGServerWorkers *workers;
+  guint i;
+
+  g_return_val_if_fail (server != NULL, NULL);
+  g_return_val_if_fail (policy == DBUS_G_SERVER_WORKERS_ROUND_ROBIN ||
+                        policy == DBUS_G_SERVER_WORKERS_LEAST_LOADED, NULL);
+
+  if (n_workers == 0)
+    n_workers = g_get_num_processors ();
+
+  workers = g_new0 (DBusGServerWorkers, 1);
+  workers->server = dbus_server_ref (server);
+  workers->policy = policy;
+  workers->func = func;
+  workers->user_data = user_data;
+  workers->notify = notify;
+  workers->n_workers = n_workers;
+  workers->workers = g_new0 (DBusGServerWorker, n_workers);
+  g_mutex_init (&workers->lock);
+  workers->connections = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  for (i = 0; i < n_workers; i++)
+    {
+      DBusGServerWorker *worker = &workers->workers[i];
+      gchar *name = g_strdup_printf ("dbus-glib worker %u", i);
+
+      worker->context = g_main_context_new ();
+      worker->loop = g_main_loop_new (worker->context, FALSE);
+      worker->thread = g_thread_new (name, worker_thread, worker);
+      g_free (name);
+    }
+
+  dbus_server_set_new_connection_function (server, new_connection, workers,
+                                           NULL);
+
+  return workers;
+}
+
+/**
+ * dbus_g_server_workers_free:
+ * @workers: the workers
+ *
+ * Stops giving new connections to @workers, closes the connections they
+ * have, stops the threads and frees @workers. This must not be called
+ * from one of the worker threads.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_server_workers_free (DBusGServerWorkers *workers)
+{
+  GHashTableIter iter;
+  gpointer key;
+  guint i;
+
+  g_return_if_fail (workers != NULL);
+
+  dbus_server_set_new_connection_function (workers->server, NULL, NULL, NULL);
+
+  g_mutex_lock (&workers->lock);
+  g_hash_table_iter_init (&iter, workers->connections);
+
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      DBusConnection *connection = key;
+
+      g_hash_table_iter_steal (&iter);
+      dbus_connection_remove_filter (connection, connection_filter, workers);
+      dbus_connection_close (connection);
+      dbus_connection_unref (connection);
+    }
+
+  g_mutex_unlock (&workers->lock);
+
+  for (i = 0; i < workers->n_workers; i++)
+    {
+      DBusGServerWorker *worker = &workers->workers[i];
+
+      g_main_loop_quit (worker->loop);
+      g_thread_join (worker->thread);
+      g_main_loop_unref (worker->loop);
+      g_main_context_unref (worker->context);
+    }
+
+  if (workers->notify != NULL)
+    workers->notify (workers->user_data);
+
+  g_hash_table_unref (workers->connections);
+  g_mutex_clear (&workers->lock);
+  g_free (workers->workers);
+  dbus_server_unref (workers->server);
+  g_free (workers);
+}
+
+/**
+ * dbus_g_server_workers_get_n_workers:
+ * @workers: the workers
+ *
+ * Returns: the number of worker threads
+ * Deprecated: New code should use GDBus instead.
+ */
+guint
+dbus_g_server_workers_get_n_workers (DBusGServerWorkers *workers)
+{
+  g_return_val_if_fail (workers != NULL, 0);
+
+  return workers->n_workers;
+}
+
+/**
+ * dbus_g_server_workers_get_context:
+ * @workers: the workers
+ * @index: a worker, less than dbus_g_server_workers_get_n_workers()
+ *
+ * Returns: (transfer none): the main context run by the worker
+ * Deprecated: New code should use GDBus instead.
+ */
+GMainContext *
+dbus_g_server_workers_get_context (DBusGServerWorkers *workers,
+                                   guint               index)
+{
+  g_return_val_if_fail (workers != NULL, NULL);
+  g_return_val_if_fail (index < workers->n_workers, NULL);
+
+  return workers->workers[index].context;
+}
+
+/**
+ * dbus_g_server_workers_get_n_connections:
+ * @workers: the workers
+ * @index: a worker, less than dbus_g_server_workers_get_n_workers()
+ *
+ * Returns: the number of connected connections given to the worker
+ * Deprecated: New code should use GDBus instead.
+ */
+guint
+dbus_g_server_workers_get_n_connections (DBusGServerWorkers *workers,
+                                         guint               index)
+{
+  guint ret;
+
+  g_return_val_if_fail (workers != NULL, 0);
+  g_return_val_if_fail (index < workers->n_workers, 0);
+
+  g_mutex_lock (&workers->lock);
+  ret = workers->workers[index].n_connections;
+  g_mutex_unlock (&workers->lock);
+
+  return ret;
+}
+
+/**
+ * dbus_g_server_workers_get_connection_worker:
+ * @workers: the workers
+ * @connection: a connection
+ *
+ * Returns: the index of the worker that @connection was given to, or -1
+ *  if it is not one of @workers' connections or has disconnected
+ * Deprecated: New code should use GDBus instead.
+ */
+gint
+dbus_g_server_workers_get_connection_worker (DBusGServerWorkers *workers,
+                                             DBusConnection     *connection)
+{
+  DBusGServerWorker *worker;
+  gint ret = -1;
+
+  g_return_val_if_fail (workers != NULL, -1);
+  g_return_val_if_fail (connection != NULL, -1);
+
+  g_mutex_lock (&workers->lock);
+  worker = g_hash_table_lookup (workers->connections, connection);
+
+  if (worker != NULL)
+    ret = worker - workers->workers;
+
+  g_mutex_unlock (&workers->lock);
+
+  return ret;
+}
+
+static void
+move_connection_free (gpointer data)
+{
+  MoveConnection *move = data;
+
+  dbus_connection_unref (move->connection);
+  g_main_context_unref (move->context);
+  g_slice_free (MoveConnection, move);
+}
+
+/* Runs in the thread of the connection's old worker, so that its old
+ * main loop integration is torn down where it is being dispatched */
+static gboolean
+move_connection_cb (gpointer data)
+{
+  MoveConnection *move = data;
+  GMainContext *current;
+
+  current = _dbus_g_get_connection_context (move->connection);
+
+  if (current != NULL && current != move->context &&
+      !g_main_context_is_owner (current))
+    {
+      MoveConnection *again;
+
+      /* An earlier move finished after this one was queued, so the
+       * connection is now somewhere else: follow it */
+      again = g_slice_new (MoveConnection);
+      again->connection = dbus_connection_ref (move->connection);
+      again->context = g_main_context_ref (move->context);
+      g_main_context_invoke_full (current, G_PRIORITY_DEFAULT,
+                                  move_connection_cb, again,
+                                  move_connection_free);
+      return FALSE;
+    }
+
+  dbus_connection_setup_with_g_main (move->connection, move->context);
+
+  return FALSE;
+}
+
+/**
+ * dbus_g_server_workers_move_connection:
+ * @workers: the workers
+ * @connection: one of @workers' connections
+ * @index: a worker, less than dbus_g_server_workers_get_n_workers()
+ *
+ * Moves @connection to a different worker, for instance to even out
+ * the load after many clients of one worker have disconnected. The
+ * move happens asynchronously, in the thread of the worker that
+ * @connection is leaving. Messages that arrive in the meantime are
+ * not lost.
+ *
+ * Returns: %FALSE if @connection is not one of @workers' connections
+ *  or has disconnected
+ * Deprecated: New code should use GDBus instead.
+ */
+gboolean
+dbus_g_server_workers_move_connection (DBusGServerWorkers *workers,
+                                       DBusConnection     *connection,
+                                       guint               index)
+{
+  DBusGServerWorker *old_worker;
+  DBusGServerWorker *new_worker;
+  MoveConnection *move;
+
+  g_return_val_if_fail (workers != NULL, FALSE);
+  g_return_val_if_fail (connection != NULL, FALSE);
+  g_return_val_if_fail (index < workers->n_workers, FALSE);
+
+  new_worker = &workers->workers[index];
+
+  g_mutex_lock (&workers->lock);
+  old_worker = g_hash_table_lookup (workers->connections, connection);
+
+  if (old_worker == NULL)
+    {
+      g_mutex_unlock (&workers->lock);
+      return FALSE;
+    }
+
+  if (old_worker == new_worker)
+    {
+      g_mutex_unlock (&workers->lock);
+      return TRUE;
+    }
+
+  old_worker->n_connections--;
+  new_worker->n_connections++;
+  g_hash_table_insert (workers->connections, connection, new_worker);
+  g_mutex_unlock (&workers->lock);
+
+  move = g_slice_new (MoveConnection);
+  move->connection = dbus_connection_ref (connection);
+  move->context = g_main_context_ref (new_worker->context);
+
+  g_main_context_invoke_full (old_worker->context, G_PRIORITY_DEFAULT,
+                              move_connection_cb, move,
+                              move_connection_free);
+
+  return TRUE;
+}
@@ -219,3 +219,129 @@ _dbus_gtypes_from_arg_signature (const char *argsig, gboolean is_client)
     }
   return ret;
 }
+
+/*
+ * Signature → GType memoization.
+ *
+ * Resolving a container signature goes through dbus_g_type_get_map() and
+ * friends, which build a specialization name and look it up by string
+ * every time. Peers tend to send the same handful of variant and signal
+ * signatures over and over, so remember the result. Types are never
+ * unregistered, so a cached entry can't go stale; the tables are merely
+ * cleared when they grow past SIGNATURE_CACHE_MAX_ENTRIES so a peer
+ * sending arbitrary signatures can't make them grow without bound.
+ */
+#define SIGNATURE_CACHE_MAX_ENTRIES 256
+
+G_LOCK_DEFINE_STATIC (signature_cache);
+/* indexed by is_client; signature → GType */
+static GHashTable *signature_type_cache[2] = { NULL, NULL };
+/* indexed by is_client; signature → GArray of GType */
+static GHashTable *signature_types_cache[2] = { NULL, NULL };
+
+static GHashTable *
+signature_cache_get (GHashTable      **tables,
+                     gboolean          is_client,
+                     GDestroyNotify    value_destroy)
+{
+  GHashTable **table = &tables[is_client ? 1 : 0];
+
+  if (*table == NULL)
+    *table = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                    g_free, value_destroy);
+  else if (g_hash_table_size (*table) >= SIGNATURE_CACHE_MAX_ENTRIES)
+    g_hash_table_remove_all (*table);
+
+  return *table;
+}
+
+/**
+ * _dbus_gtype_from_signature_cached:
+ * @signature: a single complete type signature
+ * @is_client: as for _dbus_gtype_from_signature()
+ *
+ * Like _dbus_gtype_from_signature(), but remembers the result. Safe to
+ * call from any thread.
+ *
+ * Returns: the #GType, or %G_TYPE_INVALID
+ */
+GType
+_dbus_gtype_from_signature_cached (const char *signature,
+                                   gboolean    is_client)
+{
+  GHashTable *table;
+  gpointer found;
+  GType ret;
+
+  G_LOCK (signature_cache);
+  table = signature_type_cache[is_client ? 1 : 0];
+
+  if (table != NULL &&
+      g_hash_table_lookup_extended (table, signature, NULL, &found))
+    {
+      G_UNLOCK (signature_cache);
+      return (GType) GPOINTER_TO_SIZE (found);
+    }
+
+  G_UNLOCK (signature_cache);
+
+  /* Don't hold the lock while resolving: this can register new
+   * specialized types, which takes locks of its own. Two threads racing
+   * to insert the same signature will compute the same GType. */
+  ret = _dbus_gtype_from_signature (signature, is_client);
+
+  G_LOCK (signature_cache);
+  table = signature_cache_get (signature_type_cache, is_client, NULL);
+  g_hash_table_insert (table, g_strdup (signature),
+                       GSIZE_TO_POINTER ((gsize) ret));
+  G_UNLOCK (signature_cache);
+
+  return ret;
+}
+
+/**
+ * _dbus_gtypes_from_arg_signature_cached:
+ * @signature: a sequence of complete type signatures
+ * @is_client: as for _dbus_gtypes_from_arg_signature()
+ *
+ * Like _dbus_gtypes_from_arg_signature(), but the returned array is
+ * shared with the cache and must be treated as read-only. Safe to call
+ * from any thread.
+ *
+ * Returns: a new reference to an array of #GType; release it with
+ *  g_array_unref()
+ */
+GArray *
+_dbus_gtypes_from_arg_signature_cached (const char *signature,
+                                        gboolean    is_client)
+{
+  GHashTable *table;
+  GArray *ret;
+
+  G_LOCK (signature_cache);
+  table = signature_types_cache[is_client ? 1 : 0];
+
+  if (table != NULL)
+    {
+      ret = g_hash_table_lookup (table, signature);
+
+      if (ret != NULL)
+        {
+          g_array_ref (ret);
+          G_UNLOCK (signature_cache);
+          return ret;
+        }
+    }
+
+  G_UNLOCK (signature_cache);
+
+  ret = _dbus_gtypes_from_arg_signature (signature, is_client);
+
+  G_LOCK (signature_cache);
+  table = signature_cache_get (signature_types_cache, is_client,
+                               (GDestroyNotify) g_array_unref);
+  g_hash_table_insert (table, g_strdup (signature), g_array_ref (ret));
+  G_UNLOCK (signature_cache);
+
+  return ret;
+}
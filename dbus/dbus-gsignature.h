@@ -39,4 +39,10 @@ GType          _dbus_gtype_from_signature_iter (DBusSignatureIter       *sigiter
 GArray *       _dbus_gtypes_from_arg_signature (const char              *signature,
 						gboolean                 is_client);
 
+GType          _dbus_gtype_from_signature_cached (const char            *signature,
+						 gboolean               is_client);
+
+GArray *       _dbus_gtypes_from_arg_signature_cached (const char       *signature,
+						      gboolean          is_client);
+
 #endif
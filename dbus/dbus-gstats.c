@@ -0,0 +1,515 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gstats.c: per-method call statistics for exported objects
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+#include <string.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+#include "dbus-gcork.h"
+#include "dbus-gstats.h"
+#include "dbus-gutils.h"
+
+#define STATS_PATH "/org/freedesktop/DBus/GLib/Stats"
+#define STATS_INTERFACE "org.freedesktop.DBus.GLib.Stats"
+
+/* Latencies are counted in log-linear buckets, like HdrHistogram: below
+ * SUB_BUCKETS microseconds there is one bucket per microsecond, and above
+ * that each power of two is split into SUB_BUCKETS equal parts, up to
+ * 2**(MAX_EXPONENT + 1) microseconds (a bit over an hour). This keeps the
+ * relative error below 25% with a fixed number of counters. */
+#define SUB_BUCKET_BITS 2
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_EXPONENT 31
+#define N_BUCKETS (SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+typedef struct {
+  GType gtype;
+  /* uniquely identifies the interface and method */
+  gconstpointer method_id;
+  const char *interface;
+  const char *method;
+  guint64 calls;
+  guint64 errors;
+  guint64 total_usec;
+  guint64 demarshal_usec;
+  guint64 marshal_usec;
+  guint64 buckets[N_BUCKETS];
+} MethodStatsEntry;
+
+static volatile gint stats_enabled = FALSE;
+
+G_LOCK_DEFINE_STATIC (method_stats);
+/* MethodStatsEntry => itself */
+static GHashTable *method_stats = NULL;
+
+static void
+oom (void)
+{
+  g_error ("no memory");
+}
+
+static guint
+method_stats_entry_hash (gconstpointer p)
+{
+  const MethodStatsEntry *entry = p;
+
+  return g_direct_hash (entry->method_id) ^ (guint) entry->gtype;
+}
+
+static gboolean
+method_stats_entry_equal (gconstpointer a,
+                          gconstpointer b)
+{
+  const MethodStatsEntry *ea = a;
+  const MethodStatsEntry *eb = b;
+
+  return ea->gtype == eb->gtype && ea->method_id == eb->method_id;
+}
+
+static guint
+bucket_for_usec (guint64 usec)
+{
+  gint exponent;
+
+  if (usec < SUB_BUCKETS)
+    return (guint) usec;
+
+  if (usec >= (G_GUINT64_CONSTANT (1) << (MAX_EXPONENT + 1)))
+    return N_BUCKETS - 1;
+
+  exponent = g_bit_nth_msf ((gulong) usec, -1);
+
+  return SUB_BUCKETS + (exponent - SUB_BUCKET_BITS) * SUB_BUCKETS
+    + ((usec >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+gboolean
+_dbus_g_method_stats_enabled (void)
+{
+  return g_atomic_int_get (&stats_enabled);
+}
+
+void
+_dbus_g_method_stats_record (GType          gtype,
+                             gconstpointer  method_id,
+                             const char    *interface,
+                             const char    *method,
+                             gboolean       is_error,
+                             gint64         total_usec,
+                             gint64         demarshal_usec,
+                             gint64         marshal_usec)
+{
+  MethodStatsEntry key;
+  MethodStatsEntry *entry;
+
+  key.gtype = gtype;
+  key.method_id = method_id;
+
+  G_LOCK (method_stats);
+
+  if (method_stats == NULL)
+    method_stats = g_hash_table_new_full (method_stats_entry_hash,
+                                          method_stats_entry_equal,
+                                          NULL, g_free);
+
+  entry = g_hash_table_lookup (method_stats, &key);
+
+  if (entry == NULL)
+    {
+      entry = g_new0 (MethodStatsEntry, 1);
+      entry->gtype = gtype;
+      entry->method_id = method_id;
+      entry->interface = interface;
+      entry->method = method;
+      g_hash_table_add (method_stats, entry);
+    }
+
+  entry->calls++;
+
+  if (is_error)
+    entry->errors++;
+
+  entry->total_usec += MAX (total_usec, 0);
+  entry->demarshal_usec += MAX (demarshal_usec, 0);
+  entry->marshal_usec += MAX (marshal_usec, 0);
+  entry->buckets[bucket_for_usec (MAX (total_usec, 0))]++;
+
+  G_UNLOCK (method_stats);
+}
+
+/**
+ * DBusGMethodStats:
+ * @type: the #GType of the objects on which the method was called
+ * @interface: the D-Bus interface
+ * @method: the D-Bus method name
+ * @calls: the number of calls
+ * @errors: the number of calls that failed, including calls whose arguments
+ *  could not be demarshalled
+ * @total_usec: the total time spent handling calls, in microseconds; for
+ *  asynchronous methods, this is measured until the reply is sent
+ * @demarshal_usec: the part of @total_usec spent converting arguments;
+ *  always 0 for methods generated with
+ *  <literal>dbus-binding-tool --mode=glib-server-direct</literal>, which
+ *  do this as part of the call
+ * @marshal_usec: the part of @total_usec spent converting return values,
+ *  likewise
+ * @n_buckets: the number of elements in @buckets
+ * @buckets: a histogram of the time spent handling each call, with
+ *  boundaries given by dbus_g_method_stats_get_bucket_start()
+ *
+ * Statistics about one method of one type of exported object, collected
+ * when enabled with dbus_glib_global_set_method_stats_enabled().
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * DBusGMethodStatsFunc:
+ * @stats: statistics for one method, valid until the function returns
+ * @user_data: user data passed to dbus_g_method_stats_foreach()
+ *
+ * Called by dbus_g_method_stats_foreach() for each method that has
+ * been called.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+
+/**
+ * dbus_glib_global_set_method_stats_enabled:
+ * @enabled: %TRUE to collect statistics
+ *
+ * Enable or disable collection of statistics about calls to the methods of
+ * objects exported with dbus_g_connection_register_g_object(). They are
+ * disabled by default, since collecting them slows down each method call
+ * a little.
+ *
+ * Deprecated: New code should use GDBus instead. There is no direct
+ *  equivalent for this function.
+ */
+void
+dbus_glib_global_set_method_stats_enabled (gboolean enabled)
+{
+  g_atomic_int_set (&stats_enabled, enabled ? TRUE : FALSE);
+}
+
+/**
+ * dbus_g_method_stats_get_bucket_start:
+ * @bucket: a histogram bucket, less than #DBusGMethodStats.n_buckets
+ *
+ * Returns: the shortest call duration counted in @bucket, in microseconds;
+ *  the longest is one less than the start of the next bucket
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+guint64
+dbus_g_method_stats_get_bucket_start (guint bucket)
+{
+  guint exponent;
+  guint sub_bucket;
+
+  g_return_val_if_fail (bucket < N_BUCKETS, G_MAXUINT64);
+
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+
+  exponent = (bucket - SUB_BUCKETS) / SUB_BUCKETS + SUB_BUCKET_BITS;
+  sub_bucket = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+
+  return ((guint64) (SUB_BUCKETS + sub_bucket)) << (exponent - SUB_BUCKET_BITS);
+}
+
+/**
+ * dbus_g_method_stats_foreach:
+ * @func: function to call for each method
+ * @user_data: data to pass to @func
+ *
+ * Call @func with the statistics collected for each method that has been
+ * called since statistics were enabled or last reset.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_method_stats_foreach (DBusGMethodStatsFunc func,
+                             gpointer             user_data)
+{
+  GArray *snapshot;
+  guint i;
+
+  g_return_if_fail (func != NULL);
+
+  snapshot = g_array_new (FALSE, FALSE, sizeof (MethodStatsEntry));
+
+  /* Copy everything first, so that @func can call methods, or reset the
+   * statistics, without deadlocking */
+  G_LOCK (method_stats);
+
+  if (method_stats != NULL)
+    {
+      GHashTableIter iter;
+      gpointer entry;
+
+      g_hash_table_iter_init (&iter, method_stats);
+
+      while (g_hash_table_iter_next (&iter, &entry, NULL))
+        g_array_append_vals (snapshot, entry, 1);
+    }
+
+  G_UNLOCK (method_stats);
+
+  for (i = 0; i < snapshot->len; i++)
+    {
+      const MethodStatsEntry *entry;
+      DBusGMethodStats stats;
+
+      entry = &g_array_index (snapshot, MethodStatsEntry, i);
+
+      stats.type = entry->gtype;
+      stats.interface = entry->interface;
+      stats.method = entry->method;
+      stats.calls = entry->calls;
+      stats.errors = entry->errors;
+      stats.total_usec = entry->total_usec;
+      stats.demarshal_usec = entry->demarshal_usec;
+      stats.marshal_usec = entry->marshal_usec;
+      stats.n_buckets = N_BUCKETS;
+      stats.buckets = entry->buckets;
+
+      func (&stats, user_data);
+    }
+
+  g_array_free (snapshot, TRUE);
+}
+
+/**
+ * dbus_g_method_stats_reset:
+ *
+ * Discard all the statistics collected so far.
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_method_stats_reset (void)
+{
+  G_LOCK (method_stats);
+
+  if (method_stats != NULL)
+    g_hash_table_remove_all (method_stats);
+
+  G_UNLOCK (method_stats);
+}
+
+static const char stats_introspection[] =
+  DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE
+  "<node>\n"
+  "  <interface name=\"" DBUS_INTERFACE_INTROSPECTABLE "\">\n"
+  "    <method name=\"Introspect\">\n"
+  "      <arg name=\"data\" direction=\"out\" type=\"s\"/>\n"
+  "    </method>\n"
+  "  </interface>\n"
+  "  <interface name=\"" STATS_INTERFACE "\">\n"
+  "    <method name=\"GetMethodStats\">\n"
+  "      <arg name=\"stats\" direction=\"out\" type=\"a(ssstttttat)\"/>\n"
+  "    </method>\n"
+  "    <method name=\"GetBucketStarts\">\n"
+  "      <arg name=\"starts\" direction=\"out\" type=\"at\"/>\n"
+  "    </method>\n"
+  "    <method name=\"Reset\">\n"
+  "    </method>\n"
+  "  </interface>\n"
+  "</node>\n";
+
+static void
+append_method_stats (const DBusGMethodStats *stats,
+                     gpointer                user_data)
+{
+  DBusMessageIter *array_iter = user_data;
+  DBusMessageIter struct_iter;
+  DBusMessageIter buckets_iter;
+  const char *type_name;
+  const dbus_uint64_t *buckets = (const dbus_uint64_t *) stats->buckets;
+
+  type_name = g_type_name (stats->type);
+
+  if (!dbus_message_iter_open_container (array_iter, DBUS_TYPE_STRUCT, NULL,
+                                         &struct_iter)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+                                          &type_name)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+                                          &stats->interface)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_STRING,
+                                          &stats->method)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+                                          &stats->calls)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+                                          &stats->errors)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+                                          &stats->total_usec)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+                                          &stats->demarshal_usec)
+      || !dbus_message_iter_append_basic (&struct_iter, DBUS_TYPE_UINT64,
+                                          &stats->marshal_usec)
+      || !dbus_message_iter_open_container (&struct_iter, DBUS_TYPE_ARRAY,
+                                            DBUS_TYPE_UINT64_AS_STRING,
+                                            &buckets_iter)
+      || !dbus_message_iter_append_fixed_array (&buckets_iter,
+                                                DBUS_TYPE_UINT64, &buckets,
+                                                stats->n_buckets)
+      || !dbus_message_iter_close_container (&struct_iter, &buckets_iter)
+      || !dbus_message_iter_close_container (array_iter, &struct_iter))
+    oom ();
+}
+
+static DBusHandlerResult
+stats_message (DBusConnection *connection,
+               DBusMessage    *message,
+               void           *user_data)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter;
+  DBusMessageIter array_iter;
+
+  if (dbus_message_is_method_call (message, DBUS_INTERFACE_INTROSPECTABLE,
+                                   "Introspect"))
+    {
+      const char *xml = stats_introspection;
+
+      reply = dbus_message_new_method_return (message);
+
+      if (reply == NULL
+          || !dbus_message_append_args (reply, DBUS_TYPE_STRING, &xml,
+                                        DBUS_TYPE_INVALID))
+        oom ();
+    }
+  else if (dbus_message_is_method_call (message, STATS_INTERFACE,
+                                        "GetMethodStats"))
+    {
+      reply = dbus_message_new_method_return (message);
+
+      if (reply == NULL)
+        oom ();
+
+      dbus_message_iter_init_append (reply, &iter);
+
+      if (!dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                             "(ssstttttat)", &array_iter))
+        oom ();
+
+      dbus_g_method_stats_foreach (append_method_stats, &array_iter);
+
+      if (!dbus_message_iter_close_container (&iter, &array_iter))
+        oom ();
+    }
+  else if (dbus_message_is_method_call (message, STATS_INTERFACE,
+                                        "GetBucketStarts"))
+    {
+      dbus_uint64_t starts[N_BUCKETS];
+      const dbus_uint64_t *p = starts;
+      guint i;
+
+      for (i = 0; i < N_BUCKETS; i++)
+        starts[i] = dbus_g_method_stats_get_bucket_start (i);
+
+      reply = dbus_message_new_method_return (message);
+
+      if (reply == NULL)
+        oom ();
+
+      dbus_message_iter_init_append (reply, &iter);
+
+      if (!dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                             DBUS_TYPE_UINT64_AS_STRING,
+                                             &array_iter)
+          || !dbus_message_iter_append_fixed_array (&array_iter,
+                                                    DBUS_TYPE_UINT64, &p,
+                                                    N_BUCKETS)
+          || !dbus_message_iter_close_container (&iter, &array_iter))
+        oom ();
+    }
+  else if (dbus_message_is_method_call (message, STATS_INTERFACE, "Reset"))
+    {
+      dbus_g_method_stats_reset ();
+
+      reply = dbus_message_new_method_return (message);
+
+      if (reply == NULL)
+        oom ();
+    }
+  else
+    {
+      return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+
+  if (!dbus_message_get_no_reply (message)
+      && !_dbus_g_connection_send (connection, reply))
+    oom ();
+
+  dbus_message_unref (reply);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static const DBusObjectPathVTable stats_vtable = {
+  NULL,
+  stats_message,
+  NULL
+};
+
+/**
+ * dbus_g_connection_export_method_stats:
+ * @connection: the D-Bus connection
+ *
+ * Export the statistics collected while
+ * dbus_glib_global_set_method_stats_enabled() is in effect on @connection,
+ * as the <literal>org.freedesktop.DBus.GLib.Stats</literal> interface on
+ * the object path <literal>/org/freedesktop/DBus/GLib/Stats</literal>.
+ * Its methods are:
+ *
+ * <literal>GetMethodStats</literal>, returning an array of structs of
+ * type <literal>(ssstttttat)</literal>, one for each method that
+ * has been called: #GType name, interface, method, then the
+ * #DBusGMethodStats fields from @calls to @buckets.
+ *
+ * <literal>GetBucketStarts</literal>, returning the start of each
+ * histogram bucket in microseconds, as type <literal>at</literal>.
+ *
+ * <literal>Reset</literal>, which calls dbus_g_method_stats_reset().
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+void
+dbus_g_connection_export_method_stats (DBusGConnection *connection)
+{
+  DBusError error;
+
+  g_return_if_fail (connection != NULL);
+
+  dbus_error_init (&error);
+
+  if (!dbus_connection_try_register_object_path (
+        DBUS_CONNECTION_FROM_G_CONNECTION (connection), STATS_PATH,
+        &stats_vtable, NULL, &error))
+    {
+      g_warning ("Unable to export method statistics: %s: %s",
+                 error.name, error.message);
+      dbus_error_free (&error);
+    }
+}
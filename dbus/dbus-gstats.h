@@ -0,0 +1,43 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gstats.h: per-method call statistics for exported objects
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef DBUS_GLIB_STATS_H
+#define DBUS_GLIB_STATS_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+gboolean _dbus_g_method_stats_enabled (void);
+
+void     _dbus_g_method_stats_record  (GType          gtype,
+                                       gconstpointer  method_id,
+                                       const char    *interface,
+                                       const char    *method,
+                                       gboolean       is_error,
+                                       gint64         total_usec,
+                                       gint64         demarshal_usec,
+                                       gint64         marshal_usec);
+
+G_END_DECLS
+
+#endif /* DBUS_GLIB_STATS_H */
@@ -417,6 +417,18 @@ typedef struct {
 
 static GHashTable /* char * -> data* */ *specialized_containers;
 
+/* (container, GType[]) -> GType, so that resolving a specialization we
+ * have already seen needs neither an allocation nor a formatted name.
+ * Entries are never removed, since types are never unregistered. */
+typedef struct {
+  const DBusGTypeSpecializedContainer *klass;
+  guint num_types;
+  const GType *types;
+} DBusGTypeSpecializationKey;
+
+static GHashTable /* key* -> GType */ *specializations;
+static GRWLock specializations_lock;
+
 static GQuark
 specialized_type_data_quark ()
 {
@@ -427,6 +439,53 @@ specialized_type_data_quark ()
   return quark;
 }
 
+static guint
+specialization_key_hash (gconstpointer p)
+{
+  const DBusGTypeSpecializationKey *key = p;
+  guint hash;
+  guint i;
+
+  hash = g_direct_hash (key->klass) ^ key->num_types;
+
+  for (i = 0; i < key->num_types; i++)
+    hash = (hash * 31) + (guint) key->types[i];
+
+  return hash;
+}
+
+static gboolean
+specialization_key_equal (gconstpointer a,
+                          gconstpointer b)
+{
+  const DBusGTypeSpecializationKey *ka = a;
+  const DBusGTypeSpecializationKey *kb = b;
+
+  return ka->klass == kb->klass &&
+      ka->num_types == kb->num_types &&
+      memcmp (ka->types, kb->types, sizeof (GType) * ka->num_types) == 0;
+}
+
+static DBusGTypeSpecializationKey *
+specialization_key_new (const DBusGTypeSpecializedContainer *klass,
+                        guint                                num_types,
+                        const GType                         *types)
+{
+  DBusGTypeSpecializationKey *key;
+  GType *types_copy;
+
+  /* key and types in one block, so g_free() releases both */
+  key = g_malloc (sizeof (DBusGTypeSpecializationKey) +
+                  sizeof (GType) * num_types);
+  types_copy = (GType *) (key + 1);
+  memcpy (types_copy, types, sizeof (GType) * num_types);
+
+  key->klass = klass;
+  key->num_types = num_types;
+  key->types = types_copy;
+  return key;
+}
+
 static gpointer
 specialized_init (gpointer arg G_GNUC_UNUSED)
 {
@@ -434,6 +493,8 @@ specialized_init (gpointer arg G_GNUC_UNUSED)
 
   specialized_containers = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, NULL);
+  specializations = g_hash_table_new_full (specialization_key_hash,
+      specialization_key_equal, g_free, NULL);
 
   _dbus_g_type_specialized_builtins_init ();
   return NULL;
@@ -836,22 +897,50 @@ lookup_or_register_specialized (const char  *container,
   GType ret;
   char *name;
   const DBusGTypeSpecializedContainer *klass;
+  DBusGTypeSpecializationKey key;
 
   dbus_g_type_specialized_init();
 
   klass = g_hash_table_lookup (specialized_containers, container);
   g_return_val_if_fail (klass != NULL, G_TYPE_INVALID);
 
-  name = build_specialization_name (container, num_types, types);
-  ret = g_type_from_name (name);
+  key.klass = klass;
+  key.num_types = num_types;
+  key.types = types;
+
+  g_rw_lock_reader_lock (&specializations_lock);
+  ret = GPOINTER_TO_SIZE (g_hash_table_lookup (specializations, &key));
+  g_rw_lock_reader_unlock (&specializations_lock);
+
+  if (ret != G_TYPE_INVALID)
+    return ret;
+
+  g_rw_lock_writer_lock (&specializations_lock);
+
+  /* someone else might have registered it while we weren't holding
+   * the lock */
+  ret = GPOINTER_TO_SIZE (g_hash_table_lookup (specializations, &key));
+
   if (ret == G_TYPE_INVALID)
     {
-      /* Take ownership of name */
-      ret = register_specialized_instance (klass, name,
-					   num_types,
-					   types);
+      name = build_specialization_name (container, num_types, types);
+      ret = g_type_from_name (name);
+      if (ret == G_TYPE_INVALID)
+        {
+          /* Take ownership of name */
+          ret = register_specialized_instance (klass, name,
+                                               num_types,
+                                               types);
+        }
+      g_free (name);
+
+      if (ret != G_TYPE_INVALID)
+        g_hash_table_insert (specializations,
+                             specialization_key_new (klass, num_types, types),
+                             GSIZE_TO_POINTER ((gsize) ret));
     }
-  g_free (name);
+
+  g_rw_lock_writer_unlock (&specializations_lock);
   return ret;
 }
 
@@ -1180,8 +1269,10 @@ dbus_g_type_specialized_construct (GType gtype)
  * collection, or on a collection that does not have a @fixed_accessor in its
  * #DBusGTypeSpecializedCollectionVtable.
  *
- * Specialized #GArray<!---->s are the only types provided by dbus-glib that
- * can be used with this function; user-defined types might also work.
+ * Specialized #GArray<!---->s and the collections returned by
+ * dbus_g_type_get_packed_struct_collection() are the only types provided
+ * by dbus-glib that can be used with this function; user-defined types
+ * might also work.
  *
  * Returns: %TRUE on success
  *
@@ -1690,7 +1781,7 @@ dbus_g_value_type_build_g_variant_type (GType type)
     return g_variant_type_copy (G_VARIANT_TYPE_DOUBLE);
   else if (type == G_TYPE_STRING)
     return g_variant_type_copy (G_VARIANT_TYPE_STRING);
-  else if (type == G_TYPE_STRV)
+  else if (type == G_TYPE_STRV || type == DBUS_TYPE_G_PACKED_STRV)
     return g_variant_type_copy (G_VARIANT_TYPE_STRING_ARRAY);
   else if (type == DBUS_TYPE_G_OBJECT_PATH)
     return g_variant_type_copy (G_VARIANT_TYPE_OBJECT_PATH);
@@ -1828,7 +1919,7 @@ dbus_g_value_build_g_variant (const GValue *value)
       const gchar *str = g_value_get_string (value);
       return g_variant_new_string ((str != NULL) ? str : "");
     }
-  else if (type == G_TYPE_STRV)
+  else if (type == G_TYPE_STRV || type == DBUS_TYPE_G_PACKED_STRV)
     {
       const gchar * const *strv = g_value_get_boxed (value);
       return g_variant_new_strv (strv, (strv != NULL) ? -1 : 0);
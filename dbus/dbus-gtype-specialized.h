@@ -94,6 +94,18 @@ void           dbus_g_type_map_value_iterate                (const GValue
 							     DBusGTypeSpecializedMapIterator         iterator,
 							     gpointer                                user_data);
 
+typedef struct _DBusGLazyMap DBusGLazyMap;
+
+GType          dbus_g_type_get_lazy_map                     (GType                                   key_type,
+							     GType                                   value_type);
+gboolean       dbus_g_lazy_map_lookup                       (DBusGLazyMap                           *map,
+							     gconstpointer                           key,
+							     gpointer                               *value);
+
+GType          dbus_g_type_get_packed_struct_collection     (GType                                   struct_type);
+const gsize   *dbus_g_type_get_packed_struct_offsets        (GType                                   type,
+							     gsize                                  *row_size);
+
 gboolean       dbus_g_type_struct_get_member            (const GValue *value,
                                                          guint member,
                                                          GValue *dest);
@@ -109,3 +109,258 @@ _dbus_gutils_wincaps_to_uscore (const char *caps)
 
   return g_string_free (str, FALSE);
 }
+
+/* The method lookup tables written by dbus-binding-tool since format
+ * version 5 of DBusGObjectInfo are built with these functions and then
+ * compiled into applications, so their results must never change.
+ *
+ * A table is a hash-and-displace perfect hash: the method key's hash
+ * picks a bucket, and the bucket's displacement picks the slot. */
+guint32
+_dbus_gutils_method_hash (const char *interface,
+                          const char *member,
+                          const char *signature)
+{
+  const char *parts[3];
+  guint32 h = 2166136261u;
+  guint i;
+
+  parts[0] = interface;
+  parts[1] = member;
+  parts[2] = signature;
+
+  /* FNV-1a over "interface\0member\0signature" */
+  for (i = 0; i < G_N_ELEMENTS (parts); i++)
+    {
+      const guchar *p;
+
+      for (p = (const guchar *) parts[i]; *p != '\0'; p++)
+        {
+          h ^= *p;
+          h *= 16777619u;
+        }
+
+      if (i + 1 < G_N_ELEMENTS (parts))
+        h *= 16777619u;
+    }
+
+  return h;
+}
+
+static guint32
+method_hash_mix (guint32 h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+guint
+_dbus_gutils_method_hash_slot (guint32 hash,
+                               guint32 displacement,
+                               guint   n_slots)
+{
+  guint32 start = method_hash_mix (hash);
+  guint32 step = method_hash_mix (hash ^ 0x9e3779b9u) | 1;
+
+  return (start + displacement * step) % n_slots;
+}
+
+/* Maximum displacement tried for each bucket of the method lookup table
+ * before giving up on the current table size */
+#define METHOD_LOOKUP_MAX_DISPLACEMENT 65536
+
+static gint
+method_lookup_compare_buckets (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  GSList **buckets = user_data;
+  guint size_a = g_slist_length (buckets[*(const guint *) a]);
+  guint size_b = g_slist_length (buckets[*(const guint *) b]);
+
+  /* Largest first; they are the hardest to place */
+  if (size_a != size_b)
+    return size_a > size_b ? -1 : 1;
+  return 0;
+}
+
+/* Tries to build a perfect hash table with @n_slots slots over @hashes;
+ * returns NULL if no displacement works for some bucket,
+ * for instance because two methods have the same hash */
+static guint *
+try_build_method_lookup (GArray *hashes, guint n_buckets, guint n_slots)
+{
+  GSList **buckets;
+  guint *order;
+  guint *table;
+  guint *displacements;
+  guint *slots;
+  guint *candidate;
+  guint i;
+  gboolean ok = TRUE;
+
+  buckets = g_new0 (GSList *, n_buckets);
+  order = g_new (guint, n_buckets);
+  table = g_new0 (guint, 2 + n_buckets + n_slots);
+  candidate = g_new (guint, hashes->len);
+
+  table[0] = n_buckets;
+  table[1] = n_slots;
+  displacements = table + 2;
+  slots = table + 2 + n_buckets;
+
+  for (i = 0; i < hashes->len; i++)
+    {
+      guint32 hash = g_array_index (hashes, guint32, i);
+
+      buckets[hash % n_buckets] = g_slist_prepend (buckets[hash % n_buckets],
+                                                   GUINT_TO_POINTER (i));
+    }
+
+  for (i = 0; i < n_buckets; i++)
+    order[i] = i;
+  g_qsort_with_data (order, n_buckets, sizeof (guint),
+                     method_lookup_compare_buckets, buckets);
+
+  for (i = 0; i < n_buckets && ok; i++)
+    {
+      guint bucket = order[i];
+      guint32 d;
+
+      if (buckets[bucket] == NULL)
+        break;
+
+      for (d = 0; d < METHOD_LOOKUP_MAX_DISPLACEMENT; d++)
+        {
+          GSList *l;
+          guint n = 0;
+          gboolean fits = TRUE;
+
+          for (l = buckets[bucket]; l != NULL && fits; l = l->next)
+            {
+              guint32 hash;
+              guint slot;
+              guint j;
+
+              hash = g_array_index (hashes, guint32, GPOINTER_TO_UINT (l->data));
+              slot = _dbus_gutils_method_hash_slot (hash, d, n_slots);
+
+              if (slots[slot] != 0)
+                fits = FALSE;
+
+              for (j = 0; j < n && fits; j++)
+                {
+                  if (candidate[j] == slot)
+                    fits = FALSE;
+                }
+
+              candidate[n++] = slot;
+            }
+
+          if (fits)
+            break;
+        }
+
+      if (d == METHOD_LOOKUP_MAX_DISPLACEMENT)
+        {
+          ok = FALSE;
+          break;
+        }
+
+      displacements[bucket] = d;
+      {
+        GSList *l;
+        guint n = 0;
+
+        for (l = buckets[bucket]; l != NULL; l = l->next)
+          slots[candidate[n++]] = GPOINTER_TO_UINT (l->data) + 1;
+      }
+    }
+
+  for (i = 0; i < n_buckets; i++)
+    g_slist_free (buckets[i]);
+  g_free (buckets);
+  g_free (order);
+  g_free (candidate);
+
+  if (!ok)
+    {
+      g_free (table);
+      return NULL;
+    }
+
+  return table;
+}
+
+/* Builds the table for methods with the given _dbus_gutils_method_hash()
+ * values, in the order of the object info's methods, in the layout
+ * documented at object_info_lookup_method() in dbus-gobject.c. Returns
+ * NULL if there are no methods, or if no table could be found; otherwise
+ * stores its length in @n_entries, and the result must be freed with
+ * g_free(). */
+guint *
+_dbus_gutils_build_method_lookup (GArray *hashes,
+                                  guint  *n_entries)
+{
+  guint n_buckets;
+  guint n_slots;
+  guint attempt;
+
+  if (hashes->len == 0)
+    return NULL;
+
+  n_buckets = (hashes->len + 3) / 4;
+  n_slots = hashes->len + hashes->len / 2 + 1;
+
+  for (attempt = 0; attempt < 4; attempt++, n_slots *= 2)
+    {
+      guint *table;
+
+      table = try_build_method_lookup (hashes, n_buckets, n_slots);
+      if (table != NULL)
+        {
+          *n_entries = 2 + n_buckets + n_slots;
+          return table;
+        }
+    }
+
+  return NULL;
+}
+
+/* Returns the data in @slot of @connection. If there is none and
+ * @new_func is not NULL, allocates @slot if necessary and fills it with
+ * the result of @new_func, to be freed with @free_func along with the
+ * connection. Like the main loop integration's slot, a slot allocated
+ * here is never freed. The caller must hold a lock that serializes
+ * calls for the same @slot. */
+gpointer
+_dbus_gutils_connection_get_data (DBusConnection   *connection,
+                                  dbus_int32_t     *slot,
+                                  gpointer        (*new_func) (void),
+                                  DBusFreeFunction  free_func)
+{
+  gpointer data;
+
+  if (*slot < 0)
+    {
+      if (new_func == NULL)
+        return NULL;
+
+      if (!dbus_connection_allocate_data_slot (slot))
+        g_error ("out of memory");
+    }
+
+  data = dbus_connection_get_data (connection, *slot);
+
+  if (data == NULL && new_func != NULL)
+    {
+      data = new_func ();
+
+      if (!dbus_connection_set_data (connection, *slot, data, free_func))
+        g_error ("out of memory");
+    }
+
+  return data;
+}
@@ -35,6 +35,20 @@ char      **_dbus_gutils_split_path     (const char *path);
 
 char       *_dbus_gutils_wincaps_to_uscore (const char *uscore);
 
+guint32     _dbus_gutils_method_hash      (const char *interface,
+                                           const char *member,
+                                           const char *signature);
+guint       _dbus_gutils_method_hash_slot (guint32     hash,
+                                           guint32     displacement,
+                                           guint       n_slots);
+guint      *_dbus_gutils_build_method_lookup (GArray *hashes,
+                                             guint  *n_entries);
+
+gpointer    _dbus_gutils_connection_get_data (DBusConnection   *connection,
+                                              dbus_int32_t     *slot,
+                                              gpointer        (*new_func) (void),
+                                              DBusFreeFunction  free_func);
+
 /* These munge the pointer to enforce that a plain cast won't work,
  * accessor functions must be used; i.e. to ensure the ABI
  * reflects our encapsulation.
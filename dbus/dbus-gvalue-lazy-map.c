@@ -0,0 +1,429 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gvalue-lazy-map.c: maps decoded on demand from a received message
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+#include <dbus/dbus-glib.h>
+#include "dbus-gvalue-lazy-map.h"
+#include "dbus-gvalue-utils.h"
+
+#define LAZY_MAP_CONTAINER "DBusGLazyMap"
+
+/*
+ * A lazy map is a GHashTable-style map whose entries are left in the
+ * message they arrived in until somebody asks for them. Entries that have
+ * been decoded (or added locally) live in @table, which is an ordinary
+ * GHashTable map of the same key and value types, so everything except
+ * dbus_g_lazy_map_lookup() just decodes whatever is left and then
+ * delegates to it.
+ */
+struct _DBusGLazyMap {
+  GType table_type;
+  GType key_type;
+  GType value_type;
+  GHashTable *table;
+
+  /* Everything below is only set while some entries haven't been decoded
+   * yet; message is NULL otherwise */
+  DBusMessage *message;
+  DBusMessageIter array_iter;
+  DBusGConnection *gconnection;
+  DBusGProxy *proxy;
+  /* The nesting depth the map was found at, so that decoding an entry
+   * later is subject to the same limit as decoding it straight away */
+  guint recursion_depth;
+  /* key -> DBusMessageIter pointing to that key's dict entry, for entries
+   * not yet in @table. Built by the first lookup. */
+  GHashTable *index;
+};
+
+static void
+lazy_map_release_source (DBusGLazyMap *map)
+{
+  if (map->message == NULL)
+    return;
+
+  dbus_message_unref (map->message);
+  map->message = NULL;
+
+  if (map->gconnection != NULL)
+    dbus_g_connection_unref (map->gconnection);
+  map->gconnection = NULL;
+
+  if (map->proxy != NULL)
+    g_object_unref (map->proxy);
+  map->proxy = NULL;
+
+  if (map->index != NULL)
+    g_hash_table_unref (map->index);
+  map->index = NULL;
+}
+
+/* Decode the dict entry at @entry_iter into map->table */
+static void
+lazy_map_decode_entry (DBusGLazyMap    *map,
+                       DBusMessageIter *entry_iter)
+{
+  DBusGValueMarshalCtx context;
+  DBusMessageIter subiter;
+  GValue key = { 0, };
+  GValue value = { 0, };
+  GError *error = NULL;
+
+  context.recursion_depth = map->recursion_depth;
+  context.gconnection = map->gconnection;
+  context.proxy = map->proxy;
+  context.message = map->message;
+
+  dbus_message_iter_recurse (entry_iter, &subiter);
+
+  g_value_init (&key, map->key_type);
+  if (!_dbus_gvalue_demarshal (&context, &subiter, &key, &error))
+    goto fail;
+
+  dbus_message_iter_next (&subiter);
+
+  g_value_init (&value, map->value_type);
+  if (!_dbus_gvalue_demarshal (&context, &subiter, &value, &error))
+    goto fail;
+
+  /* Ownership of values passes to the table, don't unset */
+  _dbus_g_hash_table_insert_steal_values (map->table, &key, &value);
+  return;
+
+fail:
+  /* The signature, and the contents of any variants, were checked by
+   * demarshal_lazy_map() before the map was created, so this is a bug in
+   * dbus-glib rather than bad data from the peer */
+  g_critical ("Unable to decode map entry: %s", error->message);
+  g_error_free (error);
+  if (G_IS_VALUE (&key))
+    g_value_unset (&key);
+  if (G_IS_VALUE (&value))
+    g_value_unset (&value);
+}
+
+static gboolean
+lazy_map_index_foreach_decode (gpointer key,
+                               gpointer value,
+                               gpointer user_data)
+{
+  lazy_map_decode_entry (user_data, value);
+  return TRUE;
+}
+
+/* Decode whatever hasn't been decoded yet, and drop the message */
+static void
+lazy_map_materialize (DBusGLazyMap *map)
+{
+  DBusMessageIter subiter;
+
+  if (map->message == NULL)
+    return;
+
+  if (map->index != NULL)
+    {
+      g_hash_table_foreach_remove (map->index,
+                                   lazy_map_index_foreach_decode, map);
+    }
+  else
+    {
+      dbus_message_iter_recurse (&map->array_iter, &subiter);
+
+      while (dbus_message_iter_get_arg_type (&subiter) == DBUS_TYPE_DICT_ENTRY)
+        {
+          lazy_map_decode_entry (map, &subiter);
+          dbus_message_iter_next (&subiter);
+        }
+    }
+
+  lazy_map_release_source (map);
+}
+
+static void
+lazy_map_build_index (DBusGLazyMap *map)
+{
+  DBusGValueMarshalCtx context;
+  DBusMessageIter subiter;
+
+  g_assert (map->index == NULL);
+
+  map->index = g_hash_table_new_full (_dbus_g_hash_func_from_gtype (map->key_type),
+                                      _dbus_g_hash_equal_from_gtype (map->key_type),
+                                      _dbus_g_hash_free_from_gtype (map->key_type),
+                                      g_free);
+
+  context.recursion_depth = map->recursion_depth;
+  context.gconnection = map->gconnection;
+  context.proxy = map->proxy;
+  context.message = map->message;
+
+  dbus_message_iter_recurse (&map->array_iter, &subiter);
+
+  while (dbus_message_iter_get_arg_type (&subiter) == DBUS_TYPE_DICT_ENTRY)
+    {
+      DBusMessageIter entry_iter;
+      GValue key = { 0, };
+
+      dbus_message_iter_recurse (&subiter, &entry_iter);
+      g_value_init (&key, map->key_type);
+
+      /* Keys are always basic types, so this is cheap */
+      if (_dbus_gvalue_demarshal (&context, &entry_iter, &key, NULL))
+        {
+          /* Later entries replace earlier ones, as for a GHashTable */
+          g_hash_table_insert (map->index, _dbus_g_hash_value_steal_gvalue (&key),
+                               g_memdup (&subiter, sizeof (DBusMessageIter)));
+        }
+      else
+        {
+          g_value_unset (&key);
+        }
+
+      dbus_message_iter_next (&subiter);
+    }
+}
+
+static gpointer
+lazy_map_constructor (GType type)
+{
+  DBusGLazyMap *map;
+
+  map = g_new0 (DBusGLazyMap, 1);
+  map->key_type = dbus_g_type_get_map_key_specialization (type);
+  map->value_type = dbus_g_type_get_map_value_specialization (type);
+  map->table_type = dbus_g_type_get_map ("GHashTable", map->key_type,
+                                         map->value_type);
+  map->table = dbus_g_type_specialized_construct (map->table_type);
+  return map;
+}
+
+static void
+lazy_map_free (GType    type,
+               gpointer instance)
+{
+  DBusGLazyMap *map = instance;
+
+  lazy_map_release_source (map);
+  g_boxed_free (map->table_type, map->table);
+  g_free (map);
+}
+
+static gpointer
+lazy_map_copy (GType    type,
+               gpointer src)
+{
+  DBusGLazyMap *map = src;
+  DBusGLazyMap *ret;
+
+  lazy_map_materialize (map);
+
+  ret = g_new0 (DBusGLazyMap, 1);
+  ret->key_type = map->key_type;
+  ret->value_type = map->value_type;
+  ret->table_type = map->table_type;
+  ret->table = g_boxed_copy (map->table_type, map->table);
+  return ret;
+}
+
+static void
+lazy_map_iterator (GType                           type,
+                   gpointer                        instance,
+                   DBusGTypeSpecializedMapIterator iterator,
+                   gpointer                        user_data)
+{
+  DBusGLazyMap *map = instance;
+
+  lazy_map_materialize (map);
+
+  dbus_g_type_map_peek_vtable (map->table_type)->iterator (map->table_type,
+      map->table, iterator, user_data);
+}
+
+static void
+lazy_map_append (DBusGTypeSpecializedAppendContext *ctx,
+                 GValue                            *key,
+                 GValue                            *val)
+{
+  DBusGLazyMap *map = g_value_get_boxed (ctx->val);
+
+  lazy_map_materialize (map);
+  _dbus_g_hash_table_insert_steal_values (map->table, key, val);
+}
+
+static const DBusGTypeSpecializedMapVtable lazy_map_vtable = {
+  {
+    lazy_map_constructor,
+    lazy_map_free,
+    lazy_map_copy,
+    NULL,
+    NULL,
+    NULL
+  },
+  lazy_map_iterator,
+  lazy_map_append
+};
+
+static gpointer
+lazy_map_register (gpointer data G_GNUC_UNUSED)
+{
+  dbus_g_type_register_map (LAZY_MAP_CONTAINER, &lazy_map_vtable, 0);
+  return NULL;
+}
+
+/**
+ * DBusGLazyMap:
+ *
+ * A map from keys to values, like the "GHashTable" specialized maps, that
+ * has been received from D-Bus but not necessarily decoded yet. See
+ * dbus_g_type_get_lazy_map().
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is looking up keys in a #GVariant of type %G_VARIANT_TYPE_VARDICT
+ *  with g_variant_lookup_value().
+ */
+
+/**
+ * dbus_g_type_get_lazy_map:
+ * @key_type: the #GType of the keys, as for dbus_g_type_get_map()
+ * @value_type: the #GType of the values, as for dbus_g_type_get_map()
+ *
+ * Gets a specialized map type that is sent and received like
+ * <literal>dbus_g_type_get_map ("GHashTable", key_type, value_type)</literal>,
+ * but whose instances are #DBusGLazyMap<!-- -->s rather than
+ * #GHashTable<!-- -->s.
+ *
+ * When a lazy map is received as a method argument, signal argument or
+ * reply, it keeps a reference to the message instead of decoding it. The
+ * first dbus_g_lazy_map_lookup() finds where each key is, and each
+ * lookup decodes only the value it asks for. This is much cheaper than
+ * a #GHashTable for large maps, such as <literal>a{sv}</literal>
+ * dictionaries, of which only a few keys are used.
+ *
+ * Everything else that can be done to a specialized map, such as
+ * dbus_g_type_map_value_iterate(), copying it, or sending it in a
+ * message, decodes all the remaining entries first and then behaves
+ * as usual.
+ *
+ * A lazy map is not thread-safe, even for lookups.
+ *
+ * Returns: the #GType of lazy maps with those key and value types
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+GType
+dbus_g_type_get_lazy_map (GType key_type,
+                          GType value_type)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, lazy_map_register, NULL);
+
+  return dbus_g_type_get_map (LAZY_MAP_CONTAINER, key_type, value_type);
+}
+
+/**
+ * dbus_g_lazy_map_lookup:
+ * @map: a #DBusGLazyMap
+ * @key: the key to look up, represented as it would be in a #GHashTable
+ *  map of the same type: for instance a string, or GUINT_TO_POINTER()
+ *  of an unsigned integer
+ * @value: (out) (allow-none): used to return the value, also represented
+ *  as it would be in a #GHashTable map: for instance a #GValue pointer
+ *  for a map of variants. It is owned by @map.
+ *
+ * Looks up @key in @map, decoding its value from the received message if
+ * that hasn't been done yet.
+ *
+ * Returns: %TRUE if @key is in the map
+ *
+ * Deprecated: New code should use GDBus instead.
+ */
+gboolean
+dbus_g_lazy_map_lookup (DBusGLazyMap  *map,
+                        gconstpointer  key,
+                        gpointer      *value)
+{
+  DBusMessageIter *entry_iter;
+
+  g_return_val_if_fail (map != NULL, FALSE);
+
+  if (g_hash_table_lookup_extended (map->table, key, NULL, value))
+    return TRUE;
+
+  if (map->message == NULL)
+    return FALSE;
+
+  if (map->index == NULL)
+    lazy_map_build_index (map);
+
+  entry_iter = g_hash_table_lookup (map->index, key);
+
+  if (entry_iter == NULL)
+    return FALSE;
+
+  lazy_map_decode_entry (map, entry_iter);
+  g_hash_table_remove (map->index, key);
+
+  if (g_hash_table_size (map->index) == 0)
+    lazy_map_release_source (map);
+
+  return g_hash_table_lookup_extended (map->table, key, NULL, value);
+}
+
+gboolean
+_dbus_g_type_is_lazy_map (GType type)
+{
+  return dbus_g_type_is_map (type) &&
+      dbus_g_type_map_peek_vtable (type) == &lazy_map_vtable;
+}
+
+/*
+ * _dbus_g_lazy_map_set_source:
+ * @map: an empty lazy map
+ * @context: the context in which @array_iter is being demarshalled, which
+ *  must include the message
+ * @array_iter: an iterator pointing to an array of dict entries whose
+ *  signature has already been checked against @map's type, and whose
+ *  variants, if any, are known to be decodable
+ *
+ * Arrange for @map to decode its contents from @array_iter on demand.
+ */
+void
+_dbus_g_lazy_map_set_source (DBusGLazyMap               *map,
+                             const DBusGValueMarshalCtx *context,
+                             DBusMessageIter            *array_iter)
+{
+  g_return_if_fail (map->message == NULL);
+  g_return_if_fail (g_hash_table_size (map->table) == 0);
+  g_return_if_fail (context->message != NULL);
+
+  map->message = dbus_message_ref (context->message);
+  map->array_iter = *array_iter;
+  map->recursion_depth = context->recursion_depth;
+
+  if (context->gconnection != NULL)
+    map->gconnection = dbus_g_connection_ref (context->gconnection);
+
+  if (context->proxy != NULL)
+    map->proxy = g_object_ref (context->proxy);
+}
@@ -0,0 +1,40 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* dbus-gvalue-lazy-map.h: maps decoded on demand from a received message
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#ifndef DBUS_GLIB_VALUE_LAZY_MAP_H
+#define DBUS_GLIB_VALUE_LAZY_MAP_H
+
+#include <dbus/dbus.h>
+#include <glib-object.h>
+#include "dbus-gvalue.h"
+
+G_BEGIN_DECLS
+
+gboolean _dbus_g_type_is_lazy_map     (GType                        type);
+
+void     _dbus_g_lazy_map_set_source  (DBusGLazyMap                *map,
+                                       const DBusGValueMarshalCtx  *context,
+                                       DBusMessageIter             *array_iter);
+
+G_END_DECLS
+
+#endif /* DBUS_GLIB_VALUE_LAZY_MAP_H */
@@ -330,6 +330,11 @@ hash_simple_free_from_gtype (GType gtype, GDestroyNotify *func)
           *func = (GDestroyNotify) g_strfreev;
           return TRUE;
         }
+      else if (gtype == DBUS_TYPE_G_PACKED_STRV)
+        {
+          *func = g_free;
+          return TRUE;
+        }
       else if (gtype == DBUS_TYPE_G_OBJECT_PATH)
         {
           *func = g_free;
@@ -610,6 +615,14 @@ hashtable_iterator (GType                           hash_type,
   g_hash_table_foreach (instance, hashtable_foreach_with_values, &data);
 }
 
+/* Returns the representation @value would have as a key or value in a
+ * GHashTable map, taking ownership of its contents */
+gpointer
+_dbus_g_hash_value_steal_gvalue (GValue *value)
+{
+  return hash_value_from_gvalue (value);
+}
+
 void
 _dbus_g_hash_table_insert_steal_values (GHashTable *table,
 				       GValue     *key_val,
@@ -52,6 +52,7 @@ void           _dbus_g_hash_table_insert_values       (GHashTable
 void           _dbus_g_hash_table_insert_steal_values (GHashTable *table,
 						      GValue     *key_val,
 						      GValue     *value_val);
+gpointer       _dbus_g_hash_value_steal_gvalue        (GValue     *value);
 
 gboolean       _dbus_gtype_is_valid_hash_key          (GType type);
 gboolean       _dbus_gtype_is_valid_hash_value        (GType type);
@@ -30,6 +30,8 @@
 #include "dbus-gsignature.h"
 #include "dbus-gobject.h"
 #include "dbus-gvalue-utils.h"
+#include "dbus-gvalue-lazy-map.h"
+#include "dbus-gpacked-structs.h"
 #include "dbus/dbus-glib.h"
 #include <string.h>
 #include <glib.h>
@@ -38,6 +40,11 @@
 /* Seems reasonable, but this should probably be part of the standard protocol */
 #define DBUS_GLIB_MAX_VARIANT_RECURSION 32
 
+/* Can be changed by dbus_glib_global_set_max_value_nesting() */
+static volatile gint max_value_nesting = DBUS_GLIB_MAX_VARIANT_RECURSION;
+
+typedef struct _DBusGTypePlan DBusGTypePlan;
+
 static gboolean demarshal_static_variant (DBusGValueMarshalCtx    *context,
 					  DBusMessageIter         *iter,
 					  GValue                  *value,
@@ -56,6 +63,10 @@ static gboolean demarshal_strv                  (DBusGValueMarshalCtx      *cont
 						 DBusMessageIter           *iter,
 						 GValue                    *value,
 						 GError                   **error);
+static gboolean demarshal_packed_strv           (DBusGValueMarshalCtx      *context,
+						 DBusMessageIter           *iter,
+						 GValue                    *value,
+						 GError                   **error);
 static gboolean marshal_valuearray              (DBusMessageIter           *iter,
 						 const GValue              *value);
 static gboolean demarshal_valuearray            (DBusGValueMarshalCtx      *context,
@@ -92,34 +103,44 @@ static gboolean demarshal_signature		(DBusGValueMarshalCtx      *context,
 						 DBusMessageIter           *iter,
 						 GValue                    *value,
 						 GError                   **error);
-static gboolean marshal_map                     (DBusMessageIter           *iter,
+static gboolean marshal_map                     (const DBusGTypePlan       *plan,
+						 DBusMessageIter           *iter,
 						 const GValue              *value);
-static gboolean demarshal_map                   (DBusGValueMarshalCtx      *context,
+static gboolean demarshal_lazy_map              (const DBusGTypePlan       *plan,
+						 DBusGValueMarshalCtx      *context,
 						 DBusMessageIter           *iter,
 						 GValue                    *value,
 						 GError                   **error);
 
-static gboolean marshal_collection              (DBusMessageIter           *iter,
-						 const GValue              *value);
-static gboolean marshal_collection_ptrarray     (DBusMessageIter           *iter,
+static gboolean marshal_collection_ptrarray     (const DBusGTypePlan       *plan,
+						 DBusMessageIter           *iter,
 						 const GValue              *value);
-static gboolean marshal_collection_array        (DBusMessageIter           *iter,
+static gboolean marshal_collection_array        (const DBusGTypePlan       *plan,
+						 DBusMessageIter           *iter,
 						 const GValue              *value);
-static gboolean demarshal_collection            (DBusGValueMarshalCtx      *context,
+static gboolean demarshal_collection_array      (const DBusGTypePlan       *plan,
+						 DBusGValueMarshalCtx      *context,
 						 DBusMessageIter           *iter,
 						 GValue                    *value,
 						 GError                   **error);
-static gboolean demarshal_collection_ptrarray   (DBusGValueMarshalCtx      *context,
+static gboolean marshal_packed_structs          (const DBusGTypePlan       *plan,
+						 DBusMessageIter           *iter,
+						 const GValue              *value);
+static gboolean demarshal_packed_structs        (const DBusGTypePlan       *plan,
+						 DBusGValueMarshalCtx      *context,
 						 DBusMessageIter           *iter,
 						 GValue                    *value,
 						 GError                   **error);
-static gboolean demarshal_collection_array      (DBusGValueMarshalCtx      *context,
+static gboolean marshal_struct                  (const DBusGTypePlan       *plan,
+						 DBusMessageIter           *iter,
+						 const GValue              *value);
+static gboolean demarshal_nested                (const DBusGTypePlan       *plan,
+						 DBusGValueMarshalCtx      *context,
 						 DBusMessageIter           *iter,
 						 GValue                    *value,
 						 GError                   **error);
-static gboolean marshal_struct                  (DBusMessageIter           *iter,
-						 const GValue              *value);
-static gboolean demarshal_struct                (DBusGValueMarshalCtx      *context,
+static gboolean demarshal_with_plan             (const DBusGTypePlan       *plan,
+						 DBusGValueMarshalCtx      *context,
 						 DBusMessageIter           *iter,
 						 GValue                    *value,
 						 GError                   **error);
@@ -142,6 +163,51 @@ typedef struct {
   const DBusGTypeMarshalVtable     *vtable;
 } DBusGTypeMarshalData;
 
+typedef gboolean (*DBusGTypePlanMarshalFunc)    (const DBusGTypePlan       *plan,
+						 DBusMessageIter           *iter,
+						 const GValue              *value);
+typedef gboolean (*DBusGTypePlanDemarshalFunc)  (const DBusGTypePlan       *plan,
+						 DBusGValueMarshalCtx      *context,
+						 DBusMessageIter           *iter,
+						 GValue                    *value,
+						 GError                   **error);
+
+/*
+ * How to (de)marshal one GType, worked out the first time the type is
+ * seen and attached to it as qdata. Containers point straight at the
+ * plans for their elements, so a nested value such as aa{sv} is walked
+ * without going back to the type system for each element. Plans are
+ * never freed.
+ */
+/* Containers that demarshal_nested() handles itself, without recursing */
+typedef enum {
+  DBUS_G_NEST_NONE = 0,
+  DBUS_G_NEST_VARIANT,
+  DBUS_G_NEST_STRUCT,
+  DBUS_G_NEST_MAP,
+  DBUS_G_NEST_PTRARRAY
+} DBusGNestKind;
+
+struct _DBusGTypePlan {
+  GType                          gtype;
+  DBusGNestKind                  nest_kind;
+  DBusGTypePlanMarshalFunc       marshal;
+  DBusGTypePlanDemarshalFunc     demarshal;
+  /* Types with a DBusGTypeMarshalVtable, and GValueArray */
+  DBusGValueMarshalFunc          marshaller;
+  DBusGValueDemarshalFunc        demarshaller;
+  /* Collections: the element signature. Maps: the dict entry signature.
+   * NULL if the contents can't be marshalled. */
+  char                          *contents_sig;
+  /* Collections of fixed-size types: the element size */
+  gsize                          elt_size;
+  /* Packed struct collections: how each row is laid out */
+  const DBusGPackedStructLayout *packed_layout;
+  /* Collections: the element. Maps: key and value. Structs: members. */
+  guint                          n_children;
+  const DBusGTypePlan          **children;
+};
+
 static GQuark
 dbus_g_type_metadata_data_quark ()
 {
@@ -354,6 +420,18 @@ _dbus_g_value_types_init (void)
     set_type_metadata (DBUS_TYPE_G_SIGNATURE, &typedata);
   }
 
+  {
+    static const DBusGTypeMarshalVtable vtable = {
+      marshal_strv,
+      demarshal_packed_strv
+    };
+    static const DBusGTypeMarshalData typedata = {
+      DBUS_TYPE_ARRAY_AS_STRING DBUS_TYPE_STRING_AS_STRING,
+      &vtable
+    };
+    set_type_metadata (DBUS_TYPE_G_PACKED_STRV, &typedata);
+  }
+
   types_initialized = TRUE;
 }
 
@@ -440,6 +518,78 @@ dbus_g_signature_get_g_type (void)
   return type_id;
 }
 
+/* Allocates a vector of @n_strings pointers plus a terminating %NULL,
+ * followed by @n_bytes of string storage starting at *@bytes */
+static char **
+packed_strv_alloc (gsize   n_strings,
+                   gsize   n_bytes,
+                   char  **bytes)
+{
+  char **ret;
+
+  ret = g_malloc (sizeof (char *) * (n_strings + 1) + n_bytes);
+  *bytes = (char *) (ret + n_strings + 1);
+  return ret;
+}
+
+static gpointer
+packed_strv_copy (gpointer boxed)
+{
+  const char * const *strv = boxed;
+  char **ret;
+  char *bytes;
+  gsize n_bytes = 0;
+  gsize n, i;
+
+  for (n = 0; strv[n] != NULL; n++)
+    n_bytes += strlen (strv[n]) + 1;
+
+  ret = packed_strv_alloc (n, n_bytes, &bytes);
+
+  for (i = 0; i < n; i++)
+    {
+      gsize len = strlen (strv[i]) + 1;
+
+      memcpy (bytes, strv[i], len);
+      ret[i] = bytes;
+      bytes += len;
+    }
+  ret[n] = NULL;
+
+  return ret;
+}
+
+/**
+ * DBUS_TYPE_G_PACKED_STRV:
+ *
+ * The #GType of a "packed" string vector: a %NULL-terminated array of
+ * strings like %G_TYPE_STRV, except that the array and all the strings
+ * are a single allocation, which must be freed with g_free() rather than
+ * g_strfreev(). It is sent and received as the D-Bus type
+ * <literal>as</literal>.
+ *
+ * Using this type instead of %G_TYPE_STRV for the result of a method
+ * call (see dbus_g_proxy_end_call()) makes receiving a large string array
+ * cost one allocation instead of one per string.
+ *
+ * Returns: a type derived from %G_TYPE_BOXED
+ *
+ * Deprecated: New code should use GDBus instead. The closest equivalent
+ *  is a #GVariant (%G_TYPE_VARIANT) of type %G_VARIANT_TYPE_STRING_ARRAY,
+ *  which is similarly stored in one block.
+ */
+GType
+dbus_g_packed_strv_get_g_type (void)
+{
+  static GType type_id = 0;
+
+  if (!type_id)
+    type_id = g_boxed_type_register_static ("DBusGPackedStrv",
+					    packed_strv_copy,
+					    (GBoxedFreeFunc) g_free);
+  return type_id;
+}
+
 
 char *
 _dbus_gtype_to_signature (GType gtype)
@@ -647,20 +797,37 @@ demarshal_basic (DBusGValueMarshalCtx      *context,
     return FALSE;
 }
 
-static gboolean
-demarshal_static_variant (DBusGValueMarshalCtx    *context,
-			  DBusMessageIter         *iter,
-			  GValue                  *value,
-			  GError                 **error)
+/* Recurse into the variant at @iter, and return the GType of its
+ * contents */
+static GType
+variant_get_content_type (DBusGValueMarshalCtx    *context,
+                          DBusMessageIter         *iter,
+                          DBusMessageIter         *subiter,
+                          GError                 **error)
 {
+  char basic_sig[2];
   char *sig;
-  DBusMessageIter subiter;
   GType variant_type;
+  int current_type;
 
-  dbus_message_iter_recurse (iter, &subiter);
-  sig = dbus_message_iter_get_signature (&subiter);
+  dbus_message_iter_recurse (iter, subiter);
+  current_type = dbus_message_iter_get_arg_type (subiter);
+
+  if (dbus_type_is_basic (current_type))
+    {
+      /* The signature is a single character: no need to ask libdbus
+       * to allocate a copy of it. */
+      basic_sig[0] = (char) current_type;
+      basic_sig[1] = '\0';
+      sig = basic_sig;
+    }
+  else
+    {
+      sig = dbus_message_iter_get_signature (subiter);
+    }
 
-  variant_type = _dbus_gtype_from_signature (sig, context->proxy != NULL);
+  variant_type = _dbus_gtype_from_signature_cached (sig,
+                                                    context->proxy != NULL);
   if (variant_type == G_TYPE_INVALID)
     {
       /* It can happen if we received an unknown type such as
@@ -668,11 +835,26 @@ demarshal_static_variant (DBusGValueMarshalCtx    *context,
       g_set_error (error, DBUS_GERROR,
                    DBUS_GERROR_INVALID_SIGNATURE,
                    "Variant contains unknown signature \'%s\'", sig);
-      dbus_free (sig);
-      return FALSE;
     }
 
-  dbus_free (sig);
+  if (sig != basic_sig)
+    dbus_free (sig);
+
+  return variant_type;
+}
+
+static gboolean
+demarshal_static_variant (DBusGValueMarshalCtx    *context,
+			  DBusMessageIter         *iter,
+			  GValue                  *value,
+			  GError                 **error)
+{
+  DBusMessageIter subiter;
+  GType variant_type;
+
+  variant_type = variant_get_content_type (context, iter, &subiter, error);
+  if (variant_type == G_TYPE_INVALID)
+    return FALSE;
 
   g_value_init (value, variant_type);
 
@@ -826,8 +1008,10 @@ demarshal_strv (DBusGValueMarshalCtx    *context,
 		GError                 **error)
 {
   DBusMessageIter subiter;
+  DBusMessageIter count_iter;
   int current_type;
-  GArray *arr;
+  char **ret;
+  gsize n;
 
   current_type = dbus_message_iter_get_arg_type (iter);
   if (current_type != DBUS_TYPE_ARRAY)
@@ -852,27 +1036,106 @@ demarshal_strv (DBusGValueMarshalCtx    *context,
       return FALSE;
     }
 
-  arr = g_array_new (TRUE, FALSE, sizeof (char *));
+  /* Count first, so the vector is allocated once at the right size */
+  n = 0;
+  count_iter = subiter;
+  while (dbus_message_iter_get_arg_type (&count_iter) != DBUS_TYPE_INVALID)
+    {
+      n++;
+      dbus_message_iter_next (&count_iter);
+    }
+
+  ret = g_new (char *, n + 1);
 
+  n = 0;
   while ((current_type = dbus_message_iter_get_arg_type (&subiter)) != DBUS_TYPE_INVALID)
     {
       g_assert (current_type == DBUS_TYPE_STRING);
       const char *str;
-      char *copy;
       
       dbus_message_iter_get_basic (&subiter, &str);
-      copy = g_strdup (str);
-      g_array_append_val (arr, copy);
+      ret[n++] = g_strdup (str);
 
       dbus_message_iter_next (&subiter);
     }
+  ret[n] = NULL;
 
-  g_value_take_boxed (value, arr->data);
-  g_array_free (arr, FALSE);
+  g_value_take_boxed (value, ret);
   
   return TRUE;
 }
 
+static gboolean
+demarshal_packed_strv (DBusGValueMarshalCtx    *context,
+                       DBusMessageIter         *iter,
+                       GValue                  *value,
+                       GError                 **error)
+{
+  DBusMessageIter subiter;
+  int current_type;
+  char **ret;
+  char *bytes;
+  gsize n_bytes;
+  gsize n;
+
+  current_type = dbus_message_iter_get_arg_type (iter);
+  if (current_type != DBUS_TYPE_ARRAY)
+    {
+      g_set_error (error,
+		   DBUS_GERROR,
+		   DBUS_GERROR_INVALID_ARGS,
+		   "Expected D-BUS array, got type code \'%c\'", (guchar) current_type);
+      return FALSE;
+    }
+
+  current_type = dbus_message_iter_get_element_type (iter);
+  if (current_type != DBUS_TYPE_STRING)
+    {
+      g_set_error (error,
+		   DBUS_GERROR,
+		   DBUS_GERROR_INVALID_ARGS,
+		   "Expected D-BUS string, got type code \'%c\'", (guchar) current_type);
+      return FALSE;
+    }
+
+  /* First pass: size the single block for the vector and the strings */
+  n = 0;
+  n_bytes = 0;
+  dbus_message_iter_recurse (iter, &subiter);
+  while (dbus_message_iter_get_arg_type (&subiter) != DBUS_TYPE_INVALID)
+    {
+      const char *str;
+
+      dbus_message_iter_get_basic (&subiter, &str);
+      n_bytes += strlen (str) + 1;
+      n++;
+      dbus_message_iter_next (&subiter);
+    }
+
+  ret = packed_strv_alloc (n, n_bytes, &bytes);
+
+  /* Second pass: fill it in */
+  n = 0;
+  dbus_message_iter_recurse (iter, &subiter);
+  while (dbus_message_iter_get_arg_type (&subiter) != DBUS_TYPE_INVALID)
+    {
+      const char *str;
+      gsize len;
+
+      dbus_message_iter_get_basic (&subiter, &str);
+      len = strlen (str) + 1;
+      memcpy (bytes, str, len);
+      ret[n++] = bytes;
+      bytes += len;
+      dbus_message_iter_next (&subiter);
+    }
+  ret[n] = NULL;
+
+  g_value_take_boxed (value, ret);
+
+  return TRUE;
+}
+
 static gboolean
 demarshal_valuearray (DBusGValueMarshalCtx    *context,
 		      DBusMessageIter         *iter,
@@ -937,217 +1200,231 @@ demarshal_valuearray (DBusGValueMarshalCtx    *context,
   return TRUE;
 }
 
+/* Whether every variant in the value at @iter, however deeply nested,
+ * has contents that variant_get_content_type() accepts, without going
+ * over the nesting limit if the value is decoded at @depth. Each level
+ * is counted twice, as a level can cost both demarshal_with_plan() and a
+ * nest frame one, so this errs on the side of FALSE. Nothing is
+ * allocated, and arrays of basic types are skipped without looking at
+ * their elements. */
 static gboolean
-demarshal_map (DBusGValueMarshalCtx    *context,
-	       DBusMessageIter         *iter,
-	       GValue                  *value,
-	       GError                 **error)
+variants_are_decodable (DBusGValueMarshalCtx *context,
+                        DBusMessageIter      *iter,
+                        guint                 depth)
 {
-  GType gtype;
   DBusMessageIter subiter;
-  int current_type;
-  gpointer ret;
-  GType key_gtype;
-  GType value_gtype;
-  DBusGTypeSpecializedAppendContext appendctx;
-
-  current_type = dbus_message_iter_get_arg_type (iter);
-  if (current_type != DBUS_TYPE_ARRAY)
-    {
-      g_set_error (error,
-		   DBUS_GERROR,
-		   DBUS_GERROR_INVALID_ARGS,
-		   "Expected D-BUS array, got type code \'%c\'", (guchar) current_type);
-      return FALSE;
-    }
-
-  gtype = G_VALUE_TYPE (value);
-
-  dbus_message_iter_recurse (iter, &subiter);
-
-  current_type = dbus_message_iter_get_arg_type (&subiter);
-  if (current_type != DBUS_TYPE_INVALID
-      && current_type != DBUS_TYPE_DICT_ENTRY)
-    {
-      g_set_error (error,
-		   DBUS_GERROR,
-		   DBUS_GERROR_INVALID_ARGS,
-		   "Expected D-BUS dict entry, got type code \'%c\'", (guchar) current_type);
-      return FALSE;
-    }
-
-  key_gtype = dbus_g_type_get_map_key_specialization (gtype);
-  value_gtype = dbus_g_type_get_map_value_specialization (gtype);
-
-  ret = dbus_g_type_specialized_construct (gtype);
-  g_value_take_boxed (value, ret);
 
-  dbus_g_type_specialized_init_append (value, &appendctx);
+  if (depth > (guint) g_atomic_int_get (&max_value_nesting))
+    return FALSE;
 
-  while ((current_type = dbus_message_iter_get_arg_type (&subiter)) != DBUS_TYPE_INVALID)
+  switch (dbus_message_iter_get_arg_type (iter))
     {
-      DBusMessageIter entry_iter;
-      GValue key_value = {0,};
-      GValue value_value = {0,};
-
-      current_type = dbus_message_iter_get_arg_type (&subiter);
-      g_assert (current_type == DBUS_TYPE_DICT_ENTRY);
+    case DBUS_TYPE_VARIANT:
+      if (variant_get_content_type (context, iter, &subiter, NULL) == G_TYPE_INVALID)
+        return FALSE;
 
-      dbus_message_iter_recurse (&subiter, &entry_iter);
+      return variants_are_decodable (context, &subiter, depth + 2);
 
-      g_value_init (&key_value, key_gtype);
-      if (!_dbus_gvalue_demarshal (context,
-				  &entry_iter,
-				  &key_value,
-				  error))
-	return FALSE;
+    case DBUS_TYPE_ARRAY:
+      if (dbus_type_is_basic (dbus_message_iter_get_element_type (iter)))
+        return TRUE;
+      /* fall through */
+    case DBUS_TYPE_STRUCT:
+    case DBUS_TYPE_DICT_ENTRY:
+      dbus_message_iter_recurse (iter, &subiter);
 
-      dbus_message_iter_next (&entry_iter);
+      while (dbus_message_iter_get_arg_type (&subiter) != DBUS_TYPE_INVALID)
+        {
+          if (!variants_are_decodable (context, &subiter, depth + 2))
+            return FALSE;
 
-      g_value_init (&value_value, value_gtype);
-      if (!_dbus_gvalue_demarshal (context,
-				  &entry_iter,
-				  &value_value,
-				  error))
-	return FALSE;
+          dbus_message_iter_next (&subiter);
+        }
 
-      dbus_g_type_specialized_map_append (&appendctx, &key_value, &value_value);
-      /* Ownership of values passes to map, don't unset */
+      return TRUE;
 
-      dbus_message_iter_next (&subiter);
+    default:
+      return TRUE;
     }
-  
-  return TRUE;
 }
 
 static gboolean
-demarshal_struct (DBusGValueMarshalCtx    *context,
-                  DBusMessageIter         *iter,
-                  GValue                  *value,
-                  GError                 **error)
+demarshal_lazy_map (const DBusGTypePlan     *plan,
+                    DBusGValueMarshalCtx    *context,
+                    DBusMessageIter         *iter,
+                    GValue                  *value,
+                    GError                 **error)
 {
-  int current_type;
-  DBusMessageIter subiter;
-  guint i, size;
-  GValue val = {0,};
-  GType elt_type;
+  char *sig;
+  gboolean matches;
 
-  current_type = dbus_message_iter_get_arg_type (iter);
-  if (current_type != DBUS_TYPE_STRUCT)
-    {
-      g_set_error (error,
-                   DBUS_GERROR,
-                   DBUS_GERROR_INVALID_ARGS,
-                   "Expected D-BUS struct, got type code \'%c\'", (guchar) current_type);
-      return FALSE;
-    }
+  /* Without a message to hold on to, there's nothing to be lazy about */
+  if (context->message == NULL || plan->contents_sig == NULL)
+    return demarshal_nested (plan, context, iter, value, error);
 
-  dbus_message_iter_recurse (iter, &subiter);
+  if (dbus_message_iter_get_arg_type (iter) != DBUS_TYPE_ARRAY)
+    return demarshal_nested (plan, context, iter, value, error);
 
-  g_value_take_boxed (value,
-    dbus_g_type_specialized_construct (G_VALUE_TYPE (value)));
+  /* Check the whole signature now, so that decoding entries later
+   * can only fail inside variants */
+  sig = dbus_message_iter_get_signature (iter);
+  matches = (sig[0] == DBUS_TYPE_ARRAY && strcmp (sig + 1, plan->contents_sig) == 0);
+  dbus_free (sig);
 
-  size = dbus_g_type_get_struct_size (G_VALUE_TYPE (value));
+  if (!matches)
+    return demarshal_nested (plan, context, iter, value, error);
 
-  for (i=0; i < size; i++)
-    {
+  /* Decoding a variant can still fail, for instance on an unknown type
+   * or too much nesting. If that might happen, decode everything now so
+   * that the caller gets the error, rather than losing the entry later. */
+  if (strchr (plan->contents_sig, DBUS_TYPE_VARIANT) != NULL &&
+      !variants_are_decodable (context, iter, context->recursion_depth))
+    return demarshal_nested (plan, context, iter, value, error);
 
-      elt_type = dbus_g_type_get_struct_member_type (G_VALUE_TYPE(value), i);
-      if (elt_type == G_TYPE_INVALID)
-        {
-          g_value_unset (value);
-          g_set_error (error,
-                       DBUS_GERROR,
-                       DBUS_GERROR_INVALID_ARGS,
-                       "Couldn't demarshal argument, "
-                         "struct type %s has no member %d",
-                       g_type_name (G_VALUE_TYPE(value)), i);
-          return FALSE;
-        }
+  g_value_take_boxed (value, dbus_g_type_specialized_construct (plan->gtype));
+  _dbus_g_lazy_map_set_source (g_value_get_boxed (value), context, iter);
+  return TRUE;
+}
 
-      g_value_init (&val, elt_type);
+/*
+ * Conversions between fixed-size arrays whose elements have a different
+ * width or representation in a GArray and on the wire. These are kept as
+ * simple loops over plain arrays, with no branches in the loop body, so
+ * that the compiler can vectorize them for whatever CPU it's targeting.
+ */
 
-      if (!_dbus_gvalue_demarshal (context, &subiter, &val, error))
-        {
-          g_value_unset (&val);
-          g_value_unset (value);
-          return FALSE;
-        }
-      if (!dbus_g_type_struct_set_member (value, i, &val))
-        {
-          g_value_unset (&val);
-          g_value_unset (value);
-          return FALSE;
-        }
+static void
+fixed_array_widen_int16 (gint               *dest,
+                         const dbus_int16_t *src,
+                         guint               n)
+{
+  guint i;
 
-      dbus_message_iter_next (&subiter);
-      g_value_unset (&val);
-    }
+  for (i = 0; i < n; i++)
+    dest[i] = src[i];
+}
 
-  g_assert (dbus_message_iter_get_arg_type (&subiter) == DBUS_TYPE_INVALID);
+static void
+fixed_array_widen_uint16 (guint               *dest,
+                          const dbus_uint16_t *src,
+                          guint                n)
+{
+  guint i;
 
-  return TRUE;
+  for (i = 0; i < n; i++)
+    dest[i] = src[i];
 }
 
-
-static DBusGValueDemarshalFunc
-get_type_demarshaller (GType type)
+static void
+fixed_array_widen_int32 (glong              *dest,
+                         const dbus_int32_t *src,
+                         guint               n)
 {
-  DBusGTypeMarshalData *typedata;
+  guint i;
 
-  typedata = g_type_get_qdata (type, dbus_g_type_metadata_data_quark ());
-  if (typedata == NULL)
-    {
-      if (g_type_is_a (type, G_TYPE_VALUE_ARRAY))
-	return demarshal_valuearray;
-      if (dbus_g_type_is_collection (type))
-	return demarshal_collection;
-      if (dbus_g_type_is_map (type))
-	return demarshal_map;
-      if (dbus_g_type_is_struct (type))
-        return demarshal_struct;
-
-      g_warning ("No demarshaller registered for type \"%s\"", g_type_name (type));
-      return NULL;
-    }
-  g_assert (typedata->vtable);
-  return typedata->vtable->demarshaller;
+  for (i = 0; i < n; i++)
+    dest[i] = src[i];
 }
 
-static gboolean
-demarshal_collection (DBusGValueMarshalCtx    *context,
-		      DBusMessageIter         *iter,
-		      GValue                  *value,
-		      GError                 **error)
+static void
+fixed_array_widen_uint32 (gulong              *dest,
+                          const dbus_uint32_t *src,
+                          guint                n)
 {
-  GType coltype;
-  GType subtype;
-  
-  coltype = G_VALUE_TYPE (value);
-  subtype = dbus_g_type_get_collection_specialization (coltype);
+  guint i;
 
-  if (_dbus_g_type_is_fixed (subtype))
-    return demarshal_collection_array (context, iter, value, error);
-  else
-    return demarshal_collection_ptrarray (context, iter, value, error);
+  for (i = 0; i < n; i++)
+    dest[i] = src[i];
 }
 
-static gboolean
-demarshal_collection_ptrarray (DBusGValueMarshalCtx    *context,
-			       DBusMessageIter         *iter,
-			       GValue                  *value,
-			       GError                 **error)
+/* Truncates, like marshalling a single G_TYPE_LONG does */
+static void
+fixed_array_narrow_long (dbus_int32_t *dest,
+                         const glong  *src,
+                         guint         n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = (dbus_int32_t) src[i];
+}
+
+static void
+fixed_array_narrow_ulong (dbus_uint32_t *dest,
+                          const gulong  *src,
+                          guint          n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = (dbus_uint32_t) src[i];
+}
+
+static void
+fixed_array_narrow_double (gfloat       *dest,
+                           const double *src,
+                           guint         n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = (gfloat) src[i];
+}
+
+static void
+fixed_array_widen_float (double       *dest,
+                         const gfloat *src,
+                         guint         n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = src[i];
+}
+
+/* libdbus only accepts 0 and 1 as booleans, but a gboolean can be any
+ * value. Returns TRUE if @src can be sent as-is. */
+static gboolean
+fixed_array_booleans_are_valid (const gboolean *src,
+                                guint           n)
+{
+  guint bits = 0;
+  guint i;
+
+  /* No early exit, so that this stays vectorizable */
+  for (i = 0; i < n; i++)
+    bits |= (guint) src[i];
+
+  return (bits & ~1U) == 0;
+}
+
+static void
+fixed_array_normalize_booleans (dbus_bool_t    *dest,
+                                const gboolean *src,
+                                guint           n)
+{
+  guint i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = (src[i] != FALSE);
+}
+
+static gboolean
+demarshal_collection_array (const DBusGTypePlan     *plan,
+                            DBusGValueMarshalCtx    *context,
+			    DBusMessageIter         *iter,
+			    GValue                  *value,
+			    GError                 **error)
 {
-  GType coltype;
-  GType subtype;
-  gpointer instance;
-  DBusGTypeSpecializedAppendContext ctx;
-  DBusGValueDemarshalFunc demarshaller;
   DBusMessageIter subiter;
+  GArray *ret;
+  void *msgarray;
+  int msgarray_len;
   int current_type;
+  int elt_type;
+  GType elt_gtype;
 
   current_type = dbus_message_iter_get_arg_type (iter);
-
   if (current_type != DBUS_TYPE_ARRAY)
     {
       g_set_error (error,
@@ -1157,85 +1434,827 @@ demarshal_collection_ptrarray (DBusGValueMarshalCtx    *context,
       return FALSE;
     }
 
-  dbus_message_iter_recurse (iter, &subiter);
-  
-  coltype = G_VALUE_TYPE (value);
-  subtype = dbus_g_type_get_collection_specialization (coltype);
+  g_assert (plan->elt_size != 0);
+  g_assert (plan->contents_sig != NULL);
 
-  demarshaller = get_type_demarshaller (subtype);
+  elt_gtype = dbus_g_type_get_collection_specialization (plan->gtype);
+  elt_type = dbus_message_iter_get_element_type (iter);
 
-  if (!demarshaller)
+  /* Which wire types can be converted to which element types; anything
+   * else would be misinterpreted by the bulk copy below */
+  if (elt_type != plan->contents_sig[0] &&
+      !(elt_type == DBUS_TYPE_INT16 && elt_gtype == G_TYPE_INT) &&
+      !(elt_type == DBUS_TYPE_UINT16 && elt_gtype == G_TYPE_UINT))
     {
       g_set_error (error,
 		   DBUS_GERROR,
 		   DBUS_GERROR_INVALID_ARGS,
-		   "No demarshaller registered for type \"%s\" of collection \"%s\"",
-		   g_type_name (coltype),
-		   g_type_name (subtype));
+		   "Expected D-BUS array of type code \'%c\', got type code \'%c\'",
+		   (guchar) plan->contents_sig[0], (guchar) elt_type);
       return FALSE;
     }
 
-  instance = dbus_g_type_specialized_construct (coltype);
-  g_value_take_boxed (value, instance);
+  dbus_message_iter_recurse (iter, &subiter);
 
-  dbus_g_type_specialized_init_append (value, &ctx);
+  ret = g_array_new (FALSE, TRUE, plan->elt_size);
 
-  while ((current_type = dbus_message_iter_get_arg_type (&subiter)) != DBUS_TYPE_INVALID)
+  msgarray = NULL;
+  dbus_message_iter_get_fixed_array (&subiter,
+				     &msgarray,
+				     &msgarray_len);
+  g_assert (msgarray != NULL || msgarray_len == 0);
+
+  if (msgarray_len)
     {
-      GValue eltval = {0, };
+      guint n = (guint) msgarray_len;
 
-      g_value_init (&eltval, subtype);
+      if (elt_type == DBUS_TYPE_INT16)
+        {
+          g_array_set_size (ret, n);
+          fixed_array_widen_int16 ((gint *) ret->data, msgarray, n);
+        }
+      else if (elt_type == DBUS_TYPE_UINT16)
+        {
+          g_array_set_size (ret, n);
+          fixed_array_widen_uint16 ((guint *) ret->data, msgarray, n);
+        }
+      else if (elt_gtype == G_TYPE_LONG)
+        {
+          g_array_set_size (ret, n);
+          fixed_array_widen_int32 ((glong *) ret->data, msgarray, n);
+        }
+      else if (elt_gtype == G_TYPE_ULONG)
+        {
+          g_array_set_size (ret, n);
+          fixed_array_widen_uint32 ((gulong *) ret->data, msgarray, n);
+        }
+      else if (elt_gtype == G_TYPE_FLOAT)
+        {
+          g_array_set_size (ret, n);
+          fixed_array_narrow_double ((gfloat *) ret->data, msgarray, n);
+        }
+      else
+        {
+          /* same representation on the wire and in memory */
+          g_array_append_vals (ret, msgarray, n);
+        }
+    }
 
-      if (!demarshaller (context, &subiter, &eltval, error))
-	{
-	  dbus_g_type_specialized_collection_end_append (&ctx);
-	  g_value_unset (value);
-	  return FALSE;
-	}
-      dbus_g_type_specialized_collection_append (&ctx, &eltval);
-      
+  g_value_take_boxed (value, ret);
+  
+  return TRUE;
+}
+
+static gboolean
+demarshal_packed_structs (const DBusGTypePlan     *plan,
+                          DBusGValueMarshalCtx    *context,
+                          DBusMessageIter         *iter,
+                          GValue                  *value,
+                          GError                 **error)
+{
+  const DBusGPackedStructLayout *layout = plan->packed_layout;
+  DBusMessageIter subiter;
+  GArray *ret;
+  char *sig;
+  gboolean matches;
+  guint n_rows;
+
+  if (dbus_message_iter_get_arg_type (iter) != DBUS_TYPE_ARRAY)
+    {
+      g_set_error (error,
+                   DBUS_GERROR,
+                   DBUS_GERROR_INVALID_ARGS,
+                   "Expected D-BUS array, got type code \'%c\'",
+                   (guchar) dbus_message_iter_get_arg_type (iter));
+      return FALSE;
+    }
+
+  /* Check the whole signature once, so that the loop below doesn't
+   * have to check each member */
+  sig = dbus_message_iter_get_signature (iter);
+  matches = (sig[0] == DBUS_TYPE_ARRAY && plan->contents_sig != NULL &&
+             strcmp (sig + 1, plan->contents_sig) == 0);
+
+  if (!matches)
+    {
+      g_set_error (error,
+                   DBUS_GERROR,
+                   DBUS_GERROR_INVALID_ARGS,
+                   "Expected D-BUS array of \"%s\", got \"%s\"",
+                   plan->contents_sig ? plan->contents_sig : "(null)", sig);
+      dbus_free (sig);
+      return FALSE;
+    }
+
+  dbus_free (sig);
+
+  n_rows = 0;
+  dbus_message_iter_recurse (iter, &subiter);
+  while (dbus_message_iter_get_arg_type (&subiter) == DBUS_TYPE_STRUCT)
+    {
+      n_rows++;
       dbus_message_iter_next (&subiter);
     }
-  dbus_g_type_specialized_collection_end_append (&ctx);
-  
+
+  ret = g_array_sized_new (FALSE, TRUE, layout->row_size, n_rows);
+  g_array_set_size (ret, n_rows);
+
+  n_rows = 0;
+  dbus_message_iter_recurse (iter, &subiter);
+  while (dbus_message_iter_get_arg_type (&subiter) == DBUS_TYPE_STRUCT)
+    {
+      char *row = ret->data + n_rows * layout->row_size;
+      DBusMessageIter member_iter;
+      guint i;
+
+      dbus_message_iter_recurse (&subiter, &member_iter);
+
+      for (i = 0; i < layout->n_members; i++)
+        {
+          dbus_message_iter_get_basic (&member_iter, row + layout->offsets[i]);
+          dbus_message_iter_next (&member_iter);
+        }
+
+      n_rows++;
+      dbus_message_iter_next (&subiter);
+    }
+
+  g_value_take_boxed (value, ret);
   return TRUE;
 }
 
-static gboolean
-demarshal_collection_array (DBusGValueMarshalCtx    *context,
-			    DBusMessageIter         *iter,
-			    GValue                  *value,
-			    GError                 **error)
-{
-  DBusMessageIter subiter;
-  GArray *ret;
-  GType elt_gtype;
-  int elt_size;
-  void *msgarray;
-  int msgarray_len;
+static gboolean
+marshal_leaf (const DBusGTypePlan *plan,
+              DBusMessageIter     *iter,
+              const GValue        *value)
+{
+  return plan->marshaller (iter, value);
+}
+
+static gboolean
+demarshal_leaf (const DBusGTypePlan     *plan,
+                DBusGValueMarshalCtx    *context,
+                DBusMessageIter         *iter,
+                GValue                  *value,
+                GError                 **error)
+{
+  return plan->demarshaller (context, iter, value, error);
+}
+
+static GQuark
+dbus_g_type_plan_quark ()
+{
+  static GQuark quark;
+  if (!quark)
+    quark = g_quark_from_static_string ("DBusGTypePlan");
+
+  return quark;
+}
+
+/* Serializes building plans; reading one that has been attached to its
+ * type needs no lock, since it is never modified or freed. */
+G_LOCK_DEFINE_STATIC (type_plans);
+
+static DBusGTypePlan *
+type_plan_new (GType type,
+               guint n_children)
+{
+  DBusGTypePlan *plan;
+
+  plan = g_new0 (DBusGTypePlan, 1);
+  plan->gtype = type;
+  plan->n_children = n_children;
+  if (n_children > 0)
+    plan->children = g_new0 (const DBusGTypePlan *, n_children);
+
+  return plan;
+}
+
+static void
+type_plan_free (DBusGTypePlan *plan)
+{
+  g_free (plan->contents_sig);
+  g_free (plan->children);
+  g_free (plan);
+}
+
+/* Must be called with the type_plans lock held */
+static const DBusGTypePlan *
+build_type_plan (GType type)
+{
+  DBusGTypePlan *plan;
+  DBusGTypeMarshalData *typedata;
+  guint i;
+
+  plan = g_type_get_qdata (type, dbus_g_type_plan_quark ());
+  if (plan != NULL)
+    return plan;
+
+  typedata = g_type_get_qdata (type, dbus_g_type_metadata_data_quark ());
+
+  if (typedata != NULL)
+    {
+      g_assert (typedata->vtable);
+      plan = type_plan_new (type, 0);
+      plan->marshal = marshal_leaf;
+      plan->demarshal = demarshal_leaf;
+      plan->marshaller = typedata->vtable->marshaller;
+      plan->demarshaller = typedata->vtable->demarshaller;
+
+      if (type == G_TYPE_VALUE)
+        {
+          plan->nest_kind = DBUS_G_NEST_VARIANT;
+          plan->demarshal = demarshal_nested;
+        }
+    }
+  else if (g_type_is_a (type, G_TYPE_VALUE_ARRAY))
+    {
+      plan = type_plan_new (type, 0);
+      plan->marshal = marshal_leaf;
+      plan->demarshal = demarshal_leaf;
+      plan->marshaller = marshal_valuearray;
+      plan->demarshaller = demarshal_valuearray;
+    }
+  else if (dbus_g_type_is_collection (type))
+    {
+      GType elt_gtype = dbus_g_type_get_collection_specialization (type);
+
+      if (_dbus_g_type_is_packed_struct_collection (type))
+        {
+          plan = type_plan_new (type, 0);
+          plan->marshal = marshal_packed_structs;
+          plan->demarshal = demarshal_packed_structs;
+          plan->packed_layout = _dbus_g_packed_struct_layout_get (type);
+        }
+      else if (_dbus_g_type_is_fixed (elt_gtype))
+        {
+          plan = type_plan_new (type, 0);
+          plan->marshal = marshal_collection_array;
+          plan->demarshal = demarshal_collection_array;
+          plan->elt_size = _dbus_g_type_fixed_get_size (elt_gtype);
+        }
+      else
+        {
+          const DBusGTypePlan *elt_plan = build_type_plan (elt_gtype);
+
+          if (elt_plan == NULL)
+            return NULL;
+
+          plan = type_plan_new (type, 1);
+          plan->nest_kind = DBUS_G_NEST_PTRARRAY;
+          plan->marshal = marshal_collection_ptrarray;
+          plan->demarshal = demarshal_nested;
+          plan->children[0] = elt_plan;
+        }
+
+      /* May be NULL if the element type can only be demarshalled;
+       * marshal_collection_* will complain if it is ever needed */
+      plan->contents_sig = _dbus_gtype_to_signature (elt_gtype);
+    }
+  else if (dbus_g_type_is_map (type))
+    {
+      GType key_gtype = dbus_g_type_get_map_key_specialization (type);
+      GType value_gtype = dbus_g_type_get_map_value_specialization (type);
+      const DBusGTypePlan *key_plan = build_type_plan (key_gtype);
+      const DBusGTypePlan *value_plan = build_type_plan (value_gtype);
+      char *key_sig;
+      char *value_sig;
+
+      if (key_plan == NULL || value_plan == NULL)
+        return NULL;
+
+      plan = type_plan_new (type, 2);
+      plan->nest_kind = DBUS_G_NEST_MAP;
+      plan->marshal = marshal_map;
+      if (_dbus_g_type_is_lazy_map (type))
+        plan->demarshal = demarshal_lazy_map;
+      else
+        plan->demarshal = demarshal_nested;
+      plan->children[0] = key_plan;
+      plan->children[1] = value_plan;
+
+      key_sig = _dbus_gtype_to_signature (key_gtype);
+      value_sig = _dbus_gtype_to_signature (value_gtype);
+
+      if (key_sig != NULL && value_sig != NULL)
+        plan->contents_sig = g_strdup_printf ("%c%s%s%c",
+                                              DBUS_DICT_ENTRY_BEGIN_CHAR,
+                                              key_sig, value_sig,
+                                              DBUS_DICT_ENTRY_END_CHAR);
+
+      g_free (key_sig);
+      g_free (value_sig);
+    }
+  else if (dbus_g_type_is_struct (type))
+    {
+      plan = type_plan_new (type, dbus_g_type_get_struct_size (type));
+      plan->nest_kind = DBUS_G_NEST_STRUCT;
+      plan->marshal = marshal_struct;
+      plan->demarshal = demarshal_nested;
+
+      for (i = 0; i < plan->n_children; i++)
+        {
+          GType member_gtype = dbus_g_type_get_struct_member_type (type, i);
+
+          if (member_gtype != G_TYPE_INVALID)
+            plan->children[i] = build_type_plan (member_gtype);
+
+          if (plan->children[i] == NULL)
+            {
+              type_plan_free (plan);
+              return NULL;
+            }
+        }
+    }
+  else
+    {
+      g_warning ("No marshaller registered for type \"%s\"", g_type_name (type));
+      return NULL;
+    }
+
+  g_type_set_qdata (type, dbus_g_type_plan_quark (), plan);
+  return plan;
+}
+
+/*
+ * get_type_plan:
+ * @type: a #GType
+ *
+ * Returns: how to marshal and demarshal @type, or %NULL if it can't be.
+ *  The first call for a given type works out the functions for it and for
+ *  any types it contains; later calls are a single qdata lookup.
+ */
+static const DBusGTypePlan *
+get_type_plan (GType type)
+{
+  const DBusGTypePlan *plan;
+
+  plan = g_type_get_qdata (type, dbus_g_type_plan_quark ());
+  if (plan != NULL)
+    return plan;
+
+  G_LOCK (type_plans);
+  plan = build_type_plan (type);
+  G_UNLOCK (type_plans);
+
+  return plan;
+}
+
+static gboolean
+demarshal_with_plan (const DBusGTypePlan     *plan,
+                     DBusGValueMarshalCtx    *context,
+                     DBusMessageIter         *iter,
+                     GValue                  *value,
+                     GError                 **error)
+{
+  gboolean retcode;
+
+  if (context->recursion_depth > (guint) g_atomic_int_get (&max_value_nesting))
+    {
+      g_set_error (error, DBUS_GERROR,
+                   DBUS_GERROR_NO_MEMORY, 
+                   "Variant recursion limit exceeded");
+      return FALSE;
+    }
+  context->recursion_depth++;
+
+  retcode = plan->demarshal (plan, context, iter, value, error);
+
+  context->recursion_depth--;  
+  return retcode;
+}
+
+/*
+ * Variants, structs, maps and collections of non-fixed types are
+ * demarshalled by demarshal_nested() with an explicit stack of frames,
+ * one per container that is being filled in, rather than by recursion.
+ * This keeps deeply nested values such as "vvvv...", "avavav..." or
+ * "a{sa{sa{s...}}}" from using a C stack frame and a function call per
+ * level, and means the nesting limit is just a policy decision.
+ *
+ * Each frame's container is constructed when the frame is pushed, its
+ * children are demarshalled one at a time into frame->child (and
+ * frame->key for maps), and each child is added to the container as soon
+ * as it is complete. Children that are themselves containers of this kind
+ * get a frame of their own; anything else is demarshalled by its plan.
+ *
+ * recursion_depth is accounted for exactly as the recursive implementation
+ * did, so the limit means the same as it always has.
+ */
+
+typedef struct {
+  const DBusGTypePlan *plan;
+  /* The container being filled in: the caller's GValue for the outermost
+   * frame, the parent frame's child otherwise */
+  GValue *value;
+  /* Points to the next child */
+  DBusMessageIter subiter;
+  /* Maps: the current dict entry */
+  DBusMessageIter entry_iter;
+  /* Structs: the next member. Maps: 0 for a key, 1 for a value.
+   * Variants: 1 once the contents have been demarshalled. */
+  guint index;
+  /* How much this frame added to context->recursion_depth */
+  guint depth_cost;
+  /* The child being demarshalled */
+  GValue child;
+  /* Maps: the key, while its value is being demarshalled */
+  GValue key;
+  /* Variants: the GValue that will be boxed in @value */
+  GValue *variant_val;
+  /* Maps and collections */
+  DBusGTypeSpecializedAppendContext append;
+} DBusGNestFrame;
+
+static gboolean
+nest_frame_push (GPtrArray               *stack,
+                 const DBusGTypePlan     *plan,
+                 guint                    depth_cost,
+                 DBusGValueMarshalCtx    *context,
+                 DBusMessageIter         *iter,
+                 GValue                  *value,
+                 GError                 **error)
+{
+  DBusGNestFrame *frame;
+  int current_type;
+  int expected_type;
+
+  if (depth_cost > 0 &&
+      context->recursion_depth > (guint) g_atomic_int_get (&max_value_nesting))
+    {
+      g_set_error (error, DBUS_GERROR,
+                   DBUS_GERROR_NO_MEMORY,
+                   "Variant recursion limit exceeded");
+      return FALSE;
+    }
+
+  switch (plan->nest_kind)
+    {
+    case DBUS_G_NEST_VARIANT:
+      expected_type = DBUS_TYPE_VARIANT;
+      break;
+    case DBUS_G_NEST_STRUCT:
+      expected_type = DBUS_TYPE_STRUCT;
+      break;
+    case DBUS_G_NEST_MAP:
+    case DBUS_G_NEST_PTRARRAY:
+      expected_type = DBUS_TYPE_ARRAY;
+      break;
+    case DBUS_G_NEST_NONE:
+    default:
+      g_assert_not_reached ();
+    }
+
+  current_type = dbus_message_iter_get_arg_type (iter);
+  if (current_type != expected_type)
+    {
+      g_set_error (error,
+                   DBUS_GERROR,
+                   DBUS_GERROR_INVALID_ARGS,
+                   "Expected D-BUS %s, got type code \'%c\'",
+                   expected_type == DBUS_TYPE_VARIANT ? "variant" :
+                   expected_type == DBUS_TYPE_STRUCT ? "struct" : "array",
+                   (guchar) current_type);
+      return FALSE;
+    }
+
+  frame = g_slice_new0 (DBusGNestFrame);
+  frame->plan = plan;
+  frame->value = value;
+  frame->depth_cost = depth_cost;
+
+  if (plan->nest_kind == DBUS_G_NEST_VARIANT)
+    {
+      GType variant_type;
+
+      variant_type = variant_get_content_type (context, iter,
+                                               &frame->subiter, error);
+      if (variant_type == G_TYPE_INVALID)
+        {
+          g_slice_free (DBusGNestFrame, frame);
+          return FALSE;
+        }
+
+      frame->variant_val = g_new0 (GValue, 1);
+      g_value_init (frame->variant_val, variant_type);
+    }
+  else
+    {
+      dbus_message_iter_recurse (iter, &frame->subiter);
+
+      if (plan->nest_kind == DBUS_G_NEST_MAP)
+        {
+          current_type = dbus_message_iter_get_arg_type (&frame->subiter);
+          if (current_type != DBUS_TYPE_INVALID
+              && current_type != DBUS_TYPE_DICT_ENTRY)
+            {
+              g_set_error (error,
+                           DBUS_GERROR,
+                           DBUS_GERROR_INVALID_ARGS,
+                           "Expected D-BUS dict entry, got type code \'%c\'",
+                           (guchar) current_type);
+              g_slice_free (DBusGNestFrame, frame);
+              return FALSE;
+            }
+        }
+
+      g_value_take_boxed (value, dbus_g_type_specialized_construct (plan->gtype));
+
+      if (plan->nest_kind != DBUS_G_NEST_STRUCT)
+        dbus_g_type_specialized_init_append (value, &frame->append);
+    }
+
+  context->recursion_depth += depth_cost;
+  g_ptr_array_add (stack, frame);
+  return TRUE;
+}
+
+static void
+nest_frame_pop (GPtrArray            *stack,
+                DBusGValueMarshalCtx *context,
+                gboolean              success)
+{
+  DBusGNestFrame *frame = g_ptr_array_index (stack, stack->len - 1);
+
+  if (G_IS_VALUE (&frame->child))
+    g_value_unset (&frame->child);
+
+  if (G_IS_VALUE (&frame->key))
+    g_value_unset (&frame->key);
+
+  switch (frame->plan->nest_kind)
+    {
+    case DBUS_G_NEST_VARIANT:
+      if (success)
+        {
+          g_value_take_boxed (frame->value, frame->variant_val);
+        }
+      else
+        {
+          if (G_IS_VALUE (frame->variant_val))
+            g_value_unset (frame->variant_val);
+          g_free (frame->variant_val);
+        }
+      break;
+    case DBUS_G_NEST_PTRARRAY:
+      dbus_g_type_specialized_collection_end_append (&frame->append);
+      break;
+    case DBUS_G_NEST_STRUCT:
+      if (success)
+        g_assert (dbus_message_iter_get_arg_type (&frame->subiter) == DBUS_TYPE_INVALID);
+      break;
+    case DBUS_G_NEST_MAP:
+    case DBUS_G_NEST_NONE:
+    default:
+      break;
+    }
+
+  context->recursion_depth -= frame->depth_cost;
+  g_ptr_array_set_size (stack, stack->len - 1);
+  g_slice_free (DBusGNestFrame, frame);
+}
+
+/* Find the next child of @frame's container. Returns FALSE if there are
+ * no more. */
+static gboolean
+nest_frame_next_child (DBusGNestFrame       *frame,
+                       const DBusGTypePlan **child_plan,
+                       DBusMessageIter     **child_iter,
+                       GValue              **child_value)
+{
+  const DBusGTypePlan *plan = frame->plan;
+
+  switch (plan->nest_kind)
+    {
+    case DBUS_G_NEST_VARIANT:
+      if (frame->index > 0)
+        return FALSE;
+
+      *child_plan = get_type_plan (G_VALUE_TYPE (frame->variant_val));
+      *child_iter = &frame->subiter;
+      *child_value = frame->variant_val;
+      return TRUE;
+
+    case DBUS_G_NEST_STRUCT:
+      if (frame->index >= plan->n_children)
+        return FALSE;
+
+      *child_plan = plan->children[frame->index];
+      *child_iter = &frame->subiter;
+      *child_value = &frame->child;
+      break;
+
+    case DBUS_G_NEST_MAP:
+      if (frame->index == 0)
+        {
+          if (dbus_message_iter_get_arg_type (&frame->subiter) == DBUS_TYPE_INVALID)
+            return FALSE;
+
+          dbus_message_iter_recurse (&frame->subiter, &frame->entry_iter);
+          *child_plan = plan->children[0];
+          *child_value = &frame->key;
+        }
+      else
+        {
+          *child_plan = plan->children[1];
+          *child_value = &frame->child;
+        }
+
+      *child_iter = &frame->entry_iter;
+      break;
+
+    case DBUS_G_NEST_PTRARRAY:
+      if (dbus_message_iter_get_arg_type (&frame->subiter) == DBUS_TYPE_INVALID)
+        return FALSE;
+
+      *child_plan = plan->children[0];
+      *child_iter = &frame->subiter;
+      *child_value = &frame->child;
+      break;
+
+    case DBUS_G_NEST_NONE:
+    default:
+      g_assert_not_reached ();
+    }
+
+  g_value_init (*child_value, (*child_plan)->gtype);
+  return TRUE;
+}
+
+/* Add the child that has just been demarshalled to @frame's container */
+static gboolean
+nest_frame_child_done (DBusGNestFrame  *frame,
+                       GError         **error)
+{
+  switch (frame->plan->nest_kind)
+    {
+    case DBUS_G_NEST_VARIANT:
+      frame->index = 1;
+      break;
+
+    case DBUS_G_NEST_STRUCT:
+      if (!dbus_g_type_struct_set_member (frame->value, frame->index,
+                                          &frame->child))
+        {
+          g_set_error (error,
+                       DBUS_GERROR,
+                       DBUS_GERROR_INVALID_ARGS,
+                       "Unable to set member %u of struct type \"%s\"",
+                       frame->index, g_type_name (frame->plan->gtype));
+          return FALSE;
+        }
+
+      g_value_unset (&frame->child);
+      dbus_message_iter_next (&frame->subiter);
+      frame->index++;
+      break;
+
+    case DBUS_G_NEST_MAP:
+      if (frame->index == 0)
+        {
+          dbus_message_iter_next (&frame->entry_iter);
+          frame->index = 1;
+        }
+      else
+        {
+          dbus_g_type_specialized_map_append (&frame->append, &frame->key,
+                                              &frame->child);
+          /* Ownership of values passes to map, don't unset */
+          memset (&frame->key, 0, sizeof (GValue));
+          memset (&frame->child, 0, sizeof (GValue));
+          dbus_message_iter_next (&frame->subiter);
+          frame->index = 0;
+        }
+      break;
+
+    case DBUS_G_NEST_PTRARRAY:
+      dbus_g_type_specialized_collection_append (&frame->append, &frame->child);
+      /* Ownership of the value passes to the collection, don't unset */
+      memset (&frame->child, 0, sizeof (GValue));
+      dbus_message_iter_next (&frame->subiter);
+      break;
+
+    case DBUS_G_NEST_NONE:
+    default:
+      g_assert_not_reached ();
+    }
+
+  return TRUE;
+}
+
+static gboolean
+demarshal_nested (const DBusGTypePlan     *plan,
+                  DBusGValueMarshalCtx    *context,
+                  DBusMessageIter         *iter,
+                  GValue                  *value,
+                  GError                 **error)
+{
+  GPtrArray *stack;
+  gboolean ret = FALSE;
+
+  stack = g_ptr_array_new ();
+
+  /* The caller has already counted this level */
+  if (!nest_frame_push (stack, plan, 0, context, iter, value, error))
+    goto out;
+
+  while (stack->len > 0)
+    {
+      DBusGNestFrame *frame = g_ptr_array_index (stack, stack->len - 1);
+      const DBusGTypePlan *child_plan;
+      DBusMessageIter *child_iter;
+      GValue *child_value;
+
+      if (!nest_frame_next_child (frame, &child_plan, &child_iter,
+                                  &child_value))
+        {
+          nest_frame_pop (stack, context, TRUE);
+
+          if (stack->len == 0)
+            break;
+
+          if (!nest_frame_child_done (g_ptr_array_index (stack, stack->len - 1),
+                                      error))
+            goto out;
+
+          continue;
+        }
+
+      if (child_plan == NULL)
+        {
+          g_set_error (error,
+                       DBUS_GERROR,
+                       DBUS_GERROR_INVALID_ARGS,
+                       "No demarshaller registered for type \"%s\"",
+                       g_type_name (G_VALUE_TYPE (child_value)));
+          goto out;
+        }
+
+      if (child_plan->demarshal == demarshal_nested)
+        {
+          /* Elements of a collection were never counted towards the
+           * nesting limit, only the things they contain */
+          guint cost = (frame->plan->nest_kind == DBUS_G_NEST_PTRARRAY ? 0 : 1);
+
+          if (!nest_frame_push (stack, child_plan, cost, context, child_iter,
+                                child_value, error))
+            goto out;
+
+          continue;
+        }
+
+      if (frame->plan->nest_kind == DBUS_G_NEST_PTRARRAY)
+        {
+          if (!child_plan->demarshal (child_plan, context, child_iter,
+                                      child_value, error))
+            goto out;
+        }
+      else
+        {
+          if (!demarshal_with_plan (child_plan, context, child_iter,
+                                    child_value, error))
+            goto out;
+        }
 
-  dbus_message_iter_recurse (iter, &subiter);
+      if (!nest_frame_child_done (frame, error))
+        goto out;
+    }
 
-  elt_gtype = dbus_g_type_get_collection_specialization (G_VALUE_TYPE (value));
-  g_assert (elt_gtype != G_TYPE_INVALID);
-  g_assert (_dbus_g_type_is_fixed (elt_gtype));
+  ret = TRUE;
 
-  elt_size = _dbus_g_type_fixed_get_size (elt_gtype);
-  
-  ret = g_array_new (FALSE, TRUE, elt_size);
+out:
+  /* On error, the partially-filled containers are freed along with
+   * the frames that own them, apart from the outermost, which is left
+   * in @value for the caller to unset */
+  while (stack->len > 0)
+    nest_frame_pop (stack, context, FALSE);
 
-  msgarray = NULL;
-  dbus_message_iter_get_fixed_array (&subiter,
-				     &msgarray,
-				     &msgarray_len);
-  g_assert (msgarray != NULL || msgarray_len == 0);
+  g_ptr_array_unref (stack);
+  return ret;
+}
 
-  if (msgarray_len)
-    g_array_append_vals (ret, msgarray, (guint) msgarray_len);
+/**
+ * dbus_glib_global_set_max_value_nesting:
+ * @max_depth: the maximum nesting depth, which must be positive
+ *
+ * Set how deeply variants, structs, maps and arrays may be nested in
+ * received method calls, signals and replies. Values nested more deeply
+ * are rejected with %DBUS_GERROR_NO_MEMORY. Each variant, struct, map
+ * or array counts as one level.
+ *
+ * The default is 32. libdbus places its own limit on nesting in
+ * messages, which cannot be exceeded whatever this is set to.
+ *
+ * Deprecated: New code should use GDBus instead. There is no direct
+ *  equivalent for this function.
+ */
+void
+dbus_glib_global_set_max_value_nesting (guint max_depth)
+{
+  g_return_if_fail (max_depth > 0);
+  g_return_if_fail (max_depth <= G_MAXINT);
 
-  g_value_take_boxed (value, ret);
-  
-  return TRUE;
+  g_atomic_int_set (&max_value_nesting, (gint) max_depth);
 }
 
 gboolean
@@ -1245,37 +2264,23 @@ _dbus_gvalue_demarshal (DBusGValueMarshalCtx    *context,
 		       GError                 **error)
 {
   GType gtype;
-  DBusGValueDemarshalFunc demarshaller;
-  gboolean retcode = FALSE;
-
-  if (context->recursion_depth > DBUS_GLIB_MAX_VARIANT_RECURSION)
-    {
-      g_set_error (error, DBUS_GERROR,
-                   DBUS_GERROR_NO_MEMORY, 
-                   "Variant recursion limit exceeded");
-      return FALSE;
-    }
-  context->recursion_depth++;
+  const DBusGTypePlan *plan;
 
   gtype = G_VALUE_TYPE (value);
 
-  demarshaller = get_type_demarshaller (gtype);
+  plan = get_type_plan (gtype);
 
-  if (demarshaller == NULL)
+  if (plan == NULL)
     {
       g_set_error (error,
 		   DBUS_GERROR,
 		   DBUS_GERROR_INVALID_ARGS,
 		   "No demarshaller registered for type \"%s\"",
 		   g_type_name (gtype));
-    
-      goto out;
+      return FALSE;
     }
-  
-  retcode = demarshaller (context, iter, value, error);
- out:
-  context->recursion_depth--;  
-  return retcode;
+
+  return demarshal_with_plan (plan, context, iter, value, error);
 }
 
 gboolean
@@ -1287,11 +2292,168 @@ _dbus_gvalue_demarshal_variant (DBusGValueMarshalCtx    *context,
   return demarshal_static_variant (context, iter, value, error);
 }
 
+struct _DBusGArenaChunk {
+  DBusGArenaChunk *next;
+};
+
+/* Enough for any basic type, and for a pointer */
+#define ARENA_ALIGNMENT (2 * sizeof (gpointer))
+#define ARENA_ALIGN(n) (((n) + ARENA_ALIGNMENT - 1) & ~(gsize) (ARENA_ALIGNMENT - 1))
+#define ARENA_MIN_CHUNK_SIZE 4096
+
+void
+_dbus_g_arena_init (DBusGArena *arena,
+                    gpointer    buffer,
+                    gsize       size)
+{
+  guchar *start = buffer;
+  guchar *aligned = GSIZE_TO_POINTER (ARENA_ALIGN (GPOINTER_TO_SIZE (start)));
+
+  arena->chunks = NULL;
+
+  if (buffer == NULL || aligned >= start + size)
+    {
+      arena->pos = NULL;
+      arena->end = NULL;
+    }
+  else
+    {
+      arena->pos = aligned;
+      arena->end = start + size;
+    }
+}
+
+gpointer
+_dbus_g_arena_alloc (DBusGArena *arena,
+                     gsize       size)
+{
+  gpointer ret;
+
+  size = ARENA_ALIGN (size);
+
+  if (arena->pos == NULL || (gsize) (arena->end - arena->pos) < size)
+    {
+      DBusGArenaChunk *chunk;
+      gsize header = ARENA_ALIGN (sizeof (DBusGArenaChunk));
+      gsize chunk_size = MAX (header + size, ARENA_MIN_CHUNK_SIZE);
+
+      chunk = g_malloc (chunk_size);
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+      arena->pos = ((guchar *) chunk) + header;
+      arena->end = ((guchar *) chunk) + chunk_size;
+    }
+
+  ret = arena->pos;
+  arena->pos += size;
+  return ret;
+}
+
+void
+_dbus_g_arena_clear (DBusGArena *arena)
+{
+  while (arena->chunks != NULL)
+    {
+      DBusGArenaChunk *next = arena->chunks->next;
+
+      g_free (arena->chunks);
+      arena->chunks = next;
+    }
+
+  arena->pos = NULL;
+  arena->end = NULL;
+}
+
+/*
+ * demarshal_borrowed:
+ *
+ * Try to demarshal a top-level argument without copying it out of the
+ * message. Strings, object paths and signatures point into the message
+ * itself, and a string array's vector is allocated from @arena; @value
+ * is marked as not owning any of them. The caller must keep the message
+ * and the arena alive for as long as @value is in use, and whoever wants
+ * to keep the contents for longer has to copy them, just as for any other
+ * borrowed argument.
+ *
+ * Anything more complex is owned by a container that would free it
+ * itself, so it isn't eligible.
+ *
+ * Returns: %TRUE if @value was set, %FALSE if the caller should
+ *  demarshal it normally
+ */
+static gboolean
+demarshal_borrowed (DBusMessageIter *iter,
+                    GValue          *value,
+                    DBusGArena      *arena)
+{
+  GType gtype = G_VALUE_TYPE (value);
+  int current_type = dbus_message_iter_get_arg_type (iter);
+  const char *str;
+
+  if (gtype == G_TYPE_STRING && current_type == DBUS_TYPE_STRING)
+    {
+      dbus_message_iter_get_basic (iter, &str);
+      g_value_set_static_string (value, str);
+      return TRUE;
+    }
+
+  if ((gtype == DBUS_TYPE_G_OBJECT_PATH &&
+       current_type == DBUS_TYPE_OBJECT_PATH) ||
+      (gtype == DBUS_TYPE_G_SIGNATURE &&
+       current_type == DBUS_TYPE_SIGNATURE))
+    {
+      dbus_message_iter_get_basic (iter, &str);
+      g_value_set_static_boxed (value, str);
+      return TRUE;
+    }
+
+  if (gtype == G_TYPE_STRV &&
+      current_type == DBUS_TYPE_ARRAY &&
+      dbus_message_iter_get_element_type (iter) == DBUS_TYPE_STRING)
+    {
+      DBusMessageIter subiter;
+      char **strv;
+      guint n = 0;
+
+      dbus_message_iter_recurse (iter, &subiter);
+      while (dbus_message_iter_get_arg_type (&subiter) != DBUS_TYPE_INVALID)
+        {
+          n++;
+          dbus_message_iter_next (&subiter);
+        }
+
+      strv = _dbus_g_arena_alloc (arena, sizeof (char *) * (n + 1));
+
+      n = 0;
+      dbus_message_iter_recurse (iter, &subiter);
+      while (dbus_message_iter_get_arg_type (&subiter) != DBUS_TYPE_INVALID)
+        {
+          dbus_message_iter_get_basic (&subiter, &str);
+          strv[n++] = (char *) str;
+          dbus_message_iter_next (&subiter);
+        }
+      strv[n] = NULL;
+
+      g_value_set_static_boxed (value, strv);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * _dbus_gvalue_demarshal_message:
+ * @arena: if not %NULL, strings and string arrays among the top-level
+ *  arguments may be borrowed from @message, with any extra storage
+ *  coming from @arena (see demarshal_borrowed()); the returned array must
+ *  then be freed before either of them
+ */
 GValueArray *
 _dbus_gvalue_demarshal_message  (DBusGValueMarshalCtx    *context,
 				DBusMessage             *message,
 				guint                    n_types,
 				const GType             *types,
+				DBusGArena              *arena,
 				GError                 **error)
 {
   GValueArray *ret;
@@ -1301,6 +2463,7 @@ _dbus_gvalue_demarshal_message  (DBusGValueMarshalCtx    *context,
   
   ret = g_value_array_new (6);  /* 6 is a typical maximum for arguments */
 
+  context->message = message;
   dbus_message_iter_init (message, &iter);
   index_ = 0;
   while ((current_type = dbus_message_iter_get_arg_type (&iter)) != DBUS_TYPE_INVALID)
@@ -1322,8 +2485,11 @@ _dbus_gvalue_demarshal_message  (DBusGValueMarshalCtx    *context,
       gtype = types[index_]; 
       g_value_init (value, gtype);
 
-      if (!_dbus_gvalue_demarshal (context, &iter, value, error))
-	goto lose;
+      if (arena == NULL || !demarshal_borrowed (&iter, value, arena))
+        {
+          if (!_dbus_gvalue_demarshal (context, &iter, value, error))
+            goto lose;
+        }
       dbus_message_iter_next (&iter);
       index_++;
     }
@@ -1501,7 +2667,8 @@ marshal_strv (DBusMessageIter   *iter,
   char **elt;
   gboolean ret = FALSE;
 
-  g_assert (G_VALUE_TYPE (value) == g_strv_get_type ());
+  g_assert (G_VALUE_TYPE (value) == G_TYPE_STRV ||
+            G_VALUE_TYPE (value) == DBUS_TYPE_G_PACKED_STRV);
 
   array = g_value_get_boxed (value);
 
@@ -1647,7 +2814,8 @@ marshal_signature (DBusMessageIter         *iter,
 
 struct DBusGLibHashMarshalData
 {
-  const char *entry_sig;
+  const DBusGTypePlan *key_plan;
+  const DBusGTypePlan *value_plan;
   DBusMessageIter *iter;
   gboolean err;
 };
@@ -1669,10 +2837,10 @@ marshal_map_entry (const GValue *key,
 					 &subiter))
     goto lose;
 
-  if (!_dbus_gvalue_marshal (&subiter, key))
+  if (!hashdata->key_plan->marshal (hashdata->key_plan, &subiter, key))
     goto lose;
 
-  if (!_dbus_gvalue_marshal (&subiter, value))
+  if (!hashdata->value_plan->marshal (hashdata->value_plan, &subiter, value))
     goto lose;
 
   if (!dbus_message_iter_close_container (hashdata->iter, &subiter))
@@ -1684,55 +2852,32 @@ marshal_map_entry (const GValue *key,
 }
 
 static gboolean
-marshal_map (DBusMessageIter   *iter,
+marshal_map (const DBusGTypePlan *plan,
+             DBusMessageIter   *iter,
 	     const GValue      *value)
 {
-  GType gtype;
   DBusMessageIter arr_iter;
   struct DBusGLibHashMarshalData hashdata;
-  char *key_sig;
-  char *value_sig;
-  GType key_type;
-  GType value_type;
-  char *entry_sig;
-  char *array_sig;
 
-  gtype = G_VALUE_TYPE (value);
-
-  key_type = dbus_g_type_get_map_key_specialization (gtype);
-  g_assert (_dbus_gtype_is_valid_hash_key (key_type));
-  value_type = dbus_g_type_get_map_value_specialization (gtype);
-  g_assert (_dbus_gtype_is_valid_hash_value (value_type));
-
-  key_sig = _dbus_gtype_to_signature (key_type);
-  if (!key_sig)
-    {
-      g_warning ("Cannot marshal type \"%s\" in map\n", g_type_name (key_type));
-      return FALSE;
-    }
-  value_sig = _dbus_gtype_to_signature (value_type);
-  if (!value_sig)
+  if (plan->contents_sig == NULL)
     {
-      g_free (key_sig);
-      g_warning ("Cannot marshal type \"%s\" in map\n", g_type_name (value_type));
+      g_warning ("Cannot marshal type \"%s\" in map\n", g_type_name (plan->gtype));
       return FALSE;
     }
-  entry_sig = g_strdup_printf ("%s%s", key_sig, value_sig);
-  g_free (key_sig);
-  g_free (value_sig);
-  array_sig = g_strdup_printf ("%c%s%c",
-			       DBUS_DICT_ENTRY_BEGIN_CHAR,
-			       entry_sig,
-			       DBUS_DICT_ENTRY_END_CHAR);
+
+  g_assert (_dbus_gtype_is_valid_hash_key (plan->children[0]->gtype));
+  g_assert (_dbus_gtype_is_valid_hash_value (plan->children[1]->gtype));
+
   if (!dbus_message_iter_open_container (iter,
 					 DBUS_TYPE_ARRAY,
-					 array_sig,
+					 plan->contents_sig,
 					 &arr_iter))
-    goto lose;
+    return FALSE;
 
   hashdata.iter = &arr_iter;
   hashdata.err = FALSE;
-  hashdata.entry_sig = entry_sig;
+  hashdata.key_plan = plan->children[0];
+  hashdata.value_plan = plan->children[1];
 
   dbus_g_type_map_value_iterate (value,
 				 marshal_map_entry,
@@ -1741,50 +2886,37 @@ marshal_map (DBusMessageIter   *iter,
   if (hashdata.err)
     {
       dbus_message_iter_abandon_container (iter, &arr_iter);
-      goto lose;
-    }
-  else if (!dbus_message_iter_close_container (iter, &arr_iter))
-    {
-      goto lose;
+      return FALSE;
     }
 
- out:
-  g_free (entry_sig);
-  g_free (array_sig);
-  return !hashdata.err;
- lose:
-  hashdata.err = TRUE;
-  goto out;
+  return dbus_message_iter_close_container (iter, &arr_iter);
 }
 
 static gboolean
-marshal_struct (DBusMessageIter   *iter,
+marshal_struct (const DBusGTypePlan *plan,
+                DBusMessageIter   *iter,
                 const GValue      *value)
 {
-  GType gtype;
   DBusMessageIter subiter;
-  guint size, i;
+  guint i;
   GValue val = {0,};
 
-  gtype = G_VALUE_TYPE (value);
-
-  size = dbus_g_type_get_struct_size (gtype);
-
   if (!dbus_message_iter_open_container (iter,
                                          DBUS_TYPE_STRUCT,
                                          NULL,
                                          &subiter))
     oom ();
 
-  for (i = 0; i < size; i++)
+  for (i = 0; i < plan->n_children; i++)
     {
-      g_value_init (&val, dbus_g_type_get_struct_member_type
-          (G_VALUE_TYPE(value), i));
+      const DBusGTypePlan *member_plan = plan->children[i];
+
+      g_value_init (&val, member_plan->gtype);
 
       if (!dbus_g_type_struct_get_member (value, i, &val))
         goto abandon;
 
-      if (!_dbus_gvalue_marshal (&subiter, &val))
+      if (!member_plan->marshal (member_plan, &subiter, &val))
         goto abandon;
 
       g_value_unset(&val);
@@ -1793,6 +2925,7 @@ marshal_struct (DBusMessageIter   *iter,
   return dbus_message_iter_close_container (iter, &subiter);
 
 abandon:
+  g_value_unset (&val);
   dbus_message_iter_abandon_container (iter, &subiter);
   return FALSE;
 }
@@ -1838,34 +2971,10 @@ marshal_variant (DBusMessageIter          *iter,
   return ret;
 }
 
-static DBusGValueMarshalFunc
-get_type_marshaller (GType type)
-{
-  DBusGTypeMarshalData *typedata;
-
-  typedata = g_type_get_qdata (type, dbus_g_type_metadata_data_quark ());
-  if (typedata == NULL)
-    {
-      if (g_type_is_a (type, G_TYPE_VALUE_ARRAY))
-	return marshal_valuearray;
-      if (dbus_g_type_is_collection (type))
-	return marshal_collection;
-      if (dbus_g_type_is_map (type))
-	return marshal_map;
-      if (dbus_g_type_is_struct (type))
-	return marshal_struct;
-
-      g_warning ("No marshaller registered for type \"%s\"", g_type_name (type));
-      return NULL;
-    }
-  g_assert (typedata->vtable);
-  return typedata->vtable->marshaller;
-}
-
 typedef struct
 {
   DBusMessageIter *iter;
-  DBusGValueMarshalFunc marshaller;
+  const DBusGTypePlan *elt_plan;
   gboolean err;
 } DBusGValueCollectionMarshalData;
 
@@ -1878,59 +2987,34 @@ collection_marshal_iterator (const GValue *eltval,
   if (data->err)
     return;
 
-  if (!data->marshaller (data->iter, eltval))
+  if (!data->elt_plan->marshal (data->elt_plan, data->iter, eltval))
     data->err = TRUE;
 }
 
 static gboolean
-marshal_collection (DBusMessageIter         *iter,
-		    const GValue            *value)
-{
-  GType coltype;
-  GType subtype;
-  
-  coltype = G_VALUE_TYPE (value);
-  subtype = dbus_g_type_get_collection_specialization (coltype);
-
-  if (_dbus_g_type_is_fixed (subtype))
-    return marshal_collection_array (iter, value);
-  else
-    return marshal_collection_ptrarray (iter, value);
-}
-
-static gboolean
-marshal_collection_ptrarray (DBusMessageIter         *iter,
+marshal_collection_ptrarray (const DBusGTypePlan     *plan,
+                             DBusMessageIter         *iter,
 			     const GValue            *value)
 {
-  GType coltype;
-  GType elt_gtype;
   DBusGValueCollectionMarshalData data;
   DBusMessageIter subiter;
-  char *elt_sig;
-  
-  coltype = G_VALUE_TYPE (value);
-  elt_gtype = dbus_g_type_get_collection_specialization (coltype);
-  data.marshaller = get_type_marshaller (elt_gtype);
-  if (!data.marshaller)
-    return FALSE;
 
-  elt_sig = _dbus_gtype_to_signature (elt_gtype);
-  if (!elt_sig)
+  if (plan->contents_sig == NULL)
     {
-      g_warning ("Cannot marshal type \"%s\" in collection\n", g_type_name (elt_gtype));
+      g_warning ("Cannot marshal type \"%s\" in collection\n",
+                 g_type_name (plan->children[0]->gtype));
       return FALSE;
     }
-  g_assert (g_variant_is_signature (elt_sig));
+  g_assert (g_variant_is_signature (plan->contents_sig));
 
   if (!dbus_message_iter_open_container (iter,
 					 DBUS_TYPE_ARRAY,
-					 elt_sig,
+					 plan->contents_sig,
 					 &subiter))
     oom ();
 
-  g_free (elt_sig);
-
   data.iter = &subiter;
+  data.elt_plan = plan->children[0];
   data.err = FALSE;
 
   dbus_g_type_collection_value_iterate (value,
@@ -1947,8 +3031,8 @@ marshal_collection_ptrarray (DBusMessageIter         *iter,
 }
 
 /* If any of these assertions are violated, then marshal_collection_array
- * is buggy for that type. dbus_g_value_basic_array_parse_variant() has
- * general size-conversion code, if needed. */
+ * and demarshal_collection_array need to convert that type, like they do
+ * for glong, gulong and gfloat. */
 G_STATIC_ASSERT (sizeof (dbus_bool_t) == sizeof (gboolean));
 G_STATIC_ASSERT (sizeof (dbus_int32_t) == sizeof (gint));
 G_STATIC_ASSERT (sizeof (dbus_uint32_t) == sizeof (guint));
@@ -1958,23 +3042,26 @@ G_STATIC_ASSERT (sizeof (dbus_uint64_t) == sizeof (guint64));
 G_STATIC_ASSERT (sizeof (double) == sizeof (gdouble));
 
 static gboolean
-marshal_collection_array (DBusMessageIter   *iter,
+marshal_collection_array (const DBusGTypePlan *plan,
+                          DBusMessageIter   *iter,
 			  const GValue      *value)
 {
-  GType elt_gtype;
   DBusMessageIter subiter;
   GArray *array;
-  char *subsignature_str;
+  const char *subsignature_str;
+  GType elt_gtype;
+  gpointer converted = NULL;
+  gconstpointer data;
+  gboolean ret;
 
   array = g_value_get_boxed (value);
   g_return_val_if_fail (array != NULL, FALSE);
 
-  elt_gtype = dbus_g_type_get_collection_specialization (G_VALUE_TYPE (value));
-  g_assert (_dbus_g_type_is_fixed (elt_gtype));
-  subsignature_str = _dbus_gtype_to_signature (elt_gtype);
+  subsignature_str = plan->contents_sig;
   if (!subsignature_str)
     {
-      g_warning ("Cannot marshal type \"%s\" in collection\n", g_type_name (elt_gtype));
+      g_warning ("Cannot marshal type \"%s\" in collection\n",
+                 g_type_name (dbus_g_type_get_collection_specialization (plan->gtype)));
       return FALSE;
     }
   g_assert (g_variant_is_signature (subsignature_str));
@@ -1985,24 +3072,114 @@ marshal_collection_array (DBusMessageIter   *iter,
 					 &subiter))
     oom ();
 
-  /* TODO - This assumes that basic values are the same size
-   * is this always true?  If it is we can probably avoid
-   * a lot of the overhead in _marshal_basic_instance...
-   */
-  if (!dbus_message_iter_append_fixed_array (&subiter,
-					     subsignature_str[0],
-					     &(array->data),
-					     array->len))
+  /* Most element types have the same representation in memory as on
+   * the wire, and can be appended directly; the rest are converted into
+   * a temporary array first */
+  elt_gtype = dbus_g_type_get_collection_specialization (plan->gtype);
+  data = array->data;
+
+  switch (elt_gtype)
+    {
+    case G_TYPE_BOOLEAN:
+      if (!fixed_array_booleans_are_valid ((const gboolean *) array->data,
+                                           array->len))
+        {
+          converted = g_new (dbus_bool_t, array->len);
+          fixed_array_normalize_booleans (converted,
+              (const gboolean *) array->data, array->len);
+        }
+      break;
+    case G_TYPE_LONG:
+      converted = g_new (dbus_int32_t, array->len);
+      fixed_array_narrow_long (converted, (const glong *) array->data,
+                               array->len);
+      break;
+    case G_TYPE_ULONG:
+      converted = g_new (dbus_uint32_t, array->len);
+      fixed_array_narrow_ulong (converted, (const gulong *) array->data,
+                                array->len);
+      break;
+    case G_TYPE_FLOAT:
+      converted = g_new (double, array->len);
+      fixed_array_widen_float (converted, (const gfloat *) array->data,
+                               array->len);
+      break;
+    default:
+      break;
+    }
+
+  if (converted != NULL)
+    data = converted;
+
+  ret = dbus_message_iter_append_fixed_array (&subiter,
+                                              subsignature_str[0],
+                                              &data,
+                                              array->len);
+  g_free (converted);
+
+  if (!ret)
     {
       g_critical ("Unable to serialize %u GArray members as signature %s "
-          "(OOM or invalid boolean value?)", array->len, subsignature_str);
+          "(OOM?)", array->len, subsignature_str);
 
-      g_free (subsignature_str);
       dbus_message_iter_abandon_container (iter, &subiter);
       return FALSE;
     }
 
-  g_free (subsignature_str);
+  return dbus_message_iter_close_container (iter, &subiter);
+}
+
+static gboolean
+marshal_packed_structs (const DBusGTypePlan *plan,
+                        DBusMessageIter     *iter,
+                        const GValue        *value)
+{
+  const DBusGPackedStructLayout *layout = plan->packed_layout;
+  DBusMessageIter subiter;
+  GArray *array;
+  guint row;
+
+  array = g_value_get_boxed (value);
+  g_return_val_if_fail (array != NULL, FALSE);
+  g_assert (plan->contents_sig != NULL);
+
+  if (!dbus_message_iter_open_container (iter,
+					 DBUS_TYPE_ARRAY,
+					 plan->contents_sig,
+					 &subiter))
+    oom ();
+
+  for (row = 0; row < array->len; row++)
+    {
+      const char *data = array->data + row * layout->row_size;
+      DBusMessageIter struct_iter;
+      guint i;
+
+      if (!dbus_message_iter_open_container (&subiter, DBUS_TYPE_STRUCT,
+                                             NULL, &struct_iter))
+        oom ();
+
+      for (i = 0; i < layout->n_members; i++)
+        {
+          const void *member = data + layout->offsets[i];
+          dbus_bool_t b;
+
+          /* libdbus only accepts 0 and 1 */
+          if (layout->typecodes[i] == DBUS_TYPE_BOOLEAN)
+            {
+              b = (*(const gboolean *) member != FALSE);
+              member = &b;
+            }
+
+          if (!dbus_message_iter_append_basic (&struct_iter,
+                                               layout->typecodes[i], member))
+            oom ();
+        }
+
+      if (!dbus_message_iter_close_container (&subiter, &struct_iter))
+        oom ();
+    }
+
   return dbus_message_iter_close_container (iter, &subiter);
 }
 
@@ -2010,15 +3187,12 @@ gboolean
 _dbus_gvalue_marshal (DBusMessageIter         *iter,
 		     const GValue       *value)
 {
-  GType gtype;
-  DBusGValueMarshalFunc marshaller;
+  const DBusGTypePlan *plan;
 
-  gtype = G_VALUE_TYPE (value);
-
-  marshaller = get_type_marshaller (gtype);
-  if (marshaller == NULL)
+  plan = get_type_plan (G_VALUE_TYPE (value));
+  if (plan == NULL)
     return FALSE;
-  return marshaller (iter, value);
+  return plan->marshal (plan, iter, value);
 }
 
 #ifdef DBUS_BUILD_TESTS
@@ -2037,6 +3211,9 @@ static void
 assert_signature_maps_to (const char *sig, GType expected_gtype)
 {
   g_assert (_dbus_gtype_from_signature (sig, TRUE) == expected_gtype);
+  /* once to populate the cache, once to hit it */
+  g_assert (_dbus_gtype_from_signature_cached (sig, TRUE) == expected_gtype);
+  g_assert (_dbus_gtype_from_signature_cached (sig, TRUE) == expected_gtype);
 }
 
 static void
@@ -2095,6 +3272,327 @@ _dbus_gvalue_test (const char *test_data_dir)
   type = _dbus_gtype_from_signature ("g", TRUE);
   g_assert (type == DBUS_TYPE_G_SIGNATURE);
 
+  type = _dbus_gtype_from_signature_cached ("o", FALSE);
+  g_assert (type == DBUS_TYPE_G_OBJECT_PATH);
+  type = _dbus_gtype_from_signature_cached ("h", TRUE);
+  g_assert (type == G_TYPE_INVALID);
+
+  {
+    GArray *first, *second;
+
+    first = _dbus_gtypes_from_arg_signature_cached ("sa{sv}o", TRUE);
+    second = _dbus_gtypes_from_arg_signature_cached ("sa{sv}o", TRUE);
+    g_assert (first == second);
+    g_assert_cmpuint (first->len, ==, 3);
+    g_assert (g_array_index (first, GType, 0) == G_TYPE_STRING);
+    g_assert (g_array_index (first, GType, 1) ==
+        dbus_g_type_get_map ("GHashTable", G_TYPE_STRING, G_TYPE_VALUE));
+    g_assert (g_array_index (first, GType, 2) == DBUS_TYPE_G_OBJECT_PATH);
+    g_array_unref (first);
+    g_array_unref (second);
+  }
+
+  {
+    GType asv = dbus_g_type_get_map ("GHashTable", G_TYPE_STRING,
+        G_TYPE_VALUE);
+    GType aasv = dbus_g_type_get_collection ("GPtrArray", asv);
+    const DBusGTypePlan *plan = get_type_plan (aasv);
+
+    g_assert (plan != NULL);
+    g_assert (get_type_plan (aasv) == plan);
+    g_assert_cmpuint (plan->n_children, ==, 1);
+    g_assert (plan->children[0] == get_type_plan (asv));
+    g_assert_cmpstr (plan->contents_sig, ==, "a{sv}");
+    g_assert_cmpstr (plan->children[0]->contents_sig, ==, "{sv}");
+    g_assert (plan->children[0]->children[1] == get_type_plan (G_TYPE_VALUE));
+  }
+
+  {
+    DBusGArena arena;
+    gpointer buffer[8];
+    guchar *small, *big, *after;
+
+    _dbus_g_arena_init (&arena, buffer, sizeof (buffer));
+    small = _dbus_g_arena_alloc (&arena, 3);
+    g_assert (small >= (guchar *) buffer &&
+              small < (guchar *) buffer + sizeof (buffer));
+    g_assert (GPOINTER_TO_SIZE (small) % ARENA_ALIGNMENT == 0);
+
+    /* doesn't fit: goes to the heap, and later allocations follow it */
+    big = _dbus_g_arena_alloc (&arena, 10000);
+    memset (big, 'x', 10000);
+    after = _dbus_g_arena_alloc (&arena, 1);
+    g_assert (GPOINTER_TO_SIZE (after) % ARENA_ALIGNMENT == 0);
+    g_assert (after != small && after != big);
+
+    _dbus_g_arena_clear (&arena);
+    g_assert (arena.chunks == NULL);
+  }
+
+  {
+    typedef struct { guint64 t; gdouble d; } Sample;
+    GType td = dbus_g_type_get_struct ("GValueArray", G_TYPE_UINT64,
+        G_TYPE_DOUBLE, G_TYPE_INVALID);
+    GType packed = dbus_g_type_get_packed_struct_collection (td);
+    DBusGValueMarshalCtx context = { NULL, NULL, NULL, 0 };
+    DBusMessage *message;
+    DBusMessageIter iter;
+    GValue value = { 0, };
+    GValue copy = { 0, };
+    GArray *samples;
+    const gsize *offsets;
+    gsize row_size;
+    gpointer data;
+    guint len;
+    guint i;
+
+    g_assert (packed != G_TYPE_INVALID);
+    assert_type_maps_to (packed, "a(td)");
+
+    offsets = dbus_g_type_get_packed_struct_offsets (packed, &row_size);
+    g_assert_cmpuint (row_size, ==, sizeof (Sample));
+    g_assert_cmpuint (offsets[0], ==, G_STRUCT_OFFSET (Sample, t));
+    g_assert_cmpuint (offsets[1], ==, G_STRUCT_OFFSET (Sample, d));
+
+    samples = dbus_g_type_specialized_construct (packed);
+    for (i = 0; i < 3; i++)
+      {
+        Sample sample = { G_GUINT64_CONSTANT (1) << (40 + i), i * 0.5 };
+        g_array_append_val (samples, sample);
+      }
+
+    g_value_init (&value, packed);
+    g_value_take_boxed (&value, samples);
+
+    message = dbus_message_new_method_call ("org.example", "/",
+        "org.example", "Samples");
+    dbus_message_iter_init_append (message, &iter);
+    g_assert (_dbus_gvalue_marshal (&iter, &value));
+    g_assert_cmpstr (dbus_message_get_signature (message), ==, "a(td)");
+
+    context.message = message;
+    dbus_message_iter_init (message, &iter);
+    g_value_init (&copy, packed);
+    g_assert (_dbus_gvalue_demarshal (&context, &iter, &copy, NULL));
+
+    g_assert (dbus_g_type_collection_get_fixed (&copy, &data, &len));
+    g_assert_cmpuint (len, ==, 3);
+    g_assert (memcmp (data, samples->data, 3 * sizeof (Sample)) == 0);
+
+    g_value_unset (&copy);
+    g_value_unset (&value);
+    dbus_message_unref (message);
+  }
+
+  {
+    static const dbus_int16_t shorts[] = { -32768, -1, 0, 1, 32767 };
+    const dbus_int16_t *shorts_ptr = shorts;
+    DBusGValueMarshalCtx context = { NULL, NULL, NULL, 0 };
+    DBusMessage *message;
+    DBusMessageIter iter, subiter;
+    GValue value = { 0, };
+    GArray *array;
+    gboolean b;
+    guint i;
+
+    message = dbus_message_new_method_call ("org.example", "/",
+        "org.example", "Arrays");
+    context.message = message;
+
+    /* an is received as a GArray of gint */
+    dbus_message_iter_init_append (message, &iter);
+    g_assert (dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+        DBUS_TYPE_INT16_AS_STRING, &subiter));
+    g_assert (dbus_message_iter_append_fixed_array (&subiter, DBUS_TYPE_INT16,
+        &shorts_ptr, G_N_ELEMENTS (shorts)));
+    g_assert (dbus_message_iter_close_container (&iter, &subiter));
+
+    /* a gboolean that isn't 0 or 1 is sent as TRUE */
+    array = g_array_new (FALSE, TRUE, sizeof (gboolean));
+    b = 0;
+    g_array_append_val (array, b);
+    b = 2;
+    g_array_append_val (array, b);
+    g_value_init (&value, dbus_g_type_get_collection ("GArray", G_TYPE_BOOLEAN));
+    g_value_take_boxed (&value, array);
+    g_assert (_dbus_gvalue_marshal (&iter, &value));
+    g_value_unset (&value);
+
+    dbus_message_iter_init (message, &iter);
+    g_value_init (&value, _dbus_gtype_from_signature ("an", TRUE));
+    g_assert (_dbus_gvalue_demarshal (&context, &iter, &value, NULL));
+    array = g_value_get_boxed (&value);
+    g_assert_cmpuint (array->len, ==, G_N_ELEMENTS (shorts));
+    for (i = 0; i < array->len; i++)
+      g_assert_cmpint (g_array_index (array, gint, i), ==, shorts[i]);
+    g_value_unset (&value);
+
+    dbus_message_iter_next (&iter);
+    g_value_init (&value, _dbus_gtype_from_signature ("ab", TRUE));
+    g_assert (_dbus_gvalue_demarshal (&context, &iter, &value, NULL));
+    array = g_value_get_boxed (&value);
+    g_assert_cmpuint (array->len, ==, 2);
+    g_assert_cmpint (g_array_index (array, gboolean, 0), ==, FALSE);
+    g_assert_cmpint (g_array_index (array, gboolean, 1), ==, TRUE);
+    g_value_unset (&value);
+
+    dbus_message_unref (message);
+  }
+
+  {
+    DBusGValueMarshalCtx context = { NULL, NULL, NULL, 0 };
+    DBusMessage *message;
+    DBusMessageIter iter;
+    GValue value = { 0, };
+    GValue *inner;
+    GError *error = NULL;
+    guint i;
+
+    /* 40 nested variants around an int: more than the default limit */
+    inner = g_new0 (GValue, 1);
+    g_value_init (inner, G_TYPE_INT);
+    g_value_set_int (inner, 42);
+
+    for (i = 0; i < 40; i++)
+      {
+        GValue *outer = g_new0 (GValue, 1);
+
+        g_value_init (outer, G_TYPE_VALUE);
+        g_value_take_boxed (outer, inner);
+        inner = outer;
+      }
+
+    message = dbus_message_new_method_call ("org.example", "/",
+        "org.example", "Nested");
+    dbus_message_iter_init_append (message, &iter);
+    g_assert (_dbus_gvalue_marshal (&iter, inner));
+    g_boxed_free (G_TYPE_VALUE, inner);
+    context.message = message;
+
+    dbus_message_iter_init (message, &iter);
+    g_value_init (&value, G_TYPE_VALUE);
+    g_assert (!_dbus_gvalue_demarshal (&context, &iter, &value, &error));
+    g_assert_error (error, DBUS_GERROR, DBUS_GERROR_NO_MEMORY);
+    g_clear_error (&error);
+    g_assert_cmpuint (context.recursion_depth, ==, 0);
+    g_value_unset (&value);
+
+    dbus_glib_global_set_max_value_nesting (64);
+
+    dbus_message_iter_init (message, &iter);
+    g_value_init (&value, G_TYPE_VALUE);
+    g_assert (_dbus_gvalue_demarshal (&context, &iter, &value, &error));
+    g_assert_no_error (error);
+    g_assert_cmpuint (context.recursion_depth, ==, 0);
+
+    inner = g_value_get_boxed (&value);
+    for (i = 1; i < 40; i++)
+      inner = g_value_get_boxed (inner);
+    g_assert (G_VALUE_HOLDS_INT (inner));
+    g_assert_cmpint (g_value_get_int (inner), ==, 42);
+    g_value_unset (&value);
+
+    dbus_glib_global_set_max_value_nesting (DBUS_GLIB_MAX_VARIANT_RECURSION);
+    dbus_message_unref (message);
+  }
+
+  {
+    DBusGValueMarshalCtx context = { NULL, NULL, NULL, 0 };
+    GType lazy_type = dbus_g_type_get_lazy_map (G_TYPE_STRING, G_TYPE_VALUE);
+    DBusMessage *message;
+    DBusMessageIter iter, array_iter, entry_iter;
+    GValue value = { 0, };
+    GValue shallow = { 0, };
+    GValue *shallow_inner;
+    GValue *inner;
+    GError *error = NULL;
+    gpointer looked_up;
+    const char *key;
+    guint i;
+
+    /* an a{sv} with a variant nested too deeply inside one of its
+     * entries: the error must come from demarshalling the map, not from
+     * looking the entry up later */
+    inner = g_new0 (GValue, 1);
+    g_value_init (inner, G_TYPE_INT);
+    g_value_set_int (inner, 42);
+
+    for (i = 0; i < 40; i++)
+      {
+        GValue *outer = g_new0 (GValue, 1);
+
+        g_value_init (outer, G_TYPE_VALUE);
+        g_value_take_boxed (outer, inner);
+        inner = outer;
+      }
+
+    shallow_inner = g_new0 (GValue, 1);
+    g_value_init (shallow_inner, G_TYPE_INT);
+    g_value_set_int (shallow_inner, 23);
+    g_value_init (&shallow, G_TYPE_VALUE);
+    g_value_take_boxed (&shallow, shallow_inner);
+
+    message = dbus_message_new_method_call ("org.example", "/",
+        "org.example", "LazyNested");
+    dbus_message_iter_init_append (message, &iter);
+    g_assert (dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+        "{sv}", &array_iter));
+
+    g_assert (dbus_message_iter_open_container (&array_iter,
+        DBUS_TYPE_DICT_ENTRY, NULL, &entry_iter));
+    key = "shallow";
+    g_assert (dbus_message_iter_append_basic (&entry_iter, DBUS_TYPE_STRING,
+        &key));
+    g_assert (_dbus_gvalue_marshal (&entry_iter, &shallow));
+    g_assert (dbus_message_iter_close_container (&array_iter, &entry_iter));
+
+    g_assert (dbus_message_iter_open_container (&array_iter,
+        DBUS_TYPE_DICT_ENTRY, NULL, &entry_iter));
+    key = "deep";
+    g_assert (dbus_message_iter_append_basic (&entry_iter, DBUS_TYPE_STRING,
+        &key));
+    g_assert (_dbus_gvalue_marshal (&entry_iter, inner));
+    g_assert (dbus_message_iter_close_container (&array_iter, &entry_iter));
+
+    g_assert (dbus_message_iter_close_container (&iter, &array_iter));
+    g_boxed_free (G_TYPE_VALUE, inner);
+    context.message = message;
+
+    dbus_message_iter_init (message, &iter);
+    g_value_init (&value, lazy_type);
+    g_assert (!_dbus_gvalue_demarshal (&context, &iter, &value, &error));
+    g_assert_error (error, DBUS_GERROR, DBUS_GERROR_NO_MEMORY);
+    g_clear_error (&error);
+    g_assert_cmpuint (context.recursion_depth, ==, 0);
+    g_value_unset (&value);
+
+    /* with a higher limit, both entries can be looked up */
+    dbus_glib_global_set_max_value_nesting (128);
+
+    dbus_message_iter_init (message, &iter);
+    g_value_init (&value, lazy_type);
+    g_assert (_dbus_gvalue_demarshal (&context, &iter, &value, &error));
+    g_assert_no_error (error);
+
+    g_assert (dbus_g_lazy_map_lookup (g_value_get_boxed (&value), "shallow",
+        &looked_up));
+    g_assert (G_VALUE_HOLDS_INT (looked_up));
+    g_assert_cmpint (g_value_get_int (looked_up), ==, 23);
+
+    g_assert (dbus_g_lazy_map_lookup (g_value_get_boxed (&value), "deep",
+        &looked_up));
+    inner = looked_up;
+    for (i = 1; i < 40; i++)
+      inner = g_value_get_boxed (inner);
+    g_assert (G_VALUE_HOLDS_INT (inner));
+    g_assert_cmpint (g_value_get_int (inner), ==, 42);
+    g_value_unset (&value);
+
+    dbus_glib_global_set_max_value_nesting (DBUS_GLIB_MAX_VARIANT_RECURSION);
+    g_value_unset (&shallow);
+    dbus_message_unref (message);
+  }
+
   return TRUE;
 }
 
@@ -14,9 +14,31 @@ G_BEGIN_DECLS
 typedef struct {
   DBusGConnection    *gconnection;
   DBusGProxy         *proxy;
+  /* The message being demarshalled, if any; containers that decode
+   * lazily keep a reference to it */
+  DBusMessage        *message;
   guint               recursion_depth;
 } DBusGValueMarshalCtx;
 
+typedef struct _DBusGArenaChunk DBusGArenaChunk;
+
+/* A bump allocator for memory that all goes away at once, such as the
+ * storage behind one method call's arguments. Usually initialized with a
+ * buffer on the caller's stack; it only touches the heap if that
+ * overflows. */
+typedef struct {
+  guchar             *pos;
+  guchar             *end;
+  DBusGArenaChunk    *chunks;
+} DBusGArena;
+
+void           _dbus_g_arena_init              (DBusGArena              *arena,
+					       gpointer                 buffer,
+					       gsize                    size);
+gpointer       _dbus_g_arena_alloc             (DBusGArena              *arena,
+					       gsize                    size);
+void           _dbus_g_arena_clear             (DBusGArena              *arena);
+
 void           _dbus_g_value_types_init        (void);
 
 char *         _dbus_gtype_to_signature        (GType                    type);
@@ -36,6 +58,7 @@ GValueArray *  _dbus_gvalue_demarshal_message  (DBusGValueMarshalCtx    *context
 					       DBusMessage             *message,
 					       guint                    n_params,
 					       const GType             *types, 
+					       DBusGArena              *arena,
 					       GError                 **error);
 
 gboolean       _dbus_gvalue_marshal            (DBusMessageIter         *iter,
@@ -0,0 +1,434 @@
+/* Regression tests for outgoing watermarks and lossy signals.
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#include "my-object.h"
+
+#define PATH "/org/freedesktop/DBus/GLib/Tests/MyTestObject"
+#define OTHER_PATH "/org/freedesktop/DBus/GLib/Tests/MyTestObject2"
+#define FOO_IFACE "org.freedesktop.DBus.GLib.Tests.FooObject"
+
+#define HIGH_WATERMARK 4096
+#define MAX_EMISSIONS 1000
+
+/* Sockets have buffers big enough that the outgoing queue of a peer that
+ * is reading normally hardly grows, so these tests fill it by corking the
+ * server's connection, which counts towards the watermarks too. */
+typedef struct {
+    DBusError e;
+
+    DBusServer *server;
+    DBusConnection *server_conn;
+    DBusGConnection *server_gconn;
+    GObject *object;
+
+    DBusConnection *client_conn;
+
+    /* TRUE for each call to the watermark callback with congested set,
+     * FALSE for the others */
+    GArray *watermark_events;
+
+    guint n_frobnicate;
+    guint n_sig0;
+    /* the value of "n" in each Sig2 received */
+    GPtrArray *sig2_values;
+    /* the path of each Sig2 received */
+    GPtrArray *sig2_paths;
+} Fixture;
+
+static void
+assert_no_error (const DBusError *e)
+{
+  if (G_UNLIKELY (dbus_error_is_set (e)))
+    g_error ("expected success but got error: %s: %s", e->name, e->message);
+}
+
+static gchar *
+sig2_get_n (DBusMessage *message)
+{
+  DBusMessageIter args, dict;
+
+  dbus_message_iter_init (message, &args);
+  g_assert_cmpint (dbus_message_iter_get_arg_type (&args), ==,
+      DBUS_TYPE_ARRAY);
+  dbus_message_iter_recurse (&args, &dict);
+
+  while (dbus_message_iter_get_arg_type (&dict) == DBUS_TYPE_DICT_ENTRY)
+    {
+      DBusMessageIter entry;
+      const char *key, *value;
+
+      dbus_message_iter_recurse (&dict, &entry);
+      dbus_message_iter_get_basic (&entry, &key);
+      dbus_message_iter_next (&entry);
+      dbus_message_iter_get_basic (&entry, &value);
+
+      if (strcmp (key, "n") == 0)
+        return g_strdup (value);
+
+      dbus_message_iter_next (&dict);
+    }
+
+  return NULL;
+}
+
+static DBusHandlerResult
+client_filter (DBusConnection *connection,
+    DBusMessage *message,
+    void *user_data)
+{
+  Fixture *f = user_data;
+
+  if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_SIGNAL)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  if (dbus_message_has_member (message, "Frobnicate"))
+    {
+      f->n_frobnicate++;
+    }
+  else if (dbus_message_has_member (message, "Sig0"))
+    {
+      f->n_sig0++;
+    }
+  else if (dbus_message_is_signal (message, FOO_IFACE, "Sig2"))
+    {
+      g_ptr_array_add (f->sig2_values, sig2_get_n (message));
+      g_ptr_array_add (f->sig2_paths,
+          g_strdup (dbus_message_get_path (message)));
+    }
+
+  return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static void
+watermark_cb (DBusGConnection *connection,
+    gboolean congested,
+    gpointer user_data)
+{
+  Fixture *f = user_data;
+
+  g_assert (connection == f->server_gconn);
+  g_array_append_val (f->watermark_events, congested);
+}
+
+static void
+new_conn_cb (DBusServer *server,
+    DBusConnection *server_conn,
+    void *data)
+{
+  Fixture *f = data;
+
+  g_assert (f->server_conn == NULL);
+  f->server_conn = dbus_connection_ref (server_conn);
+  dbus_connection_setup_with_g_main (server_conn, NULL);
+  f->server_gconn = dbus_connection_get_g_connection (server_conn);
+}
+
+static void
+setup (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_error_init (&f->e);
+  f->watermark_events = g_array_new (FALSE, FALSE, sizeof (gboolean));
+  f->sig2_values = g_ptr_array_new_with_free_func (g_free);
+  f->sig2_paths = g_ptr_array_new_with_free_func (g_free);
+
+  f->server = dbus_server_listen (addr, &f->e);
+  assert_no_error (&f->e);
+  g_assert (f->server != NULL);
+
+  dbus_server_set_new_connection_function (f->server, new_conn_cb, f, NULL);
+  dbus_server_setup_with_g_main (f->server, NULL);
+
+  f->client_conn = dbus_connection_open_private (
+      dbus_server_get_address (f->server), &f->e);
+  assert_no_error (&f->e);
+  g_assert (f->client_conn != NULL);
+  dbus_connection_setup_with_g_main (f->client_conn, NULL);
+
+  if (!dbus_connection_add_filter (f->client_conn, client_filter, f, NULL))
+    g_error ("OOM");
+
+  while (f->server_conn == NULL)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  f->object = g_object_new (MY_TYPE_OBJECT, NULL);
+  dbus_g_connection_register_g_object (f->server_gconn, PATH, f->object);
+
+  dbus_g_connection_set_outgoing_watermarks (f->server_gconn, 0,
+      HIGH_WATERMARK, watermark_cb, f, NULL);
+}
+
+static void
+emit_sig2 (Fixture *f,
+    const gchar *n)
+{
+  GHashTable *table = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_hash_table_insert (table, "n", (gpointer) n);
+  g_signal_emit_by_name (f->object, "sig2", table);
+  g_hash_table_unref (table);
+}
+
+/* Cork the server's connection and emit non-lossy signals until it
+ * becomes congested. Returns the number emitted. */
+static guint
+congest (Fixture *f)
+{
+  guint n = 0;
+
+  dbus_g_connection_cork (f->server_gconn);
+
+  while (f->watermark_events->len == 0)
+    {
+      g_assert_cmpuint (n, <, MAX_EMISSIONS);
+      my_object_emit_frobnicate (MY_OBJECT (f->object), NULL);
+      n++;
+    }
+
+  g_assert_cmpuint (f->watermark_events->len, ==, 1);
+  g_assert (g_array_index (f->watermark_events, gboolean, 0));
+  /* it took more than one to reach the high watermark */
+  g_assert_cmpuint (n, >, 1);
+  return n;
+}
+
+/* Uncork, and wait for the queue to drain to the low watermark */
+static void
+drain (Fixture *f)
+{
+  dbus_g_connection_uncork (f->server_gconn);
+
+  while (f->watermark_events->len < 2)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  g_assert_cmpuint (f->watermark_events->len, ==, 2);
+  g_assert (!g_array_index (f->watermark_events, gboolean, 1));
+}
+
+/* Emit Sig0 and wait for it, so that everything sent before it has been
+ * received */
+static void
+sync_with_client (Fixture *f)
+{
+  guint n_sig0 = f->n_sig0;
+
+  my_object_emit_signals (MY_OBJECT (f->object), NULL);
+
+  while (f->n_sig0 == n_sig0)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+    }
+}
+
+static void
+test_watermarks (Fixture *f,
+    gconstpointer addr)
+{
+  guint n;
+
+  n = congest (f);
+
+  /* while congested, the callback is not called again */
+  my_object_emit_frobnicate (MY_OBJECT (f->object), NULL);
+  n++;
+  g_assert_cmpuint (f->watermark_events->len, ==, 1);
+
+  drain (f);
+
+  sync_with_client (f);
+  g_assert_cmpuint (f->n_frobnicate, ==, n);
+
+  /* sending a little more does not make it congested again */
+  my_object_emit_frobnicate (MY_OBJECT (f->object), NULL);
+  sync_with_client (f);
+  g_assert_cmpuint (f->watermark_events->len, ==, 2);
+}
+
+static void
+test_lossy_send (Fixture *f,
+    gconstpointer addr)
+{
+  /* the default policy sends lossy signals like any other */
+  congest (f);
+  emit_sig2 (f, "1");
+  emit_sig2 (f, "2");
+  drain (f);
+
+  sync_with_client (f);
+  g_assert_cmpuint (f->sig2_values->len, ==, 2);
+  g_assert_cmpstr (g_ptr_array_index (f->sig2_values, 0), ==, "1");
+  g_assert_cmpstr (g_ptr_array_index (f->sig2_values, 1), ==, "2");
+}
+
+static void
+test_lossy_drop (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_g_connection_set_lossy_signal_policy (f->server_gconn,
+      DBUS_G_LOSSY_SIGNAL_DROP);
+
+  /* without congestion, lossy signals are sent */
+  emit_sig2 (f, "before");
+  sync_with_client (f);
+  g_assert_cmpuint (f->sig2_values->len, ==, 1);
+
+  congest (f);
+  emit_sig2 (f, "1");
+  emit_sig2 (f, "2");
+  emit_sig2 (f, "3");
+  drain (f);
+
+  /* the ones emitted while congested are gone for good */
+  sync_with_client (f);
+  g_assert_cmpuint (f->sig2_values->len, ==, 1);
+
+  emit_sig2 (f, "after");
+  sync_with_client (f);
+  g_assert_cmpuint (f->sig2_values->len, ==, 2);
+  g_assert_cmpstr (g_ptr_array_index (f->sig2_values, 0), ==, "before");
+  g_assert_cmpstr (g_ptr_array_index (f->sig2_values, 1), ==, "after");
+}
+
+static void
+test_lossy_coalesce (Fixture *f,
+    gconstpointer addr)
+{
+  guint n;
+  guint i;
+
+  /* the same object at a second path emits a second, separately
+   * coalesced copy of each signal */
+  dbus_g_connection_register_g_object (f->server_gconn, OTHER_PATH,
+      f->object);
+  dbus_g_connection_set_lossy_signal_policy (f->server_gconn,
+      DBUS_G_LOSSY_SIGNAL_COALESCE);
+
+  n = congest (f);
+  emit_sig2 (f, "1");
+  emit_sig2 (f, "2");
+  emit_sig2 (f, "3");
+
+  /* held until the congestion clears, even though nothing else is */
+  dbus_g_connection_uncork (f->server_gconn);
+
+  while (f->n_frobnicate < n)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  if (f->watermark_events->len < 2)
+    g_assert_cmpuint (f->sig2_values->len, ==, 0);
+
+  while (f->watermark_events->len < 2)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  g_assert (!g_array_index (f->watermark_events, gboolean, 1));
+
+  /* only the newest from each path is sent, once it drains */
+  sync_with_client (f);
+  g_assert_cmpuint (f->sig2_values->len, ==, 2);
+
+  for (i = 0; i < f->sig2_values->len; i++)
+    g_assert_cmpstr (g_ptr_array_index (f->sig2_values, i), ==, "3");
+
+  g_assert_cmpstr (g_ptr_array_index (f->sig2_paths, 0), !=,
+      g_ptr_array_index (f->sig2_paths, 1));
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer addr G_GNUC_UNUSED)
+{
+  f->server_gconn = NULL;
+
+  if (f->object != NULL)
+    {
+      g_object_unref (f->object);
+      f->object = NULL;
+    }
+
+  if (f->client_conn != NULL)
+    {
+      dbus_connection_close (f->client_conn);
+      dbus_connection_unref (f->client_conn);
+      f->client_conn = NULL;
+    }
+
+  if (f->server_conn != NULL)
+    {
+      dbus_connection_close (f->server_conn);
+      dbus_connection_unref (f->server_conn);
+      f->server_conn = NULL;
+    }
+
+  if (f->server != NULL)
+    {
+      dbus_server_disconnect (f->server);
+      dbus_server_unref (f->server);
+      f->server = NULL;
+    }
+
+  g_clear_pointer (&f->sig2_values, g_ptr_array_unref);
+  g_clear_pointer (&f->sig2_paths, g_ptr_array_unref);
+  g_clear_pointer (&f->watermark_events, g_array_unref);
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_type_init ();
+  dbus_g_type_specialized_init ();
+
+  g_test_add ("/backpressure/watermarks", Fixture, "unix:tmpdir=/tmp",
+      setup, test_watermarks, teardown);
+  g_test_add ("/backpressure/lossy-send", Fixture, "unix:tmpdir=/tmp",
+      setup, test_lossy_send, teardown);
+  g_test_add ("/backpressure/lossy-drop", Fixture, "unix:tmpdir=/tmp",
+      setup, test_lossy_drop, teardown);
+  g_test_add ("/backpressure/lossy-coalesce", Fixture, "unix:tmpdir=/tmp",
+      setup, test_lossy_coalesce, teardown);
+
+  return g_test_run ();
+}
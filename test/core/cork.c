@@ -0,0 +1,372 @@
+/* Regression tests for holding back outgoing messages with corking.
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#define CORK_IFACE "org.freedesktop.DBus.GLib.Tests.Cork"
+
+/* The client is dispatched by the default main context, and the server
+ * by a context of its own, so that the server can read whatever has
+ * reached the socket without giving the client's auto-cork flush a
+ * chance to run. */
+typedef struct {
+    DBusError e;
+
+    DBusServer *server;
+    GMainContext *server_context;
+    DBusConnection *server_conn;
+    /* the argument of each Ping received, in order */
+    GArray *received;
+
+    DBusConnection *client_conn;
+    DBusGConnection *client_gconn;
+    DBusGProxy *proxy;
+} Fixture;
+
+static void
+assert_no_error (const DBusError *e)
+{
+  if (G_UNLIKELY (dbus_error_is_set (e)))
+    g_error ("expected success but got error: %s: %s", e->name, e->message);
+}
+
+static DBusHandlerResult
+ping_filter (DBusConnection *connection,
+    DBusMessage *message,
+    void *user_data)
+{
+  Fixture *f = user_data;
+  dbus_uint32_t i;
+
+  if (!dbus_message_is_method_call (message, CORK_IFACE, "Ping"))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  if (!dbus_message_get_args (message, &f->e, DBUS_TYPE_UINT32, &i,
+        DBUS_TYPE_INVALID))
+    assert_no_error (&f->e);
+
+  g_array_append_val (f->received, i);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void
+new_conn_cb (DBusServer *server,
+    DBusConnection *server_conn,
+    void *data)
+{
+  Fixture *f = data;
+
+  g_assert (f->server_conn == NULL);
+  f->server_conn = dbus_connection_ref (server_conn);
+
+  if (!dbus_connection_add_filter (server_conn, ping_filter, f, NULL))
+    g_error ("OOM");
+
+  dbus_connection_setup_with_g_main (server_conn, f->server_context);
+}
+
+static void
+setup (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_error_init (&f->e);
+  f->received = g_array_new (FALSE, FALSE, sizeof (dbus_uint32_t));
+  f->server_context = g_main_context_new ();
+
+  f->server = dbus_server_listen (addr, &f->e);
+  assert_no_error (&f->e);
+  g_assert (f->server != NULL);
+
+  dbus_server_set_new_connection_function (f->server, new_conn_cb, f, NULL);
+  dbus_server_setup_with_g_main (f->server, NULL);
+
+  f->client_conn = dbus_connection_open_private (
+      dbus_server_get_address (f->server), &f->e);
+  assert_no_error (&f->e);
+  g_assert (f->client_conn != NULL);
+  dbus_connection_setup_with_g_main (f->client_conn, NULL);
+  f->client_gconn = dbus_connection_get_g_connection (f->client_conn);
+
+  while (f->server_conn == NULL)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  f->proxy = dbus_g_proxy_new_for_peer (f->client_gconn, "/", CORK_IFACE);
+  g_assert (f->proxy != NULL);
+}
+
+static void
+ping (Fixture *f,
+    guint i)
+{
+  dbus_g_proxy_call_no_reply (f->proxy, "Ping",
+      G_TYPE_UINT, i,
+      G_TYPE_INVALID);
+}
+
+/* Write out everything libdbus has queued on the client, then let the
+ * server read and dispatch whatever that was, without iterating the
+ * client's main context */
+static void
+deliver (Fixture *f)
+{
+  dbus_connection_flush (f->client_conn);
+
+  while (g_main_context_iteration (f->server_context, FALSE))
+    ;
+}
+
+static void
+wait_for_received (Fixture *f,
+    guint n)
+{
+  dbus_connection_flush (f->client_conn);
+
+  while (f->received->len < n)
+    {
+      g_print (".");
+      g_main_context_iteration (f->server_context, TRUE);
+    }
+}
+
+static void
+assert_received_in_order (Fixture *f,
+    guint n)
+{
+  guint i;
+
+  g_assert_cmpuint (f->received->len, ==, n);
+
+  for (i = 0; i < n; i++)
+    g_assert_cmpuint (g_array_index (f->received, dbus_uint32_t, i), ==, i);
+}
+
+static void
+test_cork (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_g_connection_cork (f->client_gconn);
+  ping (f, 0);
+  dbus_g_connection_cork (f->client_gconn);
+  ping (f, 1);
+
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 0);
+
+  /* nested: still held */
+  dbus_g_connection_uncork (f->client_gconn);
+  ping (f, 2);
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 0);
+
+  /* the last uncork sends everything, in order, without needing the
+   * main loop */
+  dbus_g_connection_uncork (f->client_gconn);
+  wait_for_received (f, 3);
+  assert_received_in_order (f, 3);
+
+  /* uncorked: sent straight away */
+  ping (f, 3);
+  wait_for_received (f, 4);
+  assert_received_in_order (f, 4);
+}
+
+static void
+test_flush (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_g_connection_cork (f->client_gconn);
+  ping (f, 0);
+  ping (f, 1);
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 0);
+
+  /* flushing the connection sends held messages too */
+  dbus_g_connection_flush (f->client_gconn);
+  wait_for_received (f, 2);
+  assert_received_in_order (f, 2);
+
+  dbus_g_connection_uncork (f->client_gconn);
+}
+
+static void
+test_auto_cork (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_g_connection_set_auto_cork (f->client_gconn, TRUE, 0, 0);
+
+  ping (f, 0);
+  ping (f, 1);
+  ping (f, 2);
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 0);
+
+  /* held until the client's main context next iterates */
+  while (g_main_context_iteration (NULL, FALSE))
+    ;
+
+  wait_for_received (f, 3);
+  assert_received_in_order (f, 3);
+
+  /* turning it off sends anything still held */
+  ping (f, 3);
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 3);
+  dbus_g_connection_set_auto_cork (f->client_gconn, FALSE, 0, 0);
+  wait_for_received (f, 4);
+  assert_received_in_order (f, 4);
+
+  ping (f, 4);
+  wait_for_received (f, 5);
+  assert_received_in_order (f, 5);
+}
+
+static void
+test_max_messages (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_g_connection_set_auto_cork (f->client_gconn, FALSE, 3, 0);
+  dbus_g_connection_cork (f->client_gconn);
+
+  ping (f, 0);
+  ping (f, 1);
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 0);
+
+  /* the third one reaches the limit, so all three go at once */
+  ping (f, 2);
+  wait_for_received (f, 3);
+  assert_received_in_order (f, 3);
+
+  /* and the count starts again */
+  ping (f, 3);
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 3);
+
+  dbus_g_connection_uncork (f->client_gconn);
+  wait_for_received (f, 4);
+  assert_received_in_order (f, 4);
+}
+
+static void
+test_max_latency (Fixture *f,
+    gconstpointer addr)
+{
+  gint64 start;
+
+  dbus_g_connection_set_auto_cork (f->client_gconn, FALSE, 0, 50);
+  dbus_g_connection_cork (f->client_gconn);
+
+  start = g_get_monotonic_time ();
+  ping (f, 0);
+  ping (f, 1);
+  deliver (f);
+  g_assert_cmpuint (f->received->len, ==, 0);
+
+  /* still corked, but the timer sends them */
+  while (f->received->len < 2)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+      deliver (f);
+    }
+
+  g_assert_cmpint (g_get_monotonic_time () - start, >=, 50 * 1000);
+  assert_received_in_order (f, 2);
+
+  dbus_g_connection_uncork (f->client_gconn);
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer addr G_GNUC_UNUSED)
+{
+  f->client_gconn = NULL;
+
+  if (f->proxy != NULL)
+    {
+      g_object_unref (f->proxy);
+      f->proxy = NULL;
+    }
+
+  if (f->client_conn != NULL)
+    {
+      dbus_connection_close (f->client_conn);
+      dbus_connection_unref (f->client_conn);
+      f->client_conn = NULL;
+    }
+
+  if (f->server_conn != NULL)
+    {
+      dbus_connection_close (f->server_conn);
+      dbus_connection_unref (f->server_conn);
+      f->server_conn = NULL;
+    }
+
+  if (f->server != NULL)
+    {
+      dbus_server_disconnect (f->server);
+      dbus_server_unref (f->server);
+      f->server = NULL;
+    }
+
+  if (f->server_context != NULL)
+    {
+      g_main_context_unref (f->server_context);
+      f->server_context = NULL;
+    }
+
+  if (f->received != NULL)
+    {
+      g_array_unref (f->received);
+      f->received = NULL;
+    }
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_type_init ();
+
+  g_test_add ("/cork/nested", Fixture, "unix:tmpdir=/tmp", setup,
+      test_cork, teardown);
+  g_test_add ("/cork/flush", Fixture, "unix:tmpdir=/tmp", setup,
+      test_flush, teardown);
+  g_test_add ("/cork/auto", Fixture, "unix:tmpdir=/tmp", setup,
+      test_auto_cork, teardown);
+  g_test_add ("/cork/max-messages", Fixture, "unix:tmpdir=/tmp", setup,
+      test_max_messages, teardown);
+  g_test_add ("/cork/max-latency", Fixture, "unix:tmpdir=/tmp", setup,
+      test_max_latency, teardown);
+
+  return g_test_run ();
+}
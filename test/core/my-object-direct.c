@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later */
+
+/* The same object info as in my-object.c, but with the glue generated by
+ * dbus-binding-tool --mode=glib-server-direct. It is in a file of its own
+ * because both glue headers define dbus_glib_my_object_object_info. */
+
+#include <config.h>
+#include <glib-object.h>
+#include <dbus/dbus-glib-lowlevel.h>
+#include "my-object.h"
+
+#include "test-service-glib-direct-glue.h"
+
+void
+my_object_use_direct_glue (void)
+{
+  gpointer klass;
+
+  /* my_object_class_init() installs the other info, so it must have run
+   * before this one replaces it */
+  klass = g_type_class_ref (MY_TYPE_OBJECT);
+  dbus_g_object_type_install_info (MY_TYPE_OBJECT,
+				   &dbus_glib_my_object_object_info);
+  g_type_class_unref (klass);
+}
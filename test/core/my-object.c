@@ -4,6 +4,7 @@
 #include <string.h>
 #include <glib/gi18n.h>
 #include <glib-object.h>
+#include <dbus/dbus-glib-lowlevel.h>
 #include "my-object.h"
 
 #include "test-service-glib-glue.h"
@@ -117,6 +118,7 @@ my_object_init (MyObject *obj)
 {
   obj->val = 0;
   obj->notouching = 42;
+  obj->main_thread = g_thread_self ();
   obj->saved_error = g_error_new_literal (MY_OBJECT_ERROR,
       MY_OBJECT_ERROR_FOO, "this method always loses");
 }
@@ -250,6 +252,19 @@ my_object_do_nothing (MyObject *obj, GError **error)
   return TRUE;
 }
 
+gboolean
+my_object_ping (MyObject *obj, GError **error)
+{
+  return TRUE;
+}
+
+gboolean
+my_object_sleep (MyObject *obj, guint msec, GError **error)
+{
+  g_usleep (msec * 1000);
+  return TRUE;
+}
+
 gboolean
 my_object_increment (MyObject *obj, gint32 x, gint32 *ret, GError **error)
 {
@@ -825,6 +840,50 @@ my_object_async_increment (MyObject *obj, gint32 x, DBusGMethodInvocation *conte
   g_idle_add ((GSourceFunc)do_async_increment, data);
 }
 
+void
+my_object_threaded_increment (MyObject *obj, gint32 x, DBusGMethodInvocation *context)
+{
+  /* we're in a worker thread, so we can reply straight away; tell the
+   * caller which thread that was, so the test can tell a silent fallback
+   * to the main context apart */
+  dbus_g_method_return (context, x + 1,
+      g_thread_self () == obj->main_thread);
+}
+
+void
+my_object_async_build_reply (MyObject *obj, guint n, DBusGMethodInvocation *context)
+{
+  DBusGMethodReply *reply;
+  gint32 *ints;
+  guint i;
+
+  reply = dbus_g_method_reply_new (context);
+  ints = g_new (gint32, n);
+
+  dbus_g_method_reply_open_container (reply, DBUS_TYPE_ARRAY, NULL);
+
+  for (i = 0; i < n; i++)
+    {
+      const char *name = "item";
+      gint32 index = i;
+      gint32 square = i * i;
+
+      dbus_g_method_reply_open_container (reply, DBUS_TYPE_STRUCT, NULL);
+      dbus_g_method_reply_append_basic (reply, DBUS_TYPE_STRING, &name);
+      dbus_g_method_reply_append_basic (reply, DBUS_TYPE_INT32, &index);
+      dbus_g_method_reply_append_basic (reply, DBUS_TYPE_INT32, &square);
+      dbus_g_method_reply_close_container (reply);
+
+      ints[i] = -index;
+    }
+
+  dbus_g_method_reply_close_container (reply);
+  dbus_g_method_reply_append_fixed_array (reply, DBUS_TYPE_INT32, ints, n);
+  dbus_g_method_reply_send (reply);
+
+  g_free (ints);
+}
+
 typedef struct {
   GError *error;
   DBusGMethodInvocation *context;
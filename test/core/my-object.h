@@ -21,6 +21,8 @@ struct MyObject
   gdouble super_studly;
   gboolean should_be_hidden;
   gsize echo_variant_called;
+  /* the thread that created the object */
+  GThread *main_thread;
 };
 
 struct MyObjectClass
@@ -49,8 +51,14 @@ typedef enum
 GQuark my_object_error_quark (void);
 GType my_object_error_get_type (void);
 
+void my_object_use_direct_glue (void);
+
 gboolean my_object_do_nothing (MyObject *obj, GError **error);
 
+gboolean my_object_ping (MyObject *obj, GError **error);
+
+gboolean my_object_sleep (MyObject *obj, guint msec, GError **error);
+
 gboolean my_object_increment (MyObject *obj, gint32 x, gint32 *ret, GError **error);
 
 gint32   my_object_increment_retval (MyObject *obj, gint32 x);
@@ -115,6 +123,8 @@ void my_object_dict_of_objs (MyObject *obj, GHashTable *dict, DBusGMethodInvocat
 gboolean my_object_terminate (MyObject *obj, GError **error);
 
 void my_object_async_increment (MyObject *obj, gint32 x, DBusGMethodInvocation *context);
+void my_object_threaded_increment (MyObject *obj, gint32 x, DBusGMethodInvocation *context);
+void my_object_async_build_reply (MyObject *obj, guint n, DBusGMethodInvocation *context);
 
 void my_object_async_throw_error (MyObject *obj, DBusGMethodInvocation *context);
 
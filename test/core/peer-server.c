@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <dbus/dbus.h>
 #include <dbus/dbus-glib.h>
@@ -27,15 +28,35 @@ new_connection_func (DBusServer *server, DBusConnection *conn, gpointer user_dat
     (dbus_connection_get_g_connection (conn), "/", obj);
 }
 
+static void
+worker_new_connection_func (DBusConnection *conn,
+                            GMainContext *context,
+                            gpointer user_data)
+{
+  GObject *obj;
+
+  obj = g_object_new (MY_TYPE_OBJECT, NULL);
+
+  dbus_g_connection_register_g_object
+    (dbus_connection_get_g_connection (conn), "/", obj);
+}
+
 int
 main (int argc, char **argv)
 {
   DBusError error;
   DBusServer *server;
+  DBusGServerWorkers *workers = NULL;
+  guint n_workers = 0;
   char *addr;
 
   dbus_error_init (&error);
 
+  /* --workers=N hands connections to N worker threads instead of
+   * dispatching them in the main thread */
+  if (argc > 1 && strncmp (argv[1], "--workers=", strlen ("--workers=")) == 0)
+    n_workers = atoi (argv[1] + strlen ("--workers="));
+
   dbus_g_thread_init ();
   g_type_init ();
 
@@ -52,10 +73,20 @@ main (int argc, char **argv)
   fflush (stdout);
   free (addr);
   dbus_server_setup_with_g_main (server, NULL);
-  dbus_server_set_new_connection_function (server, new_connection_func, NULL, NULL);
+
+  if (n_workers > 0)
+    workers = dbus_g_server_workers_new (server, n_workers,
+                                         DBUS_G_SERVER_WORKERS_LEAST_LOADED,
+                                         worker_new_connection_func,
+                                         NULL, NULL);
+  else
+    dbus_server_set_new_connection_function (server, new_connection_func, NULL, NULL);
   
   g_main_loop_run (loop);
   
+  if (workers != NULL)
+    dbus_g_server_workers_free (workers);
+
   g_main_loop_unref (loop);
   return 0;
 }
@@ -0,0 +1,479 @@
+/* Regression tests for the array-based DBusGProxy call API.
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#define TYPED_IFACE "org.freedesktop.DBus.GLib.Tests.Typed"
+
+/* The server is dispatched in a thread of its own, so that the client
+ * can make blocking calls.
+ *
+ * Every method takes a uint32 x, and replies with some prefix of
+ * (variant<uint32 x + 1>, string "hello", uint32 42), or with
+ * (variant<string "hello">, variant<array of uint32 [x, x + 1]>) for
+ * Variants. */
+typedef struct {
+    DBusError e;
+
+    DBusServer *server;
+    GMainContext *server_context;
+    GMainLoop *server_loop;
+    GThread *server_thread;
+    DBusConnection *server_conn;
+
+    DBusConnection *client_conn;
+    DBusGConnection *client_gconn;
+    DBusGProxy *proxy;
+
+    /* x */
+    GType in_types[2];
+    /* what Pair replies with */
+    GType out_types[3];
+} Fixture;
+
+static void
+assert_no_error (const DBusError *e)
+{
+  if (G_UNLIKELY (dbus_error_is_set (e)))
+    g_error ("expected success but got error: %s: %s", e->name, e->message);
+}
+
+static void
+append_variant (DBusMessageIter *iter,
+    int type,
+    const void *value)
+{
+  DBusMessageIter sub;
+  char signature[2] = { (char) type, '\0' };
+
+  if (!dbus_message_iter_open_container (iter, DBUS_TYPE_VARIANT, signature,
+        &sub) ||
+      !dbus_message_iter_append_basic (&sub, type, value) ||
+      !dbus_message_iter_close_container (iter, &sub))
+    g_error ("OOM");
+}
+
+static void
+append_uint32_array_variant (DBusMessageIter *iter,
+    const dbus_uint32_t *values,
+    int n_values)
+{
+  DBusMessageIter variant, array;
+
+  if (!dbus_message_iter_open_container (iter, DBUS_TYPE_VARIANT, "au",
+        &variant) ||
+      !dbus_message_iter_open_container (&variant, DBUS_TYPE_ARRAY, "u",
+        &array) ||
+      !dbus_message_iter_append_fixed_array (&array, DBUS_TYPE_UINT32,
+        &values, n_values) ||
+      !dbus_message_iter_close_container (&variant, &array) ||
+      !dbus_message_iter_close_container (iter, &variant))
+    g_error ("OOM");
+}
+
+static DBusHandlerResult
+typed_filter (DBusConnection *connection,
+    DBusMessage *message,
+    void *user_data)
+{
+  Fixture *f = user_data;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+  const char *member = dbus_message_get_member (message);
+  const char *hello = "hello";
+  dbus_uint32_t x, x_plus_1, answer = 42;
+  int n_args;
+
+  if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL ||
+      !dbus_message_has_interface (message, TYPED_IFACE))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  if (!dbus_message_get_args (message, &f->e, DBUS_TYPE_UINT32, &x,
+        DBUS_TYPE_INVALID))
+    assert_no_error (&f->e);
+
+  x_plus_1 = x + 1;
+  reply = dbus_message_new_method_return (message);
+
+  if (reply == NULL)
+    g_error ("OOM");
+
+  dbus_message_iter_init_append (reply, &iter);
+
+  if (g_strcmp0 (member, "Variants") == 0)
+    {
+      dbus_uint32_t array[2];
+
+      array[0] = x;
+      array[1] = x_plus_1;
+      append_variant (&iter, DBUS_TYPE_STRING, &hello);
+      append_uint32_array_variant (&iter, array, G_N_ELEMENTS (array));
+      n_args = 0;
+    }
+  else if (g_strcmp0 (member, "Single") == 0)
+    n_args = 1;
+  else if (g_strcmp0 (member, "Pair") == 0)
+    n_args = 2;
+  else if (g_strcmp0 (member, "Triple") == 0)
+    n_args = 3;
+  else
+    g_error ("unexpected method %s", member);
+
+  if (n_args >= 1)
+    append_variant (&iter, DBUS_TYPE_UINT32, &x_plus_1);
+
+  if (n_args >= 2 &&
+      !dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &hello))
+    g_error ("OOM");
+
+  if (n_args >= 3 &&
+      !dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32, &answer))
+    g_error ("OOM");
+
+  if (!dbus_connection_send (connection, reply, NULL))
+    g_error ("OOM");
+
+  dbus_message_unref (reply);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/* Runs in the server thread */
+static void
+new_conn_cb (DBusServer *server,
+    DBusConnection *server_conn,
+    void *data)
+{
+  Fixture *f = data;
+
+  if (!dbus_connection_add_filter (server_conn, typed_filter, f, NULL))
+    g_error ("OOM");
+
+  dbus_connection_setup_with_g_main (server_conn, f->server_context);
+  g_assert (g_atomic_pointer_get (&f->server_conn) == NULL);
+  g_atomic_pointer_set (&f->server_conn, dbus_connection_ref (server_conn));
+}
+
+static gpointer
+server_thread_func (gpointer data)
+{
+  Fixture *f = data;
+
+  g_main_context_push_thread_default (f->server_context);
+  g_main_loop_run (f->server_loop);
+  g_main_context_pop_thread_default (f->server_context);
+  return NULL;
+}
+
+static void
+setup (Fixture *f,
+    gconstpointer addr)
+{
+  dbus_error_init (&f->e);
+
+  f->in_types[0] = G_TYPE_UINT;
+  f->in_types[1] = G_TYPE_INVALID;
+  f->out_types[0] = G_TYPE_VALUE;
+  f->out_types[1] = G_TYPE_STRING;
+  f->out_types[2] = G_TYPE_INVALID;
+
+  f->server_context = g_main_context_new ();
+  f->server_loop = g_main_loop_new (f->server_context, FALSE);
+
+  f->server = dbus_server_listen (addr, &f->e);
+  assert_no_error (&f->e);
+  g_assert (f->server != NULL);
+
+  dbus_server_set_new_connection_function (f->server, new_conn_cb, f, NULL);
+  dbus_server_setup_with_g_main (f->server, f->server_context);
+
+  f->server_thread = g_thread_new ("server", server_thread_func, f);
+
+  f->client_conn = dbus_connection_open_private (
+      dbus_server_get_address (f->server), &f->e);
+  assert_no_error (&f->e);
+  g_assert (f->client_conn != NULL);
+  dbus_connection_setup_with_g_main (f->client_conn, NULL);
+  f->client_gconn = dbus_connection_get_g_connection (f->client_conn);
+
+  while (g_atomic_pointer_get (&f->server_conn) == NULL)
+    {
+      g_print (".");
+      g_usleep (G_USEC_PER_SEC / 100);
+    }
+
+  f->proxy = dbus_g_proxy_new_for_peer (f->client_gconn, "/", TYPED_IFACE);
+  g_assert (f->proxy != NULL);
+}
+
+static gboolean
+call (Fixture *f,
+    const char *method,
+    const GType *out_types,
+    gpointer const *out_args,
+    GError **error)
+{
+  guint x = 6;
+  gconstpointer in_args[] = { NULL };
+
+  in_args[0] = &x;
+  return dbus_g_proxy_call_typed (f->proxy, method, error,
+      f->in_types, in_args, out_types, out_args);
+}
+
+static void
+assert_variant_uint (const GValue *value,
+    guint expected)
+{
+  g_assert (G_VALUE_HOLDS_UINT (value));
+  g_assert_cmpuint (g_value_get_uint (value), ==, expected);
+}
+
+static void
+test_call (Fixture *f,
+    gconstpointer addr)
+{
+  GError *error = NULL;
+  GValue variant = { 0, };
+  gchar *str = NULL;
+  gpointer out_args[] = { NULL, NULL };
+
+  out_args[0] = &variant;
+  out_args[1] = &str;
+
+  if (!call (f, "Pair", f->out_types, out_args, &error))
+    g_error ("%s", error->message);
+
+  assert_variant_uint (&variant, 7);
+  g_assert_cmpstr (str, ==, "hello");
+
+  g_value_unset (&variant);
+  g_free (str);
+}
+
+static void
+test_null_out_args (Fixture *f,
+    gconstpointer addr)
+{
+  GError *error = NULL;
+  GValue variant = { 0, };
+  gchar *str = NULL;
+  gpointer out_args[] = { NULL, NULL };
+
+  /* only the string */
+  out_args[1] = &str;
+
+  if (!call (f, "Pair", f->out_types, out_args, &error))
+    g_error ("%s", error->message);
+
+  g_assert_cmpstr (str, ==, "hello");
+  g_free (str);
+  str = NULL;
+
+  /* only the variant */
+  out_args[0] = &variant;
+  out_args[1] = NULL;
+
+  if (!call (f, "Pair", f->out_types, out_args, &error))
+    g_error ("%s", error->message);
+
+  assert_variant_uint (&variant, 7);
+  g_value_unset (&variant);
+
+  /* neither: the reply is still checked against the types */
+  out_args[0] = NULL;
+
+  if (!call (f, "Pair", f->out_types, out_args, &error))
+    g_error ("%s", error->message);
+
+  g_assert (!call (f, "Single", f->out_types, out_args, &error));
+  g_assert_error (error, DBUS_GERROR, DBUS_GERROR_INVALID_ARGS);
+  g_clear_error (&error);
+}
+
+static void
+test_too_few (Fixture *f,
+    gconstpointer addr)
+{
+  GError *error = NULL;
+  GValue variant = { 0, };
+  gchar *str = NULL;
+  gpointer out_args[] = { NULL, NULL };
+
+  out_args[0] = &variant;
+  out_args[1] = &str;
+
+  g_assert (!call (f, "Single", f->out_types, out_args, &error));
+  g_assert_error (error, DBUS_GERROR, DBUS_GERROR_INVALID_ARGS);
+  g_clear_error (&error);
+
+  /* the variant that was read before the error was noticed has been
+   * freed again, and the string was never set */
+  g_assert (!G_IS_VALUE (&variant));
+  g_assert (str == NULL);
+}
+
+static void
+test_too_many (Fixture *f,
+    gconstpointer addr)
+{
+  GError *error = NULL;
+  GValue variant = { 0, };
+  gchar *str = NULL;
+  gpointer out_args[] = { NULL, NULL };
+
+  out_args[0] = &variant;
+  out_args[1] = &str;
+
+  g_assert (!call (f, "Triple", f->out_types, out_args, &error));
+  g_assert_error (error, DBUS_GERROR, DBUS_GERROR_INVALID_ARGS);
+  g_clear_error (&error);
+
+  /* both outputs were read before the error was noticed; the variant
+   * has visibly been unset, and "make check-valgrind" checks that the
+   * string has not leaked */
+  g_assert (!G_IS_VALUE (&variant));
+}
+
+static void
+test_variants (Fixture *f,
+    gconstpointer addr)
+{
+  GError *error = NULL;
+  GValue str_variant = { 0, };
+  GValue array_variant = { 0, };
+  GType out_types[3];
+  gpointer out_args[] = { NULL, NULL };
+  gchar *str = NULL;
+  GArray *array;
+
+  out_types[0] = G_TYPE_VALUE;
+  out_types[1] = G_TYPE_VALUE;
+  out_types[2] = G_TYPE_INVALID;
+  out_args[0] = &str_variant;
+  out_args[1] = &array_variant;
+
+  if (!call (f, "Variants", out_types, out_args, &error))
+    g_error ("%s", error->message);
+
+  g_assert (G_VALUE_HOLDS_STRING (&str_variant));
+  g_assert_cmpstr (g_value_get_string (&str_variant), ==, "hello");
+
+  g_assert (G_VALUE_HOLDS (&array_variant,
+        dbus_g_type_get_collection ("GArray", G_TYPE_UINT)));
+  array = g_value_get_boxed (&array_variant);
+  g_assert_cmpuint (array->len, ==, 2);
+  g_assert_cmpuint (g_array_index (array, guint, 0), ==, 6);
+  g_assert_cmpuint (g_array_index (array, guint, 1), ==, 7);
+
+  g_value_unset (&str_variant);
+  g_value_unset (&array_variant);
+
+  /* a variant can't be stored in a basic type */
+  out_types[1] = G_TYPE_STRING;
+  out_args[1] = &str;
+  g_assert (!call (f, "Variants", out_types, out_args, &error));
+  g_assert (error != NULL);
+  g_clear_error (&error);
+  g_assert (!G_IS_VALUE (&str_variant));
+  g_assert (str == NULL);
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer addr G_GNUC_UNUSED)
+{
+  f->client_gconn = NULL;
+
+  if (f->proxy != NULL)
+    {
+      g_object_unref (f->proxy);
+      f->proxy = NULL;
+    }
+
+  if (f->client_conn != NULL)
+    {
+      dbus_connection_close (f->client_conn);
+      dbus_connection_unref (f->client_conn);
+      f->client_conn = NULL;
+    }
+
+  if (f->server_thread != NULL)
+    {
+      g_main_loop_quit (f->server_loop);
+      g_thread_join (f->server_thread);
+      f->server_thread = NULL;
+    }
+
+  if (f->server_conn != NULL)
+    {
+      dbus_connection_close (f->server_conn);
+      dbus_connection_unref (f->server_conn);
+      f->server_conn = NULL;
+    }
+
+  if (f->server != NULL)
+    {
+      dbus_server_disconnect (f->server);
+      dbus_server_unref (f->server);
+      f->server = NULL;
+    }
+
+  if (f->server_loop != NULL)
+    {
+      g_main_loop_unref (f->server_loop);
+      f->server_loop = NULL;
+    }
+
+  if (f->server_context != NULL)
+    {
+      g_main_context_unref (f->server_context);
+      f->server_context = NULL;
+    }
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_type_init ();
+  dbus_g_thread_init ();
+
+  g_test_add ("/proxy-typed/call", Fixture, "unix:tmpdir=/tmp", setup,
+      test_call, teardown);
+  g_test_add ("/proxy-typed/null-out-args", Fixture, "unix:tmpdir=/tmp",
+      setup, test_null_out_args, teardown);
+  g_test_add ("/proxy-typed/too-few", Fixture, "unix:tmpdir=/tmp", setup,
+      test_too_few, teardown);
+  g_test_add ("/proxy-typed/too-many", Fixture, "unix:tmpdir=/tmp", setup,
+      test_too_many, teardown);
+  g_test_add ("/proxy-typed/variants", Fixture, "unix:tmpdir=/tmp", setup,
+      test_variants, teardown);
+
+  return g_test_run ();
+}
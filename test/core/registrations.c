@@ -39,10 +39,13 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
 
 #include "my-object.h"
+#include "my-object-subclass.h"
 
 #include "dbus-gmain/tests/util.h"
 
@@ -85,6 +88,18 @@ setup (Fixture *f,
   g_assert (MY_IS_OBJECT (f->object));
 }
 
+static void
+setup_emission_hooks (Fixture *f,
+    gconstpointer path_to_use)
+{
+  setup (f, path_to_use);
+  g_object_unref (f->object);
+
+  dbus_g_object_type_use_emission_hooks (MY_TYPE_OBJECT_SUBCLASS);
+  f->object = g_object_new (MY_TYPE_OBJECT_SUBCLASS, NULL);
+  g_assert (MY_IS_OBJECT (f->object));
+}
+
 static void
 teardown (Fixture *f,
     gconstpointer test_data G_GNUC_UNUSED)
@@ -417,6 +432,113 @@ test_marshal_object (Fixture *f,
     g_main_context_iteration (NULL, TRUE);
 }
 
+static DBusMessage *
+call_my_object (Fixture *f,
+    const char *method)
+{
+  DBusMessage *call;
+  DBusMessage *reply;
+  DBusPendingCall *pc;
+  dbus_bool_t mem;
+
+  call = dbus_message_new_method_call (
+      dbus_bus_get_unique_name (dbus_g_connection_get_connection (f->bus)),
+      "/foo", "org.freedesktop.DBus.GLib.Tests.MyObject", method);
+  g_assert (call != NULL);
+
+  mem = dbus_connection_send_with_reply (
+      dbus_g_connection_get_connection (f->bus2), call, &pc, -1);
+  g_assert (mem);
+  g_assert (pc != NULL);
+  dbus_message_unref (call);
+
+  while (!dbus_pending_call_get_completed (pc))
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = dbus_pending_call_steal_reply (pc);
+  g_assert (reply != NULL);
+  dbus_pending_call_unref (pc);
+
+  return reply;
+}
+
+typedef struct {
+    guint64 do_nothing_calls;
+    guint64 do_nothing_errors;
+    guint64 throw_error_calls;
+    guint64 throw_error_errors;
+} StatsTotals;
+
+static void
+stats_cb (const DBusGMethodStats *stats,
+    gpointer user_data)
+{
+  StatsTotals *totals = user_data;
+  guint64 histogram_total = 0;
+  guint i;
+
+  g_assert (g_type_is_a (stats->type, MY_TYPE_OBJECT));
+  g_assert_cmpstr (stats->interface, ==,
+      "org.freedesktop.DBus.GLib.Tests.MyObject");
+
+  for (i = 0; i < stats->n_buckets; i++)
+    histogram_total += stats->buckets[i];
+
+  g_assert_cmpuint (histogram_total, ==, stats->calls);
+  g_assert_cmpuint (stats->demarshal_usec, <=, stats->total_usec);
+
+  if (strcmp (stats->method, "DoNothing") == 0)
+    {
+      totals->do_nothing_calls += stats->calls;
+      totals->do_nothing_errors += stats->errors;
+    }
+  else if (strcmp (stats->method, "ThrowError") == 0)
+    {
+      totals->throw_error_calls += stats->calls;
+      totals->throw_error_errors += stats->errors;
+    }
+}
+
+static void
+test_method_stats (Fixture *f,
+    gconstpointer test_data G_GNUC_UNUSED)
+{
+  StatsTotals totals = { 0 };
+  DBusMessage *reply;
+
+  dbus_glib_global_set_method_stats_enabled (TRUE);
+  dbus_g_method_stats_reset ();
+
+  dbus_g_connection_register_g_object (f->bus, "/foo", f->object);
+
+  reply = call_my_object (f, "DoNothing");
+  g_assert_cmpint (dbus_message_get_type (reply), ==,
+      DBUS_MESSAGE_TYPE_METHOD_RETURN);
+  dbus_message_unref (reply);
+
+  reply = call_my_object (f, "DoNothing");
+  dbus_message_unref (reply);
+
+  reply = call_my_object (f, "ThrowError");
+  g_assert_cmpint (dbus_message_get_type (reply), ==,
+      DBUS_MESSAGE_TYPE_ERROR);
+  dbus_message_unref (reply);
+
+  dbus_g_method_stats_foreach (stats_cb, &totals);
+  g_assert_cmpuint (totals.do_nothing_calls, ==, 2);
+  g_assert_cmpuint (totals.do_nothing_errors, ==, 0);
+  g_assert_cmpuint (totals.throw_error_calls, ==, 1);
+  g_assert_cmpuint (totals.throw_error_errors, ==, 1);
+
+  g_assert_cmpuint (dbus_g_method_stats_get_bucket_start (0), ==, 0);
+  g_assert_cmpuint (dbus_g_method_stats_get_bucket_start (4), ==, 4);
+  g_assert_cmpuint (dbus_g_method_stats_get_bucket_start (8), ==, 8);
+  g_assert_cmpuint (dbus_g_method_stats_get_bucket_start (9), ==, 10);
+
+  dbus_glib_global_set_method_stats_enabled (FALSE);
+  dbus_g_method_stats_reset ();
+}
+
 int
 main (int argc, char **argv)
 {
@@ -438,10 +560,14 @@ main (int argc, char **argv)
       setup, test_reregister, teardown);
   g_test_add ("/registrations/twice", Fixture, NULL,
       setup, test_twice, teardown);
+  g_test_add ("/registrations/twice/emission-hooks", Fixture, NULL,
+      setup_emission_hooks, test_twice, teardown);
   g_test_add ("/registrations/clean-slate", Fixture, NULL,
       setup, test_clean_slate, teardown);
   g_test_add ("/registrations/marshal-object", Fixture, NULL,
       setup, test_marshal_object, teardown);
+  g_test_add ("/registrations/method-stats", Fixture, NULL,
+      setup, test_method_stats, teardown);
 
   return g_test_run ();
 }
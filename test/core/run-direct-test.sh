@@ -0,0 +1,5 @@
+#!/bin/sh
+
+# Run the tests against test-service-glib again, with its glue generated
+# by dbus-binding-tool --mode=glib-server-direct
+exec `dirname "$0"`/run-test.sh direct
@@ -4,3 +4,6 @@ set -e
 
 # The peer server writes its address over stdout, which the client reads
 ${DBUS_TOP_BUILDDIR}/libtool --mode=execute ./peer-server | ${DBUS_TOP_BUILDDIR}/libtool --mode=execute ./peer-client
+
+# Again, with the server's connections dispatched in worker threads
+${DBUS_TOP_BUILDDIR}/libtool --mode=execute ./peer-server --workers=2 | ${DBUS_TOP_BUILDDIR}/libtool --mode=execute ./peer-client
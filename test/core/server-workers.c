@@ -0,0 +1,364 @@
+/* Regression tests for DBusGServerWorkers.
+ *
+ * SPDX-License-Identifier: AFL-2.1 OR GPL-2.0-or-later
+ *
+ * Licensed under the Academic Free License version 2.1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+#define N_WORKERS 3
+#define MAX_CLIENTS 8
+
+#define WORKERS_IFACE "org.freedesktop.DBus.GLib.Tests.Workers"
+
+typedef struct {
+    DBusError e;
+
+    DBusServer *server;
+    DBusGServerWorkers *workers;
+
+    /* accepted in the main thread, in the same order as the clients */
+    GPtrArray *server_conns;
+    DBusConnection *clients[MAX_CLIENTS];
+    guint n_clients;
+} Fixture;
+
+static void
+assert_no_error (const DBusError *e)
+{
+  if (G_UNLIKELY (dbus_error_is_set (e)))
+    g_error ("expected success but got error: %s: %s", e->name, e->message);
+}
+
+/* Runs in a worker thread, and replies with that worker's index */
+static DBusHandlerResult
+which_worker_filter (DBusConnection *connection,
+    DBusMessage *message,
+    void *user_data)
+{
+  Fixture *f = user_data;
+  GMainContext *context = g_main_context_get_thread_default ();
+  DBusMessage *reply;
+  dbus_uint32_t index;
+
+  if (!dbus_message_is_method_call (message, WORKERS_IFACE, "WhichWorker"))
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  for (index = 0; index < N_WORKERS; index++)
+    {
+      if (dbus_g_server_workers_get_context (f->workers, index) == context)
+        break;
+    }
+
+  reply = dbus_message_new_method_return (message);
+
+  if (reply == NULL ||
+      !dbus_message_append_args (reply, DBUS_TYPE_UINT32, &index,
+          DBUS_TYPE_INVALID) ||
+      !dbus_connection_send (connection, reply, NULL))
+    g_error ("OOM");
+
+  dbus_message_unref (reply);
+  return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static void
+new_conn_cb (DBusConnection *server_conn,
+    GMainContext *context,
+    gpointer data)
+{
+  Fixture *f = data;
+
+  g_assert (context != NULL);
+  g_assert (context != g_main_context_default ());
+
+  if (!dbus_connection_add_filter (server_conn, which_worker_filter, f, NULL))
+    g_error ("OOM");
+
+  g_ptr_array_add (f->server_conns, dbus_connection_ref (server_conn));
+}
+
+static void
+setup (Fixture *f,
+    gconstpointer data)
+{
+  DBusGServerWorkersPolicy policy = GPOINTER_TO_UINT (data);
+
+  dbus_error_init (&f->e);
+  f->server_conns = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) dbus_connection_unref);
+
+  f->server = dbus_server_listen ("unix:tmpdir=/tmp", &f->e);
+  assert_no_error (&f->e);
+  g_assert (f->server != NULL);
+
+  f->workers = dbus_g_server_workers_new (f->server, N_WORKERS, policy,
+      new_conn_cb, f, NULL);
+  g_assert (f->workers != NULL);
+  g_assert_cmpuint (dbus_g_server_workers_get_n_workers (f->workers), ==,
+      N_WORKERS);
+
+  dbus_server_setup_with_g_main (f->server, NULL);
+}
+
+/* Returns the server's end of the new connection */
+static DBusConnection *
+add_client (Fixture *f)
+{
+  DBusConnection *client;
+
+  g_assert_cmpuint (f->n_clients, <, MAX_CLIENTS);
+
+  client = dbus_connection_open_private (dbus_server_get_address (f->server),
+      &f->e);
+  assert_no_error (&f->e);
+  g_assert (client != NULL);
+  dbus_connection_set_exit_on_disconnect (client, FALSE);
+  dbus_connection_setup_with_g_main (client, NULL);
+  f->clients[f->n_clients++] = client;
+
+  while (f->server_conns->len < f->n_clients)
+    {
+      g_print (".");
+      g_main_context_iteration (NULL, TRUE);
+    }
+
+  return g_ptr_array_index (f->server_conns, f->n_clients - 1);
+}
+
+static guint
+call_which_worker (Fixture *f,
+    DBusConnection *client)
+{
+  DBusMessage *call;
+  DBusMessage *reply;
+  dbus_uint32_t index;
+
+  call = dbus_message_new_method_call (NULL, "/", WORKERS_IFACE,
+      "WhichWorker");
+  g_assert (call != NULL);
+
+  reply = dbus_connection_send_with_reply_and_block (client, call, -1, &f->e);
+  assert_no_error (&f->e);
+  g_assert (reply != NULL);
+
+  dbus_message_get_args (reply, &f->e, DBUS_TYPE_UINT32, &index,
+      DBUS_TYPE_INVALID);
+  assert_no_error (&f->e);
+
+  dbus_message_unref (call);
+  dbus_message_unref (reply);
+  return index;
+}
+
+static void
+wait_for_n_connections (Fixture *f,
+    guint worker,
+    guint n)
+{
+  /* the count drops when the worker thread sees Disconnected */
+  while (dbus_g_server_workers_get_n_connections (f->workers, worker) != n)
+    {
+      g_print (".");
+      g_usleep (G_USEC_PER_SEC / 100);
+    }
+}
+
+static void
+disconnect_client (Fixture *f,
+    guint i)
+{
+  dbus_connection_close (f->clients[i]);
+  dbus_connection_unref (f->clients[i]);
+  f->clients[i] = NULL;
+}
+
+static void
+test_round_robin (Fixture *f,
+    gconstpointer data)
+{
+  guint i;
+
+  for (i = 0; i < 2 * N_WORKERS; i++)
+    {
+      DBusConnection *server_conn = add_client (f);
+
+      g_assert_cmpint (dbus_g_server_workers_get_connection_worker (f->workers,
+            server_conn), ==, i % N_WORKERS);
+    }
+
+  for (i = 0; i < N_WORKERS; i++)
+    g_assert_cmpuint (dbus_g_server_workers_get_n_connections (f->workers, i),
+        ==, 2);
+
+  for (i = 0; i < f->n_clients; i++)
+    g_assert_cmpuint (call_which_worker (f, f->clients[i]), ==,
+        i % N_WORKERS);
+}
+
+static void
+test_least_loaded (Fixture *f,
+    gconstpointer data)
+{
+  DBusConnection *server_conn;
+  guint i;
+
+  for (i = 0; i < N_WORKERS; i++)
+    {
+      server_conn = add_client (f);
+      g_assert_cmpint (dbus_g_server_workers_get_connection_worker (f->workers,
+            server_conn), ==, i);
+    }
+
+  /* the worker left with the fewest connections gets the next one */
+  disconnect_client (f, 1);
+  wait_for_n_connections (f, 1, 0);
+  g_assert_cmpint (dbus_g_server_workers_get_connection_worker (f->workers,
+        g_ptr_array_index (f->server_conns, 1)), ==, -1);
+
+  server_conn = add_client (f);
+  g_assert_cmpint (dbus_g_server_workers_get_connection_worker (f->workers,
+        server_conn), ==, 1);
+  g_assert_cmpuint (call_which_worker (f, f->clients[f->n_clients - 1]), ==,
+      1);
+
+  for (i = 0; i < N_WORKERS; i++)
+    g_assert_cmpuint (dbus_g_server_workers_get_n_connections (f->workers, i),
+        ==, 1);
+}
+
+static void
+test_move (Fixture *f,
+    gconstpointer data)
+{
+  DBusConnection *first;
+  DBusConnection *second;
+  guint index;
+  guint tries;
+
+  first = add_client (f);
+  second = add_client (f);
+  g_assert_cmpint (dbus_g_server_workers_get_connection_worker (f->workers,
+        first), ==, 0);
+  g_assert_cmpuint (call_which_worker (f, f->clients[0]), ==, 0);
+
+  g_assert (dbus_g_server_workers_move_connection (f->workers, first, 2));
+  g_assert_cmpint (dbus_g_server_workers_get_connection_worker (f->workers,
+        first), ==, 2);
+  g_assert_cmpuint (dbus_g_server_workers_get_n_connections (f->workers, 0),
+      ==, 0);
+  g_assert_cmpuint (dbus_g_server_workers_get_n_connections (f->workers, 2),
+      ==, 1);
+
+  /* The move itself happens asynchronously in worker 0, so a call made
+   * straight away might still be answered there, but it must be
+   * answered somewhere */
+  for (tries = 0; tries < 100; tries++)
+    {
+      index = call_which_worker (f, f->clients[0]);
+
+      if (index == 2)
+        break;
+
+      g_assert_cmpuint (index, ==, 0);
+      g_usleep (G_USEC_PER_SEC / 100);
+    }
+
+  g_assert_cmpuint (index, ==, 2);
+  g_assert_cmpuint (call_which_worker (f, f->clients[0]), ==, 2);
+  g_assert_cmpuint (call_which_worker (f, f->clients[1]), ==, 1);
+
+  /* moving to the same worker is a no-op */
+  g_assert (dbus_g_server_workers_move_connection (f->workers, second, 1));
+  g_assert_cmpuint (dbus_g_server_workers_get_n_connections (f->workers, 1),
+      ==, 1);
+
+  /* a connection that was not accepted by the workers cannot be moved */
+  g_assert (!dbus_g_server_workers_move_connection (f->workers,
+        f->clients[1], 0));
+
+  /* after disconnecting, the moved connection is forgotten by its new
+   * worker */
+  disconnect_client (f, 0);
+  wait_for_n_connections (f, 2, 0);
+  g_assert_cmpint (dbus_g_server_workers_get_connection_worker (f->workers,
+        first), ==, -1);
+  g_assert (!dbus_g_server_workers_move_connection (f->workers, first, 0));
+  g_assert_cmpuint (dbus_g_server_workers_get_n_connections (f->workers, 1),
+      ==, 1);
+}
+
+static void
+teardown (Fixture *f,
+    gconstpointer data G_GNUC_UNUSED)
+{
+  guint i;
+
+  for (i = 0; i < f->n_clients; i++)
+    {
+      if (f->clients[i] != NULL)
+        disconnect_client (f, i);
+    }
+
+  if (f->workers != NULL)
+    {
+      dbus_g_server_workers_free (f->workers);
+      f->workers = NULL;
+    }
+
+  if (f->server != NULL)
+    {
+      dbus_server_disconnect (f->server);
+      dbus_server_unref (f->server);
+      f->server = NULL;
+    }
+
+  if (f->server_conns != NULL)
+    {
+      g_ptr_array_unref (f->server_conns);
+      f->server_conns = NULL;
+    }
+}
+
+int
+main (int argc,
+    char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+  g_type_init ();
+  dbus_g_thread_init ();
+
+  g_test_add ("/server-workers/round-robin", Fixture,
+      GUINT_TO_POINTER (DBUS_G_SERVER_WORKERS_ROUND_ROBIN), setup,
+      test_round_robin, teardown);
+  g_test_add ("/server-workers/least-loaded", Fixture,
+      GUINT_TO_POINTER (DBUS_G_SERVER_WORKERS_LEAST_LOADED), setup,
+      test_least_loaded, teardown);
+  g_test_add ("/server-workers/move", Fixture,
+      GUINT_TO_POINTER (DBUS_G_SERVER_WORKERS_ROUND_ROBIN), setup,
+      test_move, teardown);
+
+  return g_test_run ();
+}
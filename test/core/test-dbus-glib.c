@@ -262,6 +262,33 @@ sig2_signal_handler (DBusGProxy  *proxy,
   cancel_exit_timeout ();
 }
 
+static gboolean
+count_names_cb (DBusGProxy   *proxy,
+                guint         index_,
+                const GValue *element,
+                gpointer      user_data)
+{
+  guint *n_names = user_data;
+
+  g_assert_cmpuint (index_, ==, *n_names);
+  g_assert (G_VALUE_HOLDS_STRING (element));
+  g_assert (g_value_get_string (element) != NULL);
+  (*n_names)++;
+  return TRUE;
+}
+
+static void
+count_map_entries_cb (const GValue *key,
+                      const GValue *value,
+                      gpointer      user_data)
+{
+  guint *n_entries = user_data;
+
+  g_assert (G_VALUE_HOLDS_STRING (key));
+  g_assert (G_VALUE_HOLDS (value, G_TYPE_VALUE));
+  (*n_entries)++;
+}
+
 static DBusGProxyCall *echo_call;
 static guint n_times_echo_cb_entered;
 static void
@@ -315,6 +342,72 @@ increment_received_cb (DBusGProxy *proxy,
   cancel_exit_timeout ();
 }
 
+static guint n_queued_increments;
+
+#define N_SLEEPS 3
+
+static guint n_sleeps_done;
+static gint n_sleeps_done_before_ping = -1;
+
+static void
+sleep_received_cb (DBusGProxy *proxy,
+                   DBusGProxyCall *call,
+                   gpointer data)
+{
+  GError *error = NULL;
+
+  if (!dbus_g_proxy_end_call (proxy, call, &error, G_TYPE_INVALID))
+    lose_gerror ("Failed to complete Sleep call", error);
+
+  if (++n_sleeps_done == N_SLEEPS && n_sleeps_done_before_ping >= 0)
+    {
+      g_main_loop_quit (loop);
+      cancel_exit_timeout ();
+    }
+}
+
+static void
+ping_received_cb (DBusGProxy *proxy,
+                  DBusGProxyCall *call,
+                  gpointer data)
+{
+  GError *error = NULL;
+
+  if (!dbus_g_proxy_end_call (proxy, call, &error, G_TYPE_INVALID))
+    lose_gerror ("Failed to complete Ping call", error);
+
+  n_sleeps_done_before_ping = n_sleeps_done;
+
+  if (n_sleeps_done == N_SLEEPS)
+    {
+      g_main_loop_quit (loop);
+      cancel_exit_timeout ();
+    }
+}
+
+static void
+queued_increment_received_cb (DBusGProxy *proxy,
+                              DBusGProxyCall *call,
+                              gpointer data)
+{
+  GError *error = NULL;
+  guint val;
+
+  if (!dbus_g_proxy_end_call (proxy, call, &error,
+			      G_TYPE_UINT, &val,
+			      G_TYPE_INVALID))
+    lose_gerror ("Failed to complete queued Increment call", error);
+
+  if (val != 43)
+    lose ("Queued Increment call returned %d, should be 43", val);
+
+  if (--n_queued_increments == 0)
+    {
+      g_main_loop_quit (loop);
+      cancel_exit_timeout ();
+    }
+}
+
 static void
 increment_async_cb (DBusGProxy *proxy, guint val, GError *error, gpointer data)
 {
@@ -553,6 +646,7 @@ main (int argc, char **argv)
   guint32 result;
   char *v_STRING_2;
   guint32 v_UINT32_2;
+  gboolean v_BOOLEAN;
   double v_DOUBLE_2;
     
   g_type_init ();
@@ -608,6 +702,53 @@ main (int argc, char **argv)
 
   g_strfreev (name_list);
 
+  /* Same again, as a single allocation */
+  if (!dbus_g_proxy_call (driver, "ListNames", &error,
+			  G_TYPE_INVALID,
+			  DBUS_TYPE_G_PACKED_STRV, &name_list,
+			  G_TYPE_INVALID))
+    lose_gerror ("Failed to complete ListNames call", error);
+
+  {
+    gboolean found = FALSE;
+    char **copy;
+
+    for (i = 0; name_list[i] != NULL; i++)
+      {
+        if (strcmp (name_list[i], DBUS_SERVICE_DBUS) == 0)
+          found = TRUE;
+      }
+    g_assert (found);
+
+    copy = g_boxed_copy (DBUS_TYPE_G_PACKED_STRV, name_list);
+    g_assert_cmpuint (g_strv_length (copy), ==, i);
+    g_assert_cmpstr (copy[0], ==, name_list[0]);
+    g_free (copy);
+  }
+
+  g_free (name_list);
+
+  /* And one element at a time */
+  {
+    DBusGProxyCall *call;
+    guint n_names = 0;
+
+    call = dbus_g_proxy_begin_call (driver, "ListNames", NULL, NULL, NULL,
+                                    G_TYPE_INVALID);
+    if (!dbus_g_proxy_end_call_foreach (driver, call, &error, G_TYPE_STRING,
+                                        count_names_cb, &n_names))
+      lose_gerror ("Failed to complete ListNames call", error);
+    g_assert_cmpuint (n_names, >, 0);
+
+    /* the elements are strings, so asking for uints must fail */
+    call = dbus_g_proxy_begin_call (driver, "ListNames", NULL, NULL, NULL,
+                                    G_TYPE_INVALID);
+    if (dbus_g_proxy_end_call_foreach (driver, call, &error, G_TYPE_UINT,
+                                       count_names_cb, &n_names))
+      lose ("Unexpected success for ListNames with wrong element type");
+    g_clear_error (&error);
+  }
+
   g_print ("calling ThisMethodDoesNotExist\n");
   /* Test handling of unknown method */
   if (dbus_g_proxy_call (driver, "ThisMethodDoesNotExist", &error,
@@ -794,6 +935,52 @@ main (int argc, char **argv)
   exit_timeout = g_timeout_add (5000, timed_exit, loop);
   g_main_loop_run (loop);
 
+  /* Ping has a high priority, so it may overtake these, but all of
+   * them must still be answered */
+  g_print ("Calling Ping behind queued Increment calls\n");
+  for (i = 0; i < 5; i++)
+    {
+      if (dbus_g_proxy_begin_call (proxy, "Increment",
+                                   queued_increment_received_cb, NULL, NULL,
+                                   G_TYPE_UINT, 42,
+                                   G_TYPE_INVALID) == NULL)
+        lose ("Failed to begin queued Increment call");
+      n_queued_increments++;
+    }
+
+  if (!dbus_g_proxy_call (proxy, "Ping", &error,
+			  G_TYPE_INVALID, G_TYPE_INVALID))
+    lose_gerror ("Failed to complete Ping call", error);
+
+  cancel_exit_timeout ();
+  exit_timeout = g_timeout_add (5000, timed_exit, loop);
+  g_main_loop_run (loop);
+
+  /* The service runs each Sleep in turn, but a Ping sent after them is
+   * answered without waiting for all of them */
+  g_print ("Calling Ping behind slow Sleep calls\n");
+  for (i = 0; i < N_SLEEPS; i++)
+    {
+      if (dbus_g_proxy_begin_call (proxy, "Sleep",
+                                   sleep_received_cb, NULL, NULL,
+                                   G_TYPE_UINT, 200,
+                                   G_TYPE_INVALID) == NULL)
+        lose ("Failed to begin Sleep call");
+    }
+
+  if (dbus_g_proxy_begin_call (proxy, "Ping", ping_received_cb, NULL, NULL,
+                               G_TYPE_INVALID) == NULL)
+    lose ("Failed to begin Ping call");
+
+  dbus_g_connection_flush (connection);
+  cancel_exit_timeout ();
+  exit_timeout = g_timeout_add (5000, timed_exit, loop);
+  g_main_loop_run (loop);
+
+  if (n_sleeps_done_before_ping < 0 || n_sleeps_done_before_ping >= N_SLEEPS)
+    lose ("Ping was answered after %d of %d Sleep calls, should have "
+          "overtaken them", n_sleeps_done_before_ping, N_SLEEPS);
+
   g_print ("Calling IncrementRetval\n");
   error = NULL;
   v_UINT32_2 = 0;
@@ -899,6 +1086,17 @@ main (int argc, char **argv)
   if (v_UINT32_2 != 43)
     lose ("(wrapped) async increment call returned %d, should be 43", v_UINT32_2);
 
+  v_UINT32_2 = 0;
+  v_BOOLEAN = TRUE;
+  if (!org_freedesktop_DBus_GLib_Tests_MyObject_threaded_increment (proxy, 42, &v_UINT32_2, &v_BOOLEAN, &error))
+    lose_gerror ("Failed to complete (wrapped) ThreadedIncrement call", error);
+
+  if (v_UINT32_2 != 43)
+    lose ("(wrapped) threaded increment call returned %d, should be 43", v_UINT32_2);
+
+  if (v_BOOLEAN)
+    lose ("(wrapped) threaded increment call ran in the service's main thread");
+
   g_print ("Calling (wrapped) throw_error\n");
   if (org_freedesktop_DBus_GLib_Tests_MyObject_throw_error (proxy, &error) != FALSE)
     lose ("(wrapped) ThrowError call unexpectedly succeeded!");
@@ -1273,8 +1471,50 @@ main (int argc, char **argv)
     g_assert (G_VALUE_HOLDS_STRING (val));
     g_assert (!strcmp ("hello", g_value_get_string (val)));
 
-    g_hash_table_destroy (table);
     g_hash_table_destroy (ret_table);
+
+    {
+      GType lazy_type = dbus_g_type_get_lazy_map (G_TYPE_STRING, G_TYPE_VALUE);
+      DBusGLazyMap *lazy = NULL;
+      GValue lazy_value = { 0, };
+      gpointer looked_up;
+      guint n_entries = 0;
+
+      g_print ("Calling ManyStringify with a lazy map reply\n");
+      if (!dbus_g_proxy_call (proxy, "ManyStringify", &error,
+                              dbus_g_type_get_map ("GHashTable", G_TYPE_STRING, G_TYPE_VALUE), table,
+                              G_TYPE_INVALID,
+                              lazy_type, &lazy,
+                              G_TYPE_INVALID))
+        lose_gerror ("Failed to complete ManyStringify call", error);
+
+      g_assert (lazy != NULL);
+
+      if (!dbus_g_lazy_map_lookup (lazy, "foo", &looked_up))
+        lose ("Lazy map didn't contain \"foo\"");
+      val = looked_up;
+      g_assert (G_VALUE_HOLDS_STRING (val));
+      g_assert (!strcmp ("42", g_value_get_string (val)));
+
+      if (dbus_g_lazy_map_lookup (lazy, "nonexistent", &looked_up))
+        lose ("Lazy map contained a key that was never sent");
+
+      /* iterating decodes the rest */
+      g_value_init (&lazy_value, lazy_type);
+      g_value_take_boxed (&lazy_value, lazy);
+      dbus_g_type_map_value_iterate (&lazy_value, count_map_entries_cb,
+                                     &n_entries);
+      g_assert_cmpuint (n_entries, ==, 2);
+
+      if (!dbus_g_lazy_map_lookup (lazy, "bar", &looked_up))
+        lose ("Lazy map didn't contain \"bar\"");
+      val = looked_up;
+      g_assert (!strcmp ("hello", g_value_get_string (val)));
+
+      g_value_unset (&lazy_value);
+    }
+
+    g_hash_table_destroy (table);
   }
 
   {
@@ -1446,6 +1686,47 @@ main (int argc, char **argv)
     g_ptr_array_free (objs, TRUE);
   }
   
+  {
+    GPtrArray *structs;
+    GArray *ints;
+    guint i;
+
+    g_print ("Calling AsyncBuildReply\n");
+
+    if (!dbus_g_proxy_call (proxy, "AsyncBuildReply", &error,
+                            G_TYPE_UINT, 5,
+                            G_TYPE_INVALID,
+                            dbus_g_type_get_collection ("GPtrArray",
+                              dbus_g_type_get_struct ("GValueArray",
+                                G_TYPE_STRING, G_TYPE_INT, G_TYPE_INT,
+                                G_TYPE_INVALID)),
+                            &structs,
+                            dbus_g_type_get_collection ("GArray", G_TYPE_INT),
+                            &ints,
+                            G_TYPE_INVALID))
+      lose_gerror ("Failed to complete AsyncBuildReply call", error);
+
+    if (structs->len != 5 || ints->len != 5)
+      lose ("AsyncBuildReply call returned %u structs and %u ints, expected 5",
+            structs->len, ints->len);
+
+    for (i = 0; i < structs->len; i++)
+      {
+        GValueArray *vals = g_ptr_array_index (structs, i);
+
+        if (strcmp (g_value_get_string (g_value_array_get_nth (vals, 0)), "item") != 0
+            || g_value_get_int (g_value_array_get_nth (vals, 1)) != (gint) i
+            || g_value_get_int (g_value_array_get_nth (vals, 2)) != (gint) (i * i)
+            || g_array_index (ints, gint, i) != - (gint) i)
+          lose ("AsyncBuildReply call returned unexpected values at %u", i);
+
+        g_value_array_free (vals);
+      }
+
+    g_ptr_array_free (structs, TRUE);
+    g_array_free (ints, TRUE);
+  }
+
   {
     GValue *variant;
     GArray *array;
@@ -1774,6 +2055,32 @@ main (int argc, char **argv)
   if (n_times_sig1_received != 3)
     lose ("Sig1 signal received %d times, should have been 3", n_times_sig1_received);
 
+  g_print ("Calling FooObject EmitSignals twice while corked\n");
+  dbus_g_connection_cork (connection);
+  dbus_g_proxy_call_no_reply (proxy, "EmitSignals", G_TYPE_INVALID);
+  dbus_g_proxy_call_no_reply (proxy, "EmitSignals", G_TYPE_INVALID);
+
+  dbus_g_connection_uncork (connection);
+
+  dbus_g_connection_flush (connection);
+  cancel_exit_timeout ();
+  exit_timeout = g_timeout_add (5000, timed_exit, loop);
+  g_main_loop_run (loop);
+  cancel_exit_timeout ();
+  exit_timeout = g_timeout_add (5000, timed_exit, loop);
+  g_main_loop_run (loop);
+  cancel_exit_timeout ();
+  exit_timeout = g_timeout_add (5000, timed_exit, loop);
+  g_main_loop_run (loop);
+  cancel_exit_timeout ();
+  exit_timeout = g_timeout_add (5000, timed_exit, loop);
+  g_main_loop_run (loop);
+
+  if (n_times_sig0_received != 5)
+    lose ("Sig0 signal received %d times, should have been 5", n_times_sig0_received);
+  if (n_times_sig1_received != 5)
+    lose ("Sig1 signal received %d times, should have been 5", n_times_sig1_received);
+
   /* Terminate again */
   g_print ("Terminating service\n");
   await_terminating_service = "org.freedesktop.DBus.GLib.TestService";
@@ -63,6 +63,9 @@
 /* Don't make PAYLOAD_SIZE too huge because it gets used as a static buffer size */
 #define PAYLOAD_SIZE 0
 
+/* How long to spin for the next message in the busy-polling runs */
+#define BUSY_POLL_USEC 100
+
 #define ECHO_SERVICE "org.freedesktop.DBus.GLib.EchoTestServer"
 #define ECHO_PATH "/org/freedesktop/DBus/GLib/EchoTest"
 #define ECHO_INTERFACE "org.freedesktop.DBus.GLib.EchoTest"
@@ -74,6 +77,10 @@ static unsigned char *payload;
 static int echo_call_size;
 static int echo_return_size;
 
+/* Time between successive iterations seen by the client, in microseconds */
+static gint64 iteration_usec[N_ITERATIONS];
+static int n_iteration_usec;
+
 typedef struct ProfileRunVTable ProfileRunVTable;
 
 typedef struct
@@ -81,6 +88,7 @@ typedef struct
   const ProfileRunVTable *vtable;
   int iterations;
   GMainLoop *loop;
+  gint64 last_iteration_time;
 } ClientData;
 
 typedef struct
@@ -95,6 +103,7 @@ struct ProfileRunVTable
 {
   const char *name;
   gboolean fake_malloc_overhead;
+  guint busy_poll_usec;
   void* (* init_server)        (ServerData *sd);
   void  (* stop_server)        (ServerData *sd,
                                 void       *server);
@@ -106,6 +115,42 @@ struct ProfileRunVTable
   void  (* main_loop_run_func) (GMainLoop *loop);
 };
 
+typedef struct
+{
+  double seconds;
+  gint64 p50_usec;
+  gint64 p99_usec;
+} ProfileResult;
+
+static void
+record_iteration (ClientData *cd)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (cd->last_iteration_time != 0 && n_iteration_usec < N_ITERATIONS)
+    iteration_usec[n_iteration_usec++] = now - cd->last_iteration_time;
+
+  cd->last_iteration_time = now;
+}
+
+static void
+print_busy_poll_stats (DBusConnection *connection,
+                       const char     *who)
+{
+  DBusGBusyPollStats stats;
+
+  dbus_connection_get_g_main_busy_poll_stats (connection, &stats);
+
+  if (stats.n_spins == 0)
+    return;
+
+  g_printerr ("%s busy-polled %" G_GUINT64_FORMAT " times, picking up %"
+              G_GUINT64_FORMAT " messages; %" G_GUINT64_FORMAT " of %"
+              G_GUINT64_FORMAT " usec spinning was useful\n",
+              who, stats.n_spins, stats.n_hits, stats.useful_usec,
+              stats.total_usec);
+}
+
 /* Note, this is all crack-a-rific; it isn't using DBusGProxy and thus is
  * a major pain
  */
@@ -161,6 +206,7 @@ with_or_without_bus_client_filter (DBusConnection     *connection,
     }
   else if (dbus_message_get_type (message) == DBUS_MESSAGE_TYPE_METHOD_RETURN)
     {
+      record_iteration (cd);
       cd->iterations += 1;
       if (cd->iterations >= N_ITERATIONS)
         {
@@ -213,7 +259,9 @@ no_bus_thread_func (void *data)
   context = g_main_context_new ();
 
   cd.iterations = 1;
+  cd.last_iteration_time = 0;
   cd.loop = g_main_loop_new (context, FALSE);
+  cd.vtable = data;
   
   if (!dbus_connection_add_filter (connection,
 				   no_bus_client_filter, &cd, NULL))
@@ -221,6 +269,7 @@ no_bus_thread_func (void *data)
   
   
   dbus_connection_setup_with_g_main (connection, context);
+  dbus_connection_set_g_main_busy_poll (connection, cd.vtable->busy_poll_usec);
 
   g_printerr ("Client thread sending message to prime pingpong\n");
   send_echo_method_call (connection);
@@ -231,6 +280,7 @@ no_bus_thread_func (void *data)
   g_printerr ("Client thread %p exiting main loop\n",
               g_thread_self());
 
+  print_busy_poll_stats (connection, "Client");
   dbus_connection_close (connection);
   
   g_main_loop_unref (cd.loop);
@@ -251,6 +301,7 @@ no_bus_server_filter (DBusConnection     *connection,
                               "Disconnected"))
     {
       g_printerr ("Client disconnected from server\n");
+      print_busy_poll_stats (connection, "Server");
       sd->n_clients -= 1;
       if (sd->n_clients == 0)
         g_main_loop_quit (sd->loop);
@@ -276,6 +327,8 @@ no_bus_new_connection_callback (DBusServer     *server,
   
   dbus_connection_ref (new_connection);
   dbus_connection_setup_with_g_main (new_connection, NULL);  
+  dbus_connection_set_g_main_busy_poll (new_connection,
+                                        sd->vtable->busy_poll_usec);
   
   if (!dbus_connection_add_filter (new_connection,
                                    no_bus_server_filter, sd, NULL))
@@ -329,6 +382,17 @@ no_bus_main_loop_run (GMainLoop *loop)
 static const ProfileRunVTable no_bus_vtable = {
   "dbus direct without bus",
   FALSE,
+  0,
+  no_bus_init_server,
+  no_bus_stop_server,
+  no_bus_thread_func,
+  no_bus_main_loop_run
+};
+
+static const ProfileRunVTable no_bus_busy_poll_vtable = {
+  "dbus direct without bus, busy-polling",
+  FALSE,
+  BUSY_POLL_USEC,
   no_bus_init_server,
   no_bus_stop_server,
   no_bus_thread_func,
@@ -392,6 +456,7 @@ with_bus_thread_func (void *data)
   context = g_main_context_new ();
 
   cd.iterations = 1;
+  cd.last_iteration_time = 0;
   cd.loop = g_main_loop_new (context, FALSE);
   
   if (!dbus_connection_add_filter (connection,
@@ -587,6 +652,7 @@ with_bus_main_loop_run (GMainLoop *loop)
 static const ProfileRunVTable with_bus_vtable = {
   "routing via a bus",
   FALSE,
+  0,
   with_bus_init_server,
   with_bus_stop_server,
   with_bus_thread_func,
@@ -915,6 +981,7 @@ plain_sockets_client_side_watch (GIOChannel   *source,
     }
   else if (condition & G_IO_OUT)
     {
+      record_iteration (cd);
       cd->iterations += 1;
       if (cd->iterations >= N_ITERATIONS)
         {
@@ -974,6 +1041,7 @@ plain_sockets_thread_func (void *data)
   context = g_main_context_new ();
 
   cd.iterations = 1;
+  cd.last_iteration_time = 0;
   cd.loop = g_main_loop_new (context, FALSE);
   cd.vtable = data;
 
@@ -1019,6 +1087,7 @@ plain_sockets_main_loop_run (GMainLoop *loop)
 static const ProfileRunVTable plain_sockets_vtable = {
   "plain sockets",
   FALSE,
+  0,
   plain_sockets_init_server,
   plain_sockets_stop_server,
   plain_sockets_thread_func,
@@ -1028,13 +1097,24 @@ static const ProfileRunVTable plain_sockets_vtable = {
 static const ProfileRunVTable plain_sockets_with_malloc_vtable = {
   "plain sockets with malloc overhead",
   TRUE,
+  0,
   plain_sockets_init_server,
   plain_sockets_stop_server,
   plain_sockets_thread_func,
   plain_sockets_main_loop_run
 };
 
-static double
+static int
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return (x > y) - (x < y);
+}
+
+static ProfileResult
 do_profile_run (const ProfileRunVTable *vtable)
 {
   GTimer *timer;
@@ -1042,6 +1122,7 @@ do_profile_run (const ProfileRunVTable *vtable)
   double secs;
   ServerData sd;
   void *server;
+  ProfileResult result = { 0 };
 
   g_printerr ("Profiling %s\n", vtable->name);
   
@@ -1049,6 +1130,7 @@ do_profile_run (const ProfileRunVTable *vtable)
   sd.n_clients = 0;
   sd.loop = g_main_loop_new (NULL, FALSE);
   sd.vtable = vtable;
+  n_iteration_usec = 0;
 
   server = (* vtable->init_server) (&sd);
   
@@ -1071,21 +1153,40 @@ do_profile_run (const ProfileRunVTable *vtable)
   g_printerr ("%s: %g seconds, %d round trips, %f seconds per pingpong\n",
               vtable->name, secs, sd.handled, secs/sd.handled);
 
+  result.seconds = secs;
+
+  if (n_iteration_usec > 0)
+    {
+      qsort (iteration_usec, n_iteration_usec, sizeof (gint64),
+             compare_gint64);
+      result.p50_usec = iteration_usec[n_iteration_usec / 2];
+      result.p99_usec = iteration_usec[(n_iteration_usec * 99) / 100];
+      g_printerr ("%s: round trip p50 %" G_GINT64_FORMAT " usec, p99 %"
+                  G_GINT64_FORMAT " usec\n",
+                  vtable->name, result.p50_usec, result.p99_usec);
+    }
+
   (* vtable->stop_server) (&sd, server);
   
   g_main_loop_unref (sd.loop);
 
-  return secs;
+  return result;
 }
 
 static void
 print_result (const ProfileRunVTable *vtable,
-              double            seconds,
-              double            baseline)
+              ProfileResult           result,
+              ProfileResult           baseline)
 {
   g_printerr (" %g times slower for %s (%g seconds, %f per iteration)\n",
-              seconds/baseline, vtable->name,
-              seconds, seconds / N_ITERATIONS);
+              result.seconds/baseline.seconds, vtable->name,
+              result.seconds, result.seconds / N_ITERATIONS);
+  g_printerr ("   round trip p50 %" G_GINT64_FORMAT " usec (%g times baseline), "
+              "p99 %" G_GINT64_FORMAT " usec (%g times baseline)\n",
+              result.p50_usec,
+              result.p50_usec / (double) MAX (baseline.p50_usec, 1),
+              result.p99_usec,
+              result.p99_usec / (double) MAX (baseline.p99_usec, 1));
 }
 #endif
 
@@ -1117,27 +1218,31 @@ main (int argc, char *argv[])
     do_profile_run (&plain_sockets_with_malloc_vtable);
   else if (argc > 1 && strcmp (argv[1], "no_bus") == 0)
     do_profile_run (&no_bus_vtable);
+  else if (argc > 1 && strcmp (argv[1], "no_bus_busy_poll") == 0)
+    do_profile_run (&no_bus_busy_poll_vtable);
   else if (argc > 1 && strcmp (argv[1], "with_bus") == 0)
     do_profile_run (&with_bus_vtable);
   else if (argc > 1 && strcmp (argv[1], "all") == 0)
     {
-      double e1, e2, e3, e4;
+      ProfileResult e1, e2, e3, e4, e5;
 
       e1 = do_profile_run (&plain_sockets_vtable);
       e2 = do_profile_run (&plain_sockets_with_malloc_vtable);
       e3 = do_profile_run (&no_bus_vtable);
-      e4 = do_profile_run (&with_bus_vtable);
+      e4 = do_profile_run (&no_bus_busy_poll_vtable);
+      e5 = do_profile_run (&with_bus_vtable);
 
       g_printerr ("Baseline plain sockets time %g seconds for %d iterations\n",
-                  e1, N_ITERATIONS);
+                  e1.seconds, N_ITERATIONS);
       print_result (&plain_sockets_vtable, e1, e1);
       print_result (&plain_sockets_with_malloc_vtable, e2, e1);
       print_result (&no_bus_vtable, e3, e1);
-      print_result (&with_bus_vtable, e4, e1);
+      print_result (&no_bus_busy_poll_vtable, e4, e1);
+      print_result (&with_bus_vtable, e5, e1);
     }
   else
     {
-      g_printerr ("Specify profile type plain_sockets, plain_sockets_with_malloc, no_bus, with_bus, all\n");
+      g_printerr ("Specify profile type plain_sockets, plain_sockets_with_malloc, no_bus, no_bus_busy_poll, with_bus, all\n");
       exit (1);
     }
 
@@ -62,6 +62,11 @@ main (int argc, char **argv)
       exit (1);
     }
 
+  /* run-direct-test.sh sets this, and the bus passes it on when it
+   * activates us */
+  if (g_getenv ("DBUS_TEST_GLIB_DIRECT_GLUE") != NULL)
+    my_object_use_direct_glue ();
+
   obj = g_object_new (MY_TYPE_OBJECT, NULL);
   obj2 = g_object_new (MY_TYPE_OBJECT, NULL);
   subobj = g_object_new (MY_TYPE_OBJECT_SUBCLASS, NULL);
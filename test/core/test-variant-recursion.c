@@ -15,20 +15,16 @@
 
 #include "dbus-gmain/tests/util.h"
 
-static gboolean
-make_recursive_stringify_call (int recursion_depth, 
-                               DBusGProxy *proxy, 
-                               GError **error)
+static GValue *
+make_nested_variant (int depth)
 {
-  gchar *out_str;
-  gboolean ret;
-  int i;
   GValue *val = g_new0 (GValue, 1);
+  int i;
 
   g_value_init (val, G_TYPE_STRING);
   g_value_set_string (val, "end of the line");
 
-  for (i = 0; i < recursion_depth; i++)
+  for (i = 0; i < depth; i++)
     {
       GValue *tmp = g_new0 (GValue, 1);
 
@@ -37,6 +33,18 @@ make_recursive_stringify_call (int recursion_depth,
       val = tmp;
     }
 
+  return val;
+}
+
+static gboolean
+make_recursive_stringify_call (int recursion_depth, 
+                               DBusGProxy *proxy, 
+                               GError **error)
+{
+  gchar *out_str;
+  gboolean ret;
+  GValue *val = make_nested_variant (recursion_depth);
+
   ret = dbus_g_proxy_call (proxy, "Stringify", error,
                            G_TYPE_VALUE, val,
                            G_TYPE_INVALID,
@@ -52,6 +60,48 @@ make_recursive_stringify_call (int recursion_depth,
   return ret;
 }
 
+/* Not run as part of the tests: "test-variant-recursion --benchmark" times
+ * round trips of nested variants through the service, which demarshals
+ * them once on each side */
+static void
+benchmark_nested_variants (DBusGProxy *proxy)
+{
+  static const int depths[] = { 1, 4, 8, 16, 24 };
+  const int n_calls = 2000;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (depths); i++)
+    {
+      GValue *val = make_nested_variant (depths[i]);
+      GError *error = NULL;
+      GTimer *timer;
+      int j;
+
+      timer = g_timer_new ();
+
+      for (j = 0; j < n_calls; j++)
+        {
+          GValue out = { 0, };
+
+          if (!dbus_g_proxy_call (proxy, "EchoVariant", &error,
+                                  G_TYPE_VALUE, val,
+                                  G_TYPE_INVALID,
+                                  G_TYPE_VALUE, &out,
+                                  G_TYPE_INVALID))
+            g_error ("Failed to complete EchoVariant call: %s", error->message);
+
+          g_value_unset (&out);
+        }
+
+      g_timer_stop (timer);
+      g_print ("depth %2d: %8.2f usec per round trip\n", depths[i],
+               g_timer_elapsed (timer, NULL) * G_USEC_PER_SEC / n_calls);
+
+      g_timer_destroy (timer);
+      g_boxed_free (G_TYPE_VALUE, val);
+    }
+}
+
 int
 main (int argc, char **argv)
 {
@@ -84,6 +134,9 @@ main (int argc, char **argv)
 			  G_TYPE_INVALID))
     g_error ("Failed to complete DoNothing call: %s", error->message);
 
+  if (argc > 1 && strcmp (argv[1], "--benchmark") == 0)
+    benchmark_nested_variants (proxy);
+
   /* Fewer than the current internal limit (16) */
   if (make_recursive_stringify_call (10, proxy, &error))
     g_error ("Unexpected success code from 10 recursive variant call: %s", error->message);